@@ -1,3 +1,1067 @@
 #include <benchmark/benchmark.h>
 
-#include "tensor/tensor.h"
+#include "tensor/adam.hpp"
+#include "tensor/checkpoint.hpp"
+#include "tensor/data_loader.hpp"
+#include "tensor/graph.hpp"
+#include "tensor/lazy.hpp"
+#include "tensor/loss.hpp"
+#include "tensor/ops.hpp"
+#include "tensor/parameter_arena.hpp"
+#include "tensor/quantize.hpp"
+#include "tensor/serialize.hpp"
+#include "tensor/sgd.hpp"
+#include "tensor/tensor.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+//
+// Run with --benchmark_format=json (or --benchmark_out=<file>
+// --benchmark_out_format=json) to get a result file that Google Benchmark's
+// tools/compare.py can diff against another run. The run_benchmarks target
+// does this and writes benchmark_results.json into the build directory.
+//
+
+namespace
+{
+
+// How the operands of a benchmark are laid out in memory.
+enum Layout : std::int64_t
+{
+  kContiguous = 0,
+  kTransposed = 1, // lhs is a transposed view
+  kBroadcast = 2,  // rhs is a single row broadcast down the lhs
+  kScalar = 3,     // rhs is a single element
+};
+
+enum UnaryOp : std::int64_t
+{
+  kRelu = 0,
+  kNeg = 1,
+  kScale = 2,
+};
+
+// Axes a reduction benchmark reduces.
+enum ReduceAxes : std::int64_t
+{
+  kReduceAll = 0,
+  kReduceRows = 1,    // axis 1
+  kReduceColumns = 2, // axis 0
+};
+
+template <typename T>
+Tensor<T> random_tensor(std::vector<std::uint32_t> const &shape,
+                        unsigned seed)
+{
+  Tensor<T> t(shape);
+
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<accumulate_t<T>> dist(-1, 1);
+  for (auto &x : *t.impl()->data_)
+  {
+    x = static_cast<T>(dist(gen));
+  }
+
+  return t;
+}
+
+template <typename T>
+Tensor<T> transposed_view(std::uint32_t rows, std::uint32_t cols,
+                          unsigned seed)
+{
+  return transpose(random_tensor<T>({cols, rows}, seed), 0, 1);
+}
+
+// Sets the library's thread count for one benchmark and restores it after.
+class ScopedThreads
+{
+public:
+  explicit ScopedThreads(std::int64_t threads) : previous_{get_num_threads()}
+  {
+    if (static_cast<std::size_t>(threads) != previous_)
+    {
+      set_num_threads(threads);
+    }
+  }
+
+  ~ScopedThreads()
+  {
+    if (get_num_threads() != previous_)
+    {
+      set_num_threads(previous_);
+    }
+  }
+
+private:
+  std::size_t previous_;
+};
+
+std::vector<std::int64_t> thread_counts()
+{
+  std::int64_t all = ThreadPool::default_num_threads();
+  return (all > 1) ? std::vector<std::int64_t>{1, all}
+                   : std::vector<std::int64_t>{1};
+}
+
+// Per-iteration work, reported by the library as GFLOP/s and GB/s.
+void set_rates(benchmark::State &state, double flops, double bytes)
+{
+  using benchmark::Counter;
+
+  if (flops > 0)
+  {
+    state.counters["GFLOP"] =
+        Counter(flops * 1e-9, Counter::kIsIterationInvariantRate);
+  }
+  if (bytes > 0)
+  {
+    state.counters["GB"] =
+        Counter(bytes * 1e-9, Counter::kIsIterationInvariantRate);
+  }
+}
+
+//
+// C = A * B with square n x n operands; layout kTransposed feeds A as a
+// transposed view, exercising the strided packing path.
+//
+template <typename T> void BM_Matmul(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  auto layout = state.range(1);
+  ScopedThreads threads(state.range(2));
+
+  auto a = (layout == kTransposed) ? transposed_view<T>(n, n, 1)
+                                   : random_tensor<T>({n, n}, 1);
+  auto b = random_tensor<T>({n, n}, 2);
+
+  for (auto _ : state)
+  {
+    auto c = matmul(a, b);
+    benchmark::DoNotOptimize(c.impl()->data_ptr());
+  }
+
+  set_rates(state, 2.0 * n * n * n, 3.0 * n * n * sizeof(T));
+}
+
+void matmul_args(benchmark::internal::Benchmark *b)
+{
+  b->ArgNames({"n", "layout", "threads"});
+  b->ArgsProduct({{64, 256, 512, 1024}, {kContiguous, kTransposed},
+                  thread_counts()});
+  b->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_TEMPLATE(BM_Matmul, float)->Apply(matmul_args);
+BENCHMARK_TEMPLATE(BM_Matmul, double)->Apply(matmul_args);
+BENCHMARK_TEMPLATE(BM_Matmul, bf16)->Apply(matmul_args);
+BENCHMARK_TEMPLATE(BM_Matmul, f16)->Apply(matmul_args);
+
+//
+// int8 n x n product into float: a per-tensor lhs against a per-column
+// symmetric rhs. With dynamic set the lhs starts as float and is quantized
+// on every call.
+//
+void BM_QuantizedMatmul(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  bool dynamic = state.range(1) != 0;
+  ScopedThreads threads(state.range(2));
+
+  auto a = random_tensor<float>({n, n}, 1);
+  auto a_q = quantize(*a.impl());
+  auto b_q = quantize(*random_tensor<float>({n, n}, 2).impl(), 1u, true);
+
+  for (auto _ : state)
+  {
+    auto c = dynamic ? matmul(a, b_q) : matmul(a_q, b_q);
+    benchmark::DoNotOptimize(c.impl()->data_ptr());
+  }
+
+  set_rates(state, 2.0 * n * n * n, 2.0 * n * n + 4.0 * n * n);
+}
+
+BENCHMARK(BM_QuantizedMatmul)
+    ->ArgNames({"n", "dynamic", "threads"})
+    ->ArgsProduct({{64, 256, 512, 1024}, {0, 1}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// Forward and backward of a matmul whose operands require gradients: one
+// GEMM forward, two accumulating GEMMs backward.
+//
+template <typename T> void BM_MatmulBackward(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  ScopedThreads threads(state.range(1));
+
+  auto a = random_tensor<T>({n, n}, 3);
+  auto b = random_tensor<T>({n, n}, 4);
+  a.impl()->requires_grad_ = true;
+  b.impl()->requires_grad_ = true;
+
+  for (auto _ : state)
+  {
+    a.impl()->grad_ = nullptr;
+    b.impl()->grad_ = nullptr;
+
+    auto c = matmul(a, b);
+    c.backward();
+    benchmark::DoNotOptimize(a.impl()->grad_->data_ptr());
+  }
+
+  set_rates(state, 3 * 2.0 * n * n * n, 0);
+}
+
+BENCHMARK_TEMPLATE(BM_MatmulBackward, float)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{64, 256, 512}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// Attention-style batched matmul: batch x (n x d) * (d x n) with the right
+// operand a transposed view, forward and backward.
+//
+template <typename T> void BM_BatchedMatmul(benchmark::State &state)
+{
+  auto batch = static_cast<std::uint32_t>(state.range(0));
+  auto n = static_cast<std::uint32_t>(state.range(1));
+  std::uint32_t d = 64;
+  ScopedThreads threads(state.range(2));
+
+  auto q = random_tensor<T>({batch, n, d}, 9);
+  auto k = random_tensor<T>({batch, n, d}, 10);
+  q.impl()->requires_grad_ = true;
+  k.impl()->requires_grad_ = true;
+
+  for (auto _ : state)
+  {
+    q.impl()->grad_ = nullptr;
+    k.impl()->grad_ = nullptr;
+
+    auto scores = matmul(q, transpose(k, 1, 2));
+    scores.backward();
+    benchmark::DoNotOptimize(q.impl()->grad_->data_ptr());
+  }
+
+  set_rates(state, 3 * 2.0 * batch * n * n * d, 0);
+}
+
+BENCHMARK_TEMPLATE(BM_BatchedMatmul, float)
+    ->ArgNames({"batch", "n", "threads"})
+    ->ArgsProduct({{8, 64}, {64, 256}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// add / sub over an n x n lhs, with the rhs laid out per Layout.
+//
+template <typename T, bool Subtract>
+void BM_Binary(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  auto layout = state.range(1);
+  ScopedThreads threads(state.range(2));
+
+  auto lhs = (layout == kTransposed) ? transposed_view<T>(n, n, 5)
+                                     : random_tensor<T>({n, n}, 5);
+  auto rhs = (layout == kBroadcast) ? random_tensor<T>({1, n}, 6)
+             : (layout == kScalar)  ? random_tensor<T>({1}, 6)
+                                    : random_tensor<T>({n, n}, 6);
+
+  for (auto _ : state)
+  {
+    auto out = Subtract ? sub(lhs, rhs) : add(lhs, rhs);
+    benchmark::DoNotOptimize(out.impl()->data_ptr());
+  }
+
+  double elems = static_cast<double>(n) * n;
+  double operands = (layout == kBroadcast || layout == kScalar) ? 2 : 3;
+  set_rates(state, elems, operands * elems * sizeof(T));
+}
+
+void elementwise_args(benchmark::internal::Benchmark *b)
+{
+  b->ArgNames({"n", "layout", "threads"});
+  b->ArgsProduct({{32, 256, 1024, 2048},
+                  {kContiguous, kTransposed, kBroadcast, kScalar},
+                  thread_counts()});
+  b->Unit(benchmark::kMicrosecond);
+}
+
+BENCHMARK_TEMPLATE(BM_Binary, float, false)->Apply(elementwise_args);
+BENCHMARK_TEMPLATE(BM_Binary, float, true)->Apply(elementwise_args);
+BENCHMARK_TEMPLATE(BM_Binary, double, false)->Apply(elementwise_args);
+BENCHMARK_TEMPLATE(BM_Binary, bf16, false)->Apply(elementwise_args);
+
+//
+// relu, negation and scaling of an n x n tensor, contiguous or transposed.
+//
+template <typename T> void BM_Unary(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  auto op = state.range(1);
+  auto layout = state.range(2);
+  ScopedThreads threads(state.range(3));
+
+  auto in = (layout == kTransposed) ? transposed_view<T>(n, n, 7)
+                                    : random_tensor<T>({n, n}, 7);
+
+  for (auto _ : state)
+  {
+    auto out = (op == kRelu)  ? relu(in)
+               : (op == kNeg) ? Tensor<T>(-*in.impl())
+                              : Tensor<T>(*in.impl() * static_cast<T>(2));
+    benchmark::DoNotOptimize(out.impl()->data_ptr());
+  }
+
+  double elems = static_cast<double>(n) * n;
+  set_rates(state, elems, 2 * elems * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_Unary, float)
+    ->ArgNames({"n", "op", "layout", "threads"})
+    ->ArgsProduct({{256, 1024, 2048},
+                   {kRelu, kNeg, kScale},
+                   {kContiguous, kTransposed},
+                   thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// The bias, activation and centring chain relu(h + bias) - mean * 2 over
+// an n x n h, one op at a time (lazy = 0) or fused by materialize.
+//
+template <typename T> void BM_ElementwiseChain(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  bool fused = state.range(1) != 0;
+  ScopedThreads threads(state.range(2));
+
+  auto h = random_tensor<T>({n, n}, 8);
+  auto bias = random_tensor<T>({n}, 9);
+  auto mean = random_tensor<T>({n, 1}, 10);
+
+  auto const &hi = *h.impl();
+  auto const &bi = *bias.impl();
+  auto const &mi = *mean.impl();
+
+  for (auto _ : state)
+  {
+    if (fused)
+    {
+      auto out = materialize(relu(lazy(hi) + lazy(bi)) -
+                             lazy(mi) * static_cast<T>(2));
+      benchmark::DoNotOptimize(out.data_ptr());
+    }
+    else
+    {
+      auto out = (hi + bi).relu() - mi * static_cast<T>(2);
+      benchmark::DoNotOptimize(out.data_ptr());
+    }
+  }
+
+  double elems = static_cast<double>(n) * n;
+  set_rates(state, 4 * elems, 2 * elems * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_ElementwiseChain, float)
+    ->ArgNames({"n", "lazy", "threads"})
+    ->ArgsProduct({{64, 256, 1024, 2048}, {0, 1}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// sum and max of an n x n tensor over all elements, over rows (one
+// contiguous run per output) or over columns (across rows).
+//
+template <typename T> void BM_Reduce(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  auto axes = state.range(1);
+  bool use_max = state.range(2) != 0;
+  ScopedThreads threads(state.range(3));
+
+  auto in = random_tensor<T>({n, n}, 11);
+
+  std::vector<std::uint32_t> dims;
+  if (axes != kReduceAll)
+  {
+    dims.push_back((axes == kReduceRows) ? 1 : 0);
+  }
+
+  for (auto _ : state)
+  {
+    auto out = use_max ? in.impl()->max(dims) : in.impl()->sum(dims);
+    benchmark::DoNotOptimize(out.data_ptr());
+  }
+
+  double elems = static_cast<double>(n) * n;
+  set_rates(state, elems, elems * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_Reduce, float)
+    ->ArgNames({"n", "axes", "max", "threads"})
+    ->ArgsProduct({{256, 2048},
+                   {kReduceAll, kReduceRows, kReduceColumns},
+                   {0, 1},
+                   thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+// relu forward and backward through a graph.
+template <typename T> void BM_ReluBackward(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  ScopedThreads threads(state.range(1));
+
+  auto x = random_tensor<T>({n, n}, 8);
+  x.impl()->requires_grad_ = true;
+
+  for (auto _ : state)
+  {
+    x.impl()->grad_ = nullptr;
+
+    auto y = relu(x);
+    y.backward();
+    benchmark::DoNotOptimize(x.impl()->grad_->data_ptr());
+  }
+
+  double elems = static_cast<double>(n) * n;
+  set_rates(state, 2 * elems, 6 * elems * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_ReluBackward, float)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024, 2048}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+// MSELoss forward and backward against a fixed target.
+template <typename T> void BM_MSELoss(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  ScopedThreads threads(state.range(1));
+
+  auto pred = random_tensor<T>({n, n}, 9);
+  auto targ = random_tensor<T>({n, n}, 10);
+  pred.impl()->requires_grad_ = true;
+
+  MSELoss<T> criterion;
+
+  for (auto _ : state)
+  {
+    pred.impl()->grad_ = nullptr;
+
+    auto loss = criterion(pred, targ);
+    loss.backward();
+    benchmark::DoNotOptimize(pred.impl()->grad_->data_ptr());
+  }
+
+  double elems = static_cast<double>(n) * n;
+  set_rates(state, 6 * elems, 5 * elems * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_MSELoss, float)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024, 2048}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(BM_MSELoss, double)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{1024}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+// One SGD update over four n x n parameters with fixed gradients.
+template <typename T> void BM_SGDStep(benchmark::State &state)
+{
+  auto n = static_cast<std::uint32_t>(state.range(0));
+  ScopedThreads threads(state.range(1));
+
+  std::vector<Tensor<T>> params;
+  for (unsigned i{}; i < 4; ++i)
+  {
+    auto p = random_tensor<T>({n, n}, 11 + i);
+    p.impl()->grad_ = random_tensor<T>({n, n}, 21 + i).impl();
+    params.push_back(p);
+  }
+
+  SGD<T> optim(params, 1e-6f);
+
+  for (auto _ : state)
+  {
+    optim.step();
+    benchmark::ClobberMemory();
+  }
+
+  double elems = 4.0 * n * n;
+  set_rates(state, 2 * elems, 3 * elems * sizeof(T));
+}
+
+BENCHMARK_TEMPLATE(BM_SGDStep, float)
+    ->ArgNames({"n", "threads"})
+    ->ArgsProduct({{256, 1024}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// Tensor::backward over a chain of depth small matmul + relu layers,
+// isolating graph traversal and per-node overhead from kernel time. With
+// plan = 1 the topological order is replayed from a BackwardPlan.
+//
+template <typename T> void BM_Backward(benchmark::State &state)
+{
+  auto depth = state.range(0);
+  bool use_plan = state.range(1) != 0;
+
+  auto w = random_tensor<T>({8, 8}, 31);
+  w.impl()->requires_grad_ = true;
+
+  BackwardPlan<T> plan;
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    w.impl()->grad_ = nullptr;
+    Tensor<T> h = w;
+    for (std::int64_t i{}; i < depth; ++i)
+    {
+      h = relu(matmul(h, w));
+    }
+    state.ResumeTiming();
+
+    if (use_plan)
+    {
+      h.backward(plan);
+    }
+    else
+    {
+      h.backward();
+    }
+  }
+
+  state.counters["nodes"] = benchmark::Counter(
+      2.0 * depth + 1, benchmark::Counter::kIsIterationInvariantRate);
+}
+
+BENCHMARK_TEMPLATE(BM_Backward, float)
+    ->ArgNames({"depth", "plan"})
+    ->ArgsProduct({{16, 256, 4096}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// Backward through heads independent matmul + relu branches over a shared
+// input, summed: the parallel backward runs the branches side by side,
+// while with threads = 1 they run one after another.
+//
+template <typename T> void BM_WideBackward(benchmark::State &state)
+{
+  auto heads = state.range(0);
+  ScopedThreads threads(state.range(1));
+
+  auto x = random_tensor<T>({64, 128}, 32);
+  x.impl()->requires_grad_ = true;
+
+  std::vector<Tensor<T>> weights;
+  for (std::int64_t k{}; k < heads; ++k)
+  {
+    weights.push_back(random_tensor<T>({128, 128}, 33 + k));
+    weights.back().impl()->requires_grad_ = true;
+  }
+
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    Tensor<T> total = relu(matmul(x, weights[0]));
+    for (std::int64_t k = 1; k < heads; ++k)
+    {
+      total = add(total, relu(matmul(x, weights[k])));
+    }
+    auto loss = sum(total);
+    state.ResumeTiming();
+
+    loss.backward();
+  }
+
+  set_rates(state, heads * 2 * 2.0 * 64 * 128 * 128, 0);
+}
+
+BENCHMARK_TEMPLATE(BM_WideBackward, float)
+    ->ArgNames({"heads", "threads"})
+    ->ArgsProduct({{4, 16}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// A full training step of the two-layer MLP in tests/manual.cpp, scaled to
+// batch x hidden: zero grads, forward, MSE loss, backward, SGD update.
+// fused = 1 builds the layers with linear / linear_relu.
+//
+template <typename T> void BM_TrainingStep(benchmark::State &state)
+{
+  auto batch = static_cast<std::uint32_t>(state.range(0));
+  auto hidden = static_cast<std::uint32_t>(state.range(1));
+  ScopedThreads threads(state.range(2));
+  bool fused = state.range(3) != 0;
+  std::uint32_t in = hidden;
+
+  auto x = random_tensor<T>({batch, in}, 41);
+  auto y = random_tensor<T>({batch, 1}, 42);
+
+  auto w1 = random_tensor<T>({in, hidden}, 43);
+  auto b1 = random_tensor<T>({batch, hidden}, 44);
+  auto w2 = random_tensor<T>({hidden, 1}, 45);
+  auto b2 = random_tensor<T>({batch, 1}, 46);
+
+  for (auto &p : {w1, b1, w2, b2})
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  SGD<T> optim({w1, b1, w2, b2}, 1e-3f);
+  MSELoss<T> criterion;
+
+  for (auto _ : state)
+  {
+    optim.reset_grad();
+
+    auto pred = fused ? linear(linear_relu(x, w1, b1), w2, b2)
+                      : add(matmul(relu(add(matmul(x, w1), b1)), w2), b2);
+    auto loss = criterion(pred, y);
+
+    loss.backward();
+    optim.step();
+
+    benchmark::DoNotOptimize(loss.impl()->data_ptr());
+  }
+
+  // Forward GEMMs once, backward GEMMs twice each.
+  double gemm = 2.0 * batch * in * hidden + 2.0 * batch * hidden;
+  set_rates(state, 3 * gemm, 0);
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK_TEMPLATE(BM_TrainingStep, float)
+    ->ArgNames({"batch", "hidden", "threads", "fused"})
+    ->ArgsProduct({{4, 64, 256}, {4, 64, 256}, thread_counts(), {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// Forward pass of the fused MLP of BM_TrainingStep over parameters that
+// require grad, building its graph (grad = 1) or under a NoGradGuard.
+//
+template <typename T> void BM_Inference(benchmark::State &state)
+{
+  auto batch = static_cast<std::uint32_t>(state.range(0));
+  auto hidden = static_cast<std::uint32_t>(state.range(1));
+  bool grad = state.range(2) != 0;
+
+  auto x = random_tensor<T>({batch, hidden}, 51);
+  auto w1 = random_tensor<T>({hidden, hidden}, 52);
+  auto b1 = random_tensor<T>({hidden}, 53);
+  auto w2 = random_tensor<T>({hidden, 1}, 54);
+  auto b2 = random_tensor<T>({1}, 55);
+
+  for (auto &p : {w1, b1, w2, b2})
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  GradModeGuard mode(grad);
+
+  for (auto _ : state)
+  {
+    auto pred = linear(linear_relu(x, w1, b1), w2, b2);
+    benchmark::DoNotOptimize(pred.impl()->data_ptr());
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK_TEMPLATE(BM_Inference, float)
+    ->ArgNames({"batch", "hidden", "grad"})
+    ->ArgsProduct({{4, 64}, {4, 64}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// The fused step of BM_TrainingStep captured once into a StaticGraph and
+// replayed, against the same step run eagerly (replay = 0). replay = 2
+// replays after StaticGraph::plan and reports the arena's size.
+//
+template <typename T> void BM_GraphReplay(benchmark::State &state)
+{
+  auto batch = static_cast<std::uint32_t>(state.range(0));
+  auto hidden = static_cast<std::uint32_t>(state.range(1));
+  auto replay = state.range(2);
+
+  auto x = random_tensor<T>({batch, hidden}, 41);
+  auto y = random_tensor<T>({batch, 1}, 42);
+
+  auto w1 = random_tensor<T>({hidden, hidden}, 43);
+  auto b1 = random_tensor<T>({hidden}, 44);
+  auto w2 = random_tensor<T>({hidden, 1}, 45);
+  auto b2 = random_tensor<T>({1}, 46);
+
+  for (auto &p : {w1, b1, w2, b2})
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  SGD<T> optim({w1, b1, w2, b2}, 1e-3f);
+  MSELoss<T> criterion;
+  auto forward = [&]()
+  { return criterion(linear(linear_relu(x, w1, b1), w2, b2), y); };
+
+  StaticGraph<T> graph;
+  if (replay)
+  {
+    graph.capture(forward);
+  }
+  if (replay == 2)
+  {
+    auto plan = graph.plan();
+    state.counters["naive_kb"] = plan.naive_bytes / 1024.0;
+    state.counters["planned_kb"] = plan.planned_bytes / 1024.0;
+  }
+
+  for (auto _ : state)
+  {
+    if (replay)
+    {
+      graph.replay();
+    }
+    else
+    {
+      optim.reset_grad();
+      forward().backward();
+    }
+    optim.step();
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK_TEMPLATE(BM_GraphReplay, float)
+    ->ArgNames({"batch", "hidden", "replay"})
+    ->ArgsProduct({{4, 64, 256}, {4, 64, 256}, {0, 1, 2}})
+    ->Unit(benchmark::kMicrosecond);
+
+
+//
+// A training step through a stack of fused layers, plain (segments = 0) or
+// with checkpoint_sequential, reporting the activations the forward pass
+// leaves allocated for the backward.
+//
+template <typename T> void BM_CheckpointedStep(benchmark::State &state)
+{
+  constexpr unsigned kLayers = 16;
+  auto batch = static_cast<std::uint32_t>(state.range(0));
+  auto hidden = static_cast<std::uint32_t>(state.range(1));
+  auto segments = static_cast<std::size_t>(state.range(2));
+
+  auto x = random_tensor<T>({batch, hidden}, 47);
+  auto y = random_tensor<T>({batch, hidden}, 48);
+
+  std::vector<Tensor<T>> params;
+  std::vector<std::function<Tensor<T>(Tensor<T> const &)>> layers;
+  for (unsigned l{}; l < kLayers; ++l)
+  {
+    auto w = random_tensor<T>({hidden, hidden}, 50 + l);
+    auto b = random_tensor<T>({hidden}, 70 + l);
+    w.impl()->requires_grad_ = true;
+    b.impl()->requires_grad_ = true;
+    params.push_back(w);
+    params.push_back(b);
+    layers.push_back([w, b](Tensor<T> const &h)
+                     { return linear_relu(h, w, b); });
+  }
+
+  SGD<T> optim(params, 1e-4f);
+  MSELoss<T> criterion;
+  auto &alloc = CachingAllocator::instance();
+  std::size_t held = 0;
+
+  for (auto _ : state)
+  {
+    optim.reset_grad();
+    auto before = alloc.stats().in_use;
+
+    Tensor<T> h = x;
+    if (segments)
+    {
+      h = checkpoint_sequential(layers, x, segments);
+    }
+    else
+    {
+      for (auto const &layer : layers)
+      {
+        h = layer(h);
+      }
+    }
+    auto loss = criterion(h, y);
+
+    held = alloc.stats().in_use - before;
+    loss.backward();
+    optim.step();
+  }
+
+  state.counters["held_kb"] = held / 1024.0;
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+BENCHMARK_TEMPLATE(BM_CheckpointedStep, float)
+    ->ArgNames({"batch", "hidden", "segments"})
+    ->ArgsProduct({{64}, {64, 256}, {0, 4, 16}})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// One optimizer step over `params` parameters of `size` elements each,
+// gradients already in place: plain SGD (kind 0), SGD with Nesterov
+// momentum (1), Adam (2) and AdamW (3).
+//
+template <typename T> void BM_OptimizerStep(benchmark::State &state)
+{
+  auto count = static_cast<std::size_t>(state.range(0));
+  auto size = static_cast<std::uint32_t>(state.range(1));
+  auto kind = state.range(2);
+  ScopedThreads threads(state.range(3));
+
+  std::vector<Tensor<T>> params;
+  for (std::size_t i{}; i < count; ++i)
+  {
+    auto p = random_tensor<T>({size}, 90 + static_cast<unsigned>(i));
+    p.impl()->grad_ = random_tensor<T>({size}, 190 + static_cast<unsigned>(i))
+                          .impl();
+    params.push_back(p);
+  }
+
+  SGD<T> sgd(params, 1e-6f, kind == 1 ? 0.9f : 0.0f, 0, kind == 1);
+  Adam<T> adam(params, 1e-6f);
+  AdamW<T> adamw(params, 1e-6f);
+
+  for (auto _ : state)
+  {
+    if (kind < 2)
+    {
+      sgd.step();
+    }
+    else if (kind == 2)
+    {
+      adam.step();
+    }
+    else
+    {
+      adamw.step();
+    }
+    benchmark::DoNotOptimize(params[0].impl()->data_ptr());
+  }
+
+  state.SetItemsProcessed(state.iterations() * count * size);
+}
+
+BENCHMARK_TEMPLATE(BM_OptimizerStep, float)
+    ->ArgNames({"params", "size", "kind", "threads"})
+    ->ArgsProduct({{1, 64}, {1024, 65536}, {0, 1, 2, 3}, thread_counts()})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// The optimizer side of a training step, gradients already computed:
+// zeroing them, their global norm and an SGD step with momentum, over
+// separate parameters (arena = 0) or the same ones in a ParameterArena.
+//
+template <typename T> void BM_ArenaStep(benchmark::State &state)
+{
+  auto count = static_cast<std::size_t>(state.range(0));
+  auto size = static_cast<std::uint32_t>(state.range(1));
+  bool packed = state.range(2) != 0;
+
+  std::vector<Tensor<T>> params;
+  for (std::size_t i{}; i < count; ++i)
+  {
+    auto p = random_tensor<T>({size}, 60 + static_cast<unsigned>(i));
+    p.impl()->grad_ = random_tensor<T>({size}, 160 + static_cast<unsigned>(i))
+                          .impl();
+    params.push_back(p);
+  }
+
+  std::unique_ptr<ParameterArena<T>> arena;
+  if (packed)
+  {
+    arena = std::make_unique<ParameterArena<T>>(params);
+  }
+  SGD<T> optim(packed ? std::vector<Tensor<T>>{arena->flat()} : params,
+               1e-6f, 0.9f);
+
+  for (auto _ : state)
+  {
+    accumulate_t<T> squares = 0;
+    if (packed)
+    {
+      arena->zero_grad();
+      squares = arena->grad_norm();
+    }
+    else
+    {
+      optim.zero_grad();
+      for (auto const &p : params)
+      {
+        auto const &g = *p.impl()->grad_;
+        squares += simd::sum_squares(g.data_ptr(), g.numel());
+      }
+    }
+    benchmark::DoNotOptimize(squares);
+    optim.step();
+  }
+
+  state.SetItemsProcessed(state.iterations() * count * size);
+}
+
+BENCHMARK_TEMPLATE(BM_ArenaStep, float)
+    ->ArgNames({"params", "size", "arena"})
+    ->ArgsProduct({{16, 256}, {64, 1024}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+//
+// Loading `mb` MiB of weights in 1 MiB tensors from a safetensors file:
+// mapped by load_safetensors (mapped = 1), against reading the payload
+// into freshly allocated tensors (0). Reads hit the page cache either way.
+//
+template <typename T> void BM_LoadWeights(benchmark::State &state)
+{
+  auto mb = static_cast<std::size_t>(state.range(0));
+  bool mapped = state.range(1) != 0;
+  constexpr std::uint32_t kElements = (1u << 20) / sizeof(T);
+
+  std::vector<std::pair<std::string, Tensor<T>>> weights;
+  for (std::size_t i{}; i < mb; ++i)
+  {
+    std::string name = "w";
+    name += std::to_string(i);
+    auto seed = static_cast<unsigned>(70 + i);
+    weights.emplace_back(name, random_tensor<T>({kElements}, seed));
+  }
+  std::string path = "/tmp/tensor_benchmark.safetensors";
+  save_safetensors(path, weights);
+
+  for (auto _ : state)
+  {
+    if (mapped)
+    {
+      auto loaded = load_safetensors<T>(path);
+      benchmark::DoNotOptimize(loaded.begin()->second.impl()->data_ptr());
+      continue;
+    }
+
+    std::ifstream in(path, std::ios::binary);
+    unsigned char length[8];
+    in.read(reinterpret_cast<char *>(length), 8);
+    std::uint64_t n = 0;
+    for (int i{}; i < 8; ++i)
+    {
+      n |= std::uint64_t{length[i]} << (8 * i);
+    }
+    in.seekg(static_cast<std::streamoff>(8 + n));
+
+    std::vector<Tensor<T>> loaded;
+    for (std::size_t i{}; i < mb; ++i)
+    {
+      Tensor<T> t(TensorImpl<T>({kElements}, uninitialized));
+      in.read(reinterpret_cast<char *>(t.impl()->data_ptr()),
+              sizeof(T) * kElements);
+      loaded.push_back(t);
+    }
+    benchmark::DoNotOptimize(loaded[0].impl()->data_ptr());
+  }
+
+  std::remove(path.c_str());
+  state.SetBytesProcessed(state.iterations() * mb * (1 << 20));
+}
+
+BENCHMARK_TEMPLATE(BM_LoadWeights, float)
+    ->ArgNames({"mb", "mapped"})
+    ->ArgsProduct({{16, 256}, {0, 1}})
+    ->Unit(benchmark::kMillisecond);
+
+//
+// Feeding shuffled batches of 256 records (`width` inputs and a target) to
+// a training step: each batch filled element by element with operator[] on
+// the training thread (loader = 0), against taken from a DataLoader that
+// assembles the next batch in the background (1).
+//
+template <typename T> void BM_DataLoader(benchmark::State &state)
+{
+  auto width = static_cast<std::uint32_t>(state.range(0));
+  bool loader = state.range(1) != 0;
+  constexpr std::uint32_t kBatch = 256;
+  constexpr std::uint32_t kRecords = 64 * kBatch;
+
+  auto data = random_tensor<T>({kRecords, width + 1}, 80);
+  T const *records = data.impl()->data_ptr();
+  std::vector<T> values(records, records + data.impl()->numel());
+
+  auto w = random_tensor<T>({width, 1}, 81);
+  auto b = random_tensor<T>({kBatch, 1}, 82);
+  w.impl()->requires_grad_ = true;
+  SGD<T> optim({w}, 1e-3f);
+  MSELoss<T> criterion;
+
+  auto train = [&](Tensor<T> const &x, Tensor<T> const &y)
+  {
+    optim.reset_grad();
+    auto loss = criterion(linear(x, w, b), y);
+    loss.backward();
+    optim.step();
+    benchmark::DoNotOptimize(loss.impl()->data_ptr());
+  };
+
+  if (loader)
+  {
+    DataLoader<T> batches(memory_records(std::move(values), width + 1),
+                          width, {.batch_size = kBatch, .drop_last = true});
+    Batch<T> batch;
+    for (auto _ : state)
+    {
+      if (!batches.next(batch))
+      {
+        batches.next(batch);
+      }
+      train(batch.inputs_, batch.targets_);
+    }
+  }
+  else
+  {
+    std::vector<std::uint32_t> order(kRecords);
+    std::iota(order.begin(), order.end(), 0u);
+    std::mt19937_64 gen(0);
+    std::uint32_t next = kRecords;
+    for (auto _ : state)
+    {
+      if (next == kRecords)
+      {
+        std::shuffle(order.begin(), order.end(), gen);
+        next = 0;
+      }
+
+      Tensor<T> x({kBatch, width});
+      Tensor<T> y({kBatch, 1});
+      for (std::uint32_t i{}; i < kBatch; ++i, ++next)
+      {
+        for (std::uint32_t j{}; j < width; ++j)
+        {
+          x[i, j] = values[order[next] * (width + 1) + j];
+        }
+        y[i, 0u] = values[order[next] * (width + 1) + width];
+      }
+      train(x, y);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBatch);
+}
+
+BENCHMARK_TEMPLATE(BM_DataLoader, float)
+    ->ArgNames({"width", "loader"})
+    ->ArgsProduct({{16, 256}, {0, 1}})
+    ->Unit(benchmark::kMicrosecond);
+
+} // namespace
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "optimizer.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+//
+// Adam: each element keeps running means of its gradient and squared
+// gradient, bias-corrected for their zero start, and steps by their ratio.
+// weight_decay adds an L2 penalty's gradient, weight_decay * p, before the
+// moments see it. Step counts are kept per parameter, so one that missed
+// some steps without a gradient still gets its own bias correction.
+//
+template <typename T> class Adam : public Optimizer<T>
+{
+public:
+  Adam(std::vector<Tensor<T>> const &params, float lr = 1e-3f,
+       float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+       float weight_decay = 0)
+      : Adam(params, lr, beta1, beta2, eps, weight_decay, false)
+  {
+  }
+
+  void step()
+  {
+    for (std::size_t i{}; i < this->params_.size(); ++i)
+    {
+      if (!this->params_[i].impl()->grad_)
+      {
+        continue;
+      }
+
+      double t = static_cast<double>(++steps_[i]);
+      double bias1 = 1 - std::pow(double{beta1_}, t);
+      double bias2 = 1 - std::pow(double{beta2_}, t);
+
+      using Acc = accumulate_t<T>;
+      constants_[i] = {
+          static_cast<Acc>(beta1_),
+          static_cast<Acc>(beta2_),
+          static_cast<Acc>(learning_rate_ / bias1),
+          static_cast<Acc>(1 / std::sqrt(bias2)),
+          static_cast<Acc>(eps_),
+          static_cast<Acc>(decoupled_ ? 0 : weight_decay_),
+          static_cast<Acc>(decoupled_ ? 1 - learning_rate_ * weight_decay_ : 1),
+      };
+    }
+
+    this->apply(
+        [&](std::size_t i, T *p, T const *g, std::size_t offset,
+            std::size_t n)
+        {
+          simd::adam_step(p, g, this->state(0, offset),
+                          this->state(1, offset), n, constants_[i]);
+        });
+  }
+
+protected:
+  Adam(std::vector<Tensor<T>> const &params, float lr, float beta1,
+       float beta2, float eps, float weight_decay, bool decoupled)
+      : Optimizer<T>(params, 2), learning_rate_{lr}, beta1_{beta1},
+        beta2_{beta2}, eps_{eps}, weight_decay_{weight_decay},
+        decoupled_{decoupled}, steps_(params.size(), 0),
+        constants_(params.size())
+  {
+  }
+
+private:
+  float learning_rate_;
+  float beta1_;
+  float beta2_;
+  float eps_;
+  float weight_decay_;
+  bool decoupled_;
+  std::vector<std::uint64_t> steps_;
+  std::vector<simd::AdamConstants<T>> constants_;
+};
+
+//
+// Adam with decoupled weight decay: the parameter shrinks by
+// lr * weight_decay each step rather than the decay passing through the
+// moments, where the adaptive scaling would weaken it for elements with
+// large gradients.
+//
+template <typename T> class AdamW : public Adam<T>
+{
+public:
+  AdamW(std::vector<Tensor<T>> const &params, float lr = 1e-3f,
+        float beta1 = 0.9f, float beta2 = 0.999f, float eps = 1e-8f,
+        float weight_decay = 1e-2f)
+      : Adam<T>(params, lr, beta1, beta2, eps, weight_decay, true)
+  {
+  }
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// Alignment of every tensor buffer: one cache line, and a full AVX-512
+// register.
+inline constexpr std::size_t kAllocAlignment = 64;
+
+// Requests below this are rounded up to a power of two, larger ones to a
+// multiple of it.
+inline constexpr std::size_t kAllocLargeBlock = std::size_t{1} << 20;
+
+struct AllocatorStats
+{
+  std::size_t in_use;       // bytes handed out and not yet returned
+  std::size_t cached;       // bytes returned and held for reuse
+  std::size_t peak;         // high-water mark of in_use
+  std::size_t requests;     // allocate calls
+  std::size_t cache_hits;   // requests served from the cache
+  std::size_t system_calls; // requests that went to aligned_alloc
+};
+
+//
+// Size-class caching allocator for tensor storage. Freed blocks are kept
+// on a free list per rounded size and handed back to the next request of
+// that class, so a training loop that allocates the same shapes every
+// step stops calling into the system allocator after its first step, and
+// reuses buffers whose pages are already mapped.
+//
+// Setting TENSOR_CACHING_ALLOCATOR=0 returns every block to the system
+// immediately, which keeps memory checkers precise.
+//
+class CachingAllocator
+{
+public:
+  CachingAllocator(CachingAllocator const &) = delete;
+  CachingAllocator &operator=(CachingAllocator const &) = delete;
+
+  //
+  // Never destroyed, so tensors that outlive static destruction can still
+  // return their storage.
+  //
+  static CachingAllocator &instance()
+  {
+    static CachingAllocator *allocator = new CachingAllocator();
+    return *allocator;
+  }
+
+  static std::size_t round_size(std::size_t bytes)
+  {
+    if (bytes <= kAllocAlignment)
+    {
+      return kAllocAlignment;
+    }
+
+    if (bytes < kAllocLargeBlock)
+    {
+      return std::bit_ceil(bytes);
+    }
+
+    return (bytes + kAllocLargeBlock - 1) / kAllocLargeBlock *
+           kAllocLargeBlock;
+  }
+
+  void *allocate(std::size_t bytes)
+  {
+    if (bytes == 0)
+    {
+      return nullptr;
+    }
+
+    std::size_t size = round_size(bytes);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      ++stats_.requests;
+      stats_.in_use += size;
+      stats_.peak = std::max(stats_.peak, stats_.in_use);
+
+      auto it = free_.find(size);
+      if (it != free_.end() && !it->second.empty())
+      {
+        void *block = it->second.back();
+        it->second.pop_back();
+
+        ++stats_.cache_hits;
+        stats_.cached -= size;
+        return block;
+      }
+
+      ++stats_.system_calls;
+    }
+
+    void *block = std::aligned_alloc(kAllocAlignment, size);
+
+    if (!block)
+    {
+      // Memory may be sitting in the cache under other size classes.
+      empty_cache();
+      block = std::aligned_alloc(kAllocAlignment, size);
+    }
+
+    if (!block)
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stats_.in_use -= size;
+      throw std::bad_alloc();
+    }
+
+    return block;
+  }
+
+  // bytes must be the size the block was allocated with.
+  void deallocate(void *block, std::size_t bytes)
+  {
+    if (!block)
+    {
+      return;
+    }
+
+    std::size_t size = round_size(bytes);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+
+      stats_.in_use -= size;
+
+      if (caching_)
+      {
+        free_[size].push_back(block);
+        stats_.cached += size;
+        return;
+      }
+    }
+
+    std::free(block);
+  }
+
+  // Returns every cached block to the system.
+  void empty_cache()
+  {
+    std::unordered_map<std::size_t, std::vector<void *>> blocks;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      blocks.swap(free_);
+      stats_.cached = 0;
+    }
+
+    for (auto &[size, list] : blocks)
+    {
+      for (void *block : list)
+      {
+        std::free(block);
+      }
+    }
+  }
+
+  AllocatorStats stats() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void reset_peak()
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.peak = stats_.in_use;
+  }
+
+  bool caching() const
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return caching_;
+  }
+
+  void set_caching(bool enabled)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      caching_ = enabled;
+    }
+
+    if (!enabled)
+    {
+      empty_cache();
+    }
+  }
+
+private:
+  CachingAllocator() : stats_{}, caching_{true}
+  {
+    if (char const *env = std::getenv("TENSOR_CACHING_ALLOCATOR"))
+    {
+      caching_ = std::strcmp(env, "0") != 0;
+    }
+  }
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::size_t, std::vector<void *>> free_;
+  AllocatorStats stats_;
+  bool caching_;
+};
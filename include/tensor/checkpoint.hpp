@@ -0,0 +1,172 @@
+#pragma once
+
+#include "grad_mode.hpp"
+#include "tensor.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+//
+// Activation checkpointing. checkpoint(fn, inputs...) runs fn on the
+// inputs and keeps only its result: the graph fn built, and with it every
+// intermediate fn produced, is released as soon as fn returns. The result
+// is a single node whose backward reruns fn on the saved inputs, this time
+// keeping the graph, and backpropagates through it.
+//
+// fn must reach graph tensors only through its arguments, which it gets as
+// fresh leaves sharing the inputs' storage. Parameters, being leaves
+// themselves, may be captured. fn should be deterministic, as the rerun
+// must reproduce the first run.
+//
+template <typename T, typename Fn, typename... Rest>
+  requires(std::same_as<Rest, Tensor<T>> && ...)
+Tensor<T> checkpoint(Fn fn, Tensor<T> const &input, Rest const &...rest)
+{
+  constexpr std::size_t N = 1 + sizeof...(Rest);
+
+  std::array<std::shared_ptr<TensorImpl<T>>, N> inputs{input.impl(),
+                                                        rest.impl()...};
+
+  // Leaves sharing the inputs' storage, so that fn's graph stops at them.
+  auto leaf = [](TensorImpl<T> const &src, bool grad)
+  {
+    Tensor<T> t(
+        TensorImpl<T>(src.data_, src.shape_, src.stride_, src.offset_));
+    t.impl()->requires_grad_ = grad && src.requires_grad_;
+    return t;
+  };
+
+  auto run = [fn, leaf](auto const &sources, bool grad)
+  {
+    auto leaves = [&]<std::size_t... I>(std::index_sequence<I...>)
+    {
+      return std::array<Tensor<T>, N>{leaf(*sources[I], grad)...};
+    }(std::make_index_sequence<N>{});
+
+    return std::pair{std::apply(fn, leaves), leaves};
+  };
+
+  auto [out, leaves] = run(inputs, false);
+  auto const &o = *out.impl();
+
+  Tensor<T> result(TensorImpl<T>(o.data_, o.shape_, o.stride_, o.offset_));
+
+  bool grad = o.requires_grad_ ||
+              (grad_enabled() &&
+               std::any_of(inputs.begin(), inputs.end(),
+                           [](auto const &t) { return t->requires_grad_; }));
+  if (!grad)
+  {
+    return result;
+  }
+
+  auto *res = result.impl().get();
+  res->requires_grad_ = true;
+  res->parents_.assign(inputs.begin(), inputs.end());
+
+  // The nested backward locks the parameters fn captured. Holding the
+  // inputs' locks around it as well would take them in an order other
+  // branches of a parallel backward do not, so only the merge below locks.
+  res->locks_own_grads_ = true;
+
+  std::array<TensorImpl<T> *, N> sources;
+  std::transform(inputs.begin(), inputs.end(), sources.begin(),
+                 [](auto const &t) { return t.get(); });
+
+  res->backward_ = [res, run, sources]()
+  {
+    if (!res->grad_)
+    {
+      return;
+    }
+
+    // Backward may itself run under a NoGradGuard.
+    GradModeGuard enable(true);
+    auto [again, leaves] = run(sources, true);
+    if (!again.impl()->requires_grad_)
+    {
+      return;
+    }
+
+    again.impl()->grad_ = res->grad_;
+    again.backward();
+
+    for (std::size_t i{}; i < N; ++i)
+    {
+      auto &grad = leaves[i].impl()->grad_;
+      if (!grad)
+      {
+        continue;
+      }
+
+      // The leaf's gradient belongs to nothing else and can be taken over.
+      std::lock_guard lock(sources[i]->grad_mutex_);
+      if (!sources[i]->grad_)
+      {
+        sources[i]->grad_ = grad;
+      }
+      else
+      {
+        *sources[i]->grad_ += *grad;
+      }
+    }
+  };
+
+  return result;
+}
+
+//
+// Runs layers one after another over input, checkpointed in segments of
+// consecutive layers. Only segment boundaries stay alive until backward,
+// plus, during it, the intermediates of the one segment being recomputed.
+// segments = 0 picks ceil(sqrt(layers)), which bounds both by about
+// sqrt(layers) activations for one extra forward pass; more segments keep
+// more boundaries and recompute shorter runs.
+//
+template <typename T>
+Tensor<T> checkpoint_sequential(
+    std::vector<std::function<Tensor<T>(Tensor<T> const &)>> const &layers,
+    Tensor<T> const &input, std::size_t segments = 0)
+{
+  std::size_t n = layers.size();
+  if (n == 0)
+  {
+    return input;
+  }
+
+  if (segments == 0)
+  {
+    segments = static_cast<std::size_t>(
+        std::ceil(std::sqrt(static_cast<double>(n))));
+  }
+  std::size_t per = (n + std::min(segments, n) - 1) / std::min(segments, n);
+
+  Tensor<T> x = input;
+  for (std::size_t begin{}; begin < n; begin += per)
+  {
+    std::vector<std::function<Tensor<T>(Tensor<T> const &)>> segment(
+        layers.begin() + begin, layers.begin() + std::min(n, begin + per));
+
+    x = checkpoint(
+        [segment](Tensor<T> const &h)
+        {
+          Tensor<T> y = h;
+          for (auto const &layer : segment)
+          {
+            y = layer(y);
+          }
+          return y;
+        },
+        x);
+  }
+  return x;
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+#include "serialize.hpp"
+#include "tensor.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//
+// Fixed-width records, width_ elements each, stored back to back. The
+// elements belong to owner_: a mapped file, or a buffer parsed into memory.
+//
+template <typename T> struct RecordSource
+{
+  T const *data_;
+  std::size_t records_;
+  std::size_t width_;
+  std::shared_ptr<void> owner_;
+};
+
+template <typename T>
+RecordSource<T> memory_records(std::vector<T> values, std::size_t width)
+{
+  if (width == 0 || values.size() % width != 0)
+  {
+    throw std::invalid_argument("Records do not divide the values");
+  }
+
+  auto owned = std::make_shared<std::vector<T>>(std::move(values));
+  return {owned->data(), owned->size() / width, width, owned};
+}
+
+//
+// A file of packed records of width elements of T, as written by
+// tofile() in NumPy. It is mapped, not read: workers fault in the pages a
+// batch needs as they assemble it, off the training thread.
+//
+template <typename T>
+RecordSource<T> binary_records(std::string const &path, std::size_t width)
+{
+  auto file = std::make_shared<MappedFile>(path);
+  if (width == 0 || file->size() % (width * sizeof(T)) != 0)
+  {
+    throw std::invalid_argument("File size is not a whole number of "
+                                "records: " + path);
+  }
+
+  return {reinterpret_cast<T const *>(file->data()),
+          file->size() / (width * sizeof(T)), width, file};
+}
+
+//
+// A CSV file of numbers, one record per line, every line with the same
+// number of fields. It is parsed into memory once, here; blank lines are
+// skipped, and so is the first line when header is set.
+//
+template <typename T>
+RecordSource<T> csv_records(std::string const &path, bool header = false)
+{
+  std::ifstream in(path);
+  if (!in)
+  {
+    throw std::invalid_argument("Cannot open " + path);
+  }
+
+  std::vector<T> values;
+  std::size_t width = 0;
+  std::string line;
+  for (std::size_t number = 1; std::getline(in, line); ++number)
+  {
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.pop_back();
+    }
+    if ((header && number == 1) || line.empty())
+    {
+      continue;
+    }
+
+    std::size_t fields = 0;
+    char const *p = line.data();
+    char const *end = p + line.size();
+    while (true)
+    {
+      while (p != end && *p == ' ')
+      {
+        ++p;
+      }
+
+      double value;
+      auto [next, error] = std::from_chars(p, end, value);
+      if (error != std::errc{})
+      {
+        throw std::invalid_argument(path + ":" + std::to_string(number) +
+                                    ": not a number");
+      }
+      values.push_back(static_cast<T>(value));
+      ++fields;
+
+      p = next;
+      while (p != end && *p == ' ')
+      {
+        ++p;
+      }
+      if (p == end)
+      {
+        break;
+      }
+      if (*p++ != ',')
+      {
+        throw std::invalid_argument(path + ":" + std::to_string(number) +
+                                    ": expected ','");
+      }
+    }
+
+    if (width == 0)
+    {
+      width = fields;
+    }
+    else if (fields != width)
+    {
+      throw std::invalid_argument(path + ":" + std::to_string(number) +
+                                  ": records differ in width");
+    }
+  }
+
+  if (width == 0)
+  {
+    throw std::invalid_argument("No records in " + path);
+  }
+  return memory_records(std::move(values), width);
+}
+
+struct DataLoaderOptions
+{
+  std::size_t batch_size = 32;
+  bool shuffle = true;
+  std::uint64_t seed = 0;
+  bool drop_last = false;     // drop an epoch's last, partial batch
+  std::size_t workers = 1;    // background threads assembling batches
+  std::size_t prefetch = 2;   // batches assembled ahead; 2 double-buffers
+  bool pin_workers = false;   // pin worker i to the i-th CPU from the last
+};
+
+// Inputs and targets of one batch, a row per record.
+template <typename T> struct Batch
+{
+  Tensor<T> inputs_;
+  Tensor<T> targets_;
+};
+
+//
+// Streams batches out of a RecordSource. Each record's first `inputs`
+// elements become a row of the batch's inputs and the rest a row of its
+// targets.
+//
+// Background workers assemble batches, in order, straight into prefetch
+// preallocated slots, while the training loop works on the batch before:
+//
+//   DataLoader<float> loader(csv_records<float>("train.csv"), 8,
+//                            {.batch_size = 64, .seed = 1});
+//   Batch<float> batch;
+//   while (loader.next(batch))
+//   {
+//     optim.zero_grad();
+//     criterion(model(batch.inputs_), batch.targets_).backward();
+//     optim.step();
+//   }
+//
+// next() returns false once per epoch, after its last batch, and the call
+// after that starts the next epoch, which workers have been assembling
+// already. With shuffle, every epoch visits the records in a fresh order
+// drawn from seed and the epoch number, so a run is reproducible whatever
+// the number of workers. A batch's tensors view its slot and are valid
+// until the next call to next(); copy them to keep them longer.
+//
+template <typename T> class DataLoader
+{
+public:
+  DataLoader(RecordSource<T> source, std::size_t inputs,
+             DataLoaderOptions options = {})
+      : source_{std::move(source)}, inputs_{inputs}, options_{options}
+  {
+    if (inputs_ == 0 || inputs_ >= source_.width_)
+    {
+      throw std::invalid_argument("Records need inputs and targets both");
+    }
+    if (options_.batch_size == 0 || options_.prefetch == 0 ||
+        options_.workers == 0)
+    {
+      throw std::invalid_argument("Batch size, prefetch and workers must "
+                                  "be positive");
+    }
+
+    batches_ = options_.drop_last
+                   ? source_.records_ / options_.batch_size
+                   : (source_.records_ + options_.batch_size - 1) /
+                         options_.batch_size;
+    if (batches_ == 0)
+    {
+      throw std::invalid_argument("Not enough records for a batch");
+    }
+
+    auto rows = static_cast<std::uint32_t>(options_.batch_size);
+    auto targets = static_cast<std::uint32_t>(source_.width_ - inputs_);
+    for (std::size_t s{}; s < options_.prefetch; ++s)
+    {
+      slots_.push_back({TensorImpl<T>({rows, static_cast<std::uint32_t>(
+                                                 inputs_)},
+                                      uninitialized),
+                        TensorImpl<T>({rows, targets}, uninitialized),
+                        kEmpty, 0});
+    }
+
+    for (std::size_t w{}; w < options_.workers; ++w)
+    {
+      workers_.emplace_back([this]() { work(); });
+      if (options_.pin_workers)
+      {
+        pin(workers_.back(), w);
+      }
+    }
+  }
+
+  DataLoader(DataLoader const &) = delete;
+  DataLoader &operator=(DataLoader const &) = delete;
+
+  ~DataLoader()
+  {
+    {
+      std::lock_guard lock(mutex_);
+      stop_ = true;
+    }
+    free_.notify_all();
+    for (auto &worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  // Batches in each epoch.
+  std::size_t batches() const { return batches_; }
+
+  bool next(Batch<T> &batch)
+  {
+    std::unique_lock lock(mutex_);
+    if (holding_)
+    {
+      ++consumed_;
+      holding_ = false;
+      free_.notify_all();
+    }
+
+    if (in_epoch_ == batches_)
+    {
+      in_epoch_ = 0;
+      return false;
+    }
+
+    auto &slot = slots_[consumed_ % slots_.size()];
+    ready_.wait(lock, [&]() { return slot.batch_ == consumed_; });
+    holding_ = true;
+    ++in_epoch_;
+
+    auto rows = static_cast<std::uint32_t>(slot.rows_);
+    batch.inputs_ = Tensor<T>(view(slot.inputs_, rows));
+    batch.targets_ = Tensor<T>(view(slot.targets_, rows));
+    return true;
+  }
+
+private:
+  static constexpr std::size_t kEmpty = std::numeric_limits<std::size_t>::max();
+
+  struct Slot
+  {
+    TensorImpl<T> inputs_;
+    TensorImpl<T> targets_;
+    std::size_t batch_; // the batch it holds, once assembled
+    std::size_t rows_;
+  };
+
+  static TensorImpl<T> view(TensorImpl<T> const &t, std::uint32_t rows)
+  {
+    return TensorImpl<T>(t.data_, {rows, t.shape_[1]}, t.stride_, 0);
+  }
+
+  static void pin([[maybe_unused]] std::thread &thread,
+                  [[maybe_unused]] std::size_t index)
+  {
+#if defined(__linux__)
+    std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus - 1 - index % cpus, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+  }
+
+  // Records of the batches of one epoch, in the order they are visited.
+  std::vector<std::size_t> order(std::size_t epoch) const
+  {
+    std::vector<std::size_t> records(source_.records_);
+    std::iota(records.begin(), records.end(), std::size_t{0});
+    if (options_.shuffle)
+    {
+      std::mt19937_64 gen(options_.seed * 0x9E3779B97F4A7C15ull + epoch);
+      std::shuffle(records.begin(), records.end(), gen);
+    }
+    return records;
+  }
+
+  // Claims batches in turn and assembles each once its slot is free.
+  void work()
+  {
+    std::size_t epoch = kEmpty;
+    std::vector<std::size_t> records;
+
+    while (true)
+    {
+      std::size_t b;
+      {
+        std::unique_lock lock(mutex_);
+        b = claimed_++;
+        free_.wait(lock, [&]()
+                   { return stop_ || b < consumed_ + slots_.size(); });
+        if (stop_)
+        {
+          return;
+        }
+      }
+
+      if (b / batches_ != epoch)
+      {
+        epoch = b / batches_;
+        records = order(epoch);
+      }
+
+      auto &slot = slots_[b % slots_.size()];
+      std::size_t first = (b % batches_) * options_.batch_size;
+      std::size_t rows =
+          std::min(options_.batch_size, source_.records_ - first);
+      std::size_t targets = source_.width_ - inputs_;
+
+      T *x = slot.inputs_.data_ptr();
+      T *y = slot.targets_.data_ptr();
+      for (std::size_t r{}; r < rows; ++r)
+      {
+        T const *record = source_.data_ + records[first + r] * source_.width_;
+        std::copy_n(record, inputs_, x + r * inputs_);
+        std::copy_n(record + inputs_, targets, y + r * targets);
+      }
+
+      {
+        std::lock_guard lock(mutex_);
+        slot.rows_ = rows;
+        slot.batch_ = b;
+      }
+      ready_.notify_all();
+    }
+  }
+
+  RecordSource<T> source_;
+  std::size_t inputs_;
+  DataLoaderOptions options_;
+  std::size_t batches_;
+  std::vector<Slot> slots_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_; // a slot was filled
+  std::condition_variable free_;  // a slot was released, or stopping
+  std::size_t claimed_{0};        // batches handed to workers
+  std::size_t consumed_{0};       // batches released by next()
+  std::size_t in_epoch_{0};       // batches next() returned this epoch
+  bool holding_{false};           // next() handed out batch consumed_
+  bool stop_{false};
+
+  std::vector<std::thread> workers_;
+};
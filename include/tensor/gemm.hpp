@@ -0,0 +1,390 @@
+#pragma once
+
+#include "simd.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <vector>
+
+//
+// Blocked GEMM following the GotoBLAS/BLIS layering:
+//
+//   C[M x N] = beta * C + A[M x K] * B[K x N]
+//
+// Every operand is addressed through a (row, col) element stride pair, so a
+// transposed operand is consumed by swapping its strides rather than by
+// copying it. The loops are blocked so that a KC x NC panel of B lives in L3,
+// an MC x KC block of A lives in L2 and a KC x NR sliver of B lives in L1;
+// both are packed into contiguous, zero-padded micro-panels that the MR x NR
+// register micro-kernel (simd_kernels.hpp) streams through.
+//
+// 16-bit operands are widened to float as they are packed and C is summed
+// in float over all of K, so bf16 and f16 GEMMs round only once per output.
+//
+template <typename T> struct GemmBlocking
+{
+  static constexpr std::size_t MR = 4;
+  static constexpr std::size_t NR = 4;
+  static constexpr std::size_t KC = 256;
+  static constexpr std::size_t MC = 128;
+  static constexpr std::size_t NC = 2048;
+};
+
+template <> struct GemmBlocking<float>
+{
+  static constexpr std::size_t MR = 6;
+  static constexpr std::size_t NR = 16;
+  static constexpr std::size_t KC = 256;
+  static constexpr std::size_t MC = 120;
+  static constexpr std::size_t NC = 4096;
+};
+
+template <> struct GemmBlocking<double>
+{
+  static constexpr std::size_t MR = 6;
+  static constexpr std::size_t NR = 8;
+  static constexpr std::size_t KC = 256;
+  static constexpr std::size_t MC = 120;
+  static constexpr std::size_t NC = 2048;
+};
+
+// Below this many multiply-adds packing costs more than it saves.
+inline constexpr std::size_t kGemmSmallWork = 16 * 16 * 16;
+
+// Below this many multiply-adds the GEMM stays on the calling thread.
+inline constexpr std::size_t kGemmParallelWork = 64 * 64 * 64;
+
+//
+// Packs rows [0, mc) x cols [0, kc) of A into MR-row micro-panels laid out
+// k-major, padding the last panel with zeros. The panels may be of a wider
+// type P than A.
+//
+template <typename T, std::size_t MR, typename P>
+void gemm_pack_a(std::size_t mc, std::size_t kc, T const *a, std::size_t rs_a,
+                 std::size_t cs_a, P *packed)
+{
+  for (std::size_t ir{}; ir < mc; ir += MR)
+  {
+    std::size_t mr = std::min(MR, mc - ir);
+
+    for (std::size_t p{}; p < kc; ++p)
+    {
+      T const *col = a + ir * rs_a + p * cs_a;
+
+      for (std::size_t i{}; i < mr; ++i)
+      {
+        packed[i] = static_cast<P>(col[i * rs_a]);
+      }
+      for (std::size_t i = mr; i < MR; ++i)
+      {
+        packed[i] = P{};
+      }
+      packed += MR;
+    }
+  }
+}
+
+//
+// Packs rows [0, kc) x cols [0, nc) of B into NR-column micro-panels laid
+// out k-major, padding the last panel with zeros.
+//
+template <typename T, std::size_t NR, typename P>
+void gemm_pack_b(std::size_t kc, std::size_t nc, T const *b, std::size_t rs_b,
+                 std::size_t cs_b, P *packed)
+{
+  for (std::size_t jr{}; jr < nc; jr += NR)
+  {
+    std::size_t nr = std::min(NR, nc - jr);
+
+    for (std::size_t p{}; p < kc; ++p)
+    {
+      T const *row = b + p * rs_b + jr * cs_b;
+
+      for (std::size_t j{}; j < nr; ++j)
+      {
+        packed[j] = static_cast<P>(row[j * cs_b]);
+      }
+      for (std::size_t j = nr; j < NR; ++j)
+      {
+        packed[j] = P{};
+      }
+      packed += NR;
+    }
+  }
+}
+
+//
+// Epilogues run on each finished block of C, while it is still in cache, as
+//
+//   epilogue(c, rs_c, cs_c, row, col, mr, nr)
+//
+// where c points at element (row, col) of C and the block is mr x nr.
+//
+struct GemmNoEpilogue
+{
+  template <typename T>
+  void operator()(T *, std::size_t, std::size_t, std::size_t, std::size_t,
+                  std::size_t, std::size_t) const
+  {
+  }
+};
+
+//
+// C = act(C + bias), with bias addressed through its own (row, col) strides
+// so a row vector broadcasts with a row stride of 0.
+//
+template <typename T, bool Relu> struct GemmBiasEpilogue
+{
+  T const *bias_;
+  std::size_t rs_bias_;
+  std::size_t cs_bias_;
+
+  void operator()(T *c, std::size_t rs_c, std::size_t cs_c, std::size_t row,
+                  std::size_t col, std::size_t mr, std::size_t nr) const
+  {
+    for (std::size_t i{}; i < mr; ++i)
+    {
+      T *out = c + i * rs_c;
+      T const *b = bias_ + (row + i) * rs_bias_ + col * cs_bias_;
+
+      if (cs_c == 1 && cs_bias_ == 1)
+      {
+        simd::add(out, out, b, nr);
+        if constexpr (Relu)
+        {
+          simd::relu(out, out, nr);
+        }
+        continue;
+      }
+
+      for (std::size_t j{}; j < nr; ++j)
+      {
+        T v = out[j * cs_c] + b[j * cs_bias_];
+        if constexpr (Relu)
+        {
+          v = (v > T{}) ? v : T{};
+        }
+        out[j * cs_c] = v;
+      }
+    }
+  }
+};
+
+template <typename T>
+void gemm_small(std::size_t M, std::size_t N, std::size_t K, T const *a,
+                std::size_t rs_a, std::size_t cs_a, T const *b,
+                std::size_t rs_b, std::size_t cs_b, T beta, T *c,
+                std::size_t rs_c, std::size_t cs_c)
+{
+  for (std::size_t i{}; i < M; ++i)
+  {
+    for (std::size_t j{}; j < N; ++j)
+    {
+      accumulate_t<T> acc{};
+      for (std::size_t k{}; k < K; ++k)
+      {
+        acc += a[i * rs_a + k * cs_a] * b[k * rs_b + j * cs_b];
+      }
+
+      T &dst = c[i * rs_c + j * cs_c];
+      dst = (beta == T{}) ? acc : beta * dst + acc;
+    }
+  }
+}
+
+//
+// Runs the micro-kernel over the NR-column panels [jr_begin, jr_end) of a
+// packed B block against one packed MC x KC block of A. c points at element
+// (row, col) of C. On the last K block the epilogue then runs over the
+// block just written, which is still in L2; running it per micro-tile would
+// spend more on dispatch than on the work.
+//
+template <typename T, typename Epilogue>
+void gemm_macro_kernel(std::size_t mc, std::size_t nc, std::size_t kc,
+                       std::size_t jr_begin, std::size_t jr_end,
+                       T const *packed_a, T const *packed_b, T beta, T *c,
+                       std::size_t rs_c, std::size_t cs_c, std::size_t row,
+                       std::size_t col, bool last, Epilogue const &epilogue)
+{
+  using Blk = GemmBlocking<T>;
+
+  for (std::size_t panel = jr_begin; panel < jr_end; ++panel)
+  {
+    std::size_t jr = panel * Blk::NR;
+
+    for (std::size_t ir{}; ir < mc; ir += Blk::MR)
+    {
+      simd::gemm_micro_kernel<T, Blk::MR, Blk::NR>(
+          kc, packed_a + ir * kc, packed_b + jr * kc,
+          c + ir * rs_c + jr * cs_c, rs_c, cs_c, beta,
+          std::min(Blk::MR, mc - ir), std::min(Blk::NR, nc - jr));
+    }
+  }
+
+  if (last && jr_begin < jr_end)
+  {
+    std::size_t j0 = jr_begin * Blk::NR;
+    std::size_t j1 = std::min(jr_end * Blk::NR, nc);
+    epilogue(c + j0 * cs_c, rs_c, cs_c, row, col + j0, mc, j1 - j0);
+  }
+}
+
+//
+// The blocked GEMM proper, on A and B of type T packed into panels of type
+// P, with C of type P.
+//
+template <typename T, typename P, typename Epilogue>
+void gemm_blocked(std::size_t M, std::size_t N, std::size_t K, T const *a,
+                  std::size_t rs_a, std::size_t cs_a, T const *b,
+                  std::size_t rs_b, std::size_t cs_b, P beta, P *c,
+                  std::size_t rs_c, std::size_t cs_c,
+                  Epilogue const &epilogue)
+{
+  using Blk = GemmBlocking<P>;
+
+  std::size_t threads =
+      (M * N * K >= kGemmParallelWork) ? get_num_threads() : 1;
+  std::size_t ic_blocks = (M + Blk::MC - 1) / Blk::MC;
+
+  Storage<P> packed_a(Blk::MC * Blk::KC, uninitialized);
+  Storage<P> packed_b(
+      std::min(Blk::NC, (N + Blk::NR - 1) / Blk::NR * Blk::NR) * Blk::KC,
+      uninitialized);
+
+  for (std::size_t jc{}; jc < N; jc += Blk::NC)
+  {
+    std::size_t nc = std::min(Blk::NC, N - jc);
+    std::size_t panels = (nc + Blk::NR - 1) / Blk::NR;
+
+    for (std::size_t pc{}; pc < K; pc += Blk::KC)
+    {
+      std::size_t kc = std::min(Blk::KC, K - pc);
+      P beta_pc = (pc == 0) ? beta : static_cast<P>(1);
+      bool last = pc + kc == K;
+      T const *b_block = b + pc * rs_b + jc * cs_b;
+
+      parallel_for(0, panels, (threads > 1) ? 1 : panels,
+                   [&](std::size_t lo, std::size_t hi)
+                   {
+                     std::size_t j = lo * Blk::NR;
+                     gemm_pack_b<T, Blk::NR>(
+                         kc, std::min(hi * Blk::NR, nc) - j,
+                         b_block + j * cs_b, rs_b, cs_b,
+                         packed_b.data() + j * kc);
+                   });
+
+      if (threads > 1 && ic_blocks >= threads)
+      {
+        // Enough row blocks to go around: each task packs its own A.
+        parallel_for(
+            0, ic_blocks, 1,
+            [&](std::size_t lo, std::size_t hi)
+            {
+              thread_local std::vector<P> local_a;
+              local_a.resize(Blk::MC * Blk::KC);
+
+              for (std::size_t blk = lo; blk < hi; ++blk)
+              {
+                std::size_t ic = blk * Blk::MC;
+                std::size_t mc = std::min(Blk::MC, M - ic);
+
+                gemm_pack_a<T, Blk::MR>(mc, kc, a + ic * rs_a + pc * cs_a,
+                                        rs_a, cs_a, local_a.data());
+                gemm_macro_kernel(mc, nc, kc, 0, panels, local_a.data(),
+                                  packed_b.data(), beta_pc,
+                                  c + ic * rs_c + jc * cs_c, rs_c, cs_c, ic,
+                                  jc, last, epilogue);
+              }
+            });
+        continue;
+      }
+
+      for (std::size_t ic{}; ic < M; ic += Blk::MC)
+      {
+        std::size_t mc = std::min(Blk::MC, M - ic);
+
+        gemm_pack_a<T, Blk::MR>(mc, kc, a + ic * rs_a + pc * cs_a, rs_a, cs_a,
+                                packed_a.data());
+
+        // Few row blocks: split the shared A block across column panels.
+        parallel_for(0, panels, (threads > 1) ? 1 : panels,
+                     [&](std::size_t lo, std::size_t hi)
+                     {
+                       gemm_macro_kernel(mc, nc, kc, lo, hi, packed_a.data(),
+                                         packed_b.data(), beta_pc,
+                                         c + ic * rs_c + jc * cs_c, rs_c,
+                                         cs_c, ic, jc, last, epilogue);
+                     });
+      }
+    }
+  }
+}
+
+template <typename T, typename Epilogue = GemmNoEpilogue>
+void gemm(std::size_t M, std::size_t N, std::size_t K, T const *a,
+          std::size_t rs_a, std::size_t cs_a, T const *b, std::size_t rs_b,
+          std::size_t cs_b, T beta, T *c, std::size_t rs_c, std::size_t cs_c,
+          Epilogue const &epilogue = {})
+{
+  if (M == 0 || N == 0)
+  {
+    return;
+  }
+
+  if (K == 0 || M * N * K <= kGemmSmallWork)
+  {
+    gemm_small(M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, beta, c, rs_c, cs_c);
+    epilogue(c, rs_c, cs_c, 0, 0, M, N);
+    return;
+  }
+
+  using Acc = accumulate_t<T>;
+
+  if constexpr (std::same_as<T, Acc>)
+  {
+    gemm_blocked(M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, beta, c, rs_c, cs_c,
+                 epilogue);
+  }
+  else
+  {
+    Storage<Acc> acc(M * N, uninitialized);
+    Acc acc_beta{};
+
+    if (beta != T{})
+    {
+      for (std::size_t i{}; i < M; ++i)
+      {
+        for (std::size_t j{}; j < N; ++j)
+        {
+          acc[i * N + j] = beta * c[i * rs_c + j * cs_c];
+        }
+      }
+      acc_beta = 1;
+    }
+
+    gemm_blocked(M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, acc_beta, acc.data(),
+                 N, 1, GemmNoEpilogue{});
+
+    parallel_for(0, M, std::max<std::size_t>(1, kGrainSize / N),
+                 [&](std::size_t lo, std::size_t hi)
+                 {
+                   for (std::size_t i = lo; i < hi; ++i)
+                   {
+                     if (cs_c == 1)
+                     {
+                       simd::convert(c + i * rs_c, acc.data() + i * N, N);
+                       continue;
+                     }
+                     for (std::size_t j{}; j < N; ++j)
+                     {
+                       c[i * rs_c + j * cs_c] = acc[i * N + j];
+                     }
+                   }
+                 });
+
+    epilogue(c, rs_c, cs_c, 0, 0, M, N);
+  }
+}
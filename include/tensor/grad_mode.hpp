@@ -0,0 +1,53 @@
+#pragma once
+
+#include <utility>
+
+// Whether ops on this thread record the graph that backward walks.
+inline bool &grad_enabled()
+{
+  thread_local bool enabled = true;
+  return enabled;
+}
+
+//
+// Sets grad_enabled() on the current thread for the guard's lifetime. With
+// recording off an op computes its result and nothing else: the result
+// does not require grad and has no parents or backward, so an evaluation
+// pass builds no graph and keeps no activations alive for one.
+//
+//   {
+//     NoGradGuard no_grad;
+//     auto pred = linear(linear_relu(x, w1, b1), w2, b2);
+//   }
+//
+// StaticGraph::capture still links and records ops run under the guard, so
+// that they are replayed; they just get no backward.
+//
+class GradModeGuard
+{
+public:
+  explicit GradModeGuard(bool enabled)
+      : previous_{std::exchange(grad_enabled(), enabled)}
+  {
+  }
+
+  GradModeGuard(GradModeGuard const &) = delete;
+  GradModeGuard &operator=(GradModeGuard const &) = delete;
+
+  ~GradModeGuard() { grad_enabled() = previous_; }
+
+private:
+  bool previous_;
+};
+
+class NoGradGuard : public GradModeGuard
+{
+public:
+  NoGradGuard() : GradModeGuard(false) {}
+};
+
+// Whether an op over these inputs records a node for backward.
+template <typename... Impls> bool records_grad(Impls const &...inputs)
+{
+  return grad_enabled() && (inputs.requires_grad_ || ...);
+}
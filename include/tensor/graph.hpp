@@ -0,0 +1,388 @@
+#pragma once
+
+#include "memory_plan.hpp"
+#include "tensor.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Whether ops on this thread are being recorded by StaticGraph::capture.
+inline bool &capturing_graph()
+{
+  thread_local bool active = false;
+  return active;
+}
+
+//
+// Capture and replay of a whole training step, in the manner of CUDA
+// graphs. capture() runs the step once, eagerly, with every op also
+// recording a forward_ that recomputes its output in place, then runs the
+// backward. The graph it built is kept: every output and gradient buffer
+// stays allocated, and replay() reruns the recorded forwards and backwards
+// over those buffers in the recorded order, without building nodes,
+// closures or parent lists. Only kernel scratch (GEMM packing, reduction
+// temporaries) is still requested, from the caching allocator.
+//
+// Inputs are static, as in CUDA graphs: new data is written into the
+// storage of the tensors the step read (x.impl()->data_ptr()), and
+// replay() picks it up. Under capture, ops link their inputs even when
+// nothing requires grad, so work derived from the inputs alone is
+// recomputed too. Every gradient in the graph, parameters' included, is
+// zeroed at the start of replay(), so an optimizer's reset_grad() is not
+// needed between replays.
+//
+// A view needs no forward_ of its own: it shares its input's storage,
+// which is rewritten in place. Reductions recompute into a temporary that
+// is copied over their output.
+//
+// plan() then shrinks the graph's footprint; see MemoryPlan.
+//
+
+// Outcome of StaticGraph::plan, in bytes.
+struct MemoryPlan
+{
+  std::size_t naive_bytes;   // every planned buffer allocated on its own
+  std::size_t planned_bytes; // the arena they share instead
+  std::size_t buffers;       // activations and gradients placed
+  std::size_t in_place;      // ops writing their result over a dead input
+};
+
+template <typename T> class StaticGraph
+{
+public:
+  bool empty() const { return !root_; }
+
+  //
+  // Runs step, which builds a graph and returns its scalar loss, under
+  // capture, then backpropagates from the loss. Throws if the step used an
+  // op that cannot be replayed.
+  //
+  template <typename Step> Tensor<T> capture(Step &&step)
+  {
+    clear();
+
+    Tensor<T> loss = [&]()
+    {
+      struct Scope
+      {
+        bool previous_ = std::exchange(capturing_graph(), true);
+        ~Scope() { capturing_graph() = previous_; }
+      } scope;
+      return step();
+    }();
+
+    auto topo = Tensor<T>::topo_order(loss.impl());
+
+    for (auto const &node : topo)
+    {
+      bool view = !node->parents_.empty() &&
+                  node->data_ == node->parents_[0]->data_;
+
+      if (!node->parents_.empty() && !node->forward_ && !view)
+      {
+        throw std::invalid_argument("Graph uses an op that cannot be "
+                                    "captured");
+      }
+
+      nodes_.push_back(node.get());
+      if (node->forward_)
+      {
+        forwards_.push_back(node.get());
+      }
+      if (node->backward_)
+      {
+        backwards_.push_back(node.get());
+      }
+    }
+
+    // Backwards run in reverse; keep them in the order they run.
+    std::reverse(backwards_.begin(), backwards_.end());
+    zero_late_.assign(nodes_.size(), false);
+    zero_before_.assign(backwards_.size(), {});
+
+    root_ = loss.impl();
+    loss.backward(true);
+
+    return loss;
+  }
+
+  // Reruns the captured step on the current contents of its inputs.
+  void replay()
+  {
+    if (!root_)
+    {
+      throw std::invalid_argument("Nothing has been captured");
+    }
+
+    for (auto *node : forwards_)
+    {
+      node->forward_();
+    }
+
+    for (std::size_t i{}; i < nodes_.size(); ++i)
+    {
+      if (nodes_[i]->grad_ && !zero_late_[i])
+      {
+        nodes_[i]->grad_->fill(static_cast<T>(0));
+      }
+    }
+
+    if (!root_->grad_)
+    {
+      root_->grad_ = std::make_shared<TensorImpl<T>>(root_->shape_);
+    }
+    root_->grad_->fill(static_cast<T>(1));
+
+    for (std::size_t k{}; k < backwards_.size(); ++k)
+    {
+      for (auto *node : zero_before_[k])
+      {
+        node->grad_->fill(static_cast<T>(0));
+      }
+      backwards_[k]->backward_();
+    }
+  }
+
+  //
+  // Moves the intermediate activations and gradients of the captured graph
+  // into one arena, where buffers whose lifetimes over a replay do not
+  // overlap share memory, and lets elementwise ops write over inputs that
+  // are dead after them (see allow_in_place). Leaves, their gradients and
+  // the loss keep buffers of their own. Afterwards an intermediate holds
+  // meaningful elements only while replay() is using it.
+  //
+  // A replay runs forwards_ at steps 0 .. F - 1 and backwards_ at steps
+  // F onwards. A buffer is in use from its first write to its last read:
+  // forwards read their parents, backwards read their saved_ tensors and
+  // their own gradient and write their parents' gradients. Gradients are
+  // then zeroed just before their first write instead of all at the start.
+  //
+  MemoryPlan plan()
+  {
+    if (!root_)
+    {
+      throw std::invalid_argument("Nothing has been captured");
+    }
+
+    zero_late_.assign(nodes_.size(), false);
+    zero_before_.assign(backwards_.size(), {});
+
+    std::size_t const F = forwards_.size();
+    std::size_t const align =
+        std::max<std::size_t>(1, kAllocAlignment / sizeof(T));
+
+    std::vector<Storage<T> *> storages;
+    std::vector<BufferLifetime> lifetimes;
+    std::unordered_map<Storage<T> *, std::size_t> index;
+
+    auto add = [&](Storage<T> *storage)
+    {
+      if (storage->empty() || index.count(storage))
+      {
+        return;
+      }
+      index.emplace(storage, storages.size());
+      storages.push_back(storage);
+      lifetimes.push_back({(storage->size() + align - 1) / align * align,
+                           std::numeric_limits<std::size_t>::max(), 0});
+    };
+
+    for (auto *node : forwards_)
+    {
+      add(node->data_.get());
+    }
+    for (auto *node : nodes_)
+    {
+      if (!node->parents_.empty() && node->grad_)
+      {
+        add(node->grad_->data_.get());
+      }
+    }
+
+    // Whatever outlives a replay stays where it is.
+    auto pin = [&](std::shared_ptr<TensorImpl<T>> const &t)
+    {
+      if (t)
+      {
+        index.erase(t->data_.get());
+      }
+    };
+    pin(root_);
+    pin(root_->grad_);
+    for (auto *node : nodes_)
+    {
+      if (node->parents_.empty())
+      {
+        index.erase(node->data_.get());
+        pin(node->grad_);
+      }
+    }
+
+    auto touch = [&](std::shared_ptr<Storage<T>> const &storage,
+                     std::size_t step)
+    {
+      auto it = index.find(storage.get());
+      if (it != index.end())
+      {
+        auto &life = lifetimes[it->second];
+        life.first_ = std::min(life.first_, step);
+        life.last_ = std::max(life.last_, step);
+      }
+    };
+
+    for (std::size_t k{}; k < F; ++k)
+    {
+      touch(forwards_[k]->data_, k);
+      for (auto const &parent : forwards_[k]->parents_)
+      {
+        touch(parent->data_, k);
+      }
+    }
+
+    for (std::size_t k{}; k < backwards_.size(); ++k)
+    {
+      auto *node = backwards_[k];
+      for (auto *saved : node->saved_)
+      {
+        touch(saved->data_, F + k);
+      }
+      if (node->grad_)
+      {
+        touch(node->grad_->data_, F + k);
+      }
+      for (auto const &parent : node->parents_)
+      {
+        if (parent->grad_)
+        {
+          touch(parent->grad_->data_, F + k);
+        }
+      }
+    }
+
+    // Buffers sharing a slot get the same offset. An in-place op's output
+    // joins its input's slot when the input is dense over its whole buffer
+    // and nothing reads it after this op.
+    std::vector<std::size_t> slot(storages.size());
+    std::iota(slot.begin(), slot.end(), std::size_t{0});
+    std::size_t in_place = 0;
+
+    for (std::size_t k{}; k < F; ++k)
+    {
+      auto *out = forwards_[k];
+      auto *in = out->in_place_input_;
+      if (!in)
+      {
+        continue;
+      }
+
+      auto o = index.find(out->data_.get());
+      auto i = index.find(in->data_.get());
+      if (o == index.end() || i == index.end() || o->second == i->second)
+      {
+        continue;
+      }
+
+      auto &from = lifetimes[slot[i->second]];
+      auto &to = lifetimes[o->second];
+      bool dense = in->offset_ == 0 && in->is_contiguous() &&
+                   in->numel() == in->data_->size();
+
+      if (dense && from.last_ == k && from.size_ == to.size_ &&
+          out->numel() == in->numel())
+      {
+        from.last_ = std::max(from.last_, to.last_);
+        slot[o->second] = slot[i->second];
+        ++in_place;
+      }
+    }
+
+    std::vector<BufferLifetime> slots;
+    std::vector<std::size_t> slot_index(storages.size());
+    MemoryPlan result{0, 0, 0, in_place};
+
+    for (std::size_t s{}; s < storages.size(); ++s)
+    {
+      auto it = index.find(storages[s]);
+      if (it == index.end() || lifetimes[s].last_ < lifetimes[s].first_)
+      {
+        continue;
+      }
+
+      result.naive_bytes += lifetimes[s].size_ * sizeof(T);
+      ++result.buffers;
+      if (slot[s] == s)
+      {
+        slot_index[s] = slots.size();
+        slots.push_back(lifetimes[s]);
+      }
+    }
+
+    std::size_t arena_size = assign_offsets(slots);
+    result.planned_bytes = arena_size * sizeof(T);
+    if (arena_size == 0)
+    {
+      return result;
+    }
+
+    auto arena = std::make_shared<Storage<T>>(arena_size, uninitialized);
+    for (std::size_t s{}; s < storages.size(); ++s)
+    {
+      if (index.count(storages[s]) &&
+          lifetimes[s].last_ >= lifetimes[s].first_)
+      {
+        storages[s]->rebind(arena, slots[slot_index[slot[s]]].offset_);
+      }
+    }
+
+    // Planned gradients may share memory with activations still in use
+    // when the replay starts, so each is zeroed just before its first use.
+    for (std::size_t i{}; i < nodes_.size(); ++i)
+    {
+      auto *node = nodes_[i];
+      if (node->parents_.empty() || !node->grad_)
+      {
+        continue;
+      }
+
+      auto it = index.find(node->grad_->data_.get());
+      if (it != index.end() && lifetimes[it->second].first_ >= F &&
+          lifetimes[it->second].last_ >= lifetimes[it->second].first_)
+      {
+        zero_late_[i] = true;
+        zero_before_[lifetimes[it->second].first_ - F].push_back(node);
+      }
+    }
+
+    return result;
+  }
+
+  // Nodes of the captured graph, every node after its parents.
+  std::vector<TensorImpl<T> *> const &nodes() const { return nodes_; }
+
+  void clear()
+  {
+    root_ = nullptr;
+    nodes_.clear();
+    forwards_.clear();
+    backwards_.clear();
+    zero_late_.clear();
+    zero_before_.clear();
+  }
+
+private:
+  // Owns the whole graph through parents_; the lists below borrow from it.
+  std::shared_ptr<TensorImpl<T>> root_;
+  std::vector<TensorImpl<T> *> nodes_;
+  std::vector<TensorImpl<T> *> forwards_;
+  std::vector<TensorImpl<T> *> backwards_;
+
+  // Gradients plan() placed, zeroed before backwards_[k] instead of first.
+  std::vector<bool> zero_late_;
+  std::vector<std::vector<TensorImpl<T> *>> zero_before_;
+};
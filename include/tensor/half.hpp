@@ -0,0 +1,177 @@
+#pragma once
+
+#include <bit>
+#include <concepts>
+#include <cstdint>
+#include <limits>
+
+//
+// 16-bit floating-point storage formats:
+//
+//   bf16   bfloat16: float's 8-bit exponent with a 7-bit mantissa
+//   f16    IEEE binary16: 5-bit exponent, 10-bit mantissa
+//
+// Both convert implicitly to float, so arithmetic on them is float
+// arithmetic, and round back to nearest, ties to even, when a float is
+// stored into one. They exist to halve memory and bandwidth; kernels widen
+// them on load and keep sums in float (see accumulate_t).
+//
+struct bf16
+{
+  std::uint16_t bits_;
+
+  bf16() = default;
+  constexpr bf16(float value) : bits_{round(value)} {}
+
+  constexpr operator float() const
+  {
+    return std::bit_cast<float>(static_cast<std::uint32_t>(bits_) << 16);
+  }
+
+  static constexpr bf16 from_bits(std::uint16_t bits)
+  {
+    bf16 h{};
+    h.bits_ = bits;
+    return h;
+  }
+
+  static constexpr std::uint16_t round(float value)
+  {
+    auto bits = std::bit_cast<std::uint32_t>(value);
+
+    // Keep NaNs quiet instead of letting the rounding carry into the sign.
+    if ((bits & 0x7FFFFFFFu) > 0x7F800000u)
+    {
+      return static_cast<std::uint16_t>((bits >> 16) | 0x0040u);
+    }
+
+    bits += 0x7FFFu + ((bits >> 16) & 1u);
+    return static_cast<std::uint16_t>(bits >> 16);
+  }
+
+  bf16 &operator+=(float other) { return *this = *this + other; }
+  bf16 &operator-=(float other) { return *this = *this - other; }
+  bf16 &operator*=(float other) { return *this = *this * other; }
+  bf16 &operator/=(float other) { return *this = *this / other; }
+};
+
+struct f16
+{
+  std::uint16_t bits_;
+
+  f16() = default;
+  constexpr f16(float value) : bits_{round(value)} {}
+
+  constexpr operator float() const
+  {
+    std::uint32_t sign = static_cast<std::uint32_t>(bits_ & 0x8000u) << 16;
+    std::uint32_t bits = static_cast<std::uint32_t>(bits_ & 0x7FFFu) << 13;
+    std::uint32_t exponent = bits & 0x0F800000u;
+
+    bits += (127u - 15u) << 23;
+
+    if (exponent == 0x0F800000u)
+    {
+      // Inf or NaN: move the exponent up to float's all-ones.
+      bits += (128u - 16u) << 23;
+    }
+    else if (exponent == 0)
+    {
+      // Subnormal: let the FPU normalize it.
+      bits += 1u << 23;
+      bits = std::bit_cast<std::uint32_t>(std::bit_cast<float>(bits) -
+                                          std::bit_cast<float>(113u << 23));
+    }
+
+    return std::bit_cast<float>(bits | sign);
+  }
+
+  static constexpr f16 from_bits(std::uint16_t bits)
+  {
+    f16 h{};
+    h.bits_ = bits;
+    return h;
+  }
+
+  static constexpr std::uint16_t round(float value)
+  {
+    auto bits = std::bit_cast<std::uint32_t>(value);
+    auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    bits &= 0x7FFFFFFFu;
+
+    if (bits >= 0x47800000u)
+    {
+      // Beyond the f16 range, Inf or NaN.
+      return sign | ((bits > 0x7F800000u) ? 0x7E00u : 0x7C00u);
+    }
+
+    if (bits < 0x38800000u)
+    {
+      // Subnormal result: adding 0.5 lines the f16 subnormal spacing up
+      // with float's last mantissa bit, and the FPU rounds.
+      float shifted = std::bit_cast<float>(bits) + 0.5f;
+      return sign | static_cast<std::uint16_t>(
+                        std::bit_cast<std::uint32_t>(shifted) - 0x3F000000u);
+    }
+
+    // Normal: rebias the exponent and round the dropped 13 bits.
+    std::uint32_t odd = (bits >> 13) & 1u;
+    bits += ((15u - 127u) << 23) + 0xFFFu + odd;
+    return sign | static_cast<std::uint16_t>(bits >> 13);
+  }
+
+  f16 &operator+=(float other) { return *this = *this + other; }
+  f16 &operator-=(float other) { return *this = *this - other; }
+  f16 &operator*=(float other) { return *this = *this * other; }
+  f16 &operator/=(float other) { return *this = *this / other; }
+};
+
+template <typename T>
+concept HalfPrecision = std::same_as<T, bf16> || std::same_as<T, f16>;
+
+// Type kernels accumulate T in: float for the 16-bit formats, else T.
+template <typename T> struct Accumulate
+{
+  using type = T;
+};
+
+template <HalfPrecision T> struct Accumulate<T>
+{
+  using type = float;
+};
+
+template <typename T> using accumulate_t = typename Accumulate<T>::type;
+
+template <> struct std::numeric_limits<bf16>
+{
+  static constexpr bool is_specialized = true;
+  static constexpr bool is_signed = true;
+  static constexpr bool is_integer = false;
+  static constexpr bool has_infinity = true;
+  static constexpr bool has_quiet_NaN = true;
+  static constexpr int digits = 8;
+
+  static constexpr bf16 min() { return bf16::from_bits(0x0080); }
+  static constexpr bf16 max() { return bf16::from_bits(0x7F7F); }
+  static constexpr bf16 lowest() { return bf16::from_bits(0xFF7F); }
+  static constexpr bf16 epsilon() { return bf16::from_bits(0x3C00); }
+  static constexpr bf16 infinity() { return bf16::from_bits(0x7F80); }
+  static constexpr bf16 quiet_NaN() { return bf16::from_bits(0x7FC0); }
+};
+
+template <> struct std::numeric_limits<f16>
+{
+  static constexpr bool is_specialized = true;
+  static constexpr bool is_signed = true;
+  static constexpr bool is_integer = false;
+  static constexpr bool has_infinity = true;
+  static constexpr bool has_quiet_NaN = true;
+  static constexpr int digits = 11;
+
+  static constexpr f16 min() { return f16::from_bits(0x0400); }
+  static constexpr f16 max() { return f16::from_bits(0x7BFF); }
+  static constexpr f16 lowest() { return f16::from_bits(0xFBFF); }
+  static constexpr f16 epsilon() { return f16::from_bits(0x1400); }
+  static constexpr f16 infinity() { return f16::from_bits(0x7C00); }
+  static constexpr f16 quiet_NaN() { return f16::from_bits(0x7E00); }
+};
@@ -0,0 +1,97 @@
+//
+// int8 GEMM micro-kernel written once against a four-byte dot product
+// abstraction D. qgemm.hpp includes this file once per instruction set,
+// inside that set's namespace and target pragma, after defining D there.
+// Like simd_kernels.hpp it has no include guard and includes nothing.
+//
+// D provides: reg (int32 lanes), width, a_operand, b_operand, zero,
+// load(int32 const *), store(int32 *, reg), add, broadcast_a(p) for the
+// four unsigned bytes at p repeated in every lane, load_b(p) for width
+// lanes of four signed bytes, and dot4(acc, a, b), which adds the four
+// byte products of each lane to it.
+//
+
+//
+// C[mr x nr] (+)= A' * B over kg groups of four k, where A' is an MR-row
+// panel of unsigned bytes and B an NR-column panel of signed bytes, both
+// packed group-major with the four bytes of a group adjacent (see
+// qgemm_pack_a / qgemm_pack_b). C holds int32 and is row-major with row
+// stride ldc.
+//
+template <typename D, std::size_t MR, std::size_t NR>
+void int8_micro_kernel(std::size_t kg, std::uint8_t const *a,
+                       std::int8_t const *b, std::int32_t *c, std::size_t ldc,
+                       bool accumulate, std::size_t mr, std::size_t nr)
+{
+  constexpr std::size_t NV = NR / D::width;
+  static_assert(NR % D::width == 0, "NR must be a multiple of the width");
+
+  typename D::reg acc[MR][NV];
+
+#pragma GCC unroll 16
+  for (std::size_t i{}; i < MR; ++i)
+  {
+#pragma GCC unroll 16
+    for (std::size_t v{}; v < NV; ++v)
+    {
+      acc[i][v] = D::zero();
+    }
+  }
+
+  for (std::size_t p{}; p < kg; ++p)
+  {
+    typename D::b_operand bv[NV];
+
+#pragma GCC unroll 16
+    for (std::size_t v{}; v < NV; ++v)
+    {
+      bv[v] = D::load_b(b + v * D::width * 4);
+    }
+
+#pragma GCC unroll 16
+    for (std::size_t i{}; i < MR; ++i)
+    {
+      auto av = D::broadcast_a(a + i * 4);
+#pragma GCC unroll 16
+      for (std::size_t v{}; v < NV; ++v)
+      {
+        acc[i][v] = D::dot4(acc[i][v], av, bv[v]);
+      }
+    }
+
+    a += MR * 4;
+    b += NR * 4;
+  }
+
+  if (mr == MR && nr == NR)
+  {
+    for (std::size_t i{}; i < MR; ++i)
+    {
+      for (std::size_t v{}; v < NV; ++v)
+      {
+        std::int32_t *dst = c + i * ldc + v * D::width;
+        auto r = accumulate ? D::add(D::load(dst), acc[i][v]) : acc[i][v];
+        D::store(dst, r);
+      }
+    }
+    return;
+  }
+
+  // Edge tile: spill the accumulators and copy the live part.
+  std::int32_t tile[MR][NR];
+  for (std::size_t i{}; i < MR; ++i)
+  {
+    for (std::size_t v{}; v < NV; ++v)
+    {
+      D::store(&tile[i][v * D::width], acc[i][v]);
+    }
+  }
+
+  for (std::size_t i{}; i < mr; ++i)
+  {
+    for (std::size_t j{}; j < nr; ++j)
+    {
+      c[i * ldc + j] = accumulate ? c[i * ldc + j] + tile[i][j] : tile[i][j];
+    }
+  }
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include "tensor.hpp"
+#include "tensor_impl.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+//
+// Opt-in lazy evaluation of elementwise chains. lazy(t) wraps a tensor in
+// an expression, and +, -, unary -, * by a scalar and relu on expressions
+// build a larger one instead of computing anything:
+//
+//   auto y = materialize(relu(lazy(h) + lazy(bias)) - lazy(mean));
+//
+// materialize broadcasts every leaf to the result's shape, as the eager
+// ops would pairwise, and walks it once with a TensorIterator. Each run is
+// cut into tiles small enough to stay in L1; every node of the expression
+// computes its tile with the same dense kernels as the eager op, reading
+// its operands' tiles and writing its own, and the root writes straight
+// into the result. A chain of k ops thus reads each input and writes the
+// output once instead of making k passes over memory.
+//
+// Expressions refer to their leaves without owning them, and there is no
+// autograd: like to<U>, the result starts a new graph.
+//
+
+// Elements per tile and node.
+inline constexpr std::size_t kLazyTile = 256;
+
+template <typename T> struct LazyLeaf
+{
+  using value_type = T;
+  static constexpr std::size_t leaves = 1;
+  static constexpr std::size_t nodes = 1;
+
+  TensorImpl<T> const *tensor_;
+};
+
+template <typename Op, typename E> struct LazyUnary
+{
+  using value_type = typename E::value_type;
+  static constexpr std::size_t leaves = E::leaves;
+  static constexpr std::size_t nodes = E::nodes + 1;
+
+  Op op_;
+  E arg_;
+};
+
+template <typename Op, typename L, typename R> struct LazyBinary
+{
+  using value_type = typename L::value_type;
+  static constexpr std::size_t leaves = L::leaves + R::leaves;
+  static constexpr std::size_t nodes = L::nodes + R::nodes + 1;
+
+  Op op_;
+  L lhs_;
+  R rhs_;
+};
+
+template <typename E>
+concept LazyExpression = requires {
+  typename E::value_type;
+  E::nodes;
+};
+
+template <typename T> LazyLeaf<T> lazy(TensorImpl<T> const &t) { return {&t}; }
+
+template <typename T> LazyLeaf<T> lazy(Tensor<T> const &t)
+{
+  return {t.impl().get()};
+}
+
+// A temporary would be gone before the expression is materialized.
+template <typename T> void lazy(TensorImpl<T> &&) = delete;
+template <typename T> void lazy(Tensor<T> &&) = delete;
+
+template <LazyExpression L, LazyExpression R>
+LazyBinary<simd::Plus<typename L::value_type>, L, R> operator+(L lhs, R rhs)
+{
+  return {{}, lhs, rhs};
+}
+
+template <LazyExpression L, LazyExpression R>
+LazyBinary<simd::Minus<typename L::value_type>, L, R> operator-(L lhs, R rhs)
+{
+  return {{}, lhs, rhs};
+}
+
+template <LazyExpression E>
+LazyUnary<simd::Negate<typename E::value_type>, E> operator-(E arg)
+{
+  return {{}, arg};
+}
+
+template <LazyExpression E>
+LazyUnary<simd::Scale<typename E::value_type>, E>
+operator*(E arg, typename E::value_type value)
+{
+  return {{value}, arg};
+}
+
+template <LazyExpression E>
+LazyUnary<simd::Relu<typename E::value_type>, E> relu(E arg)
+{
+  return {{}, arg};
+}
+
+//
+// One tile of a run: where each leaf's elements start and their stride,
+// and a scratch tile per node.
+//
+template <typename T, std::size_t Leaves, std::size_t Nodes> struct LazyTile
+{
+  std::array<T const *, Leaves> leaf_;
+  std::array<std::size_t, Leaves> stride_;
+  std::size_t n_;
+  alignas(64) T scratch_[Nodes][kLazyTile];
+};
+
+// A node's tile: n_ elements at data_, or one repeated when scalar_.
+template <typename T> struct LazyOperand
+{
+  T const *data_;
+  bool scalar_;
+};
+
+//
+// Computes a node's tile into dst, or hands back a leaf's elements where
+// they lie. Leaf is the number of the subtree's first leaf and Slot of its
+// first scratch tile; a subtree of k nodes owns tiles Slot .. Slot + k - 1
+// and its root computes into the last of them, so no two nodes share one.
+//
+template <std::size_t Leaf, std::size_t Slot, typename T, typename Tile>
+LazyOperand<T> lazy_tile(LazyLeaf<T> const &, Tile &tile, T *dst)
+{
+  T const *src = tile.leaf_[Leaf];
+  std::size_t stride = tile.stride_[Leaf];
+
+  if (stride == 1)
+  {
+    return {src, false};
+  }
+  if (stride == 0)
+  {
+    return {src, true};
+  }
+
+  for (std::size_t i{}; i < tile.n_; ++i)
+  {
+    dst[i] = src[i * stride];
+  }
+  return {dst, false};
+}
+
+template <std::size_t Leaf, std::size_t Slot, typename Op, typename E,
+          typename T, typename Tile>
+LazyOperand<T> lazy_tile(LazyUnary<Op, E> const &node, Tile &tile, T *dst)
+{
+  auto arg = lazy_tile<Leaf, Slot>(node.arg_, tile,
+                                   tile.scratch_[Slot + E::nodes - 1]);
+
+  if (arg.scalar_)
+  {
+    dst[0] = node.op_(arg.data_[0]);
+    return {dst, true};
+  }
+
+  unary_loop(dst, arg.data_, {1, 1}, tile.n_, node.op_);
+  return {dst, false};
+}
+
+template <std::size_t Leaf, std::size_t Slot, typename Op, typename L,
+          typename R, typename T, typename Tile>
+LazyOperand<T> lazy_tile(LazyBinary<Op, L, R> const &node, Tile &tile,
+                         T *dst)
+{
+  constexpr std::size_t right = Slot + L::nodes;
+
+  auto lhs = lazy_tile<Leaf, Slot>(node.lhs_, tile,
+                                   tile.scratch_[right - 1]);
+  auto rhs = lazy_tile<Leaf + L::leaves, right>(
+      node.rhs_, tile, tile.scratch_[right + R::nodes - 1]);
+
+  if (lhs.scalar_ && rhs.scalar_)
+  {
+    dst[0] = node.op_(lhs.data_[0], rhs.data_[0]);
+    return {dst, true};
+  }
+
+  binary_loop(dst, lhs.data_, rhs.data_,
+              {1, lhs.scalar_ ? 0u : 1u, rhs.scalar_ ? 0u : 1u}, tile.n_,
+              node.op_);
+  return {dst, false};
+}
+
+template <typename T, std::size_t I, typename Leaves>
+void lazy_leaves(LazyLeaf<T> const &leaf, Leaves &out)
+{
+  out[I] = leaf.tensor_;
+}
+
+template <typename T, std::size_t I, typename Op, typename E, typename Leaves>
+void lazy_leaves(LazyUnary<Op, E> const &node, Leaves &out)
+{
+  lazy_leaves<T, I>(node.arg_, out);
+}
+
+template <typename T, std::size_t I, typename Op, typename L, typename R,
+          typename Leaves>
+void lazy_leaves(LazyBinary<Op, L, R> const &node, Leaves &out)
+{
+  lazy_leaves<T, I>(node.lhs_, out);
+  lazy_leaves<T, I + L::leaves>(node.rhs_, out);
+}
+
+template <LazyExpression E>
+TensorImpl<typename E::value_type> materialize(E const &expr)
+{
+  using T = typename E::value_type;
+  constexpr std::size_t N = E::leaves;
+
+  std::array<TensorImpl<T> const *, N> leaves;
+  lazy_leaves<T, 0>(expr, leaves);
+
+  // Broadcast shape of all the leaves, aligned at the last dimension.
+  std::vector<std::uint32_t> shape;
+  for (auto const *leaf : leaves)
+  {
+    auto const &s = leaf->shape_;
+    if (s.size() > shape.size())
+    {
+      shape.insert(shape.begin(), s.size() - shape.size(), 1);
+    }
+
+    std::size_t lead = shape.size() - s.size();
+    for (std::size_t d{}; d < s.size(); ++d)
+    {
+      auto &dim = shape[lead + d];
+      if (s[d] != dim && s[d] != 1 && dim != 1)
+      {
+        throw std::invalid_argument("Broadcast not compatible");
+      }
+      if (s[d] != 1)
+      {
+        dim = s[d];
+      }
+    }
+  }
+
+  TensorImpl<T> result(shape, uninitialized);
+
+  std::vector<TensorImpl<T>> views;
+  std::array<std::vector<std::uint32_t>, N + 1> strides;
+  strides[0] = result.stride_;
+  for (std::size_t i{}; i < N; ++i)
+  {
+    views.push_back(leaves[i]->expand(shape));
+    strides[i + 1] = views[i].stride_;
+  }
+
+  TensorIterator<N + 1> iter(shape, strides);
+  T *out = result.data_ptr();
+
+  iter.for_each(
+      [&](auto const &offset, auto const &stride, std::size_t n)
+      {
+        LazyTile<T, N, E::nodes> tile;
+
+        for (std::size_t begin{}; begin < n; begin += kLazyTile)
+        {
+          tile.n_ = std::min(kLazyTile, n - begin);
+          for (std::size_t i{}; i < N; ++i)
+          {
+            tile.stride_[i] = stride[i + 1];
+            tile.leaf_[i] =
+                views[i].data_ptr() + offset[i + 1] + begin * stride[i + 1];
+          }
+
+          T *dst = out + offset[0] + begin * stride[0];
+          bool direct = stride[0] == 1;
+
+          auto root = lazy_tile<0, 0>(expr, tile,
+                                      direct ? dst
+                                             : tile.scratch_[E::nodes - 1]);
+
+          if (direct && root.data_ == dst && !root.scalar_)
+          {
+            continue;
+          }
+          for (std::size_t i{}; i < tile.n_; ++i)
+          {
+            dst[i * stride[0]] = root.data_[root.scalar_ ? 0 : i];
+          }
+        }
+      });
+
+  return result;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "ops.hpp"
 #include "tensor.hpp"
 
@@ -10,22 +12,36 @@ template <typename T> struct MSELoss
     auto pred = lhs.impl();
     auto targ = rhs.impl();
     auto loss = result.impl();
-    T N = static_cast<T>(pred->data_->size());
 
-    auto error = std::inner_product(pred->data_->begin(), pred->data_->end(),
-                                    targ->data_->begin(), static_cast<T>(0),
-                                    std::plus<T>(), [](T const &p, T const &t)
-                                    { return (p - t) * (p - t); });
+    // Either operand may be a strided view; the kernels want dense data.
+    auto pd = pred->contiguous();
+    auto td = targ->contiguous();
+    T N = static_cast<T>(pd.numel());
+
+    auto mean_error = [N](TensorImpl<T> const &p, TensorImpl<T> const &t)
+    {
+      auto error = parallel_reduce(
+          0, p.numel(), kGrainSize, static_cast<T>(0),
+          [&](std::size_t begin, std::size_t end)
+          {
+            return simd::squared_distance(p.data_ptr() + begin,
+                                          t.data_ptr() + begin, end - begin);
+          },
+          std::plus<T>());
+      return error / N;
+    };
 
-    (*loss->data_)[0] = error / N;
+    loss->data_ptr()[0] = mean_error(pd, td);
 
-    if (pred->requires_grad_ || targ->requires_grad_)
+    if (records_grad(*pred, *targ))
     {
       loss->requires_grad_ = true;
       loss->parents_ = {pred, targ};
 
-      loss->backward_ = [pred, targ, loss, N]()
+      loss->backward_ = [pred = pred.get(), targ = targ.get(), pd, td, N]()
       {
+        T scale = static_cast<T>(2) / N;
+
         if (pred->requires_grad_)
         {
           if (!pred->grad_)
@@ -33,14 +49,15 @@ template <typename T> struct MSELoss
             pred->grad_ = std::make_shared<TensorImpl<T>>(pred->shape_);
             pred->grad_->fill(static_cast<T>(0));
           }
-          auto pg = pred->grad_->data_->begin();
-          auto pd = pred->data_->begin();
-          auto td = targ->data_->begin();
+          T *pg = pred->grad_->data_ptr();
 
-          for (; pg != pred->grad_->data_->end(); ++pg, ++pd, ++td)
-          {
-            *pg += (*pd - *td) * static_cast<T>(2) / N;
-          }
+          parallel_for(0, pd.numel(), kGrainSize,
+                       [&](std::size_t begin, std::size_t end)
+                       {
+                         simd::diff_axpy(pg + begin, scale,
+                                         pd.data_ptr() + begin,
+                                         td.data_ptr() + begin, end - begin);
+                       });
         }
 
         if (targ->requires_grad_)
@@ -50,18 +67,40 @@ template <typename T> struct MSELoss
             targ->grad_ = std::make_shared<TensorImpl<T>>(targ->shape_);
           }
 
-          auto tg = targ->grad_->data_->begin();
-          auto pd = pred->data_->begin();
-          auto td = targ->data_->begin();
+          T *tg = targ->grad_->data_ptr();
 
-          for (; tg != targ->grad_->data_->end(); ++tg, ++pd, ++td)
-          {
-            *tg += (*td - *pd) * static_cast<T>(2) / N;
-          }
+          parallel_for(0, td.numel(), kGrainSize,
+                       [&](std::size_t begin, std::size_t end)
+                       {
+                         simd::diff_axpy(tg + begin, scale,
+                                         td.data_ptr() + begin,
+                                         pd.data_ptr() + begin, end - begin);
+                       });
         }
       };
     }
 
+    // Dense copies of strided operands share storage with the ones the
+    // backward reads, so refreshing them here serves both.
+    capture_node(
+        *loss,
+        [l = loss.get(), p = pred.get(), t = targ.get(), pd, td,
+         mean_error]() mutable
+        {
+          auto identity = [](T const &a) { return a; };
+          if (pd.data_ != p->data_)
+          {
+            TensorImpl<T>::unary_kernel(pd, *p, identity);
+          }
+          if (td.data_ != t->data_)
+          {
+            TensorImpl<T>::unary_kernel(td, *t, identity);
+          }
+          l->data_ptr()[0] = mean_error(pd, td);
+        },
+        pred, targ);
+    save_for_backward(*loss, {pred.get(), targ.get()});
+
     return result;
   }
 };
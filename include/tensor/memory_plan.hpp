@@ -0,0 +1,76 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <numeric>
+#include <vector>
+
+//
+// A buffer to be placed in an arena: size_ elements, in use from step
+// first_ through step last_ inclusive. assign_offsets fills in offset_.
+//
+struct BufferLifetime
+{
+  std::size_t size_;
+  std::size_t first_;
+  std::size_t last_;
+  std::size_t offset_{0};
+
+  bool overlaps(BufferLifetime const &other) const
+  {
+    return first_ <= other.last_ && other.first_ <= last_;
+  }
+};
+
+//
+// Places buffers so that any two in use at the same step occupy disjoint
+// ranges, and returns the arena size. Greedy by size: largest buffers go
+// first, each at the lowest offset that fits between the buffers already
+// placed whose lifetimes overlap its own. Sizes should be multiples of the
+// alignment every offset needs.
+//
+inline std::size_t assign_offsets(std::vector<BufferLifetime> &buffers)
+{
+  std::vector<std::size_t> order(buffers.size());
+  std::iota(order.begin(), order.end(), std::size_t{0});
+  std::stable_sort(order.begin(), order.end(),
+                   [&](std::size_t a, std::size_t b)
+                   { return buffers[a].size_ > buffers[b].size_; });
+
+  std::vector<std::size_t> placed;
+  std::vector<BufferLifetime const *> live;
+  std::size_t arena = 0;
+
+  for (auto i : order)
+  {
+    auto &buffer = buffers[i];
+
+    live.clear();
+    for (auto j : placed)
+    {
+      if (buffers[j].overlaps(buffer))
+      {
+        live.push_back(&buffers[j]);
+      }
+    }
+    std::sort(live.begin(), live.end(),
+              [](auto const *a, auto const *b)
+              { return a->offset_ < b->offset_; });
+
+    std::size_t offset = 0;
+    for (auto const *other : live)
+    {
+      if (other->offset_ >= offset + buffer.size_)
+      {
+        break;
+      }
+      offset = std::max(offset, other->offset_ + other->size_);
+    }
+
+    buffer.offset_ = offset;
+    arena = std::max(arena, offset + buffer.size_);
+    placed.push_back(i);
+  }
+
+  return arena;
+}
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//
+// Storage for a graph node's edges and closures. Nearly every op has at
+// most three inputs and a backward capturing a few pointers, so both are
+// kept inside the node instead of in heap blocks of their own: building a
+// node then allocates only its TensorImpl and its elements.
+//
+
+//
+// A vector whose first N elements live inline; it moves to the heap only
+// once it grows past them.
+//
+template <typename E, std::size_t N> class SmallVector
+{
+public:
+  SmallVector() = default;
+
+  SmallVector(std::initializer_list<E> items)
+  {
+    assign(items.begin(), items.end());
+  }
+
+  SmallVector(SmallVector const &other)
+  {
+    assign(other.begin(), other.end());
+  }
+
+  SmallVector(SmallVector &&other) noexcept { take(other); }
+
+  SmallVector &operator=(SmallVector const &other)
+  {
+    if (this != &other)
+    {
+      assign(other.begin(), other.end());
+    }
+    return *this;
+  }
+
+  SmallVector &operator=(SmallVector &&other) noexcept
+  {
+    if (this != &other)
+    {
+      clear();
+      take(other);
+    }
+    return *this;
+  }
+
+  SmallVector &operator=(std::initializer_list<E> items)
+  {
+    assign(items.begin(), items.end());
+    return *this;
+  }
+
+  template <typename It> void assign(It first, It last)
+  {
+    clear();
+    for (; first != last; ++first)
+    {
+      push_back(*first);
+    }
+  }
+
+  void push_back(E item)
+  {
+    if (size_ < N)
+    {
+      inline_[size_++] = std::move(item);
+      return;
+    }
+
+    if (size_ == N)
+    {
+      heap_.reserve(2 * N);
+      heap_.assign(std::make_move_iterator(inline_.begin()),
+                   std::make_move_iterator(inline_.end()));
+    }
+    heap_.push_back(std::move(item));
+    ++size_;
+  }
+
+  void clear()
+  {
+    for (std::size_t i{}; i < std::min(size_, N); ++i)
+    {
+      inline_[i] = E{};
+    }
+    heap_.clear();
+    size_ = 0;
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  E *begin() { return size_ > N ? heap_.data() : inline_.data(); }
+  E *end() { return begin() + size_; }
+  E const *begin() const { return size_ > N ? heap_.data() : inline_.data(); }
+  E const *end() const { return begin() + size_; }
+
+  E &operator[](std::size_t i) { return begin()[i]; }
+  E const &operator[](std::size_t i) const { return begin()[i]; }
+
+private:
+  // Leaves other empty.
+  void take(SmallVector &other)
+  {
+    if (other.size_ > N)
+    {
+      heap_ = std::move(other.heap_);
+    }
+    else
+    {
+      std::move(other.inline_.begin(), other.inline_.begin() + other.size_,
+                inline_.begin());
+    }
+    size_ = std::exchange(other.size_, 0);
+    other.clear();
+  }
+
+  std::array<E, N> inline_{};
+  std::vector<E> heap_;
+  std::size_t size_{0};
+};
+
+//
+// A copyable void() callable, like std::function, but holding closures of
+// up to kInline bytes inline rather than the two pointers std::function
+// keeps before it allocates. Larger ones go to the heap.
+//
+class NodeFunction
+{
+public:
+  static constexpr std::size_t kInline = 64;
+
+  NodeFunction() = default;
+  NodeFunction(std::nullptr_t) {}
+
+  template <typename F>
+    requires(!std::same_as<std::decay_t<F>, NodeFunction> &&
+             !std::same_as<std::decay_t<F>, std::nullptr_t> &&
+             std::invocable<std::decay_t<F> &>)
+  NodeFunction(F &&f)
+  {
+    using Fn = std::decay_t<F>;
+
+    if constexpr (fits_inline<Fn>())
+    {
+      ::new (buffer_) Fn(std::forward<F>(f));
+      ops_ = &kInlineOps<Fn>;
+    }
+    else
+    {
+      ::new (buffer_) Fn *(new Fn(std::forward<F>(f)));
+      ops_ = &kHeapOps<Fn>;
+    }
+  }
+
+  NodeFunction(NodeFunction const &other) : ops_{other.ops_}
+  {
+    if (ops_)
+    {
+      ops_->copy(buffer_, other.buffer_);
+    }
+  }
+
+  NodeFunction(NodeFunction &&other) noexcept : ops_{other.ops_}
+  {
+    if (ops_)
+    {
+      ops_->move(buffer_, other.buffer_);
+      other.ops_ = nullptr;
+    }
+  }
+
+  NodeFunction &operator=(NodeFunction const &other)
+  {
+    if (this != &other)
+    {
+      NodeFunction copy(other);
+      *this = std::move(copy);
+    }
+    return *this;
+  }
+
+  NodeFunction &operator=(NodeFunction &&other) noexcept
+  {
+    if (this != &other)
+    {
+      reset();
+      ops_ = std::exchange(other.ops_, nullptr);
+      if (ops_)
+      {
+        ops_->move(buffer_, other.buffer_);
+      }
+    }
+    return *this;
+  }
+
+  NodeFunction &operator=(std::nullptr_t)
+  {
+    reset();
+    return *this;
+  }
+
+  ~NodeFunction() { reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  void operator()() { ops_->call(buffer_); }
+
+private:
+  // Moving out of a buffer also destroys what it held.
+  struct Ops
+  {
+    void (*call)(void *);
+    void (*copy)(void *, void const *);
+    void (*move)(void *, void *);
+    void (*destroy)(void *);
+  };
+
+  template <typename Fn> static constexpr bool fits_inline()
+  {
+    return sizeof(Fn) <= kInline &&
+           alignof(Fn) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible_v<Fn>;
+  }
+
+  template <typename Fn>
+  static constexpr Ops kInlineOps{
+      [](void *f) { (*static_cast<Fn *>(f))(); },
+      [](void *dst, void const *src)
+      { ::new (dst) Fn(*static_cast<Fn const *>(src)); },
+      [](void *dst, void *src)
+      {
+        ::new (dst) Fn(std::move(*static_cast<Fn *>(src)));
+        static_cast<Fn *>(src)->~Fn();
+      },
+      [](void *f) { static_cast<Fn *>(f)->~Fn(); }};
+
+  template <typename Fn>
+  static constexpr Ops kHeapOps{
+      [](void *f) { (**static_cast<Fn **>(f))(); },
+      [](void *dst, void const *src)
+      { ::new (dst) Fn *(new Fn(**static_cast<Fn *const *>(src))); },
+      [](void *dst, void *src) { ::new (dst) Fn *(*static_cast<Fn **>(src)); },
+      [](void *f) { delete *static_cast<Fn **>(f); }};
+
+  void reset()
+  {
+    if (ops_)
+    {
+      std::exchange(ops_, nullptr)->destroy(buffer_);
+    }
+  }
+
+  alignas(std::max_align_t) unsigned char buffer_[kInline];
+  Ops const *ops_{nullptr};
+};
@@ -1,48 +1,131 @@
 #pragma once
 
+#include "grad_mode.hpp"
+#include "graph.hpp"
 #include "tensor.hpp"
 
+//
+// Adds g, summed down to t's shape where the forward broadcast t, into t's
+// gradient, negated for the subtrahend of sub. A first gradient gets a
+// buffer of its own: g belongs to another node and may still be
+// accumulated into.
+//
+template <typename T>
+void accumulate_grad(TensorImpl<T> &t, TensorImpl<T> const &g,
+                     bool negate = false)
+{
+  auto reduced = g.sum_to(t.shape_);
+
+  if (t.grad_)
+  {
+    if (negate)
+    {
+      *t.grad_ -= reduced;
+    }
+    else
+    {
+      *t.grad_ += reduced;
+    }
+  }
+  else if (negate)
+  {
+    t.grad_ = std::make_shared<TensorImpl<T>>(-reduced);
+  }
+  else if (reduced.data_ != g.data_)
+  {
+    t.grad_ = std::make_shared<TensorImpl<T>>(reduced);
+  }
+  else
+  {
+    t.grad_ = std::make_shared<TensorImpl<T>>(reduced.clone());
+  }
+}
+
+//
+// Under StaticGraph::capture, links res to its inputs even when none of
+// them requires grad, and gives it forward, which recomputes res in place
+// when the graph is replayed. Views pass nullptr: they share their input's
+// storage.
+//
+template <typename T, typename Forward, typename... Inputs>
+void capture_node(TensorImpl<T> &res, Forward forward,
+                  Inputs const &...inputs)
+{
+  if (!capturing_graph())
+  {
+    return;
+  }
+
+  if (res.parents_.empty())
+  {
+    res.parents_ = {inputs...};
+  }
+  res.forward_ = std::move(forward);
+}
+
+// Under capture, records the tensors whose elements res's backward reads.
+template <typename T>
+void save_for_backward(TensorImpl<T> &res,
+                       std::initializer_list<TensorImpl<T> *> saved)
+{
+  if (capturing_graph())
+  {
+    res.saved_ = saved;
+  }
+}
+
+//
+// Under capture, lets an elementwise op whose result has input's shape
+// write it over input when nothing reads input afterwards.
+//
+template <typename T>
+void allow_in_place(TensorImpl<T> &res, TensorImpl<T> &input)
+{
+  if (capturing_graph() && input.shape_ == res.shape_)
+  {
+    res.in_place_input_ = &input;
+  }
+}
+
 template <typename T> Tensor<T> add(Tensor<T> const &lhs, Tensor<T> const &rhs)
 {
   Tensor<T> result(*lhs.impl() + *rhs.impl());
 
-  if (lhs.impl()->requires_grad_ || rhs.impl()->requires_grad_)
+  // The node owns its closures, so they refer to it, and through parents_
+  // to its inputs, without owning them.
+  auto *res = result.impl().get();
+  auto *a = lhs.impl().get();
+  auto *b = rhs.impl().get();
+
+  if (records_grad(*a, *b))
   {
-    result.impl()->requires_grad_ = true;
-    result.impl()->parents_ = {lhs.impl(), rhs.impl()};
+    res->requires_grad_ = true;
+    res->parents_ = {lhs.impl(), rhs.impl()};
 
-    result.impl()->backward_ = [result, lhs, rhs]()
+    res->backward_ = [res, a, b]()
     {
-      if (!result.impl()->grad_)
+      if (!res->grad_)
         return;
 
-      if (lhs.impl()->requires_grad_)
+      if (a->requires_grad_)
       {
-        if (lhs.impl()->grad_)
-        {
-          *(lhs.impl()->grad_) += *(result.impl()->grad_);
-        }
-        else
-        {
-          lhs.impl()->grad_ =
-              std::make_shared<TensorImpl<T>>(*(result.impl()->grad_));
-        }
+        accumulate_grad(*a, *res->grad_);
       }
 
-      if (rhs.impl()->requires_grad_)
+      if (b->requires_grad_)
       {
-        if (rhs.impl()->grad_)
-        {
-          *(rhs.impl()->grad_) += *(result.impl()->grad_);
-        }
-        else
-        {
-          rhs.impl()->grad_ =
-              std::make_shared<TensorImpl<T>>(*(result.impl()->grad_));
-        }
+        accumulate_grad(*b, *res->grad_);
       }
     };
   }
+
+  capture_node(
+      *res,
+      [res, a, b]()
+      { TensorImpl<T>::binary_kernel(*res, *a, *b, simd::Plus<T>{}); },
+      lhs.impl(), rhs.impl());
+  allow_in_place(*res, *a);
+
   return result;
 }
 
@@ -50,149 +133,701 @@ template <typename T> Tensor<T> sub(Tensor<T> const &lhs, Tensor<T> const &rhs)
 {
   Tensor<T> result(*lhs.impl() - *rhs.impl());
 
-  if (lhs.impl()->requires_grad_ || rhs.impl()->requires_grad_)
+  auto *res = result.impl().get();
+  auto *a = lhs.impl().get();
+  auto *b = rhs.impl().get();
+
+  if (records_grad(*a, *b))
   {
-    result.impl()->requires_grad_ = true;
-    result.impl()->parents_ = {lhs.impl(), rhs.impl()};
+    res->requires_grad_ = true;
+    res->parents_ = {lhs.impl(), rhs.impl()};
 
-    result.impl()->backward_ = [result, lhs, rhs]()
+    res->backward_ = [res, a, b]()
     {
-      if (!result.impl()->grad_)
+      if (!res->grad_)
         return;
 
-      if (lhs.impl()->requires_grad_)
+      if (a->requires_grad_)
       {
-        if (lhs.impl()->grad_)
-        {
-          *(lhs.impl()->grad_) += *(result.impl()->grad_);
-        }
-        else
-        {
-          lhs.impl()->grad_ =
-              std::make_shared<TensorImpl<T>>(*(result.impl()->grad_));
-        }
+        accumulate_grad(*a, *res->grad_);
       }
 
-      if (rhs.impl()->requires_grad_)
+      if (b->requires_grad_)
       {
-        if (rhs.impl()->grad_)
-        {
-          *(rhs.impl()->grad_) -= *(result.impl()->grad_);
-        }
-        else
-        {
-          rhs.impl()->grad_ =
-              std::make_shared<TensorImpl<T>>(-(*(result.impl()->grad_)));
-        }
+        accumulate_grad(*b, *res->grad_, true);
       }
     };
   }
+
+  capture_node(
+      *res,
+      [res, a, b]()
+      { TensorImpl<T>::binary_kernel(*res, *a, *b, simd::Minus<T>{}); },
+      lhs.impl(), rhs.impl());
+  allow_in_place(*res, *a);
+
+  return result;
+}
+
+//
+// Wraps a view of inp (see TensorImpl's view ops) in a Tensor. The view
+// shares inp's storage; backward calls accumulate(inp_grad, result_grad) to
+// route the result's gradient back onto the input's layout. Reductions, and
+// view ops that had to copy, use it as well with a result that has storage
+// of its own; they pass forward(out), which recomputes that result into out
+// for a captured graph.
+//
+template <typename T, typename Accumulate, typename Forward = std::nullptr_t>
+Tensor<T> view_op(Tensor<T> const &input, TensorImpl<T> view,
+                  Accumulate accumulate, Forward forward = nullptr)
+{
+  auto inp = input.impl();
+
+  Tensor<T> result(std::move(view));
+
+  auto *res = result.impl().get();
+
+  if (capturing_graph())
+  {
+    NodeFunction recompute;
+    if constexpr (!std::is_null_pointer_v<Forward>)
+    {
+      if (res->data_ != inp->data_)
+      {
+        recompute = [res, forward]() { forward(*res); };
+      }
+    }
+    capture_node(*res, std::move(recompute), inp);
+  }
+
+  if (records_grad(*inp))
+  {
+    res->requires_grad_ = true;
+    res->parents_ = {inp};
+    res->backward_ = [res, src = inp.get(), accumulate]()
+    {
+      if (!res->grad_)
+        return;
+
+      if (!src->grad_)
+      {
+        src->grad_ = std::make_shared<TensorImpl<T>>(src->shape_);
+      }
+
+      accumulate(*src->grad_, *res->grad_);
+    };
+  }
+
   return result;
 }
 
 template <typename T>
 Tensor<T> transpose(Tensor<T> const &inp, std::size_t dimA, std::size_t dimB)
 {
-  Tensor<T> result(inp.impl()->transpose(dimA, dimB));
+  return view_op(inp, inp.impl()->transpose(dimA, dimB),
+                 [dimA, dimB](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.transpose(dimA, dimB); });
+}
 
-  if (inp.impl()->requires_grad_)
+template <typename T>
+Tensor<T> permute(Tensor<T> const &inp, std::vector<std::uint32_t> const &dims)
+{
+  std::vector<std::uint32_t> inverse(dims.size());
+  for (std::size_t d{}; d < dims.size() && dims[d] < dims.size(); ++d)
   {
-    result.impl()->requires_grad_ = true;
-    result.impl()->parents_ = {inp.impl()};
+    inverse[dims[d]] = d;
+  }
+
+  return view_op(inp, inp.impl()->permute(dims),
+                 [inverse](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.permute(inverse); });
+}
+
+template <typename T>
+Tensor<T> view(Tensor<T> const &inp, std::vector<std::uint32_t> const &shape)
+{
+  return view_op(inp, inp.impl()->view(shape),
+                 [](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.reshape(grad.shape_); });
+}
+
+template <typename T>
+Tensor<T> reshape(Tensor<T> const &inp,
+                  std::vector<std::uint32_t> const &shape)
+{
+  auto *src = inp.impl().get();
 
-    result.impl()->backward_ = [result, inp, dimA, dimB]()
+  return view_op(inp, inp.impl()->reshape(shape),
+                 [](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.reshape(grad.shape_); },
+                 [src](TensorImpl<T> &out)
+                 {
+                   auto dst = out.view(src->shape_);
+                   TensorImpl<T>::unary_kernel(dst, *src,
+                                               [](T const &a) { return a; });
+                 });
+}
+
+template <typename T>
+Tensor<T> slice(Tensor<T> const &inp, std::uint32_t dim, std::uint32_t start,
+                std::uint32_t end, std::uint32_t step = 1)
+{
+  return view_op(inp, inp.impl()->slice(dim, start, end, step),
+                 [=](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 {
+                   auto window = grad.slice(dim, start, end, step);
+                   window += g;
+                 });
+}
+
+template <typename T>
+Tensor<T> narrow(Tensor<T> const &inp, std::uint32_t dim, std::uint32_t start,
+                 std::uint32_t length)
+{
+  return slice(inp, dim, start, start + length);
+}
+
+template <typename T>
+Tensor<T> expand(Tensor<T> const &inp, std::vector<std::uint32_t> const &shape)
+{
+  return view_op(inp, inp.impl()->expand(shape),
+                 [](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad.add_reduced(g); });
+}
+
+template <typename T> Tensor<T> squeeze(Tensor<T> const &inp)
+{
+  return view_op(inp, inp.impl()->squeeze(),
+                 [](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.view(grad.shape_); });
+}
+
+template <typename T> Tensor<T> unsqueeze(Tensor<T> const &inp,
+                                          std::uint32_t dim)
+{
+  return view_op(inp, inp.impl()->unsqueeze(dim),
+                 [](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.view(grad.shape_); });
+}
+
+template <typename T> Tensor<T> contiguous(Tensor<T> const &inp)
+{
+  auto *src = inp.impl().get();
+
+  return view_op(inp, inp.impl()->contiguous(),
+                 [](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g; },
+                 [src](TensorImpl<T> &out)
+                 {
+                   TensorImpl<T>::unary_kernel(out, *src,
+                                               [](T const &a) { return a; });
+                 });
+}
+
+//
+// Batched over leading dimensions as in TensorImpl::matmul. An operand that
+// was broadcast along some batch dimensions gets its gradient summed over
+// them; one that spans the whole batch accumulates straight into its
+// gradient.
+//
+template <typename T>
+Tensor<T> matmul(Tensor<T> const &lhs, Tensor<T> const &rhs)
+{
+  Tensor<T> result(lhs.impl()->matmul(*rhs.impl()));
+
+  auto *res = result.impl().get();
+  auto *pa = lhs.impl().get();
+  auto *pb = rhs.impl().get();
+
+  if (records_grad(*pa, *pb))
+  {
+    res->requires_grad_ = true;
+    res->parents_ = {lhs.impl(), rhs.impl()};
+
+    res->backward_ = [res, pa, pb]()
     {
-      if (inp.impl()->grad_)
+      if (!res->grad_)
+        return;
+
+      auto &a = *pa;
+      auto &b = *pb;
+      auto const &g = *res->grad_;
+
+      auto spans_batch = [&](TensorImpl<T> const &t)
+      {
+        return t.shape_.size() == g.shape_.size() &&
+               std::equal(t.shape_.begin(), t.shape_.end() - 2,
+                          g.shape_.begin());
+      };
+
+      auto transposed = [](TensorImpl<T> const &t)
       {
-        *(inp.impl()->grad_) += result.impl()->grad_->transpose(dimA, dimB);
+        auto d = static_cast<std::uint32_t>(t.shape_.size());
+        return t.transpose(d - 2, d - 1);
+      };
+
+      if (a.requires_grad_)
+      {
+        if (!a.grad_)
+        {
+          a.grad_ = std::make_shared<TensorImpl<T>>(a.shape_);
+        }
+
+        // dA += dC * B^T
+        if (spans_batch(a))
+        {
+          a.grad_->addmm(g, b, false, true);
+        }
+        else
+        {
+          a.grad_->add_reduced(g.matmul(transposed(b)));
+        }
       }
-      else
+
+      if (b.requires_grad_)
       {
-        inp.impl()->grad_ = std::make_shared<TensorImpl<T>>(
-            result.impl()->grad_->transpose(dimA, dimB));
+        if (!b.grad_)
+        {
+          b.grad_ = std::make_shared<TensorImpl<T>>(b.shape_);
+        }
+
+        // dB += A^T * dC
+        if (spans_batch(b))
+        {
+          b.grad_->addmm(a, g, true, false);
+        }
+        else
+        {
+          b.grad_->add_reduced(transposed(a).matmul(g));
+        }
       }
     };
   }
+
+  capture_node(
+      *res,
+      [res, pa, pb]()
+      { TensorImpl<T>::batched_gemm(*pa, *pb, false, false, T{}, *res); },
+      lhs.impl(), rhs.impl());
+  save_for_backward(*res, {pa, pb});
+
   return result;
 }
 
+//
+// Fused fully connected layer, act(input * weight + bias), with weight laid
+// out in x out as in matmul(input, weight). The forward applies the bias
+// and activation in the GEMM epilogue; the backward is one graph node that
+// masks the incoming gradient once and produces dX, dW and db from it.
+//
 template <typename T>
-Tensor<T> matmul(Tensor<T> const &lhs, Tensor<T> const &rhs)
+Tensor<T> linear_impl(Tensor<T> const &input, Tensor<T> const &weight,
+                      Tensor<T> const &bias, bool relu)
 {
-  Tensor<T> result(lhs.impl()->matmul(*rhs.impl()));
+  auto x = input.impl();
+  auto w = weight.impl();
+  auto b = bias.impl();
+
+  Tensor<T> result(x->linear(*w, *b, relu));
 
-  if (lhs.impl()->requires_grad_ || rhs.impl()->requires_grad_)
+  auto *res = result.impl().get();
+
+  if (records_grad(*x, *w, *b))
   {
-    result.impl()->requires_grad_ = true;
-    result.impl()->parents_ = {lhs.impl(), rhs.impl()};
+    res->requires_grad_ = true;
+    res->parents_ = {x, w, b};
 
-    result.impl()->backward_ = [result, lhs, rhs]()
+    // scratch holds the masked gradient between calls, so that a replayed
+    // graph reuses it; it is replaced once the bias has taken it over.
+    res->backward_ = [res, relu, x = x.get(), w = w.get(), b = b.get(),
+                      scratch = std::shared_ptr<TensorImpl<T>>()]() mutable
     {
-      if (!result.impl()->grad_)
+      if (!res->grad_)
         return;
 
-      if (lhs.impl()->requires_grad_)
+      // Gradient at the pre-activation: relu passes it where the output is
+      // positive, which is where its input was.
+      auto masked = res->grad_;
+      if (relu)
       {
-        if (lhs.impl()->grad_)
+        if (!scratch || scratch == b->grad_)
         {
-          *(lhs.impl()->grad_) +=
-              result.impl()->grad_->matmul(rhs.impl()->transpose(0, 1));
+          scratch = std::make_shared<TensorImpl<T>>(res->shape_);
         }
         else
         {
-          lhs.impl()->grad_ = std::make_shared<TensorImpl<T>>(
-              result.impl()->grad_->matmul(rhs.impl()->transpose(0, 1)));
+          scratch->fill(static_cast<T>(0));
         }
+
+        masked = scratch;
+        parallel_for(0, masked->numel(), kGrainSize,
+                     [&](std::size_t begin, std::size_t end)
+                     {
+                       simd::relu_backward(masked->data_ptr() + begin,
+                                           res->data_ptr() + begin,
+                                           res->grad_->data_ptr() + begin,
+                                           end - begin);
+                     });
       }
 
-      if (rhs.impl()->requires_grad_)
+      auto grad_of = [](TensorImpl<T> *t)
       {
-        if (rhs.impl()->grad_)
+        if (!t->grad_)
         {
-          *(rhs.impl()->grad_) +=
-              lhs.impl()->transpose(0, 1).matmul(*result.impl()->grad_);
+          t->grad_ = std::make_shared<TensorImpl<T>>(t->shape_);
+        }
+        return t->grad_;
+      };
+
+      // dX += dY * W^T
+      if (x->requires_grad_)
+      {
+        grad_of(x)->addmm(*masked, *w, false, true);
+      }
+
+      // dW += X^T * dY
+      if (w->requires_grad_)
+      {
+        grad_of(w)->addmm(*x, *masked, true, false);
+      }
+
+      // db += dY summed over the rows the bias was broadcast along. A
+      // full-size bias seeing its first gradient can take over the masked
+      // buffer, which nothing else refers to.
+      if (b->requires_grad_)
+      {
+        if (relu && !b->grad_ && b->shape_ == masked->shape_)
+        {
+          b->grad_ = masked;
         }
         else
         {
-          rhs.impl()->grad_ = std::make_shared<TensorImpl<T>>(
-              lhs.impl()->transpose(0, 1).matmul(*result.impl()->grad_));
+          grad_of(b)->add_reduced(*masked);
         }
       }
     };
   }
+
+  capture_node(
+      *res,
+      [res, relu, px = x.get(), pw = w.get(), pb = b.get()]()
+      { TensorImpl<T>::linear_kernel(*px, *pw, *pb, relu, *res); },
+      x, w, b);
+  if (relu)
+  {
+    save_for_backward(*res, {x.get(), w.get(), res});
+  }
+  else
+  {
+    save_for_backward(*res, {x.get(), w.get()});
+  }
+
   return result;
 }
 
+template <typename T>
+Tensor<T> linear(Tensor<T> const &input, Tensor<T> const &weight,
+                 Tensor<T> const &bias)
+{
+  return linear_impl(input, weight, bias, false);
+}
+
+template <typename T>
+Tensor<T> linear_relu(Tensor<T> const &input, Tensor<T> const &weight,
+                      Tensor<T> const &bias)
+{
+  return linear_impl(input, weight, bias, true);
+}
+
 template <typename T> Tensor<T> relu(Tensor<T> const &input)
 {
   auto inp = input.impl();
 
   Tensor<T> result(inp->relu());
 
-  auto res = result.impl();
+  auto *res = result.impl().get();
 
-  if (inp->requires_grad_)
+  if (records_grad(*inp))
   {
     res->requires_grad_ = true;
     res->parents_ = {inp};
-    res->backward_ = [=]()
+    res->backward_ = [res, src = inp.get()]()
     {
       if (!res->grad_)
         return;
 
-      if (!inp->grad_)
+      if (!src->grad_)
       {
-        inp->grad_ = std::make_shared<TensorImpl<T>>(inp->shape_);
+        src->grad_ = std::make_shared<TensorImpl<T>>(src->shape_);
       }
 
-      for (std::size_t i{}; i < inp->grad_->data_->size(); ++i)
+      // The output is positive exactly where the input was, and unlike the
+      // input it is dense and may not have been overwritten (see
+      // allow_in_place).
+      parallel_for(0, res->numel(), kGrainSize,
+                   [&](std::size_t begin, std::size_t end)
+                   {
+                     simd::relu_backward(src->grad_->data_ptr() + begin,
+                                         res->data_ptr() + begin,
+                                         res->grad_->data_ptr() + begin,
+                                         end - begin);
+                   });
+    };
+  }
+
+  capture_node(
+      *res,
+      [res, src = inp.get()]()
+      { TensorImpl<T>::unary_kernel(*res, *src, simd::Relu<T>{}); },
+      inp);
+  save_for_backward(*res, {res});
+  allow_in_place(*res, *inp);
+
+  return result;
+}
+
+//
+// Reductions over axes (see TensorImpl::sum). Their gradients broadcast the
+// result's gradient back over the reduced dimensions, which keep is the
+// result's shape with those dimensions left in place at size 1.
+//
+
+// Forward for view_op that reruns reduce on inp and copies it into out.
+template <typename T, typename Reduce>
+auto rerun_reduction(TensorImpl<T> const *inp, Reduce reduce)
+{
+  return [inp, reduce](TensorImpl<T> &out)
+  {
+    TensorImpl<T>::unary_kernel(out, reduce(*inp),
+                                [](T const &a) { return a; });
+  };
+}
+
+template <typename T>
+Tensor<T> sum(Tensor<T> const &inp, std::vector<std::uint32_t> const &axes = {},
+              bool keepdim = false)
+{
+  auto keep = inp.impl()->reduced_shape(axes, true);
+
+  return view_op(inp, inp.impl()->sum(axes, keepdim),
+                 [keep](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.reshape(keep); },
+                 rerun_reduction(inp.impl().get(),
+                                 [axes, keepdim](TensorImpl<T> const &x)
+                                 { return x.sum(axes, keepdim); }));
+}
+
+template <typename T>
+Tensor<T> mean(Tensor<T> const &inp,
+               std::vector<std::uint32_t> const &axes = {},
+               bool keepdim = false)
+{
+  auto keep = inp.impl()->reduced_shape(axes, true);
+  T scale = static_cast<T>(1) /
+            static_cast<T>(inp.impl()->reduced_count(axes));
+
+  return view_op(inp, inp.impl()->mean(axes, keepdim),
+                 [keep, scale](TensorImpl<T> &grad, TensorImpl<T> const &g)
+                 { grad += g.reshape(keep) * scale; },
+                 rerun_reduction(inp.impl().get(),
+                                 [axes, keepdim](TensorImpl<T> const &x)
+                                 { return x.mean(axes, keepdim); }));
+}
+
+//
+// Max and min send each output's gradient to the inputs equal to it,
+// split evenly between ties.
+//
+template <typename T, typename Reduce>
+Tensor<T> extremum_op(Tensor<T> const &input, Reduce reduce,
+                      std::vector<std::uint32_t> const &axes)
+{
+  auto inp = input.impl();
+  auto keep = inp->reduced_shape(axes, true);
+  auto out = reduce(*inp);
+
+  auto result = view_op(
+      input, out,
+      [inp = inp.get(), out, keep, axes](TensorImpl<T> &grad,
+                                         TensorImpl<T> const &g)
       {
-        (*inp->grad_->data_)[i] +=
-            (((*inp->data_)[i] > 0) ? (*res->grad_->data_)[i]
-                                    : static_cast<T>(0));
+        TensorImpl<T> hits(inp->shape_, uninitialized);
+        TensorImpl<T>::binary_kernel(hits, *inp, out.reshape(keep),
+                                     [](T const &x, T const &m)
+                                     { return static_cast<T>(x == m); });
+
+        auto share = hits.sum(axes, true);
+        TensorImpl<T>::binary_kernel(share, g.reshape(keep), share,
+                                     [](T const &a, T const &n)
+                                     { return a / n; });
+
+        TensorImpl<T>::binary_kernel(hits, hits, share,
+                                     [](T const &h, T const &s)
+                                     { return h * s; });
+        grad += hits;
+      },
+      rerun_reduction(inp.get(), reduce));
+
+  save_for_backward(*result.impl(), {inp.get(), result.impl().get()});
+  return result;
+}
+
+template <typename T>
+Tensor<T> max(Tensor<T> const &inp, std::vector<std::uint32_t> const &axes = {},
+              bool keepdim = false)
+{
+  return extremum_op(
+      inp,
+      [axes, keepdim](TensorImpl<T> const &x) { return x.max(axes, keepdim); },
+      axes);
+}
+
+template <typename T>
+Tensor<T> min(Tensor<T> const &inp, std::vector<std::uint32_t> const &axes = {},
+              bool keepdim = false)
+{
+  return extremum_op(
+      inp,
+      [axes, keepdim](TensorImpl<T> const &x) { return x.min(axes, keepdim); },
+      axes);
+}
+
+//
+// The gradient of a product with respect to one factor is the product of
+// the others, built from prefix and suffix products along each lane so
+// that zero factors need no division.
+//
+template <typename T>
+Tensor<T> prod(Tensor<T> const &input,
+               std::vector<std::uint32_t> const &axes = {},
+               bool keepdim = false)
+{
+  auto inp = input.impl();
+  auto keep = inp->reduced_shape(axes, true);
+
+  // Kept dimensions first, reduced ones last, so each lane is contiguous.
+  std::vector<std::uint32_t> order;
+  for (int reduced = 0; reduced < 2; ++reduced)
+  {
+    for (std::uint32_t d{}; d < inp->shape_.size(); ++d)
+    {
+      if ((keep[d] != inp->shape_[d]) == static_cast<bool>(reduced))
+      {
+        order.push_back(d);
       }
-    };
+    }
   }
 
+  std::vector<std::uint32_t> inverse(order.size());
+  for (std::size_t d{}; d < order.size(); ++d)
+  {
+    inverse[order[d]] = d;
+  }
+
+  std::size_t R = inp->reduced_count(axes);
+
+  auto result = view_op(
+      input, inp->prod(axes, keepdim),
+      [inp = inp.get(), order, inverse, R](TensorImpl<T> &grad,
+                                           TensorImpl<T> const &g)
+      {
+        if (R == 0)
+        {
+          return;
+        }
+
+        auto x = inp->permute(order).contiguous();
+        auto gd = g.contiguous();
+        TensorImpl<T> dx(x.shape_, uninitialized);
+
+        T const *xs = x.data_ptr();
+        T const *gs = gd.data_ptr();
+        T *out = dx.data_ptr();
+
+        parallel_for(0, x.numel() / R, std::max<std::size_t>(1, kGrainSize / R),
+                     [&](std::size_t lo, std::size_t hi)
+                     {
+                       for (std::size_t lane = lo; lane < hi; ++lane)
+                       {
+                         T const *a = xs + lane * R;
+                         T *o = out + lane * R;
+
+                         T acc = gs[lane];
+                         for (std::size_t r{}; r < R; ++r)
+                         {
+                           o[r] = acc;
+                           acc *= a[r];
+                         }
+
+                         acc = static_cast<T>(1);
+                         for (std::size_t r = R; r-- > 0;)
+                         {
+                           o[r] *= acc;
+                           acc *= a[r];
+                         }
+                       }
+                     });
+
+        grad += dx.permute(inverse);
+      },
+      rerun_reduction(inp.get(), [axes, keepdim](TensorImpl<T> const &x)
+                      { return x.prod(axes, keepdim); }));
+
+  save_for_backward(*result.impl(), {inp.get()});
+  return result;
+}
+
+// d|x|/dx = x / |x|, taken as 0 where the norm is 0.
+template <typename T>
+Tensor<T> norm(Tensor<T> const &input,
+               std::vector<std::uint32_t> const &axes = {},
+               bool keepdim = false)
+{
+  auto inp = input.impl();
+  auto keep = inp->reduced_shape(axes, true);
+  auto out = inp->norm(axes, keepdim);
+
+  auto result = view_op(
+      input, out,
+      [inp = inp.get(), out, keep](TensorImpl<T> &grad, TensorImpl<T> const &g)
+      {
+        TensorImpl<T> share(keep, uninitialized);
+        TensorImpl<T>::binary_kernel(share, g.reshape(keep), out.reshape(keep),
+                                     [](T const &a, T const &n)
+                                     { return (n == 0) ? T{} : a / n; });
+
+        TensorImpl<T> dx(inp->shape_, uninitialized);
+        TensorImpl<T>::binary_kernel(dx, *inp, share,
+                                     [](T const &x, T const &s)
+                                     { return x * s; });
+        grad += dx;
+      },
+      rerun_reduction(inp.get(), [axes, keepdim](TensorImpl<T> const &x)
+                      { return x.norm(axes, keepdim); }));
+
+  save_for_backward(*result.impl(), {inp.get(), result.impl().get()});
   return result;
 }
+
+// Not differentiable; the result never requires grad.
+template <typename T>
+Tensor<std::int64_t> argmax(Tensor<T> const &inp, std::uint32_t axis,
+                            bool keepdim = false)
+{
+  return Tensor<std::int64_t>(inp.impl()->argmax(axis, keepdim));
+}
+
+template <typename T> Tensor<std::int64_t> argmax(Tensor<T> const &inp)
+{
+  return Tensor<std::int64_t>(inp.impl()->argmax());
+}
+
+//
+// Converts to element type U, e.g. to<bf16>(weights). A graph holds a
+// single element type, so the result starts a new graph instead of
+// extending the input's.
+//
+template <typename U, typename T> Tensor<U> to(Tensor<T> const &input)
+{
+  return Tensor<U>(input.impl()->template to<U>());
+}
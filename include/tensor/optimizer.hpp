@@ -0,0 +1,155 @@
+#pragma once
+
+#include "tensor.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <utility>
+#include <vector>
+
+//
+// What SGD, Adam and AdamW share: the parameters, their per-element state
+// and a multi-tensor apply.
+//
+// State is allocated, zeroed, when the optimizer is built: each kind (a
+// velocity, a moment) is one Storage holding every parameter's elements
+// back to back, so a step allocates nothing. It is kept in
+// accumulate_t<T>, float for the 16-bit formats, which only the
+// parameters themselves are rounded to. A step runs one fused kernel
+// over all parameters that have a gradient in a single parallel pass. The
+// parameters are cut into runs of at most kGrainSize elements, and the
+// pool splits the list of runs, so that small and large tensors balance
+// across threads together.
+//
+template <typename T> class Optimizer
+{
+public:
+  // Zeroes every gradient in place: backward accumulates into the same
+  // buffers next time instead of allocating them again.
+  void zero_grad()
+  {
+    for (auto const &param : params_)
+    {
+      if (auto const &grad = param.impl()->grad_)
+      {
+        grad->fill(static_cast<T>(0));
+      }
+    }
+  }
+
+  // Drops every gradient.
+  void reset_grad()
+  {
+    for (auto const &param : params_)
+    {
+      param.impl()->grad_ = nullptr;
+    }
+  }
+
+  std::vector<Tensor<T>> const &params() const { return params_; }
+
+protected:
+  Optimizer(std::vector<Tensor<T>> const &params, std::size_t states)
+      : params_{params}
+  {
+    std::size_t total = 0;
+    for (auto const &param : params_)
+    {
+      offsets_.push_back(total);
+      total += param.impl()->numel();
+    }
+
+    for (std::size_t k{}; k < states; ++k)
+    {
+      state_.emplace_back(total);
+    }
+  }
+
+  // State k of the element at offset in the flattened parameters.
+  accumulate_t<T> *state(std::size_t k, std::size_t offset)
+  {
+    return state_[k].data() + offset;
+  }
+
+  //
+  // Calls kernel(i, p, g, offset, n) on every run of n dense elements of
+  // parameter i that has a gradient, p and g pointing at the run and
+  // offset being its first element's in the flattened parameters. A
+  // strided parameter or gradient is updated through a dense copy.
+  //
+  template <typename Kernel> void apply(Kernel const &kernel)
+  {
+    runs_.clear();
+
+    std::size_t total = 0;
+    for (std::size_t i{}; i < params_.size(); ++i)
+    {
+      auto *p = params_[i].impl().get();
+      if (!p->grad_)
+      {
+        continue;
+      }
+
+      T *data = p->data_ptr();
+      if (!p->is_contiguous())
+      {
+        copies_.push_back(p->contiguous());
+        write_back_.emplace_back(p, &copies_.back());
+        data = copies_.back().data_ptr();
+      }
+
+      T const *grad = p->grad_->data_ptr();
+      if (!p->grad_->is_contiguous())
+      {
+        copies_.push_back(p->grad_->contiguous());
+        grad = copies_.back().data_ptr();
+      }
+
+      std::size_t n = p->numel();
+      for (std::size_t begin{}; begin < n; begin += kGrainSize)
+      {
+        runs_.push_back({i, data + begin, grad + begin, offsets_[i] + begin,
+                         std::min(kGrainSize, n - begin)});
+      }
+      total += n;
+    }
+
+    parallel_for(0, runs_.size(), total > kGrainSize ? 1 : runs_.size(),
+                 [&](std::size_t lo, std::size_t hi)
+                 {
+                   for (std::size_t r = lo; r < hi; ++r)
+                   {
+                     auto const &run = runs_[r];
+                     kernel(run.param_, run.data_, run.grad_, run.offset_,
+                            run.n_);
+                   }
+                 });
+
+    for (auto [p, copy] : write_back_)
+    {
+      TensorImpl<T>::unary_kernel(*p, *copy, [](T const &a) { return a; });
+    }
+    write_back_.clear();
+    copies_.clear();
+  }
+
+  std::vector<Tensor<T>> params_;
+
+private:
+  struct Run
+  {
+    std::size_t param_;
+    T *data_;
+    T const *grad_;
+    std::size_t offset_;
+    std::size_t n_;
+  };
+
+  std::vector<std::size_t> offsets_;
+  std::vector<Storage<accumulate_t<T>>> state_;
+  // Reused from step to step, like runs_: even an empty deque allocates.
+  std::vector<Run> runs_;
+  std::deque<TensorImpl<T>> copies_;
+  std::vector<std::pair<TensorImpl<T> *, TensorImpl<T> *>> write_back_;
+};
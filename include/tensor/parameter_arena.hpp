@@ -0,0 +1,128 @@
+#pragma once
+
+#include "tensor.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+//
+// A model's parameters back to back in one aligned buffer, and their
+// gradients in the same layout in a second. Building the arena moves each
+// parameter's storage into the first, values included (tensors sharing it
+// follow, as with StaticGraph::plan), and gives each parameter a zeroed
+// gradient viewing the second. Backward accumulates into those in place,
+// so passes over the whole model (an optimizer step, zeroing, the global
+// gradient norm, writing the weights out) stream over two dense buffers
+// instead of a small block per tensor.
+//
+// flat() is the whole arena as one 1-D parameter with the gradient buffer
+// as its grad_; an optimizer built on {arena.flat()} updates every
+// parameter in one pass. Each parameter starts on a kAllocAlignment
+// boundary; the padding between them stays zero and so does its gradient.
+//
+// Gradients must be zeroed (zero_grad here or in the optimizer) rather than
+// dropped with reset_grad, after which backward would allocate new ones
+// outside the arena.
+//
+template <typename T> class ParameterArena
+{
+public:
+  explicit ParameterArena(std::vector<Tensor<T>> const &params)
+      : params_{params}
+  {
+    std::size_t const align =
+        std::max<std::size_t>(1, kAllocAlignment / sizeof(T));
+
+    std::vector<std::size_t> offsets;
+    std::size_t total = 0;
+    for (auto const &param : params_)
+    {
+      auto const &p = *param.impl();
+      if (p.offset_ != 0 || !p.is_contiguous() ||
+          p.numel() != p.data_->size())
+      {
+        throw std::invalid_argument("Arena parameters must own their "
+                                    "whole storage densely");
+      }
+
+      offsets.push_back(total);
+      total += (p.numel() + align - 1) / align * align;
+    }
+
+    data_ = std::make_shared<Storage<T>>(total);
+    grad_ = std::make_shared<Storage<T>>(total);
+
+    for (std::size_t i{}; i < params_.size(); ++i)
+    {
+      auto &p = *params_[i].impl();
+      std::copy(p.data_->begin(), p.data_->end(), data_->data() + offsets[i]);
+      p.data_->rebind(data_, offsets[i]);
+      p.grad_ = std::make_shared<TensorImpl<T>>(grad_, p.shape_, p.stride_,
+                                                offsets[i]);
+    }
+
+    auto n = static_cast<std::uint32_t>(total);
+    flat_ = Tensor<T>(TensorImpl<T>(data_, {n}, {1}, 0));
+    flat_.impl()->grad_ =
+        std::make_shared<TensorImpl<T>>(TensorImpl<T>(grad_, {n}, {1}, 0));
+  }
+
+  std::vector<Tensor<T>> const &params() const { return params_; }
+  Tensor<T> const &flat() const { return flat_; }
+
+  // Elements in each buffer, padding included.
+  std::size_t size() const { return data_->size(); }
+
+  T *data() { return data_->data(); }
+  T const *data() const { return data_->data(); }
+  T *grad() { return grad_->data(); }
+  T const *grad() const { return grad_->data(); }
+
+  void zero_grad()
+  {
+    parallel_for(0, size(), kGrainSize,
+                 [&](std::size_t lo, std::size_t hi)
+                 { std::fill(grad() + lo, grad() + hi, static_cast<T>(0)); });
+  }
+
+  // L2 norm of all gradients taken together.
+  accumulate_t<T> grad_norm() const
+  {
+    using Acc = accumulate_t<T>;
+    Acc sum = parallel_reduce(
+        0, size(), kGrainSize, static_cast<Acc>(0),
+        [&](std::size_t lo, std::size_t hi)
+        { return simd::sum_squares(grad() + lo, hi - lo); },
+        std::plus<Acc>());
+    return std::sqrt(sum);
+  }
+
+  //
+  // Scales all gradients together so that their norm is at most max_norm,
+  // keeping their direction, and returns the norm they had.
+  //
+  accumulate_t<T> clip_grad_norm(accumulate_t<T> max_norm)
+  {
+    auto norm = grad_norm();
+    if (norm > max_norm)
+    {
+      auto factor = static_cast<T>(max_norm / norm);
+      parallel_for(0, size(), kGrainSize,
+                   [&](std::size_t lo, std::size_t hi)
+                   { simd::scale(grad() + lo, grad() + lo, factor, hi - lo); });
+    }
+    return norm;
+  }
+
+private:
+  std::vector<Tensor<T>> params_;
+  std::shared_ptr<Storage<T>> data_;
+  std::shared_ptr<Storage<T>> grad_;
+  Tensor<T> flat_;
+};
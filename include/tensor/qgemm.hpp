@@ -0,0 +1,574 @@
+#pragma once
+
+#include "gemm.hpp"
+#include "simd.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+//
+// int8 x int8 -> int32 GEMM for quantized inference:
+//
+//   C[M x N] = sum_k (A[i, k] - za) * (B[k, j] - zb[j])
+//
+// blocked and packed like gemm.hpp. The micro-kernels (int8_kernels.hpp)
+// consume k four at a time, the shape of VNNI's vpdpbusd, which multiplies
+// unsigned bytes of A by signed bytes of B and sums each group of four into
+// an int32 lane. A is therefore packed offset by 128 into unsigned bytes and
+// every instruction set computes the same exact sum of a' * b; the offset
+// and the zero points are folded back in afterwards from row and column
+// sums:
+//
+//   sum (a - za)(b - zb) = sum a'b - (za + 128) colsum(b) - zb rowsum(a)
+//                          + K za zb
+//
+// Without VNNI the bytes are widened to 16 bits and multiplied with
+// pmaddwd, which is exact where pmaddubsw would saturate. Sums stay exact
+// for K up to 65536.
+//
+namespace simd
+{
+
+enum class Int8Level
+{
+  Scalar,
+  AVX2,
+  AVX512BW,
+  AVX512VNNI
+};
+
+// The int8 kernels available, capped by the active float level so that
+// set_level() and TENSOR_SIMD lower both together.
+inline Int8Level int8_level()
+{
+#if TENSOR_SIMD_X86
+  static Int8Level const detected = []()
+  {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw"))
+    {
+      return __builtin_cpu_supports("avx512vnni") ? Int8Level::AVX512VNNI
+                                                  : Int8Level::AVX512BW;
+    }
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return Int8Level::AVX2;
+    }
+    return Int8Level::Scalar;
+  }();
+
+  switch (level())
+  {
+  case Level::AVX512:
+    return detected;
+  case Level::AVX2:
+    return std::min(detected, Int8Level::AVX2);
+  default:
+    return Int8Level::Scalar;
+  }
+#else
+  return Int8Level::Scalar;
+#endif
+}
+
+namespace scalar
+{
+
+struct Dot4
+{
+  struct operand
+  {
+    std::int32_t v[4];
+  };
+
+  using reg = std::int32_t;
+  using a_operand = operand;
+  using b_operand = operand;
+  static constexpr std::size_t width = 1;
+
+  static reg zero() { return 0; }
+  static reg load(std::int32_t const *p) { return *p; }
+  static void store(std::int32_t *p, reg v) { *p = v; }
+  static reg add(reg a, reg b) { return a + b; }
+  static operand broadcast_a(std::uint8_t const *p)
+  {
+    return {{p[0], p[1], p[2], p[3]}};
+  }
+  static operand load_b(std::int8_t const *p)
+  {
+    return {{p[0], p[1], p[2], p[3]}};
+  }
+  static reg dot4(reg acc, operand a, operand b)
+  {
+    return acc + a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2] +
+           a.v[3] * b.v[3];
+  }
+};
+
+#include "int8_kernels.hpp"
+
+} // namespace scalar
+
+#if TENSOR_SIMD_X86
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))),        \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+namespace avx2
+{
+
+struct Dot4
+{
+  // Even and odd bytes of each 16-bit lane, widened to 16 bits.
+  struct operand
+  {
+    __m256i even;
+    __m256i odd;
+  };
+
+  using reg = __m256i;
+  using a_operand = operand;
+  using b_operand = operand;
+  static constexpr std::size_t width = 8;
+
+  static reg zero() { return _mm256_setzero_si256(); }
+  static reg load(std::int32_t const *p)
+  {
+    return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+  }
+  static void store(std::int32_t *p, reg v)
+  {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+  }
+  static reg add(reg a, reg b) { return _mm256_add_epi32(a, b); }
+  static operand broadcast_a(std::uint8_t const *p)
+  {
+    std::int32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    reg x = _mm256_set1_epi32(word);
+    return {_mm256_and_si256(x, _mm256_set1_epi16(0x00FF)),
+            _mm256_srli_epi16(x, 8)};
+  }
+  static operand load_b(std::int8_t const *p)
+  {
+    reg x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+    return {_mm256_srai_epi16(_mm256_slli_epi16(x, 8), 8),
+            _mm256_srai_epi16(x, 8)};
+  }
+  static reg dot4(reg acc, operand a, operand b)
+  {
+    return _mm256_add_epi32(
+        acc, _mm256_add_epi32(_mm256_madd_epi16(a.even, b.even),
+                              _mm256_madd_epi16(a.odd, b.odd)));
+  }
+};
+
+#include "int8_kernels.hpp"
+
+} // namespace avx2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(                                                 \
+    __attribute__((target("avx512f,avx512bw"))), apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#endif
+
+namespace avx512bw
+{
+
+// As avx2::Dot4 at twice the width. Masked shifts for the same GCC 12
+// warning as avx512::Vec<bf16>.
+struct Dot4
+{
+  struct operand
+  {
+    __m512i even;
+    __m512i odd;
+  };
+
+  using reg = __m512i;
+  using a_operand = operand;
+  using b_operand = operand;
+  static constexpr std::size_t width = 16;
+
+  static reg zero() { return _mm512_setzero_si512(); }
+  static reg load(std::int32_t const *p) { return _mm512_loadu_si512(p); }
+  static void store(std::int32_t *p, reg v) { _mm512_storeu_si512(p, v); }
+  static reg add(reg a, reg b) { return _mm512_add_epi32(a, b); }
+  static operand broadcast_a(std::uint8_t const *p)
+  {
+    std::int32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    reg x = _mm512_set1_epi32(word);
+    return {_mm512_and_si512(x, _mm512_set1_epi16(0x00FF)),
+            _mm512_maskz_srli_epi16(~0u, x, 8)};
+  }
+  static operand load_b(std::int8_t const *p)
+  {
+    reg x = _mm512_loadu_si512(p);
+    return {_mm512_maskz_srai_epi16(~0u, _mm512_maskz_slli_epi16(~0u, x, 8),
+                                    8),
+            _mm512_maskz_srai_epi16(~0u, x, 8)};
+  }
+  static reg dot4(reg acc, operand a, operand b)
+  {
+    return _mm512_add_epi32(
+        acc, _mm512_add_epi32(_mm512_madd_epi16(a.even, b.even),
+                              _mm512_madd_epi16(a.odd, b.odd)));
+  }
+};
+
+#include "int8_kernels.hpp"
+
+} // namespace avx512bw
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(                                                 \
+    __attribute__((target("avx512f,avx512bw,avx512vnni"))),                    \
+    apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vnni")
+#endif
+
+namespace avx512vnni
+{
+
+struct Dot4
+{
+  using reg = __m512i;
+  using a_operand = __m512i;
+  using b_operand = __m512i;
+  static constexpr std::size_t width = 16;
+
+  static reg zero() { return _mm512_setzero_si512(); }
+  static reg load(std::int32_t const *p) { return _mm512_loadu_si512(p); }
+  static void store(std::int32_t *p, reg v) { _mm512_storeu_si512(p, v); }
+  static reg add(reg a, reg b) { return _mm512_add_epi32(a, b); }
+  static reg broadcast_a(std::uint8_t const *p)
+  {
+    std::int32_t word;
+    std::memcpy(&word, p, sizeof(word));
+    return _mm512_set1_epi32(word);
+  }
+  static reg load_b(std::int8_t const *p) { return _mm512_loadu_si512(p); }
+  static reg dot4(reg acc, reg a, reg b)
+  {
+    return _mm512_dpbusd_epi32(acc, a, b);
+  }
+};
+
+#include "int8_kernels.hpp"
+
+} // namespace avx512vnni
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+} // namespace simd
+
+//
+// Register tile and cache blocking for one int8 kernel. KC counts bytes of
+// k and is a multiple of four, so only the last K block has a partial
+// group.
+//
+template <std::size_t MR_, std::size_t NR_> struct QGemmBlocking
+{
+  static constexpr std::size_t MR = MR_;
+  static constexpr std::size_t NR = NR_;
+  static constexpr std::size_t KC = 512;
+  static constexpr std::size_t MC = 96;
+  static constexpr std::size_t NC = 4096;
+};
+
+//
+// Packs rows [0, mc) x cols [0, kc) of A into MR-row micro-panels of
+// unsigned bytes a + 128, laid out group-major with the four k of a group
+// adjacent. Padding rows and k read as a = 0.
+//
+template <std::size_t MR>
+void qgemm_pack_a(std::size_t mc, std::size_t kc, std::int8_t const *a,
+                  std::size_t rs_a, std::size_t cs_a, std::uint8_t *packed)
+{
+  for (std::size_t ir{}; ir < mc; ir += MR)
+  {
+    std::size_t mr = std::min(MR, mc - ir);
+
+    for (std::size_t p{}; p < kc; p += 4)
+    {
+      for (std::size_t i{}; i < MR; ++i)
+      {
+        for (std::size_t q{}; q < 4; ++q)
+        {
+          bool live = i < mr && p + q < kc;
+          std::int32_t v = live ? a[(ir + i) * rs_a + (p + q) * cs_a] : 0;
+          packed[i * 4 + q] = static_cast<std::uint8_t>(v + 128);
+        }
+      }
+      packed += MR * 4;
+    }
+  }
+}
+
+//
+// Packs rows [0, kc) x cols [0, nc) of B into NR-column micro-panels laid
+// out like qgemm_pack_a's, padding with zeros.
+//
+template <std::size_t NR>
+void qgemm_pack_b(std::size_t kc, std::size_t nc, std::int8_t const *b,
+                  std::size_t rs_b, std::size_t cs_b, std::int8_t *packed)
+{
+  for (std::size_t jr{}; jr < nc; jr += NR)
+  {
+    std::size_t nr = std::min(NR, nc - jr);
+
+    for (std::size_t p{}; p < kc; p += 4)
+    {
+      for (std::size_t j{}; j < NR; ++j)
+      {
+        for (std::size_t q{}; q < 4; ++q)
+        {
+          bool live = j < nr && p + q < kc;
+          packed[j * 4 + q] =
+              live ? b[(p + q) * rs_b + (jr + j) * cs_b] : std::int8_t{};
+        }
+      }
+      packed += NR * 4;
+    }
+  }
+}
+
+//
+// C = A' * B over all of K, with A' the offset A, through one instruction
+// set's micro-kernel. Same loop structure and threading as gemm_blocked.
+//
+template <typename Blk, auto Kernel>
+void qgemm_blocked(std::size_t M, std::size_t N, std::size_t K,
+                   std::int8_t const *a, std::size_t rs_a, std::size_t cs_a,
+                   std::int8_t const *b, std::size_t rs_b, std::size_t cs_b,
+                   std::int32_t *c, std::size_t ldc)
+{
+  std::size_t threads =
+      (M * N * K >= kGemmParallelWork) ? get_num_threads() : 1;
+  std::size_t ic_blocks = (M + Blk::MC - 1) / Blk::MC;
+
+  Storage<std::uint8_t> packed_a(Blk::MC * Blk::KC, uninitialized);
+  Storage<std::int8_t> packed_b(
+      std::min(Blk::NC, (N + Blk::NR - 1) / Blk::NR * Blk::NR) * Blk::KC,
+      uninitialized);
+
+  auto macro_kernel = [&](std::size_t mc, std::size_t nc, std::size_t kg,
+                          std::size_t jr_begin, std::size_t jr_end,
+                          std::uint8_t const *pa, std::int32_t *c_block,
+                          bool accumulate)
+  {
+    for (std::size_t panel = jr_begin; panel < jr_end; ++panel)
+    {
+      std::size_t jr = panel * Blk::NR;
+
+      for (std::size_t ir{}; ir < mc; ir += Blk::MR)
+      {
+        Kernel(kg, pa + ir * kg * 4, packed_b.data() + jr * kg * 4,
+               c_block + ir * ldc + jr, ldc, accumulate,
+               std::min(Blk::MR, mc - ir), std::min(Blk::NR, nc - jr));
+      }
+    }
+  };
+
+  for (std::size_t jc{}; jc < N; jc += Blk::NC)
+  {
+    std::size_t nc = std::min(Blk::NC, N - jc);
+    std::size_t panels = (nc + Blk::NR - 1) / Blk::NR;
+
+    for (std::size_t pc{}; pc < K; pc += Blk::KC)
+    {
+      std::size_t kc = std::min(Blk::KC, K - pc);
+      std::size_t kg = (kc + 3) / 4;
+      bool accumulate = pc > 0;
+      std::int8_t const *b_block = b + pc * rs_b + jc * cs_b;
+
+      parallel_for(0, panels, (threads > 1) ? 1 : panels,
+                   [&](std::size_t lo, std::size_t hi)
+                   {
+                     std::size_t j = lo * Blk::NR;
+                     qgemm_pack_b<Blk::NR>(
+                         kc, std::min(hi * Blk::NR, nc) - j,
+                         b_block + j * cs_b, rs_b, cs_b,
+                         packed_b.data() + j * kg * 4);
+                   });
+
+      if (threads > 1 && ic_blocks >= threads)
+      {
+        parallel_for(0, ic_blocks, 1,
+                     [&](std::size_t lo, std::size_t hi)
+                     {
+                       thread_local std::vector<std::uint8_t> local_a;
+                       local_a.resize(Blk::MC * Blk::KC);
+
+                       for (std::size_t blk = lo; blk < hi; ++blk)
+                       {
+                         std::size_t ic = blk * Blk::MC;
+                         std::size_t mc = std::min(Blk::MC, M - ic);
+
+                         qgemm_pack_a<Blk::MR>(mc, kc,
+                                               a + ic * rs_a + pc * cs_a,
+                                               rs_a, cs_a, local_a.data());
+                         macro_kernel(mc, nc, kg, 0, panels, local_a.data(),
+                                      c + ic * ldc + jc, accumulate);
+                       }
+                     });
+        continue;
+      }
+
+      for (std::size_t ic{}; ic < M; ic += Blk::MC)
+      {
+        std::size_t mc = std::min(Blk::MC, M - ic);
+
+        qgemm_pack_a<Blk::MR>(mc, kc, a + ic * rs_a + pc * cs_a, rs_a, cs_a,
+                              packed_a.data());
+
+        parallel_for(0, panels, (threads > 1) ? 1 : panels,
+                     [&](std::size_t lo, std::size_t hi)
+                     {
+                       macro_kernel(mc, nc, kg, lo, hi, packed_a.data(),
+                                    c + ic * ldc + jc, accumulate);
+                     });
+      }
+    }
+  }
+}
+
+//
+// Int32 C[M x N] (row stride ldc) = (A - za) * (B - zb), with zb a zero
+// point per column of B, or nullptr for all zero.
+//
+inline void qgemm(std::size_t M, std::size_t N, std::size_t K,
+                  std::int8_t const *a, std::size_t rs_a, std::size_t cs_a,
+                  std::int32_t za, std::int8_t const *b, std::size_t rs_b,
+                  std::size_t cs_b, std::int32_t const *zb, std::int32_t *c,
+                  std::size_t ldc)
+{
+  if (M == 0 || N == 0)
+  {
+    return;
+  }
+
+  if (K == 0 || M * N * K <= kGemmSmallWork)
+  {
+    for (std::size_t i{}; i < M; ++i)
+    {
+      for (std::size_t j{}; j < N; ++j)
+      {
+        std::int32_t zero_b = zb ? zb[j] : 0;
+        std::int32_t acc{};
+        for (std::size_t k{}; k < K; ++k)
+        {
+          acc += (a[i * rs_a + k * cs_a] - za) *
+                 (b[k * rs_b + j * cs_b] - zero_b);
+        }
+        c[i * ldc + j] = acc;
+      }
+    }
+    return;
+  }
+
+  switch (simd::int8_level())
+  {
+#if TENSOR_SIMD_X86
+  case simd::Int8Level::AVX512VNNI:
+  {
+    using Blk = QGemmBlocking<8, 32>;
+    qgemm_blocked<Blk, simd::avx512vnni::int8_micro_kernel<
+                           simd::avx512vnni::Dot4, Blk::MR, Blk::NR>>(
+        M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, c, ldc);
+    break;
+  }
+  case simd::Int8Level::AVX512BW:
+  {
+    using Blk = QGemmBlocking<6, 32>;
+    qgemm_blocked<Blk, simd::avx512bw::int8_micro_kernel<
+                           simd::avx512bw::Dot4, Blk::MR, Blk::NR>>(
+        M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, c, ldc);
+    break;
+  }
+  case simd::Int8Level::AVX2:
+  {
+    using Blk = QGemmBlocking<4, 16>;
+    qgemm_blocked<Blk, simd::avx2::int8_micro_kernel<simd::avx2::Dot4,
+                                                     Blk::MR, Blk::NR>>(
+        M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, c, ldc);
+    break;
+  }
+#endif
+  default:
+  {
+    using Blk = QGemmBlocking<4, 8>;
+    qgemm_blocked<Blk, simd::scalar::int8_micro_kernel<simd::scalar::Dot4,
+                                                       Blk::MR, Blk::NR>>(
+        M, N, K, a, rs_a, cs_a, b, rs_b, cs_b, c, ldc);
+    break;
+  }
+  }
+
+  // Fold the offset and zero points back in.
+  std::vector<std::int32_t> col_sum(N);
+  for (std::size_t k{}; k < K; ++k)
+  {
+    for (std::size_t j{}; j < N; ++j)
+    {
+      col_sum[j] += b[k * rs_b + j * cs_b];
+    }
+  }
+
+  auto K32 = static_cast<std::int32_t>(K);
+  std::vector<std::int32_t> col_term(N);
+  for (std::size_t j{}; j < N; ++j)
+  {
+    std::int32_t zero_b = zb ? zb[j] : 0;
+    col_term[j] = K32 * za * zero_b - (za + 128) * col_sum[j];
+  }
+
+  parallel_for(0, M, std::max<std::size_t>(1, kGrainSize / (N + K)),
+               [&](std::size_t lo, std::size_t hi)
+               {
+                 for (std::size_t i = lo; i < hi; ++i)
+                 {
+                   std::int32_t row_sum{};
+                   if (zb)
+                   {
+                     for (std::size_t k{}; k < K; ++k)
+                     {
+                       row_sum += a[i * rs_a + k * cs_a];
+                     }
+                   }
+
+                   std::int32_t *row = c + i * ldc;
+                   for (std::size_t j{}; j < N; ++j)
+                   {
+                     row[j] += col_term[j] - (zb ? zb[j] * row_sum : 0);
+                   }
+                 }
+               });
+}
@@ -0,0 +1,356 @@
+#pragma once
+
+#include "qgemm.hpp"
+#include "tensor.hpp"
+#include "tensor_impl.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+//
+// Affine int8 quantization, real = scale * (q - zero_point), with a single
+// scale and zero point for the whole tensor or one per index along axis_
+// (per channel).
+//
+struct QuantParams
+{
+  std::vector<float> scale_;
+  std::vector<std::int32_t> zero_point_;
+  std::optional<std::uint32_t> axis_;
+
+  //
+  // Parameters covering [lo, hi], widened to include 0 so that zero
+  // padding and relu outputs quantize exactly. Symmetric ranges use
+  // [-127, 127] with a zero point of 0, the form weights take so that the
+  // GEMM needs no row sums of the activations.
+  //
+  static std::pair<float, std::int32_t> choose(float lo, float hi,
+                                               bool symmetric)
+  {
+    lo = std::min(lo, 0.0f);
+    hi = std::max(hi, 0.0f);
+
+    if (symmetric)
+    {
+      float scale = std::max(-lo, hi) / 127.0f;
+      return {(scale > 0) ? scale : 1.0f, 0};
+    }
+
+    float scale = (hi - lo) / 255.0f;
+    if (!(scale > 0))
+    {
+      return {1.0f, 0};
+    }
+
+    auto zero_point =
+        static_cast<std::int32_t>(std::nearbyint(-128.0f - lo / scale));
+    return {scale, std::clamp(zero_point, -128, 127)};
+  }
+};
+
+struct QuantizedTensor
+{
+  TensorImpl<std::int8_t> values_;
+  QuantParams params_;
+
+  std::vector<std::uint32_t> const &shape() const { return values_.shape_; }
+
+  TensorImpl<float> dequantize() const
+  {
+    auto q = values_.contiguous();
+    TensorImpl<float> result(q.shape_, uninitialized);
+
+    auto layout = channel_layout(q.shape_, params_.axis_);
+    std::size_t channels = layout[1];
+    std::size_t inner = layout[2];
+    std::int8_t const *in = q.data_ptr();
+    float *out = result.data_ptr();
+
+    parallel_for(0, layout[0] * channels,
+                 std::max<std::size_t>(1, kGrainSize / (inner + 1)),
+                 [&](std::size_t lo, std::size_t hi)
+                 {
+                   for (std::size_t run = lo; run < hi; ++run)
+                   {
+                     std::size_t ch = run % channels;
+                     float scale = params_.scale_[ch];
+                     float zero = static_cast<float>(params_.zero_point_[ch]);
+
+                     std::int8_t const *src = in + run * inner;
+                     float *dst = out + run * inner;
+                     std::size_t n = inner;
+
+                     for (std::size_t i{}; i < n; ++i)
+                     {
+                       dst[i] = scale * (static_cast<float>(src[i]) - zero);
+                     }
+                   }
+                 });
+
+    return result;
+  }
+
+  //
+  // A contiguous tensor viewed as [outer, channels, inner] around the
+  // quantization axis; per-tensor parameters have a single channel.
+  //
+  static std::array<std::size_t, 3>
+  channel_layout(std::vector<std::uint32_t> const &shape,
+                 std::optional<std::uint32_t> axis)
+  {
+    std::size_t numel = std::accumulate(shape.begin(), shape.end(),
+                                        std::size_t{1},
+                                        std::multiplies<std::size_t>());
+    if (!axis)
+    {
+      return {1, 1, numel};
+    }
+
+    std::size_t inner = std::accumulate(shape.begin() + *axis + 1,
+                                        shape.end(), std::size_t{1},
+                                        std::multiplies<std::size_t>());
+    std::size_t channels = shape[*axis];
+    return {(channels * inner > 0) ? numel / (channels * inner) : 0, channels,
+            inner};
+  }
+};
+
+inline QuantizedTensor quantize(TensorImpl<float> const &input,
+                                QuantParams params)
+{
+  std::size_t channels = params.axis_ ? 0 : 1;
+  if (params.axis_)
+  {
+    if (*params.axis_ >= input.shape_.size())
+    {
+      throw std::invalid_argument("Quantization axis is out of bounds");
+    }
+    channels = input.shape_[*params.axis_];
+  }
+  if (params.scale_.size() != channels ||
+      params.zero_point_.size() != channels)
+  {
+    throw std::invalid_argument(
+        "Quantization parameters do not match the channel count");
+  }
+
+  auto x = input.contiguous();
+  QuantizedTensor result{
+      TensorImpl<std::int8_t>(x.shape_, uninitialized), std::move(params)};
+
+  auto layout = QuantizedTensor::channel_layout(x.shape_, result.params_.axis_);
+  std::size_t inner = layout[2];
+  float const *in = x.data_ptr();
+  std::int8_t *out = result.values_.data_ptr();
+
+  parallel_for(0, layout[0] * channels,
+               std::max<std::size_t>(1, kGrainSize / (inner + 1)),
+               [&](std::size_t lo, std::size_t hi)
+               {
+                 for (std::size_t run = lo; run < hi; ++run)
+                 {
+                   std::size_t ch = run % channels;
+                   float inv = 1.0f / result.params_.scale_[ch];
+                   auto zero =
+                       static_cast<float>(result.params_.zero_point_[ch]);
+
+                   // Locals only: byte stores may alias anything read
+                   // through a reference, which blocks vectorization.
+                   float const *src = in + run * inner;
+                   std::int8_t *dst = out + run * inner;
+                   std::size_t n = inner;
+
+                   for (std::size_t i{}; i < n; ++i)
+                   {
+                     // Shifted to [0.5, 255.5] so that truncation rounds
+                     // to nearest (halves up), which unlike nearbyint
+                     // vectorizes; the argument order sends NaN to 0.
+                     float v = src[i] * inv + zero + 128.5f;
+                     v = std::min(255.0f, std::max(0.0f, v));
+                     dst[i] = static_cast<std::int8_t>(
+                         static_cast<std::int32_t>(v) - 128);
+                   }
+                 }
+               });
+
+  return result;
+}
+
+//
+// Records the range of the float tensors passed through it, per tensor or
+// per channel along an axis, to calibrate quantization parameters. Calling
+// it returns its argument, so it can wrap a forward op where it stands:
+//
+//   auto h = observer(linear_relu(x, w1, b1));
+//
+class MinMaxObserver
+{
+public:
+  MinMaxObserver() = default;
+
+  explicit MinMaxObserver(std::uint32_t axis) : axis_{axis} {}
+
+  void observe(TensorImpl<float> const &x)
+  {
+    std::vector<std::uint32_t> axes;
+    if (axis_)
+    {
+      if (*axis_ >= x.shape_.size())
+      {
+        throw std::invalid_argument("Observer axis is out of bounds");
+      }
+      for (std::uint32_t d{}; d < x.shape_.size(); ++d)
+      {
+        if (d != *axis_)
+        {
+          axes.push_back(d);
+        }
+      }
+    }
+
+    // Along a tensor's only dimension, each element is its own channel.
+    bool elementwise = axis_ && x.shape_.size() == 1;
+    auto lo = elementwise ? x.contiguous() : x.min(axes);
+    auto hi = elementwise ? x.contiguous() : x.max(axes);
+
+    if (min_.empty())
+    {
+      min_.assign(lo.data_ptr(), lo.data_ptr() + lo.numel());
+      max_.assign(hi.data_ptr(), hi.data_ptr() + hi.numel());
+      return;
+    }
+    if (lo.numel() != min_.size())
+    {
+      throw std::invalid_argument("Observed a different channel count");
+    }
+
+    for (std::size_t c{}; c < min_.size(); ++c)
+    {
+      min_[c] = std::min(min_[c], lo.data_ptr()[c]);
+      max_[c] = std::max(max_[c], hi.data_ptr()[c]);
+    }
+  }
+
+  Tensor<float> operator()(Tensor<float> const &x)
+  {
+    observe(*x.impl());
+    return x;
+  }
+
+  QuantParams params(bool symmetric = false) const
+  {
+    if (min_.empty())
+    {
+      throw std::invalid_argument("Observer has not seen any tensor");
+    }
+
+    QuantParams result{{}, {}, axis_};
+    for (std::size_t c{}; c < min_.size(); ++c)
+    {
+      auto [scale, zero_point] = QuantParams::choose(min_[c], max_[c],
+                                                     symmetric);
+      result.scale_.push_back(scale);
+      result.zero_point_.push_back(zero_point);
+    }
+    return result;
+  }
+
+private:
+  std::optional<std::uint32_t> axis_;
+  std::vector<float> min_;
+  std::vector<float> max_;
+};
+
+// Quantized with parameters chosen from the tensor's own range.
+inline QuantizedTensor quantize(TensorImpl<float> const &input,
+                                std::optional<std::uint32_t> axis = {},
+                                bool symmetric = false)
+{
+  MinMaxObserver observer = axis ? MinMaxObserver(*axis) : MinMaxObserver();
+  observer.observe(input);
+  return quantize(input, observer.params(symmetric));
+}
+
+//
+// Float product of quantized operands: lhs [..., M, K] per tensor, rhs
+// [K, N] per tensor or per output channel (axis 1). Leading dimensions of
+// lhs fold into M as in linear. The int32 result of qgemm is scaled back
+// by the two scales.
+//
+inline Tensor<float> matmul(QuantizedTensor const &lhs,
+                            QuantizedTensor const &rhs)
+{
+  auto const &ls = lhs.shape();
+  auto const &rs = rhs.shape();
+
+  if (ls.size() < 2 || rs.size() != 2 || ls.back() != rs[0])
+  {
+    throw std::invalid_argument("Quantized matmul shapes are incompatible");
+  }
+  if (lhs.params_.axis_ || (rhs.params_.axis_ && *rhs.params_.axis_ != 1))
+  {
+    throw std::invalid_argument(
+        "Quantized matmul needs a per-tensor lhs and a per-tensor or "
+        "per-column rhs");
+  }
+
+  auto a = lhs.values_.contiguous();
+  auto const &b = rhs.values_;
+  std::size_t K = rs[0];
+  std::size_t N = rs[1];
+  std::size_t M = (K > 0) ? a.numel() / K : 0;
+
+  // Column zero points, skipped when all are 0 as for symmetric weights.
+  std::vector<std::int32_t> zb(N, rhs.params_.zero_point_[0]);
+  std::vector<float> scale(N, lhs.params_.scale_[0] * rhs.params_.scale_[0]);
+  if (rhs.params_.axis_)
+  {
+    for (std::size_t j{}; j < N; ++j)
+    {
+      zb[j] = rhs.params_.zero_point_[j];
+      scale[j] = lhs.params_.scale_[0] * rhs.params_.scale_[j];
+    }
+  }
+  bool zero_b = std::all_of(zb.begin(), zb.end(),
+                            [](std::int32_t z) { return z == 0; });
+
+  Storage<std::int32_t> acc(M * N, uninitialized);
+  qgemm(M, N, K, a.data_ptr(), K, 1, lhs.params_.zero_point_[0],
+        b.data_ptr(), b.stride_[0], b.stride_[1],
+        zero_b ? nullptr : zb.data(), acc.data(), N);
+
+  auto shape = ls;
+  shape.back() = rs[1];
+  Tensor<float> result(TensorImpl<float>(shape, uninitialized));
+  float *out = result.impl()->data_ptr();
+
+  parallel_for(0, M, std::max<std::size_t>(1, kGrainSize / N),
+               [&](std::size_t lo, std::size_t hi)
+               {
+                 for (std::size_t i = lo; i < hi; ++i)
+                 {
+                   for (std::size_t j{}; j < N; ++j)
+                   {
+                     out[i * N + j] =
+                         scale[j] * static_cast<float>(acc[i * N + j]);
+                   }
+                 }
+               });
+
+  return result;
+}
+
+// Dynamic quantization: lhs is quantized per tensor from its own range.
+inline Tensor<float> matmul(Tensor<float> const &lhs,
+                            QuantizedTensor const &rhs)
+{
+  return matmul(quantize(*lhs.impl()), rhs);
+}
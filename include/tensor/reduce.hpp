@@ -0,0 +1,248 @@
+#pragma once
+
+#include "simd.hpp"
+#include "storage.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+//
+// Reductions over a contiguous buffer viewed as [outer, R, inner]: out[o, i]
+// combines in[o, r, i] over r. Any set of axes of a contiguous tensor is
+// reduced by repeating this on the innermost run of reduced axes (see
+// TensorImpl::reduce).
+//
+// A reducer provides
+//
+//   identity()               value of an empty reduction
+//   combine(a, b)            merge two partial results
+//   run(a, n)                reduce n contiguous inputs
+//   accumulate(acc, a, n)    acc[i] = combine(acc[i], f(a[i])) for inputs
+//   merge(acc, a, n)         acc[i] = combine(acc[i], a[i]) for partials
+//   Partial                  the reducer for a second pass over partials
+//   pairwise                 whether rows are summed pairwise (see below)
+//
+
+template <typename T> struct SumReducer
+{
+  using Partial = SumReducer;
+  static constexpr bool pairwise = true;
+
+  static T identity() { return T{}; }
+  static T combine(T a, T b) { return a + b; }
+  static T run(T const *a, std::size_t n) { return simd::sum(a, n); }
+  static void accumulate(T *acc, T const *a, std::size_t n)
+  {
+    simd::add(acc, acc, a, n);
+  }
+  static void merge(T *acc, T const *a, std::size_t n)
+  {
+    simd::add(acc, acc, a, n);
+  }
+};
+
+// Sum of squares, the inner part of the 2-norm.
+template <typename T> struct SumSquaresReducer
+{
+  using Partial = SumReducer<T>;
+  static constexpr bool pairwise = true;
+
+  static T identity() { return T{}; }
+  static T combine(T a, T b) { return a + b; }
+  static T run(T const *a, std::size_t n) { return simd::sum_squares(a, n); }
+  static void accumulate(T *acc, T const *a, std::size_t n)
+  {
+    simd::add_squares(acc, a, n);
+  }
+  static void merge(T *acc, T const *a, std::size_t n)
+  {
+    simd::add(acc, acc, a, n);
+  }
+};
+
+template <typename T> struct ProdReducer
+{
+  using Partial = ProdReducer;
+  static constexpr bool pairwise = false;
+
+  static T identity() { return static_cast<T>(1); }
+  static T combine(T a, T b) { return a * b; }
+  static T run(T const *a, std::size_t n)
+  {
+    T acc = identity();
+    for (std::size_t i{}; i < n; ++i)
+    {
+      acc *= a[i];
+    }
+    return acc;
+  }
+  static void accumulate(T *acc, T const *a, std::size_t n)
+  {
+    for (std::size_t i{}; i < n; ++i)
+    {
+      acc[i] *= a[i];
+    }
+  }
+  static void merge(T *acc, T const *a, std::size_t n)
+  {
+    accumulate(acc, a, n);
+  }
+};
+
+template <typename T> struct MaxReducer
+{
+  using Partial = MaxReducer;
+  static constexpr bool pairwise = false;
+
+  static T identity() { return std::numeric_limits<T>::lowest(); }
+  static T combine(T a, T b) { return (a > b) ? a : b; }
+  static T run(T const *a, std::size_t n)
+  {
+    return (n == 0) ? identity() : simd::max_value(a, n);
+  }
+  static void accumulate(T *acc, T const *a, std::size_t n)
+  {
+    simd::maximum(acc, acc, a, n);
+  }
+  static void merge(T *acc, T const *a, std::size_t n)
+  {
+    simd::maximum(acc, acc, a, n);
+  }
+};
+
+template <typename T> struct MinReducer
+{
+  using Partial = MinReducer;
+  static constexpr bool pairwise = false;
+
+  static T identity() { return std::numeric_limits<T>::max(); }
+  static T combine(T a, T b) { return (a < b) ? a : b; }
+  static T run(T const *a, std::size_t n)
+  {
+    return (n == 0) ? identity() : simd::min_value(a, n);
+  }
+  static void accumulate(T *acc, T const *a, std::size_t n)
+  {
+    simd::minimum(acc, acc, a, n);
+  }
+  static void merge(T *acc, T const *a, std::size_t n)
+  {
+    simd::minimum(acc, acc, a, n);
+  }
+};
+
+// Rows of inner elements handled per task when reducing across rows.
+inline constexpr std::size_t kReduceTile = 1024;
+
+// Below this many rows a pairwise reducer accumulates rows directly.
+inline constexpr std::size_t kPairwiseRows = 8;
+
+//
+// acc[0, len) combined with count rows of rows (stride apart). Reducers
+// marked pairwise split the rows in half and merge the halves, keeping the
+// rounding error of long column sums logarithmic in count.
+//
+template <typename Reducer, typename T>
+void reduce_rows(T *acc, T const *rows, std::size_t count, std::size_t stride,
+                 std::size_t len)
+{
+  if (!Reducer::pairwise || count <= kPairwiseRows)
+  {
+    for (std::size_t r{}; r < count; ++r)
+    {
+      Reducer::accumulate(acc, rows + r * stride, len);
+    }
+    return;
+  }
+
+  std::size_t half = count / 2;
+  reduce_rows<Reducer>(acc, rows, half, stride, len);
+
+  Storage<T> upper(len, Reducer::identity());
+  reduce_rows<Reducer>(upper.data(), rows + half * stride, count - half,
+                       stride, len);
+  Reducer::merge(acc, upper.data(), len);
+}
+
+template <typename Reducer, typename T>
+void reduce_lanes(T const *in, T *out, std::size_t outer, std::size_t R,
+                  std::size_t inner)
+{
+  if (inner == 1 && outer == 1)
+  {
+    // One output: split the run and combine the partials in order.
+    out[0] = parallel_reduce(
+        0, R, kGrainSize, Reducer::identity(),
+        [&](std::size_t begin, std::size_t end)
+        { return Reducer::run(in + begin, end - begin); },
+        [](T a, T b) { return Reducer::combine(a, b); });
+    return;
+  }
+
+  if (inner == 1)
+  {
+    // Each output reduces its own contiguous run.
+    parallel_for(0, outer, std::max<std::size_t>(1, kGrainSize / (R + 1)),
+                 [&](std::size_t lo, std::size_t hi)
+                 {
+                   for (std::size_t o = lo; o < hi; ++o)
+                   {
+                     out[o] = Reducer::run(in + o * R, R);
+                   }
+                 });
+    return;
+  }
+
+  // Reduce across rows: each task owns a tile of inner outputs and streams
+  // the R rows above it with vector combines.
+  std::size_t tiles = (inner + kReduceTile - 1) / kReduceTile;
+  std::size_t work = std::max<std::size_t>(1, R * kReduceTile);
+
+  parallel_for(0, outer * tiles, std::max<std::size_t>(1, kGrainSize / work),
+               [&](std::size_t lo, std::size_t hi)
+               {
+                 for (std::size_t item = lo; item < hi; ++item)
+                 {
+                   std::size_t o = item / tiles;
+                   std::size_t i0 = (item % tiles) * kReduceTile;
+                   std::size_t len = std::min(kReduceTile, inner - i0);
+
+                   T *acc = out + o * inner + i0;
+                   std::fill_n(acc, len, Reducer::identity());
+                   reduce_rows<Reducer>(acc, in + o * R * inner + i0, R, inner,
+                                        len);
+                 }
+               });
+}
+
+//
+// Index of the largest element along the middle axis of [outer, R, inner];
+// the first one wins ties.
+//
+template <typename T>
+void argmax_lanes(T const *in, std::int64_t *out, std::size_t outer,
+                  std::size_t R, std::size_t inner)
+{
+  parallel_for(0, outer * inner,
+               std::max<std::size_t>(1, kGrainSize / (R + 1)),
+               [&](std::size_t lo, std::size_t hi)
+               {
+                 for (std::size_t lane = lo; lane < hi; ++lane)
+                 {
+                   T const *p = in + (lane / inner) * R * inner + lane % inner;
+
+                   std::size_t best{};
+                   for (std::size_t r = 1; r < R; ++r)
+                   {
+                     if (p[r * inner] > p[best * inner])
+                     {
+                       best = r;
+                     }
+                   }
+                   out[lane] = static_cast<std::int64_t>(best);
+                 }
+               });
+}
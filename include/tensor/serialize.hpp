@@ -0,0 +1,652 @@
+#pragma once
+
+#include "half.hpp"
+#include "tensor.hpp"
+
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//
+// Tensors on disk in the safetensors format: an 8-byte little-endian
+// header length, a JSON header giving each tensor's name, dtype, shape and
+// byte range, then the elements themselves, row-major and back to back.
+// Files written here load in other safetensors readers and the other way
+// round. Views are written densified, so the format needs no strides or
+// offsets.
+//
+// save_safetensors pads the header with spaces so that the elements start
+// 64-byte aligned. The format forbids gaps between payloads, so the ones
+// after the first are aligned to their element size only.
+//
+// load_safetensors maps the file instead of reading it, and every tensor's
+// Storage borrows its elements straight from the mapping, which stays
+// until the last of them is gone. Loading costs a header parse; pages come
+// in as they are first touched, and processes loading the same file share
+// them in the page cache. The mapping is private: writing to a loaded
+// tensor copies the page it touches and never changes the file.
+//
+
+static_assert(std::endian::native == std::endian::little,
+              "safetensors payloads are little-endian");
+
+template <typename T> constexpr std::string_view safetensors_dtype()
+{
+  if constexpr (std::same_as<T, float>)
+    return "F32";
+  else if constexpr (std::same_as<T, double>)
+    return "F64";
+  else if constexpr (std::same_as<T, bf16>)
+    return "BF16";
+  else if constexpr (std::same_as<T, f16>)
+    return "F16";
+  else if constexpr (std::same_as<T, std::int8_t>)
+    return "I8";
+  else if constexpr (std::same_as<T, std::uint8_t>)
+    return "U8";
+  else if constexpr (std::same_as<T, std::int16_t>)
+    return "I16";
+  else if constexpr (std::same_as<T, std::int32_t>)
+    return "I32";
+  else if constexpr (std::same_as<T, std::int64_t>)
+    return "I64";
+  else
+    static_assert(sizeof(T) == 0, "No safetensors dtype for this type");
+}
+
+// A whole file mapped copy-on-write, unmapped on destruction.
+class MappedFile
+{
+public:
+  explicit MappedFile(std::string const &path)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw std::invalid_argument("Cannot open " + path);
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      ::close(fd);
+      throw std::invalid_argument("Cannot map " + path);
+    }
+
+    size_ = static_cast<std::size_t>(st.st_size);
+    void *data = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                        fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+      throw std::invalid_argument("Cannot map " + path);
+    }
+    data_ = static_cast<unsigned char *>(data);
+  }
+
+  MappedFile(MappedFile const &) = delete;
+  MappedFile &operator=(MappedFile const &) = delete;
+
+  ~MappedFile() { ::munmap(data_, size_); }
+
+  unsigned char *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+private:
+  unsigned char *data_;
+  std::size_t size_;
+};
+
+// One tensor's entry in a safetensors header.
+struct SafetensorsEntry
+{
+  std::string name_;
+  std::string dtype_;
+  std::vector<std::uint64_t> shape_;
+  std::uint64_t begin_;
+  std::uint64_t end_;
+};
+
+//
+// Parses a safetensors header: a JSON object from names to entries. It
+// reads all of JSON that may appear there and skips __metadata__ and
+// fields it does not know.
+//
+class SafetensorsHeader
+{
+public:
+  explicit SafetensorsHeader(std::string_view text) : text_{text} {}
+
+  std::vector<SafetensorsEntry> parse()
+  {
+    std::vector<SafetensorsEntry> entries;
+    object(
+        [&](std::string const &name)
+        {
+          if (name == "__metadata__")
+          {
+            skip();
+            return;
+          }
+
+          SafetensorsEntry entry{name, {}, {}, 0, 0};
+          bool offsets = false;
+          object(
+              [&](std::string const &field)
+              {
+                if (field == "dtype")
+                {
+                  entry.dtype_ = string();
+                }
+                else if (field == "shape")
+                {
+                  entry.shape_ = integers();
+                }
+                else if (field == "data_offsets")
+                {
+                  auto range = integers();
+                  if (range.size() != 2)
+                  {
+                    fail();
+                  }
+                  entry.begin_ = range[0];
+                  entry.end_ = range[1];
+                  offsets = true;
+                }
+                else
+                {
+                  skip();
+                }
+              });
+
+          if (entry.dtype_.empty() || !offsets)
+          {
+            fail();
+          }
+          entries.push_back(std::move(entry));
+        });
+
+    while (pos_ < text_.size() && is_space(text_[pos_]))
+    {
+      ++pos_;
+    }
+    if (pos_ != text_.size())
+    {
+      fail();
+    }
+    return entries;
+  }
+
+private:
+  [[noreturn]] static void fail()
+  {
+    throw std::invalid_argument("Malformed safetensors header");
+  }
+
+  static bool is_space(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  // The next character that is not whitespace, left unconsumed.
+  char peek()
+  {
+    while (pos_ < text_.size() && is_space(text_[pos_]))
+    {
+      ++pos_;
+    }
+    if (pos_ == text_.size())
+    {
+      fail();
+    }
+    return text_[pos_];
+  }
+
+  bool accept(char c)
+  {
+    if (peek() != c)
+    {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  void expect(char c)
+  {
+    if (!accept(c))
+    {
+      fail();
+    }
+  }
+
+  // Calls member(key) with the value of each member next to be read.
+  template <typename Member> void object(Member &&member)
+  {
+    expect('{');
+    if (accept('}'))
+    {
+      return;
+    }
+    do
+    {
+      auto key = string();
+      expect(':');
+      member(key);
+    } while (accept(','));
+    expect('}');
+  }
+
+  std::vector<std::uint64_t> integers()
+  {
+    std::vector<std::uint64_t> values;
+    expect('[');
+    if (accept(']'))
+    {
+      return values;
+    }
+    do
+    {
+      values.push_back(integer());
+    } while (accept(','));
+    expect(']');
+    return values;
+  }
+
+  std::uint64_t integer()
+  {
+    peek();
+    std::uint64_t value = 0;
+    std::size_t start = pos_;
+    for (; pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9';
+         ++pos_)
+    {
+      auto digit = static_cast<std::uint64_t>(text_[pos_] - '0');
+      if (value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10)
+      {
+        fail();
+      }
+      value = value * 10 + digit;
+    }
+    if (pos_ == start)
+    {
+      fail();
+    }
+    return value;
+  }
+
+  std::uint32_t hex4()
+  {
+    if (text_.size() - pos_ < 4)
+    {
+      fail();
+    }
+    std::uint32_t value = 0;
+    for (int i{}; i < 4; ++i)
+    {
+      char c = text_[pos_++];
+      int digit = (c >= '0' && c <= '9')   ? c - '0'
+                  : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                  : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                           : -1;
+      if (digit < 0)
+      {
+        fail();
+      }
+      value = (value << 4) | static_cast<std::uint32_t>(digit);
+    }
+    return value;
+  }
+
+  // A \u escape, surrogate pairs included, as UTF-8.
+  void code_point(std::string &out)
+  {
+    std::uint32_t cp = hex4();
+    if (cp >= 0xD800 && cp < 0xDC00)
+    {
+      if (text_.substr(pos_, 2) != "\\u")
+      {
+        fail();
+      }
+      pos_ += 2;
+      std::uint32_t low = hex4();
+      if (low < 0xDC00 || low >= 0xE000)
+      {
+        fail();
+      }
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+    }
+
+    auto put = [&](std::uint32_t byte) { out += static_cast<char>(byte); };
+    if (cp < 0x80)
+    {
+      put(cp);
+    }
+    else if (cp < 0x800)
+    {
+      put(0xC0 | (cp >> 6));
+      put(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+      put(0xE0 | (cp >> 12));
+      put(0x80 | ((cp >> 6) & 0x3F));
+      put(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+      put(0xF0 | (cp >> 18));
+      put(0x80 | ((cp >> 12) & 0x3F));
+      put(0x80 | ((cp >> 6) & 0x3F));
+      put(0x80 | (cp & 0x3F));
+    }
+  }
+
+  std::string string()
+  {
+    expect('"');
+    std::string out;
+    while (true)
+    {
+      if (pos_ == text_.size())
+      {
+        fail();
+      }
+      char c = text_[pos_++];
+      if (c == '"')
+      {
+        return out;
+      }
+      if (c != '\\')
+      {
+        out += c;
+        continue;
+      }
+
+      if (pos_ == text_.size())
+      {
+        fail();
+      }
+      switch (char e = text_[pos_++])
+      {
+      case '"':
+      case '\\':
+      case '/':
+        out += e;
+        break;
+      case 'b':
+        out += '\b';
+        break;
+      case 'f':
+        out += '\f';
+        break;
+      case 'n':
+        out += '\n';
+        break;
+      case 'r':
+        out += '\r';
+        break;
+      case 't':
+        out += '\t';
+        break;
+      case 'u':
+        code_point(out);
+        break;
+      default:
+        fail();
+      }
+    }
+  }
+
+  // Any value: an object, array, string, number, true, false or null.
+  void skip()
+  {
+    char c = peek();
+    if (c == '{')
+    {
+      object([&](std::string const &) { skip(); });
+    }
+    else if (c == '[')
+    {
+      ++pos_;
+      if (accept(']'))
+      {
+        return;
+      }
+      do
+      {
+        skip();
+      } while (accept(','));
+      expect(']');
+    }
+    else if (c == '"')
+    {
+      string();
+    }
+    else
+    {
+      std::size_t start = pos_;
+      while (pos_ < text_.size() &&
+             ((text_[pos_] >= '0' && text_[pos_] <= '9') ||
+              (text_[pos_] >= 'a' && text_[pos_] <= 'z') ||
+              (text_[pos_] >= 'A' && text_[pos_] <= 'Z') ||
+              text_[pos_] == '+' || text_[pos_] == '-' ||
+              text_[pos_] == '.'))
+      {
+        ++pos_;
+      }
+      if (pos_ == start)
+      {
+        fail();
+      }
+    }
+  }
+
+  std::string_view text_;
+  std::size_t pos_{0};
+};
+
+inline std::string safetensors_quote(std::string const &s)
+{
+  static constexpr char kHex[] = "0123456789abcdef";
+
+  std::string out = "\"";
+  for (char c : s)
+  {
+    auto u = static_cast<unsigned char>(c);
+    if (c == '"' || c == '\\')
+    {
+      out += '\\';
+      out += c;
+    }
+    else if (u < 0x20)
+    {
+      out += "\\u00";
+      out += kHex[u >> 4];
+      out += kHex[u & 0xF];
+    }
+    else
+    {
+      out += c;
+    }
+  }
+  return out + '"';
+}
+
+// Writes the tensors to path under their names, which must be unique.
+template <typename T>
+void save_safetensors(
+    std::string const &path,
+    std::vector<std::pair<std::string, Tensor<T>>> const &tensors)
+{
+  std::set<std::string> names;
+  std::string header = "{";
+  std::uint64_t offset = 0;
+
+  for (auto const &[name, tensor] : tensors)
+  {
+    if (!names.insert(name).second)
+    {
+      throw std::invalid_argument("Duplicate tensor name " + name);
+    }
+
+    auto const &t = *tensor.impl();
+    std::uint64_t bytes = t.numel() * sizeof(T);
+
+    if (header.size() > 1)
+    {
+      header += ',';
+    }
+    header += safetensors_quote(name) + ":{\"dtype\":\"";
+    header += safetensors_dtype<T>();
+    header += "\",\"shape\":[";
+    for (std::size_t d{}; d < t.shape_.size(); ++d)
+    {
+      if (d > 0)
+      {
+        header += ',';
+      }
+      header += std::to_string(t.shape_[d]);
+    }
+    header += "],\"data_offsets\":[" + std::to_string(offset) + "," +
+              std::to_string(offset + bytes) + "]}";
+    offset += bytes;
+  }
+  header += '}';
+  header.append((kAllocAlignment - (8 + header.size()) % kAllocAlignment) %
+                    kAllocAlignment,
+                ' ');
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out)
+  {
+    throw std::invalid_argument("Cannot open " + path);
+  }
+
+  char length[8];
+  for (int i{}; i < 8; ++i)
+  {
+    length[i] = static_cast<char>(header.size() >> (8 * i));
+  }
+  out.write(length, 8);
+  out.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+  for (auto const &[name, tensor] : tensors)
+  {
+    auto dense = tensor.impl()->contiguous();
+    out.write(reinterpret_cast<char const *>(dense.data_ptr()),
+              static_cast<std::streamsize>(dense.numel() * sizeof(T)));
+  }
+
+  if (!out.flush())
+  {
+    throw std::invalid_argument("Cannot write " + path);
+  }
+}
+
+//
+// Maps the file at path and returns its tensors by name, borrowing their
+// elements from the mapping. Every tensor in the file must be of type T.
+//
+template <typename T>
+std::map<std::string, Tensor<T>> load_safetensors(std::string const &path)
+{
+  auto file = std::make_shared<MappedFile>(path);
+  auto malformed = [&]()
+  { return std::invalid_argument("Malformed safetensors file " + path); };
+
+  if (file->size() < 8)
+  {
+    throw malformed();
+  }
+  std::uint64_t length = 0;
+  for (int i{}; i < 8; ++i)
+  {
+    length |= std::uint64_t{file->data()[i]} << (8 * i);
+  }
+  if (length > file->size() - 8)
+  {
+    throw malformed();
+  }
+
+  auto entries = SafetensorsHeader(
+                     {reinterpret_cast<char const *>(file->data() + 8),
+                      static_cast<std::size_t>(length)})
+                     .parse();
+  unsigned char *payload = file->data() + 8 + length;
+  std::size_t bytes = file->size() - 8 - length;
+
+  std::map<std::string, Tensor<T>> tensors;
+  for (auto const &entry : entries)
+  {
+    if (entry.dtype_ != safetensors_dtype<T>())
+    {
+      throw std::invalid_argument("Tensor " + entry.name_ + " is " +
+                                  entry.dtype_ + ", not " +
+                                  std::string(safetensors_dtype<T>()));
+    }
+
+    std::vector<std::uint32_t> shape;
+    std::size_t numel = 1;
+    for (auto dim : entry.shape_)
+    {
+      if (dim > std::numeric_limits<std::uint32_t>::max() ||
+          (dim != 0 && numel > bytes / dim))
+      {
+        throw malformed();
+      }
+      shape.push_back(static_cast<std::uint32_t>(dim));
+      numel *= dim;
+    }
+    if (entry.begin_ > entry.end_ || entry.end_ > bytes ||
+        entry.end_ - entry.begin_ != numel * sizeof(T))
+    {
+      throw malformed();
+    }
+
+    // Payloads other writers left misaligned for T are copied out.
+    unsigned char *src = payload + entry.begin_;
+    std::shared_ptr<Storage<T>> storage;
+    if (reinterpret_cast<std::uintptr_t>(src) % alignof(T) == 0)
+    {
+      storage = std::make_shared<Storage<T>>(reinterpret_cast<T *>(src),
+                                             numel, file);
+    }
+    else
+    {
+      storage = std::make_shared<Storage<T>>(numel, uninitialized);
+      std::memcpy(storage->data(), src, numel * sizeof(T));
+    }
+
+    auto stride = TensorImpl<T>::contiguous_strides(shape);
+    bool added =
+        tensors
+            .emplace(entry.name_,
+                     Tensor<T>(TensorImpl<T>(std::move(storage),
+                                             std::move(shape),
+                                             std::move(stride), 0)))
+            .second;
+    if (!added)
+    {
+      throw malformed();
+    }
+  }
+  return tensors;
+}
@@ -1,41 +1,42 @@
 #pragma once
 
-#include "tensor.hpp"
+#include "optimizer.hpp"
 
-template <typename T> class SGD
+//
+// Stochastic gradient descent. With momentum, each element keeps a
+// velocity and moves along it, Nesterov-style looking one step ahead if
+// nesterov is set. weight_decay adds an L2 penalty's gradient,
+// weight_decay * p.
+//
+template <typename T> class SGD : public Optimizer<T>
 {
 public:
-  SGD(std::vector<Tensor<T>> const &params, float const &lr)
-      : params_{params}, learning_rate_{lr}
+  SGD(std::vector<Tensor<T>> const &params, float lr, float momentum = 0,
+      float weight_decay = 0, bool nesterov = false)
+      : Optimizer<T>(params, momentum != 0 ? 1 : 0), learning_rate_{lr},
+        momentum_{momentum}, weight_decay_{weight_decay}, nesterov_{nesterov}
   {
   }
 
   void step()
   {
-    for (auto param : params_)
-    {
-      auto p = param.impl();
+    using Acc = accumulate_t<T>;
+    Acc lr = static_cast<Acc>(learning_rate_);
+    Acc momentum = static_cast<Acc>(momentum_);
+    Acc weight_decay = static_cast<Acc>(weight_decay_);
+    bool velocity = momentum_ != 0;
 
-      if (!p->grad_)
-        continue;
-
-      std::transform(
-          p->data_->begin(), p->data_->end(), p->grad_->data_->begin(),
-          p->data_->begin(), [this](T const &d, T const &g)
-          { return d - (g * static_cast<T>(this->learning_rate_)); });
-    }
-  }
-
-  void reset_grad()
-  {
-    for (auto param : params_)
-    {
-      auto p = param.impl();
-      p->grad_ = nullptr;
-    }
+    this->apply(
+        [&](std::size_t, T *p, T const *g, std::size_t offset, std::size_t n)
+        {
+          simd::sgd_step(p, g, velocity ? this->state(0, offset) : nullptr,
+                         n, lr, momentum, weight_decay, nesterov_);
+        });
   }
 
 private:
-  std::vector<Tensor<T>> params_;
   float learning_rate_;
+  float momentum_;
+  float weight_decay_;
+  bool nesterov_;
 };
@@ -0,0 +1,832 @@
+#pragma once
+
+#include "half.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <cstdlib>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TENSOR_SIMD_X86 1
+#include <immintrin.h>
+#else
+#define TENSOR_SIMD_X86 0
+#endif
+
+//
+// Explicit SIMD kernels for the contiguous inner loops of the elementwise
+// family, selected at runtime. The kernels in simd_kernels.hpp are compiled
+// once per instruction set with that set enabled through a target pragma,
+// so one binary built for baseline x86-64 runs AVX2 or AVX-512 code on
+// machines that have it and SSE2 (or plain scalar code) elsewhere.
+//
+// bf16 and f16 have Vec types that widen into float registers on load and
+// round on store, so the same kernels run on them in float. Below AVX2,
+// which brings the f16 conversions, they use the scalar instantiation.
+//
+// The level is picked from cpuid on first use. TENSOR_SIMD=scalar|sse2|
+// avx2|avx512 in the environment, or set_level(), can lower it but never
+// raise it past what the CPU supports.
+//
+namespace simd
+{
+
+enum class Level
+{
+  Scalar,
+  SSE2,
+  AVX2,
+  AVX512
+};
+
+template <typename T>
+concept Vectorizable = std::same_as<T, float> || std::same_as<T, double>;
+
+inline Level detected_level()
+{
+#if TENSOR_SIMD_X86
+  static Level const level = []()
+  {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+      return Level::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+        __builtin_cpu_supports("f16c"))
+    {
+      return Level::AVX2;
+    }
+    return Level::SSE2;
+  }();
+  return level;
+#else
+  return Level::Scalar;
+#endif
+}
+
+inline std::atomic<Level> &active_level()
+{
+  static std::atomic<Level> level = []()
+  {
+    Level wanted = detected_level();
+
+    if (char const *env = std::getenv("TENSOR_SIMD"))
+    {
+      std::string_view name(env);
+      if (name == "scalar")
+      {
+        wanted = Level::Scalar;
+      }
+      else if (name == "sse2")
+      {
+        wanted = Level::SSE2;
+      }
+      else if (name == "avx2")
+      {
+        wanted = Level::AVX2;
+      }
+    }
+
+    return std::min(wanted, detected_level());
+  }();
+  return level;
+}
+
+inline Level level() { return active_level().load(std::memory_order_relaxed); }
+
+inline void set_level(Level wanted)
+{
+  active_level().store(std::min(wanted, detected_level()),
+                       std::memory_order_relaxed);
+}
+
+//
+// Per-step constants of adam_step. step_size_ is the learning rate over
+// the first moment's bias correction 1 - beta1^t and bias2_rsqrt_ is
+// 1 / sqrt(1 - beta2^t). Adam's weight decay goes into the gradient as
+// l2_; AdamW's shrinks the parameter by decay_ = 1 - lr * weight_decay.
+// They are kept in accumulate_t<T>: bf16 rounds 0.999 to 1 and f16 1e-8
+// to 0.
+//
+template <typename T> struct AdamConstants
+{
+  accumulate_t<T> beta1_;
+  accumulate_t<T> beta2_;
+  accumulate_t<T> step_size_;
+  accumulate_t<T> bias2_rsqrt_;
+  accumulate_t<T> eps_;
+  accumulate_t<T> l2_;
+  accumulate_t<T> decay_;
+};
+
+namespace scalar
+{
+
+template <typename T> struct Vec
+{
+  using scalar = T;
+  using reg = T;
+  static constexpr std::size_t width = 1;
+
+  static reg load(T const *p) { return *p; }
+  static void store(T *p, reg v) { *p = v; }
+  static reg set1(T x) { return x; }
+  static reg zero() { return T{}; }
+  static reg add(reg a, reg b) { return a + b; }
+  static reg sub(reg a, reg b) { return a - b; }
+  static reg mul(reg a, reg b) { return a * b; }
+  static reg max(reg a, reg b) { return (a > b) ? a : b; }
+  static reg min(reg a, reg b) { return (a < b) ? a : b; }
+  static reg div(reg a, reg b) { return a / b; }
+  static reg sqrt(reg a) { return std::sqrt(a); }
+  static reg fmadd(reg a, reg b, reg c) { return a * b + c; }
+  static reg select_positive(reg x, reg v) { return (x > T{}) ? v : T{}; }
+  static T reduce_add(reg v) { return v; }
+};
+
+template <HalfPrecision H> struct Vec<H> : Vec<float>
+{
+  using scalar = H;
+
+  static reg load(H const *p) { return *p; }
+  static void store(H *p, reg v) { *p = v; }
+  static reg set1(H x) { return x; }
+};
+
+#include "simd_kernels.hpp"
+
+} // namespace scalar
+
+#if TENSOR_SIMD_X86
+
+namespace sse2
+{
+
+template <typename T> struct Vec;
+
+template <> struct Vec<float>
+{
+  using scalar = float;
+  using reg = __m128;
+  static constexpr std::size_t width = 4;
+
+  static reg load(float const *p) { return _mm_loadu_ps(p); }
+  static void store(float *p, reg v) { _mm_storeu_ps(p, v); }
+  static reg set1(float x) { return _mm_set1_ps(x); }
+  static reg zero() { return _mm_setzero_ps(); }
+  static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+  static reg max(reg a, reg b) { return _mm_max_ps(a, b); }
+  static reg min(reg a, reg b) { return _mm_min_ps(a, b); }
+  static reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+  static reg sqrt(reg a) { return _mm_sqrt_ps(a); }
+  static reg fmadd(reg a, reg b, reg c)
+  {
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+  }
+  static reg select_positive(reg x, reg v)
+  {
+    return _mm_and_ps(_mm_cmpgt_ps(x, _mm_setzero_ps()), v);
+  }
+  static float reduce_add(reg v)
+  {
+    reg hi = _mm_movehl_ps(v, v);
+    reg sum = _mm_add_ps(v, hi);
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+  }
+};
+
+template <> struct Vec<double>
+{
+  using scalar = double;
+  using reg = __m128d;
+  static constexpr std::size_t width = 2;
+
+  static reg load(double const *p) { return _mm_loadu_pd(p); }
+  static void store(double *p, reg v) { _mm_storeu_pd(p, v); }
+  static reg set1(double x) { return _mm_set1_pd(x); }
+  static reg zero() { return _mm_setzero_pd(); }
+  static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+  static reg max(reg a, reg b) { return _mm_max_pd(a, b); }
+  static reg min(reg a, reg b) { return _mm_min_pd(a, b); }
+  static reg div(reg a, reg b) { return _mm_div_pd(a, b); }
+  static reg sqrt(reg a) { return _mm_sqrt_pd(a); }
+  static reg fmadd(reg a, reg b, reg c)
+  {
+    return _mm_add_pd(_mm_mul_pd(a, b), c);
+  }
+  static reg select_positive(reg x, reg v)
+  {
+    return _mm_and_pd(_mm_cmpgt_pd(x, _mm_setzero_pd()), v);
+  }
+  static double reduce_add(reg v)
+  {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+  }
+};
+
+#include "simd_kernels.hpp"
+
+} // namespace sse2
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))),        \
+                             apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+
+namespace avx2
+{
+
+template <typename T> struct Vec;
+
+template <> struct Vec<float>
+{
+  using scalar = float;
+  using reg = __m256;
+  static constexpr std::size_t width = 8;
+
+  static reg load(float const *p) { return _mm256_loadu_ps(p); }
+  static void store(float *p, reg v) { _mm256_storeu_ps(p, v); }
+  static reg set1(float x) { return _mm256_set1_ps(x); }
+  static reg zero() { return _mm256_setzero_ps(); }
+  static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+  static reg max(reg a, reg b) { return _mm256_max_ps(a, b); }
+  static reg min(reg a, reg b) { return _mm256_min_ps(a, b); }
+  static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+  static reg sqrt(reg a) { return _mm256_sqrt_ps(a); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_ps(a, b, c); }
+  static reg select_positive(reg x, reg v)
+  {
+    return _mm256_and_ps(_mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ),
+                         v);
+  }
+  static float reduce_add(reg v)
+  {
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                            _mm256_extractf128_ps(v, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+  }
+};
+
+template <> struct Vec<double>
+{
+  using scalar = double;
+  using reg = __m256d;
+  static constexpr std::size_t width = 4;
+
+  static reg load(double const *p) { return _mm256_loadu_pd(p); }
+  static void store(double *p, reg v) { _mm256_storeu_pd(p, v); }
+  static reg set1(double x) { return _mm256_set1_pd(x); }
+  static reg zero() { return _mm256_setzero_pd(); }
+  static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+  static reg max(reg a, reg b) { return _mm256_max_pd(a, b); }
+  static reg min(reg a, reg b) { return _mm256_min_pd(a, b); }
+  static reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+  static reg sqrt(reg a) { return _mm256_sqrt_pd(a); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm256_fmadd_pd(a, b, c); }
+  static reg select_positive(reg x, reg v)
+  {
+    return _mm256_and_pd(_mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_GT_OQ),
+                         v);
+  }
+  static double reduce_add(reg v)
+  {
+    __m128d sum = _mm_add_pd(_mm256_castpd256_pd128(v),
+                             _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(sum, _mm_unpackhi_pd(sum, sum)));
+  }
+};
+
+template <> struct Vec<bf16> : Vec<float>
+{
+  using scalar = bf16;
+
+  static reg load(bf16 const *p)
+  {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+    return _mm256_castsi256_ps(
+        _mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+  }
+  static void store(bf16 *p, reg v)
+  {
+    // Round to nearest even on the upper half; NaNs are made quiet.
+    __m256i bits = _mm256_castps_si256(v);
+    __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16),
+                                   _mm256_set1_epi32(1));
+    __m256i rounded = _mm256_srli_epi32(
+        _mm256_add_epi32(bits,
+                         _mm256_add_epi32(odd, _mm256_set1_epi32(0x7FFF))),
+        16);
+    __m256i nan = _mm256_or_si256(_mm256_srli_epi32(bits, 16),
+                                  _mm256_set1_epi32(0x0040));
+    __m256i is_nan = _mm256_castps_si256(_mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    rounded = _mm256_blendv_epi8(rounded, nan, is_nan);
+    rounded = _mm256_and_si256(rounded, _mm256_set1_epi32(0xFFFF));
+
+    // packus works per 128-bit lane; put the two halves back in order.
+    __m256i packed = _mm256_permute4x64_epi64(
+        _mm256_packus_epi32(rounded, rounded), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p),
+                     _mm256_castsi256_si128(packed));
+  }
+  static reg set1(bf16 x) { return _mm256_set1_ps(x); }
+};
+
+template <> struct Vec<f16> : Vec<float>
+{
+  using scalar = f16;
+
+  static reg load(f16 const *p)
+  {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)));
+  }
+  static void store(f16 *p, reg v)
+  {
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(p),
+                     _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+  }
+  static reg set1(f16 x) { return _mm256_set1_ps(x); }
+};
+
+#include "simd_kernels.hpp"
+
+} // namespace avx2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f"))),              \
+                             apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+namespace avx512
+{
+
+template <typename T> struct Vec;
+
+template <> struct Vec<float>
+{
+  using scalar = float;
+  using reg = __m512;
+  static constexpr std::size_t width = 16;
+
+  static reg load(float const *p) { return _mm512_loadu_ps(p); }
+  static void store(float *p, reg v) { _mm512_storeu_ps(p, v); }
+  static reg set1(float x) { return _mm512_set1_ps(x); }
+  static reg zero() { return _mm512_setzero_ps(); }
+  static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_ps(a, b); }
+  static reg max(reg a, reg b)
+  {
+    return _mm512_maskz_max_ps(0xFFFF, a, b);
+  }
+  static reg min(reg a, reg b)
+  {
+    return _mm512_maskz_min_ps(0xFFFF, a, b);
+  }
+  static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+  static reg sqrt(reg a) { return _mm512_maskz_sqrt_ps(0xFFFF, a); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_ps(a, b, c); }
+  static reg select_positive(reg x, reg v)
+  {
+    return _mm512_maskz_mov_ps(
+        _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), v);
+  }
+  static float reduce_add(reg v)
+  {
+    // The unmasked extracts trip -Wuninitialized in GCC 12's headers.
+    __m512d d = _mm512_castps_pd(v);
+    __m256 lo = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, d, 0));
+    __m256 hi = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, d, 1));
+    return avx2::Vec<float>::reduce_add(_mm256_add_ps(lo, hi));
+  }
+};
+
+template <> struct Vec<double>
+{
+  using scalar = double;
+  using reg = __m512d;
+  static constexpr std::size_t width = 8;
+
+  static reg load(double const *p) { return _mm512_loadu_pd(p); }
+  static void store(double *p, reg v) { _mm512_storeu_pd(p, v); }
+  static reg set1(double x) { return _mm512_set1_pd(x); }
+  static reg zero() { return _mm512_setzero_pd(); }
+  static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+  static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+  static reg mul(reg a, reg b) { return _mm512_mul_pd(a, b); }
+  static reg max(reg a, reg b) { return _mm512_maskz_max_pd(0xFF, a, b); }
+  static reg min(reg a, reg b) { return _mm512_maskz_min_pd(0xFF, a, b); }
+  static reg div(reg a, reg b) { return _mm512_div_pd(a, b); }
+  static reg sqrt(reg a) { return _mm512_maskz_sqrt_pd(0xFF, a); }
+  static reg fmadd(reg a, reg b, reg c) { return _mm512_fmadd_pd(a, b, c); }
+  static reg select_positive(reg x, reg v)
+  {
+    return _mm512_maskz_mov_pd(
+        _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_GT_OQ), v);
+  }
+  static double reduce_add(reg v)
+  {
+    __m256d lo = _mm512_maskz_extractf64x4_pd(0xF, v, 0);
+    __m256d hi = _mm512_maskz_extractf64x4_pd(0xF, v, 1);
+    return avx2::Vec<double>::reduce_add(_mm256_add_pd(lo, hi));
+  }
+};
+
+template <> struct Vec<bf16> : Vec<float>
+{
+  using scalar = bf16;
+
+  static reg load(bf16 const *p)
+  {
+    // Masked forms here and in Vec<f16>: the unmasked conversions and
+    // shifts trip the same GCC 12 warning as reduce_add.
+    __m256i h = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+    return _mm512_castsi512_ps(_mm512_maskz_slli_epi32(
+        0xFFFF, _mm512_maskz_cvtepu16_epi32(0xFFFF, h), 16));
+  }
+  static void store(bf16 *p, reg v)
+  {
+    // Round to nearest even on the upper half; NaNs are made quiet.
+    __m512i bits = _mm512_castps_si512(v);
+    __m512i upper = _mm512_maskz_srli_epi32(0xFFFF, bits, 16);
+    __m512i odd = _mm512_and_si512(upper, _mm512_set1_epi32(1));
+    __m512i rounded = _mm512_maskz_srli_epi32(
+        0xFFFF,
+        _mm512_add_epi32(bits,
+                         _mm512_add_epi32(odd, _mm512_set1_epi32(0x7FFF))),
+        16);
+    __m512i nan = _mm512_or_si512(upper, _mm512_set1_epi32(0x0040));
+    rounded = _mm512_mask_mov_epi32(
+        rounded, _mm512_cmp_ps_mask(v, v, _CMP_UNORD_Q), nan);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p),
+                        _mm512_maskz_cvtepi32_epi16(0xFFFF, rounded));
+  }
+  static reg set1(bf16 x) { return _mm512_set1_ps(x); }
+};
+
+template <> struct Vec<f16> : Vec<float>
+{
+  using scalar = f16;
+
+  static reg load(f16 const *p)
+  {
+    return _mm512_maskz_cvtph_ps(
+        0xFFFF, _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)));
+  }
+  static void store(f16 *p, reg v)
+  {
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(p),
+                        _mm512_maskz_cvtps_ph(0xFFFF, v,
+                                              _MM_FROUND_TO_NEAREST_INT));
+  }
+  static reg set1(f16 x) { return _mm512_set1_ps(x); }
+};
+
+#include "simd_kernels.hpp"
+
+} // namespace avx512
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#define TENSOR_SIMD_DISPATCH(T, kernel, ...)                                   \
+  switch (level())                                                             \
+  {                                                                            \
+  case Level::AVX512:                                                          \
+    return avx512::kernel<avx512::Vec<T>>(__VA_ARGS__);                        \
+  case Level::AVX2:                                                            \
+    return avx2::kernel<avx2::Vec<T>>(__VA_ARGS__);                            \
+  case Level::SSE2:                                                            \
+    return sse2::kernel<sse2::Vec<T>>(__VA_ARGS__);                            \
+  default:                                                                     \
+    return scalar::kernel<scalar::Vec<T>>(__VA_ARGS__);                        \
+  }
+
+#define TENSOR_SIMD_HALF_DISPATCH(T, kernel, ...)                              \
+  switch (level())                                                             \
+  {                                                                            \
+  case Level::AVX512:                                                          \
+    return avx512::kernel<avx512::Vec<T>>(__VA_ARGS__);                        \
+  case Level::AVX2:                                                            \
+    return avx2::kernel<avx2::Vec<T>>(__VA_ARGS__);                            \
+  default:                                                                     \
+    return scalar::kernel<scalar::Vec<T>>(__VA_ARGS__);                        \
+  }
+
+#else
+
+#define TENSOR_SIMD_DISPATCH(T, kernel, ...)                                   \
+  return scalar::kernel<scalar::Vec<T>>(__VA_ARGS__);
+
+#define TENSOR_SIMD_HALF_DISPATCH(T, kernel, ...)                              \
+  return scalar::kernel<scalar::Vec<T>>(__VA_ARGS__);
+
+#endif
+
+//
+// Dispatching entry points. Types without vector kernels use the scalar
+// instantiation directly.
+//
+#define TENSOR_SIMD_ENTRY(T, kernel, ...)                                      \
+  if constexpr (Vectorizable<T>)                                               \
+  {                                                                            \
+    TENSOR_SIMD_DISPATCH(T, kernel, __VA_ARGS__)                               \
+  }                                                                            \
+  else if constexpr (HalfPrecision<T>)                                         \
+  {                                                                            \
+    TENSOR_SIMD_HALF_DISPATCH(T, kernel, __VA_ARGS__)                          \
+  }                                                                            \
+  else                                                                         \
+  {                                                                            \
+    return scalar::kernel<scalar::Vec<T>>(__VA_ARGS__);                        \
+  }
+
+template <typename T>
+void add(T *out, T const *a, T const *b, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, add, out, a, b, n)
+}
+
+template <typename T>
+void sub(T *out, T const *a, T const *b, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, sub, out, a, b, n)
+}
+
+template <typename T>
+void add_scalar(T *out, T const *a, T s, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, add_scalar, out, a, s, n)
+}
+
+template <typename T>
+void sub_scalar(T *out, T const *a, T s, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, sub_scalar, out, a, s, n)
+}
+
+template <typename T>
+void rsub_scalar(T *out, T const *a, T s, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, rsub_scalar, out, a, s, n)
+}
+
+template <typename T> void scale(T *out, T const *a, T s, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, scale, out, a, s, n)
+}
+
+template <typename T> void neg(T *out, T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, neg, out, a, n)
+}
+
+template <typename T> void relu(T *out, T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, relu, out, a, n)
+}
+
+template <typename T>
+void relu_backward(T *grad_in, T const *x, T const *grad_out, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, relu_backward, grad_in, x, grad_out, n)
+}
+
+template <typename T> void axpy(T *y, T alpha, T const *x, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, axpy, y, alpha, x, n)
+}
+
+template <typename T>
+void diff_axpy(T *y, T alpha, T const *a, T const *b, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, diff_axpy, y, alpha, a, b, n)
+}
+
+template <typename T>
+accumulate_t<T> squared_distance(T const *a, T const *b, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, squared_distance, a, b, n)
+}
+
+template <typename T> accumulate_t<T> sum(T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, sum, a, n)
+}
+
+template <typename T> accumulate_t<T> sum_squares(T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, sum_squares, a, n)
+}
+
+template <typename T> T max_value(T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, max_value, a, n)
+}
+
+template <typename T> T min_value(T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, min_value, a, n)
+}
+
+template <typename T>
+void maximum(T *out, T const *a, T const *b, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, maximum, out, a, b, n)
+}
+
+template <typename T>
+void minimum(T *out, T const *a, T const *b, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, minimum, out, a, b, n)
+}
+
+template <typename T> void add_squares(T *acc, T const *a, std::size_t n)
+{
+  TENSOR_SIMD_ENTRY(T, add_squares, acc, a, n)
+}
+
+template <typename T>
+void sgd_step(T *p, T const *g, accumulate_t<T> *buf, std::size_t n,
+              accumulate_t<T> lr, accumulate_t<T> momentum,
+              accumulate_t<T> weight_decay, bool nesterov)
+{
+  TENSOR_SIMD_ENTRY(T, sgd_step, p, g, buf, n, lr, momentum, weight_decay,
+                    nesterov)
+}
+
+template <typename T>
+void adam_step(T *p, T const *g, accumulate_t<T> *m, accumulate_t<T> *v,
+               std::size_t n, AdamConstants<T> const &c)
+{
+  TENSOR_SIMD_ENTRY(T, adam_step, p, g, m, v, n, c)
+}
+
+//
+// out = in, converted between element types. Conversions among float, bf16
+// and f16 are vectorized: they share a register type, so this is a load of
+// one Vec and a store of the other.
+//
+template <typename To, typename From>
+void convert(To *out, From const *in, std::size_t n)
+{
+  constexpr bool vectorized =
+      (std::same_as<To, float> || HalfPrecision<To>) &&
+      (std::same_as<From, float> || HalfPrecision<From>);
+
+  if constexpr (vectorized)
+  {
+#if TENSOR_SIMD_X86
+    switch (level())
+    {
+    case Level::AVX512:
+      return avx512::convert<avx512::Vec<To>, avx512::Vec<From>>(out, in, n);
+    case Level::AVX2:
+      return avx2::convert<avx2::Vec<To>, avx2::Vec<From>>(out, in, n);
+    default:
+      break;
+    }
+#endif
+    return scalar::convert<scalar::Vec<To>, scalar::Vec<From>>(out, in, n);
+  }
+  else
+  {
+    for (std::size_t i{}; i < n; ++i)
+    {
+      out[i] = static_cast<To>(static_cast<accumulate_t<From>>(in[i]));
+    }
+  }
+}
+
+#undef TENSOR_SIMD_ENTRY
+#undef TENSOR_SIMD_HALF_DISPATCH
+#undef TENSOR_SIMD_DISPATCH
+
+template <typename T, std::size_t MR, std::size_t NR>
+void gemm_micro_kernel(std::size_t kc, T const *a, T const *b, T *c,
+                       std::size_t rs_c, std::size_t cs_c, T beta,
+                       std::size_t mr, std::size_t nr)
+{
+#if TENSOR_SIMD_X86
+  if constexpr (Vectorizable<T>)
+  {
+    switch (level())
+    {
+    case Level::AVX512:
+      if constexpr (NR % avx512::Vec<T>::width == 0)
+      {
+        return avx512::gemm_micro_kernel<avx512::Vec<T>, MR, NR>(
+            kc, a, b, c, rs_c, cs_c, beta, mr, nr);
+      }
+      [[fallthrough]];
+    case Level::AVX2:
+      return avx2::gemm_micro_kernel<avx2::Vec<T>, MR, NR>(
+          kc, a, b, c, rs_c, cs_c, beta, mr, nr);
+    case Level::SSE2:
+      return sse2::gemm_micro_kernel<sse2::Vec<T>, MR, NR>(
+          kc, a, b, c, rs_c, cs_c, beta, mr, nr);
+    default:
+      break;
+    }
+  }
+#endif
+
+  scalar::gemm_micro_kernel<scalar::Vec<T>, MR, NR>(kc, a, b, c, rs_c, cs_c,
+                                                    beta, mr, nr);
+}
+
+//
+// Elementwise functors for TensorIterator loops. Besides the scalar call
+// they expose dense() forms that unary_loop/binary_loop use for unit-stride
+// and scalar-broadcast runs.
+//
+template <typename T> struct Plus
+{
+  T operator()(T const &a, T const &b) const { return a + b; }
+
+  void dense(T *out, T const *a, T const *b, std::size_t n) const
+  {
+    add(out, a, b, n);
+  }
+  void dense_scalar_rhs(T *out, T const *a, T b, std::size_t n) const
+  {
+    add_scalar(out, a, b, n);
+  }
+  void dense_scalar_lhs(T *out, T a, T const *b, std::size_t n) const
+  {
+    add_scalar(out, b, a, n);
+  }
+};
+
+template <typename T> struct Minus
+{
+  T operator()(T const &a, T const &b) const { return a - b; }
+
+  void dense(T *out, T const *a, T const *b, std::size_t n) const
+  {
+    sub(out, a, b, n);
+  }
+  void dense_scalar_rhs(T *out, T const *a, T b, std::size_t n) const
+  {
+    sub_scalar(out, a, b, n);
+  }
+  void dense_scalar_lhs(T *out, T a, T const *b, std::size_t n) const
+  {
+    rsub_scalar(out, b, a, n);
+  }
+};
+
+template <typename T> struct Negate
+{
+  T operator()(T const &a) const { return -a; }
+
+  void dense(T *out, T const *a, std::size_t n) const { neg(out, a, n); }
+};
+
+template <typename T> struct Scale
+{
+  T value_;
+
+  T operator()(T const &a) const { return a * value_; }
+
+  void dense(T *out, T const *a, std::size_t n) const
+  {
+    scale(out, a, value_, n);
+  }
+};
+
+template <typename T> struct Relu
+{
+  T operator()(T const &a) const { return (a > T{}) ? a : T{}; }
+
+  void dense(T *out, T const *a, std::size_t n) const { relu(out, a, n); }
+};
+
+} // namespace simd
@@ -0,0 +1,618 @@
+//
+// Contiguous elementwise, reduction and GEMM micro-kernels written once
+// against a vector abstraction V. simd.hpp includes this file once per
+// instruction set, inside that set's namespace and target pragma, after
+// defining Vec<T> there. It therefore has no include guard and must not
+// include anything itself.
+//
+// V provides: scalar, reg, width, load, store, set1, zero, add, sub, mul,
+// div, sqrt, max, min, fmadd(a, b, c) = a * b + c, select_positive(x, v)
+// = (x > 0) ? v : 0 and reduce_add. Sums are carried in
+// accumulate_t<scalar>, which is wider than scalar for the 16-bit formats.
+//
+
+template <typename V>
+void add(typename V::scalar *out, typename V::scalar const *a,
+         typename V::scalar const *b, std::size_t n)
+{
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::add(V::load(a + i), V::load(b + i)));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = a[i] + b[i];
+  }
+}
+
+template <typename V>
+void sub(typename V::scalar *out, typename V::scalar const *a,
+         typename V::scalar const *b, std::size_t n)
+{
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::sub(V::load(a + i), V::load(b + i)));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = a[i] - b[i];
+  }
+}
+
+// out = a + s
+template <typename V>
+void add_scalar(typename V::scalar *out, typename V::scalar const *a,
+                typename V::scalar s, std::size_t n)
+{
+  auto vs = V::set1(s);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::add(V::load(a + i), vs));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = a[i] + s;
+  }
+}
+
+// out = a - s
+template <typename V>
+void sub_scalar(typename V::scalar *out, typename V::scalar const *a,
+                typename V::scalar s, std::size_t n)
+{
+  auto vs = V::set1(s);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::sub(V::load(a + i), vs));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = a[i] - s;
+  }
+}
+
+// out = s - a
+template <typename V>
+void rsub_scalar(typename V::scalar *out, typename V::scalar const *a,
+                 typename V::scalar s, std::size_t n)
+{
+  auto vs = V::set1(s);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::sub(vs, V::load(a + i)));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = s - a[i];
+  }
+}
+
+// out = a * s
+template <typename V>
+void scale(typename V::scalar *out, typename V::scalar const *a,
+           typename V::scalar s, std::size_t n)
+{
+  auto vs = V::set1(s);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::mul(V::load(a + i), vs));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = a[i] * s;
+  }
+}
+
+template <typename V>
+void neg(typename V::scalar *out, typename V::scalar const *a, std::size_t n)
+{
+  auto zero = V::zero();
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::sub(zero, V::load(a + i)));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = -a[i];
+  }
+}
+
+template <typename V>
+void relu(typename V::scalar *out, typename V::scalar const *a, std::size_t n)
+{
+  using T = typename V::scalar;
+
+  auto zero = V::zero();
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::max(V::load(a + i), zero));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = (a[i] > T{}) ? a[i] : T{};
+  }
+}
+
+// grad_in += (x > 0) ? grad_out : 0
+template <typename V>
+void relu_backward(typename V::scalar *grad_in, typename V::scalar const *x,
+                   typename V::scalar const *grad_out, std::size_t n)
+{
+  using T = typename V::scalar;
+
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    auto masked = V::select_positive(V::load(x + i), V::load(grad_out + i));
+    V::store(grad_in + i, V::add(V::load(grad_in + i), masked));
+  }
+  for (; i < n; ++i)
+  {
+    grad_in[i] += (x[i] > T{}) ? grad_out[i] : T{};
+  }
+}
+
+// y += alpha * x
+template <typename V>
+void axpy(typename V::scalar *y, typename V::scalar alpha,
+          typename V::scalar const *x, std::size_t n)
+{
+  auto va = V::set1(alpha);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(y + i, V::fmadd(va, V::load(x + i), V::load(y + i)));
+  }
+  for (; i < n; ++i)
+  {
+    y[i] += alpha * x[i];
+  }
+}
+
+// y += alpha * (a - b)
+template <typename V>
+void diff_axpy(typename V::scalar *y, typename V::scalar alpha,
+               typename V::scalar const *a, typename V::scalar const *b,
+               std::size_t n)
+{
+  auto va = V::set1(alpha);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    auto d = V::sub(V::load(a + i), V::load(b + i));
+    V::store(y + i, V::fmadd(va, d, V::load(y + i)));
+  }
+  for (; i < n; ++i)
+  {
+    y[i] += alpha * (a[i] - b[i]);
+  }
+}
+
+// sum((a - b)^2), with two accumulators to hide the add latency
+template <typename V>
+accumulate_t<typename V::scalar> squared_distance(typename V::scalar const *a,
+                                                  typename V::scalar const *b,
+                                                  std::size_t n)
+{
+  using Acc = accumulate_t<typename V::scalar>;
+
+  auto acc0 = V::zero();
+  auto acc1 = V::zero();
+  std::size_t i{};
+  for (; i + 2 * V::width <= n; i += 2 * V::width)
+  {
+    auto d0 = V::sub(V::load(a + i), V::load(b + i));
+    auto d1 = V::sub(V::load(a + i + V::width), V::load(b + i + V::width));
+    acc0 = V::fmadd(d0, d0, acc0);
+    acc1 = V::fmadd(d1, d1, acc1);
+  }
+  for (; i + V::width <= n; i += V::width)
+  {
+    auto d = V::sub(V::load(a + i), V::load(b + i));
+    acc0 = V::fmadd(d, d, acc0);
+  }
+
+  Acc sum = V::reduce_add(V::add(acc0, acc1));
+  for (; i < n; ++i)
+  {
+    Acc d = static_cast<Acc>(a[i]) - static_cast<Acc>(b[i]);
+    sum += d * d;
+  }
+  return sum;
+}
+
+//
+// Pairwise sums: runs longer than a block are split in half and the halves
+// summed separately, so rounding error grows with log(n) rather than n.
+// Within a block four vector accumulators hide the add latency.
+//
+template <typename V, bool Square>
+accumulate_t<typename V::scalar> pairwise_sum(typename V::scalar const *a,
+                                              std::size_t n)
+{
+  using Acc = accumulate_t<typename V::scalar>;
+  constexpr std::size_t block = 256;
+
+  if (n > block)
+  {
+    std::size_t half = n / 2 / V::width * V::width;
+    return pairwise_sum<V, Square>(a, half) +
+           pairwise_sum<V, Square>(a + half, n - half);
+  }
+
+  auto acc0 = V::zero();
+  auto acc1 = V::zero();
+  auto acc2 = V::zero();
+  auto acc3 = V::zero();
+
+  auto term = [](auto x, auto acc)
+  {
+    if constexpr (Square)
+    {
+      return V::fmadd(x, x, acc);
+    }
+    else
+    {
+      return V::add(x, acc);
+    }
+  };
+
+  std::size_t i{};
+  for (; i + 4 * V::width <= n; i += 4 * V::width)
+  {
+    acc0 = term(V::load(a + i), acc0);
+    acc1 = term(V::load(a + i + V::width), acc1);
+    acc2 = term(V::load(a + i + 2 * V::width), acc2);
+    acc3 = term(V::load(a + i + 3 * V::width), acc3);
+  }
+  for (; i + V::width <= n; i += V::width)
+  {
+    acc0 = term(V::load(a + i), acc0);
+  }
+
+  Acc sum = V::reduce_add(V::add(V::add(acc0, acc1), V::add(acc2, acc3)));
+  for (; i < n; ++i)
+  {
+    Acc x = static_cast<Acc>(a[i]);
+    sum += Square ? x * x : x;
+  }
+  return sum;
+}
+
+template <typename V>
+accumulate_t<typename V::scalar> sum(typename V::scalar const *a,
+                                     std::size_t n)
+{
+  return pairwise_sum<V, false>(a, n);
+}
+
+template <typename V>
+accumulate_t<typename V::scalar> sum_squares(typename V::scalar const *a,
+                                             std::size_t n)
+{
+  return pairwise_sum<V, true>(a, n);
+}
+
+// Largest element; n must be positive.
+template <typename V>
+typename V::scalar max_value(typename V::scalar const *a, std::size_t n)
+{
+  using T = typename V::scalar;
+
+  T best = a[0];
+  std::size_t i{};
+  if (n >= V::width)
+  {
+    auto acc = V::load(a);
+    for (i = V::width; i + V::width <= n; i += V::width)
+    {
+      acc = V::max(acc, V::load(a + i));
+    }
+
+    T lanes[V::width];
+    V::store(lanes, acc);
+    for (std::size_t l{}; l < V::width; ++l)
+    {
+      best = (lanes[l] > best) ? lanes[l] : best;
+    }
+  }
+  for (; i < n; ++i)
+  {
+    best = (a[i] > best) ? a[i] : best;
+  }
+  return best;
+}
+
+// Smallest element; n must be positive.
+template <typename V>
+typename V::scalar min_value(typename V::scalar const *a, std::size_t n)
+{
+  using T = typename V::scalar;
+
+  T best = a[0];
+  std::size_t i{};
+  if (n >= V::width)
+  {
+    auto acc = V::load(a);
+    for (i = V::width; i + V::width <= n; i += V::width)
+    {
+      acc = V::min(acc, V::load(a + i));
+    }
+
+    T lanes[V::width];
+    V::store(lanes, acc);
+    for (std::size_t l{}; l < V::width; ++l)
+    {
+      best = (lanes[l] < best) ? lanes[l] : best;
+    }
+  }
+  for (; i < n; ++i)
+  {
+    best = (a[i] < best) ? a[i] : best;
+  }
+  return best;
+}
+
+template <typename V>
+void maximum(typename V::scalar *out, typename V::scalar const *a,
+             typename V::scalar const *b, std::size_t n)
+{
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::max(V::load(a + i), V::load(b + i)));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = (a[i] > b[i]) ? a[i] : b[i];
+  }
+}
+
+template <typename V>
+void minimum(typename V::scalar *out, typename V::scalar const *a,
+             typename V::scalar const *b, std::size_t n)
+{
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    V::store(out + i, V::min(V::load(a + i), V::load(b + i)));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = (a[i] < b[i]) ? a[i] : b[i];
+  }
+}
+
+// acc += a * a
+template <typename V>
+void add_squares(typename V::scalar *acc, typename V::scalar const *a,
+                 std::size_t n)
+{
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    auto x = V::load(a + i);
+    V::store(acc + i, V::fmadd(x, x, V::load(acc + i)));
+  }
+  for (; i < n; ++i)
+  {
+    acc[i] += a[i] * a[i];
+  }
+}
+
+//
+// One SGD step: d = g + weight_decay * p; with a velocity buf, buf =
+// momentum * buf + d and d = buf, or d + momentum * buf for Nesterov; then
+// p -= lr * d. buf is null without momentum. The constants and buf are in
+// accumulate_t<scalar>, handled through Vec<Acc>, which shares V's register
+// type, so that neither rounds to a 16-bit format between steps.
+//
+template <typename V>
+void sgd_step(typename V::scalar *p, typename V::scalar const *g,
+              accumulate_t<typename V::scalar> *buf, std::size_t n,
+              accumulate_t<typename V::scalar> lr,
+              accumulate_t<typename V::scalar> momentum,
+              accumulate_t<typename V::scalar> weight_decay, bool nesterov)
+{
+  using T = typename V::scalar;
+  using Acc = accumulate_t<T>;
+  using A = Vec<Acc>;
+
+  auto vlr = A::set1(-lr);
+  auto vmu = A::set1(momentum);
+  auto vwd = A::set1(weight_decay);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    auto x = V::load(p + i);
+    auto d = V::fmadd(vwd, x, V::load(g + i));
+    if (buf)
+    {
+      auto u = V::fmadd(vmu, A::load(buf + i), d);
+      A::store(buf + i, u);
+      d = nesterov ? V::fmadd(vmu, u, d) : u;
+    }
+    V::store(p + i, V::fmadd(vlr, d, x));
+  }
+  for (; i < n; ++i)
+  {
+    Acc x = p[i];
+    Acc d = weight_decay * x + static_cast<Acc>(g[i]);
+    if (buf)
+    {
+      Acc u = momentum * buf[i] + d;
+      buf[i] = u;
+      d = nesterov ? momentum * u + d : u;
+    }
+    p[i] = static_cast<T>(x - lr * d);
+  }
+}
+
+//
+// One Adam step over the first and second moments m and v:
+//   d = g + l2 * p
+//   m = beta1 * m + (1 - beta1) * d
+//   v = beta2 * v + (1 - beta2) * d * d
+//   p = decay * p - step_size * m / (sqrt(v) * bias2_rsqrt + eps)
+// The constants and moments are in accumulate_t<scalar>, as in sgd_step:
+// in bf16, 1 - beta2 would round to 0, and in f16 eps to 0.
+//
+template <typename V>
+void adam_step(typename V::scalar *p, typename V::scalar const *g,
+               accumulate_t<typename V::scalar> *m,
+               accumulate_t<typename V::scalar> *v, std::size_t n,
+               AdamConstants<typename V::scalar> const &c)
+{
+  using T = typename V::scalar;
+  using Acc = accumulate_t<T>;
+  using A = Vec<Acc>;
+
+  auto vb1 = A::set1(c.beta1_);
+  auto vb2 = A::set1(c.beta2_);
+  auto vc1 = A::set1(1 - c.beta1_);
+  auto vc2 = A::set1(1 - c.beta2_);
+  auto vl2 = A::set1(c.l2_);
+  auto vdecay = A::set1(c.decay_);
+  auto vstep = A::set1(-c.step_size_);
+  auto vrsqrt = A::set1(c.bias2_rsqrt_);
+  auto veps = A::set1(c.eps_);
+  std::size_t i{};
+  for (; i + V::width <= n; i += V::width)
+  {
+    auto x = V::load(p + i);
+    auto d = V::fmadd(vl2, x, V::load(g + i));
+    auto mi = V::fmadd(vb1, A::load(m + i), V::mul(vc1, d));
+    auto vi = V::fmadd(vb2, A::load(v + i), V::mul(vc2, V::mul(d, d)));
+    A::store(m + i, mi);
+    A::store(v + i, vi);
+
+    auto denom = V::fmadd(V::sqrt(vi), vrsqrt, veps);
+    V::store(p + i, V::fmadd(vstep, V::div(mi, denom), V::mul(vdecay, x)));
+  }
+  for (; i < n; ++i)
+  {
+    Acc x = p[i];
+    Acc d = c.l2_ * x + static_cast<Acc>(g[i]);
+    m[i] = c.beta1_ * m[i] + (1 - c.beta1_) * d;
+    v[i] = c.beta2_ * v[i] + (1 - c.beta2_) * d * d;
+    Acc denom = std::sqrt(v[i]) * c.bias2_rsqrt_ + c.eps_;
+    p[i] = static_cast<T>(c.decay_ * x - c.step_size_ * m[i] / denom);
+  }
+}
+
+// out = in between two Vecs sharing a register type.
+template <typename VO, typename VI>
+void convert(typename VO::scalar *out, typename VI::scalar const *in,
+             std::size_t n)
+{
+  using To = typename VO::scalar;
+
+  std::size_t i{};
+  for (; i + VI::width <= n; i += VI::width)
+  {
+    VO::store(out + i, VI::load(in + i));
+  }
+  for (; i < n; ++i)
+  {
+    out[i] = static_cast<To>(static_cast<float>(in[i]));
+  }
+}
+
+//
+// MR x NR GEMM micro-kernel over packed panels (see gemm.hpp). Each row of
+// the tile is held in NR / width registers; full tiles with unit column
+// stride are written back with vector stores.
+//
+template <typename V, std::size_t MR, std::size_t NR>
+void gemm_micro_kernel(std::size_t kc, typename V::scalar const *a,
+                       typename V::scalar const *b, typename V::scalar *c,
+                       std::size_t rs_c, std::size_t cs_c,
+                       typename V::scalar beta, std::size_t mr, std::size_t nr)
+{
+  using T = typename V::scalar;
+  constexpr std::size_t NV = NR / V::width;
+  static_assert(NR % V::width == 0, "NR must be a multiple of the width");
+
+  typename V::reg acc[MR][NV];
+
+#pragma GCC unroll 16
+  for (std::size_t i{}; i < MR; ++i)
+  {
+#pragma GCC unroll 16
+    for (std::size_t v{}; v < NV; ++v)
+    {
+      acc[i][v] = V::zero();
+    }
+  }
+
+  for (std::size_t p{}; p < kc; ++p)
+  {
+    typename V::reg bv[NV];
+
+#pragma GCC unroll 16
+    for (std::size_t v{}; v < NV; ++v)
+    {
+      bv[v] = V::load(b + v * V::width);
+    }
+
+#pragma GCC unroll 16
+    for (std::size_t i{}; i < MR; ++i)
+    {
+      auto av = V::set1(a[i]);
+#pragma GCC unroll 16
+      for (std::size_t v{}; v < NV; ++v)
+      {
+        acc[i][v] = V::fmadd(av, bv[v], acc[i][v]);
+      }
+    }
+
+    a += MR;
+    b += NR;
+  }
+
+  if (mr == MR && nr == NR && cs_c == 1)
+  {
+    auto vbeta = V::set1(beta);
+
+    for (std::size_t i{}; i < MR; ++i)
+    {
+      for (std::size_t v{}; v < NV; ++v)
+      {
+        T *dst = c + i * rs_c + v * V::width;
+        auto r = acc[i][v];
+        if (beta != T{})
+        {
+          r = V::fmadd(vbeta, V::load(dst), r);
+        }
+        V::store(dst, r);
+      }
+    }
+    return;
+  }
+
+  T tile[MR][NR];
+  for (std::size_t i{}; i < MR; ++i)
+  {
+    for (std::size_t v{}; v < NV; ++v)
+    {
+      V::store(&tile[i][v * V::width], acc[i][v]);
+    }
+  }
+
+  for (std::size_t i{}; i < mr; ++i)
+  {
+    for (std::size_t j{}; j < nr; ++j)
+    {
+      T &dst = c[i * rs_c + j * cs_c];
+      dst = (beta == T{}) ? tile[i][j] : beta * dst + tile[i][j];
+    }
+  }
+}
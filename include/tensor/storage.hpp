@@ -0,0 +1,137 @@
+#pragma once
+
+#include "allocator.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// Tag selecting the constructors that skip zeroing.
+struct Uninitialized
+{
+};
+
+inline constexpr Uninitialized uninitialized{};
+
+//
+// Fixed-size, 64-byte aligned element buffer backing a tensor. Memory comes
+// from the CachingAllocator; the interface is the subset of std::vector the
+// library uses. A storage rebound into a larger one (see rebind) borrows its
+// elements from it instead, as does one built over memory someone else
+// owns, such as a mapped file.
+//
+template <typename T> class Storage
+{
+  static_assert(std::is_trivially_copyable_v<T>,
+                "Storage holds trivially copyable elements only");
+
+public:
+  using value_type = T;
+  using iterator = T *;
+  using const_iterator = T const *;
+
+  Storage() : data_{nullptr}, size_{0} {}
+
+  explicit Storage(std::size_t size) : Storage(size, T{}) {}
+
+  Storage(std::size_t size, T const &value)
+      : data_{allocate(size)}, size_{size}
+  {
+    std::fill_n(data_, size_, value);
+  }
+
+  Storage(std::size_t size, Uninitialized)
+      : data_{allocate(size)}, size_{size}
+  {
+  }
+
+  // Borrows size elements at data, keeping owner alive while it does.
+  Storage(T *data, std::size_t size, std::shared_ptr<void> owner)
+      : data_{data}, size_{size}, base_{std::move(owner)}
+  {
+  }
+
+  Storage(std::initializer_list<T> values)
+      : data_{allocate(values.size())}, size_{values.size()}
+  {
+    std::copy(values.begin(), values.end(), data_);
+  }
+
+  Storage(Storage const &other)
+      : data_{allocate(other.size_)}, size_{other.size_}
+  {
+    std::copy_n(other.data_, size_, data_);
+  }
+
+  Storage(Storage &&other) noexcept
+      : data_{std::exchange(other.data_, nullptr)},
+        size_{std::exchange(other.size_, 0)}, base_{std::move(other.base_)}
+  {
+  }
+
+  Storage &operator=(Storage other) noexcept
+  {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    std::swap(base_, other.base_);
+    return *this;
+  }
+
+  ~Storage() { release(); }
+
+  //
+  // Moves this buffer to the size() elements of base starting at offset,
+  // which it keeps alive, and frees its own block. Every tensor sharing
+  // this storage follows it; the elements are not carried over. The memory
+  // planner (graph.hpp) uses this to place buffers in one arena.
+  //
+  void rebind(std::shared_ptr<Storage> base, std::size_t offset)
+  {
+    T *data = base->data() + offset;
+    release();
+    data_ = data;
+    base_ = std::move(base);
+  }
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T *data() { return data_; }
+  T const *data() const { return data_; }
+
+  T &operator[](std::size_t i) { return data_[i]; }
+  T const &operator[](std::size_t i) const { return data_[i]; }
+
+  iterator begin() { return data_; }
+  iterator end() { return data_ + size_; }
+  const_iterator begin() const { return data_; }
+  const_iterator end() const { return data_ + size_; }
+
+  friend bool operator==(Storage const &lhs, Storage const &rhs)
+  {
+    return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end());
+  }
+
+private:
+  static T *allocate(std::size_t size)
+  {
+    return static_cast<T *>(
+        CachingAllocator::instance().allocate(size * sizeof(T)));
+  }
+
+  void release()
+  {
+    if (!base_)
+    {
+      CachingAllocator::instance().deallocate(data_, size_ * sizeof(T));
+    }
+    base_ = nullptr;
+  }
+
+  T *data_;
+  std::size_t size_;
+  std::shared_ptr<void> base_;
+};
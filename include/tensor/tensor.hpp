@@ -2,8 +2,126 @@
 
 #include "tensor_impl.hpp"
 
+#include <algorithm>
+#include <initializer_list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
 template <typename T> class Tensor;
 
+//
+// The structure of a graph in topological order: for each node, the
+// positions of its parents in that order. replay() walks a new graph from
+// its root along the recorded edges, checking that every node has the
+// recorded parents, and so recovers the order without a traversal.
+//
+template <typename T> class BackwardPlan
+{
+public:
+  bool empty() const { return parent_begin_.empty(); }
+
+  std::size_t size() const { return empty() ? 0 : parent_begin_.size() - 1; }
+
+  // Whether the last backward through this plan reused the recorded order.
+  bool last_replayed() const { return last_replayed_; }
+
+  void record(std::vector<std::shared_ptr<TensorImpl<T>>> const &topo)
+  {
+    std::unordered_map<TensorImpl<T> const *, std::uint32_t> position;
+    for (std::size_t i{}; i < topo.size(); ++i)
+    {
+      position.emplace(topo[i].get(), i);
+    }
+
+    parent_begin_.assign(1, 0);
+    parent_ids_.clear();
+
+    for (auto const &node : topo)
+    {
+      for (auto const &parent : node->parents_)
+      {
+        parent_ids_.push_back(position.at(parent.get()));
+      }
+      parent_begin_.push_back(parent_ids_.size());
+    }
+  }
+
+  //
+  // Fills topo with the graph rooted at root in recorded order. Returns
+  // false, leaving topo unspecified, if the graph differs from the recorded
+  // one.
+  //
+  bool replay(std::shared_ptr<TensorImpl<T>> const &root,
+              std::vector<std::shared_ptr<TensorImpl<T>>> &topo)
+  {
+    last_replayed_ = false;
+
+    if (empty())
+    {
+      return false;
+    }
+
+    std::size_t n = size();
+    std::uint64_t epoch = TensorImpl<T>::next_visit_epoch();
+
+    topo.assign(n, nullptr);
+    topo[n - 1] = root;
+    root->visit_epoch_.store(epoch, std::memory_order_relaxed);
+
+    // Children come after their parents, so each node is reached from a
+    // child before it is visited itself.
+    for (std::size_t i = n; i-- > 0;)
+    {
+      auto const &node = topo[i];
+      std::size_t begin = parent_begin_[i];
+      std::size_t count = parent_begin_[i + 1] - begin;
+
+      if (!node || node->parents_.size() != count)
+      {
+        return false;
+      }
+
+      for (std::size_t slot{}; slot < count; ++slot)
+      {
+        auto &parent = topo[parent_ids_[begin + slot]];
+
+        if (!parent)
+        {
+          // A node met at two recorded positions means shared structure
+          // the recorded graph did not have.
+          if (node->parents_[slot]->visit_epoch_.load(
+                  std::memory_order_relaxed) == epoch)
+          {
+            return false;
+          }
+          parent = node->parents_[slot];
+          parent->visit_epoch_.store(epoch, std::memory_order_relaxed);
+        }
+        else if (parent != node->parents_[slot])
+        {
+          return false;
+        }
+      }
+    }
+
+    last_replayed_ = true;
+    return true;
+  }
+
+  void clear()
+  {
+    parent_begin_.clear();
+    parent_ids_.clear();
+  }
+
+private:
+  // Node i's parents are parent_ids_[parent_begin_[i], parent_begin_[i + 1]).
+  std::vector<std::uint32_t> parent_begin_;
+  std::vector<std::uint32_t> parent_ids_;
+  bool last_replayed_{false};
+};
+
 template <typename T>
 std::ostream &operator<<(std::ostream &out, Tensor<T> const &t);
 
@@ -20,9 +138,17 @@ public:
   {
   }
 
+  Tensor(std::initializer_list<std::uint32_t> shape)
+      : Tensor(std::vector<std::uint32_t>(shape))
+  {
+  }
+
   Tensor(Tensor const &other) : impl_{other.impl_} {}
 
-  Tensor(TensorImpl<T> impl) : impl_{std::make_shared<TensorImpl<T>>(impl)} {}
+  Tensor(TensorImpl<T> impl)
+      : impl_{std::make_shared<TensorImpl<T>>(std::move(impl))}
+  {
+  }
 
   Tensor operator=(Tensor const &other)
   {
@@ -39,48 +165,242 @@ public:
     return (*impl_)[args...];
   }
 
-  void backward()
+  //
+  // Backpropagates from this tensor into every leaf that requires grad.
+  // Unless retain_graph, each node is released as soon as its backward has
+  // run (see TensorImpl::release_graph), so the intermediates only the
+  // graph kept alive are freed by the time backward returns, and a second
+  // backward through the same graph finds nothing to run.
+  //
+  void backward(bool retain_graph = false)
   {
-    if (!impl_->grad_)
+    seed_grad();
+    run_backward(topo_order(impl_), retain_graph);
+  }
+
+  //
+  // As backward(), but reuses the topological order recorded in plan when
+  // this graph has the same structure as the last one run through it, as in
+  // a training loop that rebuilds an identical graph every step.
+  //
+  void backward(BackwardPlan<T> &plan, bool retain_graph = false)
+  {
+    seed_grad();
+
+    std::vector<std::shared_ptr<TensorImpl<T>>> topo;
+
+    if (!plan.replay(impl_, topo))
     {
-      impl_->grad_ = std::make_shared<TensorImpl<T>>(impl_->shape_);
-      impl_->grad_->fill(static_cast<T>(1));
+      topo = topo_order(impl_);
+      plan.record(topo);
     }
 
-    std::vector<std::shared_ptr<TensorImpl<T>>> visited;
+    run_backward(topo, retain_graph);
+  }
+
+  //
+  // Nodes reachable from root with every node after its parents. The walk
+  // keeps an explicit stack so deep graphs cannot overflow the call stack,
+  // and marks nodes with a per-walk epoch instead of searching a visited
+  // list.
+  //
+  static std::vector<std::shared_ptr<TensorImpl<T>>>
+  topo_order(std::shared_ptr<TensorImpl<T>> const &root)
+  {
+    std::uint64_t epoch = TensorImpl<T>::next_visit_epoch();
+
+    using Frame = std::pair<std::shared_ptr<TensorImpl<T>> const *, std::size_t>;
+
     std::vector<std::shared_ptr<TensorImpl<T>>> topo;
+    std::vector<Frame> stack;
 
-    topoSort(impl_, visited, topo);
+    root->visit_epoch_.store(epoch, std::memory_order_relaxed);
+    stack.push_back({&root, 0});
 
-    for (auto it = topo.rbegin(); it != topo.rend(); ++it)
+    while (!stack.empty())
     {
-      if ((*it)->backward_)
+      auto &[node, next] = stack.back();
+      auto const &parents = (*node)->parents_;
+
+      if (next < parents.size())
       {
-        (*it)->backward_();
+        auto const &parent = parents[next++];
+        if (parent->visit_epoch_.load(std::memory_order_relaxed) != epoch)
+        {
+          parent->visit_epoch_.store(epoch, std::memory_order_relaxed);
+          stack.push_back({&parent, 0});
+        }
+        continue;
       }
+
+      topo.push_back(*node);
+      stack.pop_back();
     }
+
+    return topo;
   }
 
-  static void topoSort(std::shared_ptr<TensorImpl<T>> v,
-                       std::vector<std::shared_ptr<TensorImpl<T>>> &visited,
-                       std::vector<std::shared_ptr<TensorImpl<T>>> &topo)
+  friend std::ostream &operator<< <>(std::ostream &out, Tensor<T> const &t);
+
+private:
+  //
+  // Inner nodes still holding gradients from an earlier backward through a
+  // retained graph have passed them on already, so they start from zero.
+  // topo keeps every node alive until the walk is done, so releasing one
+  // never frees a node whose backward is still to run. Leaves have nothing
+  // to release and are left alone: a parameter a checkpoint captures is
+  // also walked by its recompute's backward, which may be running at the
+  // same time.
+  //
+  static void
+  run_backward(std::vector<std::shared_ptr<TensorImpl<T>>> const &topo,
+               bool retain_graph)
   {
-    if (std::find(visited.begin(), visited.end(), v) != visited.end())
+    for (std::size_t i{}; i + 1 < topo.size(); ++i)
+    {
+      if (topo[i]->backward_ && topo[i]->grad_)
+      {
+        topo[i]->grad_->fill(static_cast<T>(0));
+      }
+    }
+
+    if (ThreadPool::instance().num_threads() > 1)
+    {
+      run_backward_parallel(topo, retain_graph);
       return;
+    }
 
-    visited.push_back(v);
+    std::vector<std::shared_ptr<TensorImpl<T>>> released;
 
-    for (auto &parent : v->parents_)
+    for (auto it = topo.rbegin(); it != topo.rend(); ++it)
     {
-      topoSort(parent, visited, topo);
+      auto &node = **it;
+      if (node.backward_)
+      {
+        node.backward_();
+      }
+      if (!retain_graph && !node.parents_.empty())
+      {
+        node.release_graph(released);
+        released.clear();
+      }
     }
+  }
 
-    topo.push_back(v);
-  };
+  //
+  // Runs each node's backward once every child of it has run, in place of
+  // the reversed topological order: the dA and dB branches of a matmul's
+  // inputs, the heads of a multi-head layer or the members of an ensemble
+  // then backpropagate side by side. A node locks the gradients it
+  // accumulates into, those of its parents that require grad, while its
+  // backward runs, unless it sets locks_own_grads_.
+  //
+  // A node that readies several parents keeps one for its own thread and
+  // hands the others to the pool, so a chain runs on one thread without
+  // going through the pool at all. Gradients a node receives from several
+  // branches are summed in the order the branches finish, which can vary
+  // from run to run in the last bits; a single-threaded pool keeps the
+  // serial order. Leaves are not counted or scheduled, having no backward
+  // to run, so the walk writes nothing but their gradients.
+  //
+  static void run_backward_parallel(
+      std::vector<std::shared_ptr<TensorImpl<T>>> const &topo,
+      bool retain_graph)
+  {
+    for (auto const &node : topo)
+    {
+      if (!node->parents_.empty())
+      {
+        node->pending_children_.store(0, std::memory_order_relaxed);
+      }
+    }
+    for (auto const &node : topo)
+    {
+      for (auto const &parent : node->parents_)
+      {
+        if (!parent->parents_.empty())
+        {
+          parent->pending_children_.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
 
-  friend std::ostream &operator<< <>(std::ostream &out, Tensor<T> const &t);
+    TaskGroup group;
+
+    auto run = [&](TensorImpl<T> *node, auto &self) -> void
+    {
+      std::vector<std::shared_ptr<TensorImpl<T>>> released;
+
+      while (node)
+      {
+        if (node->backward_)
+        {
+          SmallVector<TensorImpl<T> *, 3> writes;
+          for (auto const &parent : node->parents_)
+          {
+            if (parent->requires_grad_ && !node->locks_own_grads_)
+            {
+              writes.push_back(parent.get());
+            }
+          }
+          std::sort(writes.begin(), writes.end());
+
+          SmallVector<std::unique_lock<std::mutex>, 3> locks;
+          for (std::size_t i{}; i < writes.size(); ++i)
+          {
+            if (i == 0 || writes[i] != writes[i - 1])
+            {
+              locks.push_back(std::unique_lock(writes[i]->grad_mutex_));
+            }
+          }
+
+          node->backward_();
+        }
+
+        TensorImpl<T> *next = nullptr;
+        for (auto const &parent : node->parents_)
+        {
+          if (parent->parents_.empty() ||
+              parent->pending_children_.fetch_sub(
+                  1, std::memory_order_acq_rel) != 1)
+          {
+            continue;
+          }
+
+          if (!next)
+          {
+            next = parent.get();
+          }
+          else
+          {
+            group.run([&self, ready = parent.get()]()
+                      { self(ready, self); });
+          }
+        }
+
+        if (!retain_graph && !node->parents_.empty())
+        {
+          node->release_graph(released);
+          released.clear();
+        }
+        node = next;
+      }
+    };
+
+    run(topo.back().get(), run);
+    group.wait();
+  }
+
+  void seed_grad()
+  {
+    if (!impl_->grad_)
+    {
+      impl_->grad_ =
+          std::make_shared<TensorImpl<T>>(impl_->shape_, uninitialized);
+      impl_->grad_->fill(static_cast<T>(1));
+    }
+  }
 
-private:
   std::shared_ptr<TensorImpl<T>> impl_;
 };
 
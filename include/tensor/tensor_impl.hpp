@@ -1,33 +1,73 @@
 #pragma once
 
+#include "gemm.hpp"
+#include "node.hpp"
+#include "reduce.hpp"
+#include "simd.hpp"
+#include "storage.hpp"
+#include "tensor_iterator.hpp"
+#include "thread_pool.hpp"
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <cstdint>
 #include <functional>
 #include <iomanip>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <numeric>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
 template <typename T> struct TensorImpl
 {
   std::vector<std::uint32_t> shape_;
   std::vector<std::uint32_t> stride_;
-  std::shared_ptr<std::vector<T>> data_;
+  std::shared_ptr<Storage<T>> data_;
+  std::size_t offset_;
 
   bool requires_grad_;
-  std::vector<std::shared_ptr<TensorImpl>> parents_;
+  SmallVector<std::shared_ptr<TensorImpl>, 3> parents_;
   std::shared_ptr<TensorImpl> grad_;
-  std::function<void()> backward_;
+  NodeFunction backward_;
+
+  // Recomputes this node's elements in place from parents_; set only by
+  // ops run under StaticGraph::capture (see graph.hpp).
+  NodeFunction forward_;
+
+  // Also recorded under capture, for the memory planner: the tensors whose
+  // elements backward_ reads, and an input forward_ may overwrite with the
+  // result once nothing else reads it.
+  SmallVector<TensorImpl *, 3> saved_;
+  TensorImpl *in_place_input_{nullptr};
+
+  // Last graph traversal that reached this node (see Tensor::topo_order).
+  // Checkpoint recomputes on parallel backward branches walk their graphs
+  // at once, and can meet the same captured parameter.
+  std::atomic<std::uint64_t> visit_epoch_{0};
+
+  // For the parallel backward (see Tensor::backward): children whose
+  // backward has yet to run, and a lock over grad_ for the ones that do.
+  std::atomic<std::uint32_t> pending_children_{0};
+  std::mutex grad_mutex_;
+
+  // Set on nodes whose backward_ locks the gradients it writes itself, so
+  // the parallel backward does not hold those locks around it: checkpoint
+  // runs a whole nested backward, which takes locks of its own.
+  bool locks_own_grads_{false};
 
   template <std::same_as<std::uint32_t>... Args>
   TensorImpl(Args... args)
       : shape_{args...}, stride_(shape_.size()),
-        data_(std::make_shared<std::vector<T>>(
+        data_(std::make_shared<Storage<T>>(
             std::accumulate(shape_.begin(), shape_.end(), 1,
                             std::multiplies<std::uint32_t>()))),
-        requires_grad_{false}, parents_{}, grad_{nullptr}, backward_{}
+        offset_{0}, requires_grad_{false}, parents_{}, grad_{nullptr},
+        backward_{}
   {
     std::transform(shape_.rbegin(), shape_.rend(), stride_.rbegin(),
                    [&, n = 1](const std::uint32_t dim) mutable
@@ -40,10 +80,11 @@ template <typename T> struct TensorImpl
 
   TensorImpl(std::vector<std::uint32_t> const &shape)
       : shape_{shape}, stride_(shape_.size()),
-        data_(std::make_shared<std::vector<T>>(
+        data_(std::make_shared<Storage<T>>(
             std::accumulate(shape_.begin(), shape_.end(), 1,
                             std::multiplies<std::uint32_t>()))),
-        requires_grad_{false}, parents_{}, grad_{nullptr}, backward_{}
+        offset_{0}, requires_grad_{false}, parents_{}, grad_{nullptr},
+        backward_{}
   {
     std::transform(shape_.rbegin(), shape_.rend(), stride_.rbegin(),
                    [&, n = 1](const std::uint32_t dim) mutable
@@ -54,14 +95,201 @@ template <typename T> struct TensorImpl
                    });
   }
 
+  //
+  // Leaves the elements uninitialized, for op outputs that are written in
+  // full before anything reads them. Every other constructor zeroes.
+  //
+  TensorImpl(std::vector<std::uint32_t> const &shape, Uninitialized)
+      : shape_{shape}, stride_{contiguous_strides(shape)},
+        data_(std::make_shared<Storage<T>>(
+            std::accumulate(shape.begin(), shape.end(), std::size_t{1},
+                            std::multiplies<std::size_t>()),
+            uninitialized)),
+        offset_{0}, requires_grad_{false}, parents_{}, grad_{nullptr},
+        backward_{}
+  {
+  }
+
+  //
+  // A view of existing storage: elements live at data_[offset_ + sum(index *
+  // stride_)]. The view starts with no autograd state of its own.
+  //
+  TensorImpl(std::shared_ptr<Storage<T>> data,
+             std::vector<std::uint32_t> shape,
+             std::vector<std::uint32_t> stride, std::size_t offset)
+      : shape_{std::move(shape)}, stride_{std::move(stride)},
+        data_{std::move(data)}, offset_{offset}, requires_grad_{false},
+        parents_{}, grad_{nullptr}, backward_{}
+  {
+  }
+
   TensorImpl(TensorImpl const &other)
       : shape_{other.shape_}, stride_{other.stride_}, data_{other.data_},
-        requires_grad_{other.requires_grad_}, parents_{other.parents_},
-        grad_{other.grad_}, backward_{other.backward_}
+        offset_{other.offset_}, requires_grad_{other.requires_grad_},
+        parents_{other.parents_}, grad_{other.grad_},
+        backward_{other.backward_}, forward_{other.forward_},
+        saved_{other.saved_}, in_place_input_{other.in_place_input_},
+        locks_own_grads_{other.locks_own_grads_}
+  {
+  }
+
+  TensorImpl(TensorImpl &&other) noexcept
+      : shape_{std::move(other.shape_)}, stride_{std::move(other.stride_)},
+        data_{std::move(other.data_)}, offset_{other.offset_},
+        requires_grad_{other.requires_grad_},
+        parents_{std::move(other.parents_)}, grad_{std::move(other.grad_)},
+        backward_{std::move(other.backward_)},
+        forward_{std::move(other.forward_)}, saved_{std::move(other.saved_)},
+        in_place_input_{other.in_place_input_},
+        locks_own_grads_{other.locks_own_grads_}
+  {
+  }
+
+  // As the constructors, these leave the traversal state and locks alone.
+  TensorImpl &operator=(TensorImpl const &other)
   {
+    if (this != &other)
+    {
+      shape_ = other.shape_;
+      stride_ = other.stride_;
+      data_ = other.data_;
+      offset_ = other.offset_;
+      requires_grad_ = other.requires_grad_;
+      parents_ = other.parents_;
+      grad_ = other.grad_;
+      backward_ = other.backward_;
+      forward_ = other.forward_;
+      saved_ = other.saved_;
+      in_place_input_ = other.in_place_input_;
+      locks_own_grads_ = other.locks_own_grads_;
+    }
+    return *this;
+  }
+
+  TensorImpl &operator=(TensorImpl &&other) noexcept
+  {
+    if (this != &other)
+    {
+      shape_ = std::move(other.shape_);
+      stride_ = std::move(other.stride_);
+      data_ = std::move(other.data_);
+      offset_ = other.offset_;
+      requires_grad_ = other.requires_grad_;
+      parents_ = std::move(other.parents_);
+      grad_ = std::move(other.grad_);
+      backward_ = std::move(other.backward_);
+      forward_ = std::move(other.forward_);
+      saved_ = std::move(other.saved_);
+      in_place_input_ = other.in_place_input_;
+      locks_own_grads_ = other.locks_own_grads_;
+    }
+    return *this;
   }
 
-  void fill(T const &val) { std::fill(data_->begin(), data_->end(), val); }
+  //
+  // Releasing a long graph through the shared_ptr chain would recurse once
+  // per node. Parents this node holds the last reference to are unlinked
+  // onto a local stack instead, so teardown depth stays constant.
+  //
+  ~TensorImpl()
+  {
+    if (parents_.empty())
+    {
+      return;
+    }
+
+    std::vector<std::shared_ptr<TensorImpl>> pending;
+    release_graph(pending);
+
+    while (!pending.empty())
+    {
+      auto node = std::move(pending.back());
+      pending.pop_back();
+
+      if (node && node.use_count() == 1)
+      {
+        node->release_graph(pending);
+      }
+    }
+  }
+
+  //
+  // Unlinks this node from the graph, moving its parents onto pending, and
+  // drops the closures and records that refer into it. The node keeps its
+  // elements and gradient and becomes a leaf.
+  //
+  void release_graph(std::vector<std::shared_ptr<TensorImpl>> &pending)
+  {
+    for (auto &parent : parents_)
+    {
+      pending.push_back(std::move(parent));
+    }
+    parents_.clear();
+    backward_ = nullptr;
+    forward_ = nullptr;
+    saved_.clear();
+    in_place_input_ = nullptr;
+    locks_own_grads_ = false;
+  }
+
+  // A fresh tag for visit_epoch_, distinct from every earlier one.
+  static std::uint64_t next_visit_epoch()
+  {
+    static std::atomic<std::uint64_t> epochs{0};
+    return ++epochs;
+  }
+
+  std::size_t numel() const
+  {
+    return std::accumulate(shape_.begin(), shape_.end(), std::size_t{1},
+                           std::multiplies<std::size_t>());
+  }
+
+  // First element of this tensor within its storage.
+  T *data_ptr() const { return data_->data() + offset_; }
+
+  static std::vector<std::uint32_t>
+  contiguous_strides(std::vector<std::uint32_t> const &shape)
+  {
+    std::vector<std::uint32_t> stride(shape.size());
+    std::uint32_t n = 1;
+    for (std::size_t d = shape.size(); d-- > 0;)
+    {
+      stride[d] = n;
+      n *= shape[d];
+    }
+    return stride;
+  }
+
+  // Row-major and dense; strides of size-1 dimensions are irrelevant.
+  bool is_contiguous() const
+  {
+    std::uint32_t n = 1;
+    for (std::size_t d = shape_.size(); d-- > 0;)
+    {
+      if (shape_[d] != 1 && stride_[d] != n)
+      {
+        return false;
+      }
+      n *= shape_[d];
+    }
+    return true;
+  }
+
+  void fill(T const &val)
+  {
+    TensorIterator<1> iter(shape_, {stride_});
+    T *out = data_ptr();
+
+    iter.for_each(
+        [&](auto const &offset, auto const &stride, std::size_t n)
+        {
+          for (std::size_t i{}; i < n; ++i)
+          {
+            out[offset[0] + i * stride[0]] = val;
+          }
+        });
+  }
 
   //
   // Subscribing to pytorch semantics:
@@ -125,12 +353,56 @@ template <typename T> struct TensorImpl
     return {shape_out, lhs_stride, rhs_stride};
   }
 
+  //
+  // out = op(in), elementwise over matching shapes.
+  //
+  template <typename Op>
+  static void unary_kernel(TensorImpl &out, TensorImpl const &in, Op op)
+  {
+    TensorIterator<2> iter(out.shape_, {out.stride_, in.stride_});
+
+    T *o = out.data_ptr();
+    T const *a = in.data_ptr();
+
+    iter.for_each(
+        [&](auto const &offset, auto const &stride, std::size_t n)
+        { unary_loop(o + offset[0], a + offset[1], stride, n, op); });
+  }
+
+  //
+  // out = op(lhs, rhs), elementwise over the broadcast of lhs and rhs, which
+  // must have out's shape. out may alias lhs for in-place updates.
+  //
+  template <typename Op>
+  static void binary_kernel(TensorImpl &out, TensorImpl const &lhs,
+                            TensorImpl const &rhs, Op op)
+  {
+    auto [shape_out, lhs_stride, rhs_stride] = broadcast_shapes(lhs, rhs);
+
+    if (out.shape_ != shape_out)
+    {
+      throw std::invalid_argument("Broadcast not compatible");
+    }
+
+    TensorIterator<3> iter(shape_out, {out.stride_, lhs_stride, rhs_stride});
+
+    T *o = out.data_ptr();
+    T const *a = lhs.data_ptr();
+    T const *b = rhs.data_ptr();
+
+    iter.for_each(
+        [&](auto const &offset, auto const &stride, std::size_t n)
+        {
+          binary_loop(o + offset[0], a + offset[1], b + offset[2], stride, n,
+                      op);
+        });
+  }
+
   TensorImpl operator-() const
   {
-    TensorImpl result = TensorImpl(this->shape_);
+    TensorImpl result(shape_, uninitialized);
 
-    std::transform(this->data_->begin(), this->data_->end(),
-                   result.data_->begin(), [](T const &a) { return -a; });
+    unary_kernel(result, *this, simd::Negate<T>{});
 
     return result;
   }
@@ -139,248 +411,865 @@ template <typename T> struct TensorImpl
   {
     auto [shape_out, lhs_stride, rhs_stride] = broadcast_shapes(*this, other);
 
-    TensorImpl result = TensorImpl(shape_out);
+    TensorImpl result(shape_out, uninitialized);
+
+    binary_kernel(result, *this, other, simd::Plus<T>{});
+
+    return result;
+  }
+
+  TensorImpl operator-(TensorImpl const &other) const
+  {
+    auto [shape_out, lhs_stride, rhs_stride] = broadcast_shapes(*this, other);
+
+    TensorImpl result(shape_out, uninitialized);
+
+    binary_kernel(result, *this, other, simd::Minus<T>{});
+
+    return result;
+  }
+
+  TensorImpl operator*(T const &val) const
+  {
+    TensorImpl result(shape_, uninitialized);
+
+    unary_kernel(result, *this, simd::Scale<T>{val});
+
+    return result;
+  }
+
+  void operator+=(TensorImpl const &other)
+  {
+    binary_kernel(*this, *this, other, simd::Plus<T>{});
+  }
+
+  void operator-=(TensorImpl const &other)
+  {
+    binary_kernel(*this, *this, other, simd::Minus<T>{});
+  }
+
+  void operator*=(T const &val)
+  {
+    unary_kernel(*this, *this, simd::Scale<T>{val});
+  }
+
+  template <std::same_as<std::uint32_t>... Args> T &operator[](Args... args)
+  {
+    if (sizeof...(args) != shape_.size())
+    {
+      throw std::invalid_argument("Number of arguments mismatch dimension");
+    }
+
+    std::array<std::uint32_t, sizeof...(args)> indices = {args...};
+
+    if (!std::equal(indices.begin(), indices.end(), shape_.begin(),
+                    [](std::uint32_t idx, std::uint32_t bound)
+                    { return idx < bound; }))
+    {
+      throw std::invalid_argument("Indices are out of bounds");
+    }
+
+    auto pos = std::inner_product(indices.begin(), indices.end(),
+                                  stride_.begin(), std::size_t{0});
+
+    return data_ptr()[pos];
+  }
+
+  //
+  // View ops. Each returns a tensor sharing this tensor's storage with a new
+  // shape, stride and offset; no element is copied.
+  //
+  TensorImpl as_strided(std::vector<std::uint32_t> shape,
+                        std::vector<std::uint32_t> stride,
+                        std::size_t offset) const
+  {
+    return TensorImpl(data_, std::move(shape), std::move(stride), offset);
+  }
+
+  TensorImpl transpose(std::uint32_t dimA, std::uint32_t dimB) const
+  {
+    if (dimA >= shape_.size() || dimB >= shape_.size())
+    {
+      throw std::invalid_argument("Dimensions are out of bounds");
+    }
 
-    const auto &lhs_data = *this->data_;
-    const auto &rhs_data = *other.data_;
+    TensorImpl result = as_strided(shape_, stride_, offset_);
 
-    std::vector<std::uint32_t> coord(shape_out.size());
+    std::swap(result.stride_[dimA], result.stride_[dimB]);
+    std::swap(result.shape_[dimA], result.shape_[dimB]);
 
-    for (std::size_t i{}; i < result.data_->size(); ++i)
+    return result;
+  }
+
+  // Result dimension d is this tensor's dimension dims[d].
+  TensorImpl permute(std::vector<std::uint32_t> const &dims) const
+  {
+    if (dims.size() != shape_.size())
     {
-      auto lhs_idx =
-          std::inner_product(coord.begin(), coord.end(), lhs_stride.begin(), 0);
-      auto rhs_idx =
-          std::inner_product(coord.begin(), coord.end(), rhs_stride.begin(), 0);
+      throw std::invalid_argument("Number of arguments mismatch dimension");
+    }
 
-      (*result.data_)[i] = lhs_data[lhs_idx] + rhs_data[rhs_idx];
+    std::vector<bool> seen(dims.size());
+    std::vector<std::uint32_t> shape(dims.size());
+    std::vector<std::uint32_t> stride(dims.size());
 
-      for (auto k = shape_out.size() - 1; k >= 0; --k)
+    for (std::size_t d{}; d < dims.size(); ++d)
+    {
+      if (dims[d] >= shape_.size() || seen[dims[d]])
       {
-        if (++coord[k] >= shape_out[k])
-        {
-          coord[k] = 0;
-        }
-        else
-        {
-          break;
-        }
+        throw std::invalid_argument("Invalid permutation");
       }
+      seen[dims[d]] = true;
+      shape[d] = shape_[dims[d]];
+      stride[d] = stride_[dims[d]];
     }
 
+    return as_strided(shape, stride, offset_);
+  }
+
+  // Reinterprets a contiguous tensor with a new shape of the same size.
+  TensorImpl view(std::vector<std::uint32_t> const &shape) const
+  {
+    if (std::accumulate(shape.begin(), shape.end(), std::size_t{1},
+                        std::multiplies<std::size_t>()) != numel())
+    {
+      throw std::invalid_argument("Shape does not match number of elements");
+    }
+
+    if (!is_contiguous())
+    {
+      throw std::invalid_argument("View requires a contiguous tensor");
+    }
+
+    return as_strided(shape, contiguous_strides(shape), offset_);
+  }
+
+  // Like view, but copies first when this tensor is not contiguous.
+  TensorImpl reshape(std::vector<std::uint32_t> const &shape) const
+  {
+    return is_contiguous() ? view(shape) : contiguous().view(shape);
+  }
+
+  // Elements start, start + step, ... below end along dim.
+  TensorImpl slice(std::uint32_t dim, std::uint32_t start, std::uint32_t end,
+                   std::uint32_t step = 1) const
+  {
+    if (dim >= shape_.size())
+    {
+      throw std::invalid_argument("Dimensions are out of bounds");
+    }
+
+    end = std::min(end, shape_[dim]);
+
+    if (step == 0 || start > end)
+    {
+      throw std::invalid_argument("Invalid slice");
+    }
+
+    TensorImpl result = as_strided(
+        shape_, stride_, offset_ + std::size_t{start} * stride_[dim]);
+
+    result.shape_[dim] = (end - start + step - 1) / step;
+    result.stride_[dim] *= step;
+
     return result;
   }
 
-  TensorImpl operator-(TensorImpl const &other) const
+  TensorImpl narrow(std::uint32_t dim, std::uint32_t start,
+                    std::uint32_t length) const
   {
-    auto [shape_out, lhs_stride, rhs_stride] = broadcast_shapes(*this, other);
+    if (dim >= shape_.size() || start + length > shape_[dim])
+    {
+      throw std::invalid_argument("Indices are out of bounds");
+    }
 
-    TensorImpl result = TensorImpl(shape_out);
+    return slice(dim, start, start + length);
+  }
 
-    const auto &lhs_data = *this->data_;
-    const auto &rhs_data = *other.data_;
+  //
+  // Broadcasts size-1 (or missing leading) dimensions to shape by giving
+  // them a stride of 0.
+  //
+  TensorImpl expand(std::vector<std::uint32_t> const &shape) const
+  {
+    if (shape.size() < shape_.size())
+    {
+      throw std::invalid_argument("Broadcast not compatible");
+    }
 
-    std::vector<std::uint32_t> coord(shape_out.size());
+    std::vector<std::uint32_t> stride(shape.size(), 0);
+    std::size_t lead = shape.size() - shape_.size();
 
-    for (std::size_t i{}; i < result.data_->size(); ++i)
+    for (std::size_t d{}; d < shape_.size(); ++d)
     {
-      auto lhs_idx =
-          std::inner_product(coord.begin(), coord.end(), lhs_stride.begin(), 0);
-      auto rhs_idx =
-          std::inner_product(coord.begin(), coord.end(), rhs_stride.begin(), 0);
+      if (shape_[d] == shape[lead + d])
+      {
+        stride[lead + d] = stride_[d];
+      }
+      else if (shape_[d] != 1)
+      {
+        throw std::invalid_argument("Broadcast not compatible");
+      }
+    }
 
-      (*result.data_)[i] = lhs_data[lhs_idx] - rhs_data[rhs_idx];
+    return as_strided(shape, stride, offset_);
+  }
+
+  // Drops every size-1 dimension.
+  TensorImpl squeeze() const
+  {
+    std::vector<std::uint32_t> shape;
+    std::vector<std::uint32_t> stride;
 
-      for (auto k = shape_out.size() - 1; k >= 0; --k)
+    for (std::size_t d{}; d < shape_.size(); ++d)
+    {
+      if (shape_[d] != 1)
       {
-        if (++coord[k] >= shape_out[k])
-        {
-          coord[k] = 0;
-        }
-        else
-        {
-          break;
-        }
+        shape.push_back(shape_[d]);
+        stride.push_back(stride_[d]);
       }
     }
 
-    return result;
+    return as_strided(shape, stride, offset_);
   }
 
-  TensorImpl operator*(T const &val) const
+  TensorImpl squeeze(std::uint32_t dim) const
   {
-    TensorImpl result = TensorImpl(this->shape_);
+    if (dim >= shape_.size())
+    {
+      throw std::invalid_argument("Dimensions are out of bounds");
+    }
+
+    TensorImpl result = as_strided(shape_, stride_, offset_);
 
-    std::transform(this->data_->begin(), this->data_->end(),
-                   result.data_->begin(),
-                   [val](T const &a) { return a * val; });
+    if (shape_[dim] == 1)
+    {
+      result.shape_.erase(result.shape_.begin() + dim);
+      result.stride_.erase(result.stride_.begin() + dim);
+    }
 
     return result;
   }
 
-  void operator+=(TensorImpl const &other)
+  TensorImpl unsqueeze(std::uint32_t dim) const
   {
-    auto [shape_out, lhs_stride, rhs_stride] = broadcast_shapes(*this, other);
-
-    if (this->shape_ != shape_out)
+    if (dim > shape_.size())
     {
-      throw std::invalid_argument("Broadcast not compatible");
+      throw std::invalid_argument("Dimensions are out of bounds");
     }
 
-    auto &lhs_data = *this->data_;
-    const auto &rhs_data = *other.data_;
+    TensorImpl result = as_strided(shape_, stride_, offset_);
 
-    std::vector<std::uint32_t> coord(shape_out.size());
+    std::uint32_t stride =
+        (dim < shape_.size()) ? stride_[dim] * shape_[dim] : 1;
+    result.shape_.insert(result.shape_.begin() + dim, 1);
+    result.stride_.insert(result.stride_.begin() + dim, stride);
 
-    for (std::size_t i{}; i < lhs_data.size(); ++i)
+    return result;
+  }
+
+  // This tensor if it is already contiguous, otherwise a dense copy.
+  TensorImpl contiguous() const
+  {
+    if (is_contiguous())
     {
-      auto rhs_idx =
-          std::inner_product(coord.begin(), coord.end(), rhs_stride.begin(), 0);
+      return as_strided(shape_, stride_, offset_);
+    }
 
-      lhs_data[i] += rhs_data[rhs_idx];
+    TensorImpl result(shape_, uninitialized);
 
-      for (auto k = shape_out.size() - 1; k >= 0; --k)
-      {
-        if (++coord[k] >= shape_out[k])
-        {
-          coord[k] = 0;
-        }
-        else
+    unary_kernel(result, *this, [](T const &a) { return a; });
+
+    return result;
+  }
+
+  // A dense copy that never shares storage with this tensor.
+  TensorImpl clone() const
+  {
+    TensorImpl result(shape_, uninitialized);
+
+    unary_kernel(result, *this, [](T const &a) { return a; });
+
+    return result;
+  }
+
+  // A dense copy converted to element type U.
+  template <typename U> TensorImpl<U> to() const
+  {
+    TensorImpl<U> result(shape_, uninitialized);
+
+    TensorIterator<2> iter(shape_, {result.stride_, stride_});
+    U *out = result.data_ptr();
+    T const *in = data_ptr();
+
+    iter.for_each(
+        [&](auto const &offset, auto const &stride, std::size_t n)
         {
-          break;
-        }
-      }
+          if (stride[0] == 1 && stride[1] == 1)
+          {
+            simd::convert(out + offset[0], in + offset[1], n);
+            return;
+          }
+
+          for (std::size_t i{}; i < n; ++i)
+          {
+            out[offset[0] + i * stride[0]] = static_cast<U>(
+                static_cast<accumulate_t<T>>(in[offset[1] + i * stride[1]]));
+          }
+        });
+
+    return result;
+  }
+
+  //
+  // Reductions. axes lists the dimensions to reduce, each at most once, and
+  // an empty list reduces all of them. keepdim leaves the reduced
+  // dimensions in place with size 1 instead of dropping them.
+  //
+  TensorImpl sum(std::vector<std::uint32_t> const &axes = {},
+                 bool keepdim = false) const
+  {
+    return reduce<SumReducer>(axes, keepdim);
+  }
+
+  // For 16-bit tensors, mean and norm finish in float too: a sum can
+  // overflow f16 where the mean or norm does not.
+  TensorImpl mean(std::vector<std::uint32_t> const &axes = {},
+                  bool keepdim = false) const
+  {
+    if constexpr (HalfPrecision<T>)
+    {
+      return to<float>().mean(axes, keepdim).template to<T>();
     }
+
+    auto result = sum(axes, keepdim);
+    result *= static_cast<T>(1) / static_cast<T>(reduced_count(axes));
+    return result;
   }
 
-  void operator-=(TensorImpl const &other)
+  TensorImpl max(std::vector<std::uint32_t> const &axes = {},
+                 bool keepdim = false) const
   {
-    auto [shape_out, lhs_stride, rhs_stride] = broadcast_shapes(*this, other);
+    check_nonempty(axes);
+    return reduce<MaxReducer>(axes, keepdim);
+  }
 
-    if (this->shape_ != shape_out)
+  TensorImpl min(std::vector<std::uint32_t> const &axes = {},
+                 bool keepdim = false) const
+  {
+    check_nonempty(axes);
+    return reduce<MinReducer>(axes, keepdim);
+  }
+
+  TensorImpl prod(std::vector<std::uint32_t> const &axes = {},
+                  bool keepdim = false) const
+  {
+    return reduce<ProdReducer>(axes, keepdim);
+  }
+
+  // Euclidean norm over axes.
+  TensorImpl norm(std::vector<std::uint32_t> const &axes = {},
+                  bool keepdim = false) const
+  {
+    if constexpr (HalfPrecision<T>)
     {
-      throw std::invalid_argument("Broadcast not compatible");
+      return to<float>().norm(axes, keepdim).template to<T>();
+    }
+
+    auto result = reduce<SumSquaresReducer>(axes, keepdim);
+
+    T *out = result.data_ptr();
+    for (std::size_t i{}; i < result.numel(); ++i)
+    {
+      out[i] = std::sqrt(out[i]);
     }
 
-    auto &lhs_data = *this->data_;
-    const auto &rhs_data = *other.data_;
+    return result;
+  }
 
-    std::vector<std::uint32_t> coord(shape_out.size());
+  // Position of the largest element along axis; the first one wins ties.
+  TensorImpl<std::int64_t> argmax(std::uint32_t axis,
+                                  bool keepdim = false) const
+  {
+    check_nonempty({axis});
 
-    for (std::size_t i{}; i < lhs_data.size(); ++i)
+    auto input = contiguous();
+    auto span = [&](std::size_t lo, std::size_t hi)
     {
-      auto rhs_idx =
-          std::inner_product(coord.begin(), coord.end(), rhs_stride.begin(), 0);
+      return std::accumulate(shape_.begin() + lo, shape_.begin() + hi,
+                             std::size_t{1}, std::multiplies<std::size_t>());
+    };
+
+    TensorImpl<std::int64_t> result(reduced_shape({axis}, keepdim),
+                                    uninitialized);
 
-      lhs_data[i] -= rhs_data[rhs_idx];
+    argmax_lanes(input.data_ptr(), result.data_ptr(), span(0, axis),
+                 shape_[axis], span(axis + 1, shape_.size()));
+
+    return result;
+  }
 
-      for (auto k = shape_out.size() - 1; k >= 0; --k)
+  // Position of the largest element in the flattened tensor.
+  TensorImpl<std::int64_t> argmax() const
+  {
+    check_nonempty({});
+
+    auto input = contiguous();
+    TensorImpl<std::int64_t> result(std::vector<std::uint32_t>{},
+                                    uninitialized);
+
+    argmax_lanes(input.data_ptr(), result.data_ptr(), 1, numel(), 1);
+
+    return result;
+  }
+
+  // This tensor's shape after reducing axes (see sum).
+  std::vector<std::uint32_t>
+  reduced_shape(std::vector<std::uint32_t> const &axes, bool keepdim) const
+  {
+    auto mask = reduced_dims(axes);
+
+    std::vector<std::uint32_t> shape;
+    for (std::size_t d{}; d < shape_.size(); ++d)
+    {
+      if (!mask[d])
       {
-        if (++coord[k] >= shape_out[k])
-        {
-          coord[k] = 0;
-        }
-        else
-        {
-          break;
-        }
+        shape.push_back(shape_[d]);
+      }
+      else if (keepdim)
+      {
+        shape.push_back(1);
       }
     }
+    return shape;
   }
 
-  void operator*=(T const &val) const
+  // Number of elements folded into each output of a reduction over axes.
+  std::size_t reduced_count(std::vector<std::uint32_t> const &axes) const
   {
-    std::transform(this->data_->begin(), this->data_->end(),
-                   this->data_->begin(), [val](T const &a) { return a * val; });
+    auto mask = reduced_dims(axes);
+
+    std::size_t count = 1;
+    for (std::size_t d{}; d < shape_.size(); ++d)
+    {
+      if (mask[d])
+      {
+        count *= shape_[d];
+      }
+    }
+    return count;
   }
 
-  template <std::same_as<std::uint32_t>... Args> T &operator[](Args... args)
+  //
+  // Sums this tensor down to shape, which must broadcast to this tensor's
+  // shape. Used to send gradients back through expand and broadcasting;
+  // when nothing needs summing the result is a view of this tensor.
+  //
+  TensorImpl sum_to(std::vector<std::uint32_t> const &shape) const
   {
-    if (sizeof...(args) != shape_.size())
+    if (shape.size() > shape_.size())
     {
-      throw std::invalid_argument("Number of arguments mismatch dimension");
+      throw std::invalid_argument("Broadcast not compatible");
     }
 
-    std::array<std::uint32_t, sizeof...(args)> indices = {args...};
+    std::size_t lead = shape_.size() - shape.size();
+    std::vector<std::uint32_t> axes;
+    std::vector<std::uint32_t> stride(shape.size());
 
-    if (!std::equal(indices.begin(), indices.end(), shape_.begin(),
-                    [](T const &idx, T const &bound) { return idx < bound; }))
+    for (std::size_t d{}; d < shape_.size(); ++d)
     {
-      throw std::invalid_argument("Indices are out of bounds");
+      std::uint32_t target = (d < lead) ? 1 : shape[d - lead];
+
+      if (target != shape_[d] && target != 1)
+      {
+        throw std::invalid_argument("Broadcast not compatible");
+      }
+
+      if (target != shape_[d])
+      {
+        axes.push_back(d);
+      }
+
+      if (d >= lead)
+      {
+        stride[d - lead] = stride_[d];
+      }
     }
 
-    auto pos =
-        std::inner_product(indices.begin(), indices.end(), stride_.begin(), 0u);
+    if (axes.empty())
+    {
+      // Only size-1 dimensions differ, and their strides are irrelevant.
+      return as_strided(shape, stride, offset_);
+    }
 
-    return (*data_)[pos];
+    return reduce<SumReducer>(axes, true).view(shape);
   }
 
-  TensorImpl transpose(std::uint32_t dimA, std::uint32_t dimB) const
+  // Adds src, summed down to this tensor's shape (see sum_to).
+  void add_reduced(TensorImpl const &src) { *this += src.sum_to(shape_); }
+
+  //
+  // Matrix product over the last two dimensions. Leading (batch)
+  // dimensions broadcast against each other as in numpy's @, and each pair
+  // of matrices is multiplied in place through its strides.
+  //
+  TensorImpl matmul(TensorImpl const &other) const
   {
-    if (dimA >= shape_.size() || dimB >= shape_.size())
+    std::size_t da = shape_.size();
+    std::size_t db = other.shape_.size();
+
+    if (da < 2 || db < 2)
     {
-      throw std::invalid_argument("Dimensions are out of bounds");
+      throw std::invalid_argument(
+          "MatMul not defined for tensors with fewer than 2 dimensions");
     }
 
-    TensorImpl result = TensorImpl(this->shape_);
+    // Batch shape: the broadcast of both operands' leading dimensions.
+    std::size_t batch_dims = std::max(da, db) - 2;
+    std::vector<std::uint32_t> shape(batch_dims + 2);
 
-    std::copy(this->data_->begin(), this->data_->end(), result.data_->begin());
+    for (std::size_t d{}; d < batch_dims; ++d)
+    {
+      std::size_t lead_a = batch_dims - (da - 2);
+      std::size_t lead_b = batch_dims - (db - 2);
+      std::uint32_t dim_a = (d >= lead_a) ? shape_[d - lead_a] : 1;
+      std::uint32_t dim_b = (d >= lead_b) ? other.shape_[d - lead_b] : 1;
 
-    std::swap(result.stride_[dimA], result.stride_[dimB]);
-    std::swap(result.shape_[dimA], result.shape_[dimB]);
+      if (dim_a != dim_b && dim_a != 1 && dim_b != 1)
+      {
+        throw std::invalid_argument("Broadcast not compatible");
+      }
+      shape[d] = std::max(dim_a, dim_b);
+    }
+
+    shape[batch_dims] = shape_[da - 2];
+    shape[batch_dims + 1] = other.shape_[db - 1];
+
+    // beta = 0: the GEMM stores every element of C without reading it.
+    TensorImpl result(shape, uninitialized);
+
+    batched_gemm(*this, other, false, false, static_cast<T>(0), result);
 
     return result;
   }
 
-  TensorImpl matmul(TensorImpl const &other) const
+  //
+  // act(this * weight + bias) with the bias add and activation applied by
+  // the GEMM epilogue on each tile as it is finished. bias is anything that
+  // expands to the output shape: a full matrix, a row or a vector.
+  //
+  TensorImpl linear(TensorImpl const &weight, TensorImpl const &bias,
+                    bool relu) const
   {
-    if (shape_.size() != 2 || other.shape_.size() != 2)
+    if (shape_.size() != 2 || weight.shape_.size() != 2)
     {
       throw std::invalid_argument("MatMul not defined for non-2D tensors");
     }
 
-    std::uint32_t K = shape_[1];
+    if (shape_[1] != weight.shape_[0])
+    {
+      throw std::invalid_argument("Inner dimensions must match");
+    }
+
+    TensorImpl result({shape_[0], weight.shape_[1]}, uninitialized);
 
-    if (K != other.shape_[0])
+    linear_kernel(*this, weight, bias, relu, result);
+
+    return result;
+  }
+
+  // out = act(input * weight + bias) into an existing M x N tensor.
+  static void linear_kernel(TensorImpl const &input, TensorImpl const &weight,
+                            TensorImpl const &bias, bool relu,
+                            TensorImpl &out)
+  {
+    std::uint32_t M = input.shape_[0];
+    std::uint32_t N = weight.shape_[1];
+    std::uint32_t K = input.shape_[1];
+
+    auto b = bias.expand({M, N});
+
+    auto run = [&](auto const &epilogue)
+    {
+      gemm<T>(M, N, K, input.data_ptr(), input.stride_[0], input.stride_[1],
+              weight.data_ptr(), weight.stride_[0], weight.stride_[1],
+              static_cast<T>(0), out.data_ptr(), out.stride_[0],
+              out.stride_[1], epilogue);
+    };
+
+    if (relu)
+    {
+      run(GemmBiasEpilogue<T, true>{b.data_ptr(), b.stride_[0], b.stride_[1]});
+    }
+    else
+    {
+      run(GemmBiasEpilogue<T, false>{b.data_ptr(), b.stride_[0],
+                                     b.stride_[1]});
+    }
+  }
+
+  //
+  // Accumulates op(a) * op(b) into this tensor, where op transposes the last
+  // two dimensions of its operand when requested. Transposition only swaps
+  // the strides handed to the GEMM, so no operand is copied. a and b
+  // broadcast over this tensor's batch dimensions.
+  //
+  void addmm(TensorImpl const &a, TensorImpl const &b, bool transpose_a,
+             bool transpose_b)
+  {
+    batched_gemm(a, b, transpose_a, transpose_b, static_cast<T>(1), *this);
+  }
+
+  //
+  // c[i] = beta * c[i] + op(a[i]) * op(b[i]) for every batch index i of c,
+  // with a and b broadcast over c's leading dimensions. Batches run in
+  // parallel, in groups large enough to be worth a task; each GEMM may
+  // split further on its own.
+  //
+  static void batched_gemm(TensorImpl const &a, TensorImpl const &b,
+                           bool transpose_a, bool transpose_b, T beta,
+                           TensorImpl &c)
+  {
+    std::size_t da = a.shape_.size();
+    std::size_t db = b.shape_.size();
+    std::size_t dc = c.shape_.size();
+
+    if (da < 2 || db < 2 || dc < 2)
+    {
+      throw std::invalid_argument(
+          "MatMul not defined for tensors with fewer than 2 dimensions");
+    }
+
+    std::size_t rs_a = a.stride_[da - (transpose_a ? 1 : 2)];
+    std::size_t cs_a = a.stride_[da - (transpose_a ? 2 : 1)];
+    std::size_t rs_b = b.stride_[db - (transpose_b ? 1 : 2)];
+    std::size_t cs_b = b.stride_[db - (transpose_b ? 2 : 1)];
+    std::size_t rs_c = c.stride_[dc - 2];
+    std::size_t cs_c = c.stride_[dc - 1];
+
+    std::uint32_t M = a.shape_[da - (transpose_a ? 1 : 2)];
+    std::uint32_t K = a.shape_[da - (transpose_a ? 2 : 1)];
+    std::uint32_t N = b.shape_[db - (transpose_b ? 2 : 1)];
+
+    if (K != b.shape_[db - (transpose_b ? 1 : 2)])
     {
       throw std::invalid_argument("Inner dimensions must match");
     }
 
-    std::uint32_t M = shape_[0];
-    std::uint32_t N = other.shape_[1];
+    if (c.shape_[dc - 2] != M || c.shape_[dc - 1] != N)
+    {
+      throw std::invalid_argument("Output shape mismatch");
+    }
+
+    if (dc == 2)
+    {
+      if (da != 2 || db != 2)
+      {
+        throw std::invalid_argument("Broadcast not compatible");
+      }
+
+      gemm<T>(M, N, K, a.data_ptr(), rs_a, cs_a, b.data_ptr(), rs_b, cs_b,
+              beta, c.data_ptr(), rs_c, cs_c);
+      return;
+    }
 
-    TensorImpl result(M, N);
+    std::vector<std::uint32_t> batch(c.shape_.begin(), c.shape_.end() - 2);
 
-    for (std::size_t i{}; i < M; ++i)
+    // Strides that walk an operand's matrices in c's batch order.
+    auto batch_stride = [&](TensorImpl const &t)
     {
-      for (std::size_t j{}; j < N; ++j)
+      std::size_t dims = t.shape_.size() - 2;
+      if (dims > batch.size())
+      {
+        throw std::invalid_argument("Broadcast not compatible");
+      }
+
+      std::size_t lead = batch.size() - dims;
+      std::vector<std::uint32_t> stride(batch.size(), 0);
+
+      for (std::size_t d{}; d < dims; ++d)
       {
-        auto idx = i * result.stride_[0] + j * result.stride_[1];
-        for (std::size_t k{}; k < K; ++k)
+        if (t.shape_[d] == batch[lead + d])
         {
-          auto a = (*this->data_)[i * this->stride_[0] + k * this->stride_[1]];
-          auto b = (*other.data_)[k * other.stride_[0] + j * other.stride_[1]];
-          (*result.data_)[idx] += a * b;
+          stride[lead + d] = t.stride_[d];
+        }
+        else if (t.shape_[d] != 1)
+        {
+          throw std::invalid_argument("Broadcast not compatible");
         }
       }
-    }
-
-    return result;
+      return stride;
+    };
+
+    std::vector<std::uint32_t> stride_c(c.stride_.begin(),
+                                        c.stride_.end() - 2);
+    TensorIterator<3> iter(batch,
+                           {stride_c, batch_stride(a), batch_stride(b)});
+
+    // Offsets of every batch's matrices, gathered once up front.
+    std::vector<std::array<std::size_t, 3>> offsets;
+    offsets.reserve(iter.numel());
+    iter.serial_for_each(0, iter.numel(),
+                         [&](auto const &offset, auto const &st, std::size_t n)
+                         {
+                           for (std::size_t i{}; i < n; ++i)
+                           {
+                             offsets.push_back({offset[0] + i * st[0],
+                                                offset[1] + i * st[1],
+                                                offset[2] + i * st[2]});
+                           }
+                         });
+
+    std::size_t work = std::max<std::size_t>(
+        1, std::size_t{M} * std::size_t{N} * std::size_t{K});
+
+    parallel_for(0, offsets.size(),
+                 std::max<std::size_t>(1, kGemmParallelWork / work),
+                 [&](std::size_t lo, std::size_t hi)
+                 {
+                   for (std::size_t i = lo; i < hi; ++i)
+                   {
+                     auto const &[oc, oa, ob] = offsets[i];
+                     gemm<T>(M, N, K, a.data_ptr() + oa, rs_a, cs_a,
+                             b.data_ptr() + ob, rs_b, cs_b, beta,
+                             c.data_ptr() + oc, rs_c, cs_c);
+                   }
+                 });
   }
 
   TensorImpl relu() const
   {
-    TensorImpl result(this->shape_);
+    TensorImpl result(shape_, uninitialized);
 
-    std::transform(result.data_->begin(), result.data_->end(),
-                   result.data_->begin(),
-                   [](T const &d) { return std::max(static_cast<T>(0), d); });
+    unary_kernel(result, *this, simd::Relu<T>{});
 
     return result;
   }
 
   template <typename U>
   friend std::ostream &operator<<(std::ostream &out, TensorImpl<U> const &impl);
+
+private:
+  template <typename U> friend struct TensorImpl;
+
+  // reduced_dims(axes)[d] is true when d is reduced.
+  std::vector<bool> reduced_dims(std::vector<std::uint32_t> const &axes) const
+  {
+    std::vector<bool> mask(shape_.size(), axes.empty());
+
+    for (auto axis : axes)
+    {
+      if (axis >= shape_.size() || mask[axis])
+      {
+        throw std::invalid_argument("Invalid reduction axes");
+      }
+      mask[axis] = true;
+    }
+    return mask;
+  }
+
+  // Max, min and argmax have no value over an empty set.
+  void check_nonempty(std::vector<std::uint32_t> const &axes) const
+  {
+    if (reduced_count(axes) == 0)
+    {
+      throw std::invalid_argument("Reduction over an empty dimension");
+    }
+  }
+
+  // 16-bit tensors are reduced in float and rounded once at the end.
+  template <template <typename> class ReducerFor>
+  TensorImpl reduce(std::vector<std::uint32_t> const &axes, bool keepdim) const
+  {
+    if constexpr (HalfPrecision<T>)
+    {
+      return to<float>()
+          .template reduce<ReducerFor>(axes, keepdim)
+          .template to<T>();
+    }
+    else
+    {
+      return reduce_passes<ReducerFor<T>>(axes, keepdim);
+    }
+  }
+
+  //
+  // Reduces axes one run of adjacent reduced dimensions at a time,
+  // innermost first, so every pass sees a dense [outer, R, inner] buffer.
+  // Passes after the first combine partial results with Reducer::Partial.
+  //
+  template <typename Reducer>
+  TensorImpl reduce_passes(std::vector<std::uint32_t> const &axes,
+                           bool keepdim) const
+  {
+    auto mask = reduced_dims(axes);
+    auto result_shape = reduced_shape(axes, keepdim);
+
+    auto input = contiguous();
+    std::vector<std::uint32_t> shape = shape_;
+
+    T const *src = input.data_ptr();
+    std::shared_ptr<Storage<T>> buffer;
+
+    for (;;)
+    {
+      std::size_t end = shape.size();
+      while (end > 0 && !mask[end - 1])
+      {
+        --end;
+      }
+
+      if (end == 0)
+      {
+        break;
+      }
+
+      std::size_t begin = end - 1;
+      while (begin > 0 && mask[begin - 1])
+      {
+        --begin;
+      }
+
+      auto span = [&](std::size_t lo, std::size_t hi)
+      {
+        return std::accumulate(shape.begin() + lo, shape.begin() + hi,
+                               std::size_t{1},
+                               std::multiplies<std::size_t>());
+      };
+
+      std::size_t outer = span(0, begin);
+      std::size_t R = span(begin, end);
+      std::size_t inner = span(end, shape.size());
+
+      auto next = std::make_shared<Storage<T>>(outer * inner, uninitialized);
+
+      if (!buffer)
+      {
+        reduce_lanes<Reducer>(src, next->data(), outer, R, inner);
+      }
+      else
+      {
+        reduce_lanes<typename Reducer::Partial>(src, next->data(), outer, R,
+                                                inner);
+      }
+
+      shape.erase(shape.begin() + begin, shape.begin() + end);
+      mask.erase(mask.begin() + begin, mask.begin() + end);
+
+      src = next->data();
+      buffer = std::move(next);
+    }
+
+    if (!buffer)
+    {
+      // Nothing to reduce: a 0-d tensor.
+      return clone();
+    }
+
+    auto stride = contiguous_strides(result_shape);
+    return TensorImpl(std::move(buffer), std::move(result_shape),
+                      std::move(stride), 0);
+  }
 };
 
 template <typename T>
@@ -401,9 +1290,10 @@ std::ostream &operator<<(std::ostream &out, TensorImpl<T> const &impl)
   out << '\n';
 
   out << "Data: ";
-  for (auto x : *impl.data_)
+  auto dense = impl.contiguous();
+  for (std::size_t i{}; i < dense.numel(); ++i)
   {
-    std::cout << x << ", ";
+    std::cout << dense.data_ptr()[i] << ", ";
   }
   out << '\n';
 
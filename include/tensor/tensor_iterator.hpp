@@ -0,0 +1,274 @@
+#pragma once
+
+#include "thread_pool.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//
+// Walks N operands over a common shape, each through its own element
+// strides (a stride of 0 broadcasts). Size-1 dimensions are dropped and
+// adjacent dimensions that are laid out back to back in every operand are
+// coalesced, so a same-shape contiguous op collapses to a single flat run.
+//
+// for_each hands the innermost dimension to the kernel as 1-D runs
+//
+//   loop(offsets, strides, n)
+//
+// where offsets holds each operand's element offset of the first element
+// and strides its inner stride. Offsets of the outer dimensions are updated
+// incrementally between runs rather than recomputed per element.
+//
+template <std::size_t N> class TensorIterator
+{
+public:
+  using Offsets = std::array<std::size_t, N>;
+
+  TensorIterator(std::vector<std::uint32_t> const &shape,
+                 std::array<std::vector<std::uint32_t>, N> const &strides)
+      : numel_{1}
+  {
+    for (std::size_t d{}; d < shape.size(); ++d)
+    {
+      numel_ *= shape[d];
+
+      if (shape[d] == 1)
+      {
+        continue;
+      }
+
+      bool mergeable = !shape_.empty();
+      for (std::size_t op{}; op < N && mergeable; ++op)
+      {
+        mergeable = strides_[op].back() ==
+                    static_cast<std::size_t>(strides[op][d]) * shape[d];
+      }
+
+      if (mergeable)
+      {
+        shape_.back() *= shape[d];
+        for (std::size_t op{}; op < N; ++op)
+        {
+          strides_[op].back() = strides[op][d];
+        }
+        continue;
+      }
+
+      shape_.push_back(shape[d]);
+      for (std::size_t op{}; op < N; ++op)
+      {
+        strides_[op].push_back(strides[op][d]);
+      }
+    }
+
+    if (shape_.empty())
+    {
+      shape_.push_back(1);
+      for (std::size_t op{}; op < N; ++op)
+      {
+        strides_[op].push_back(0);
+      }
+    }
+  }
+
+  std::size_t numel() const { return numel_; }
+
+  std::size_t ndim() const { return shape_.size(); }
+
+  // True when every operand is traversed as one dense run.
+  bool is_contiguous() const
+  {
+    if (shape_.size() != 1)
+    {
+      return false;
+    }
+
+    for (std::size_t op{}; op < N; ++op)
+    {
+      if (strides_[op][0] != 1)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  template <typename Loop>
+  void for_each(Loop &&loop, std::size_t grain = kGrainSize) const
+  {
+    parallel_for(0, numel_, grain, [&](std::size_t begin, std::size_t end)
+                 { serial_for_each(begin, end, loop); });
+  }
+
+  //
+  // Visits the flat index range [begin, end) of the iteration space.
+  //
+  template <typename Loop>
+  void serial_for_each(std::size_t begin, std::size_t end, Loop &&loop) const
+  {
+    if (begin >= end)
+    {
+      return;
+    }
+
+    std::size_t inner = shape_.size() - 1;
+    std::size_t inner_size = shape_[inner];
+
+    Offsets inner_strides;
+    for (std::size_t op{}; op < N; ++op)
+    {
+      inner_strides[op] = strides_[op][inner];
+    }
+
+    // Position of begin in the outer dimensions.
+    std::vector<std::size_t> coord(inner);
+    std::size_t rest = begin / inner_size;
+    std::size_t i = begin % inner_size;
+
+    Offsets offsets{};
+    for (std::size_t d = inner; d-- > 0;)
+    {
+      coord[d] = rest % shape_[d];
+      rest /= shape_[d];
+
+      for (std::size_t op{}; op < N; ++op)
+      {
+        offsets[op] += coord[d] * strides_[op][d];
+      }
+    }
+
+    std::size_t pos = begin;
+    while (pos < end)
+    {
+      std::size_t n = std::min(inner_size - i, end - pos);
+
+      Offsets run = offsets;
+      for (std::size_t op{}; op < N; ++op)
+      {
+        run[op] += i * inner_strides[op];
+      }
+
+      loop(run, inner_strides, n);
+
+      pos += n;
+      i = 0;
+
+      for (std::size_t d = inner; d-- > 0;)
+      {
+        if (++coord[d] < shape_[d])
+        {
+          for (std::size_t op{}; op < N; ++op)
+          {
+            offsets[op] += strides_[op][d];
+          }
+          break;
+        }
+
+        coord[d] = 0;
+        for (std::size_t op{}; op < N; ++op)
+        {
+          offsets[op] -= (shape_[d] - 1) * strides_[op][d];
+        }
+      }
+    }
+  }
+
+private:
+  std::vector<std::size_t> shape_;
+  std::array<std::vector<std::size_t>, N> strides_;
+  std::size_t numel_;
+};
+
+//
+// 1-D loops for TensorIterator runs. The dense and scalar-broadcast cases
+// go to the functor's dense forms when it has them (see simd.hpp) and to
+// flat loops otherwise; everything else falls back to strided indexing.
+//
+template <typename T, typename Op>
+void unary_loop(T *out, T const *in, std::array<std::size_t, 2> const &stride,
+                std::size_t n, Op const &op)
+{
+  if (stride[0] == 1 && stride[1] == 1)
+  {
+    if constexpr (requires { op.dense(out, in, n); })
+    {
+      op.dense(out, in, n);
+    }
+    else
+    {
+      for (std::size_t i{}; i < n; ++i)
+      {
+        out[i] = op(in[i]);
+      }
+    }
+    return;
+  }
+
+  for (std::size_t i{}; i < n; ++i)
+  {
+    out[i * stride[0]] = op(in[i * stride[1]]);
+  }
+}
+
+template <typename T, typename Op>
+void binary_loop(T *out, T const *lhs, T const *rhs,
+                 std::array<std::size_t, 3> const &stride, std::size_t n,
+                 Op const &op)
+{
+  if (stride[0] == 1 && stride[1] == 1 && stride[2] == 1)
+  {
+    if constexpr (requires { op.dense(out, lhs, rhs, n); })
+    {
+      op.dense(out, lhs, rhs, n);
+    }
+    else
+    {
+      for (std::size_t i{}; i < n; ++i)
+      {
+        out[i] = op(lhs[i], rhs[i]);
+      }
+    }
+    return;
+  }
+
+  if (stride[0] == 1 && stride[1] == 1 && stride[2] == 0)
+  {
+    T const r = *rhs;
+    if constexpr (requires { op.dense_scalar_rhs(out, lhs, r, n); })
+    {
+      op.dense_scalar_rhs(out, lhs, r, n);
+    }
+    else
+    {
+      for (std::size_t i{}; i < n; ++i)
+      {
+        out[i] = op(lhs[i], r);
+      }
+    }
+    return;
+  }
+
+  if (stride[0] == 1 && stride[1] == 0 && stride[2] == 1)
+  {
+    T const l = *lhs;
+    if constexpr (requires { op.dense_scalar_lhs(out, l, rhs, n); })
+    {
+      op.dense_scalar_lhs(out, l, rhs, n);
+    }
+    else
+    {
+      for (std::size_t i{}; i < n; ++i)
+      {
+        out[i] = op(l, rhs[i]);
+      }
+    }
+    return;
+  }
+
+  for (std::size_t i{}; i < n; ++i)
+  {
+    out[i * stride[0]] = op(lhs[i * stride[1]], rhs[i * stride[2]]);
+  }
+}
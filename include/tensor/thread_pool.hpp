@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//
+// Elementwise kernels below this many elements run on the calling thread;
+// dispatching smaller ranges costs more than it saves.
+//
+inline constexpr std::size_t kGrainSize = 32768;
+
+class TaskGroup;
+
+//
+// Work-stealing pool. Each worker owns a deque: it pushes and pops its own
+// tasks at the back and steals from the front of the others when idle.
+// Threads outside the pool submit through a shared injection queue. The
+// calling thread always takes part in the work it forks, so a pool of N
+// threads spawns N - 1 workers.
+//
+class ThreadPool
+{
+public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(std::size_t num_threads)
+  {
+    num_threads = std::max<std::size_t>(num_threads, 1);
+
+    // One queue per worker plus the injection queue at the end.
+    for (std::size_t i{}; i < num_threads; ++i)
+    {
+      queues_.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (std::size_t i{}; i + 1 < num_threads; ++i)
+    {
+      workers_.emplace_back([this, i]() { worker_loop(i); });
+    }
+  }
+
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool &operator=(ThreadPool const &) = delete;
+
+  ~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+
+    for (auto &worker : workers_)
+    {
+      worker.join();
+    }
+  }
+
+  static ThreadPool &instance() { return *holder(); }
+
+  //
+  // Replaces the library-wide pool. Must not be called while kernels are
+  // running on the current pool.
+  //
+  static void set_num_threads(std::size_t num_threads)
+  {
+    auto &pool = holder();
+    pool.reset();
+    pool = std::make_unique<ThreadPool>(num_threads);
+  }
+
+  static std::size_t default_num_threads()
+  {
+    if (char const *env = std::getenv("TENSOR_NUM_THREADS"))
+    {
+      if (auto n = std::strtoul(env, nullptr, 10); n > 0)
+      {
+        return n;
+      }
+    }
+
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  std::size_t num_threads() const { return workers_.size() + 1; }
+
+  void submit(TaskGroup *group, Task task)
+  {
+    auto &queue = local_queue();
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex_);
+      queue.tasks_.push_back({group, std::move(task)});
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      ++queued_;
+    }
+    wake_.notify_one();
+  }
+
+  //
+  // Runs the most recently submitted task of the calling thread if it
+  // belongs to group. Waiters only help with their own group so that a
+  // kernel never re-enters unrelated work while its scratch state is live.
+  //
+  bool run_one(TaskGroup const *group)
+  {
+    auto &queue = local_queue();
+    Entry entry;
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex_);
+      if (queue.tasks_.empty() || queue.tasks_.back().group_ != group)
+      {
+        return false;
+      }
+      entry = std::move(queue.tasks_.back());
+      queue.tasks_.pop_back();
+    }
+    --queued_;
+    execute(entry);
+    return true;
+  }
+
+private:
+  struct Entry
+  {
+    TaskGroup *group_{nullptr};
+    Task task_;
+  };
+
+  struct WorkQueue
+  {
+    std::mutex mutex_;
+    std::deque<Entry> tasks_;
+  };
+
+  static std::unique_ptr<ThreadPool> &holder()
+  {
+    static std::unique_ptr<ThreadPool> pool =
+        std::make_unique<ThreadPool>(default_num_threads());
+    return pool;
+  }
+
+  static ThreadPool *&current_pool()
+  {
+    thread_local ThreadPool *pool = nullptr;
+    return pool;
+  }
+
+  static std::size_t &current_index()
+  {
+    thread_local std::size_t index = 0;
+    return index;
+  }
+
+  WorkQueue &local_queue()
+  {
+    if (current_pool() == this)
+    {
+      return *queues_[current_index()];
+    }
+    return *queues_.back();
+  }
+
+  bool try_pop(std::size_t index, Entry &entry)
+  {
+    auto &own = *queues_[index];
+    {
+      std::lock_guard<std::mutex> lock(own.mutex_);
+      if (!own.tasks_.empty())
+      {
+        entry = std::move(own.tasks_.back());
+        own.tasks_.pop_back();
+        return true;
+      }
+    }
+
+    for (std::size_t i = 1; i < queues_.size(); ++i)
+    {
+      auto &victim = *queues_[(index + i) % queues_.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex_);
+      if (!victim.tasks_.empty())
+      {
+        entry = std::move(victim.tasks_.front());
+        victim.tasks_.pop_front();
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void worker_loop(std::size_t index)
+  {
+    current_pool() = this;
+    current_index() = index;
+
+    while (true)
+    {
+      Entry entry;
+      if (try_pop(index, entry))
+      {
+        --queued_;
+        execute(entry);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [this]() { return stop_ || queued_ > 0; });
+      if (stop_ && queued_ == 0)
+      {
+        return;
+      }
+    }
+  }
+
+  static void execute(Entry &entry);
+
+  std::vector<std::unique_ptr<WorkQueue>> queues_;
+  std::vector<std::thread> workers_;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  std::atomic<std::size_t> queued_{0};
+  bool stop_{false};
+};
+
+//
+// Fork-join scope: tasks run on the pool and wait() blocks until all of
+// them finished, helping with the group's own queued tasks meanwhile. The
+// first exception thrown by a task is rethrown from wait().
+//
+class TaskGroup
+{
+public:
+  explicit TaskGroup(ThreadPool &pool = ThreadPool::instance()) : pool_{pool}
+  {
+  }
+
+  TaskGroup(TaskGroup const &) = delete;
+  TaskGroup &operator=(TaskGroup const &) = delete;
+
+  ~TaskGroup() { join(); }
+
+  void run(ThreadPool::Task task)
+  {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    pool_.submit(this, std::move(task));
+  }
+
+  void wait()
+  {
+    join();
+
+    if (error_)
+    {
+      std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+  }
+
+private:
+  friend class ThreadPool;
+
+  void join()
+  {
+    while (pending_.load(std::memory_order_acquire) > 0)
+    {
+      if (!pool_.run_one(this))
+      {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  void finish(std::exception_ptr error)
+  {
+    if (error)
+    {
+      std::lock_guard<std::mutex> lock(error_mutex_);
+      if (!error_)
+      {
+        error_ = error;
+      }
+    }
+    pending_.fetch_sub(1, std::memory_order_release);
+  }
+
+  ThreadPool &pool_;
+  std::atomic<std::size_t> pending_{0};
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+};
+
+inline void ThreadPool::execute(Entry &entry)
+{
+  std::exception_ptr error;
+  try
+  {
+    entry.task_();
+  }
+  catch (...)
+  {
+    error = std::current_exception();
+  }
+  entry.group_->finish(error);
+}
+
+inline std::size_t get_num_threads()
+{
+  return ThreadPool::instance().num_threads();
+}
+
+inline void set_num_threads(std::size_t num_threads)
+{
+  ThreadPool::set_num_threads(num_threads);
+}
+
+//
+// Calls fn(chunk_begin, chunk_end) over [begin, end) split into chunks of at
+// least grain iterations. Ranges no larger than grain, and single-threaded
+// pools, run inline on the calling thread without touching the pool.
+//
+template <typename Fn>
+void parallel_for(std::size_t begin, std::size_t end, std::size_t grain,
+                  Fn &&fn)
+{
+  if (end <= begin)
+  {
+    return;
+  }
+
+  std::size_t n = end - begin;
+  auto &pool = ThreadPool::instance();
+  grain = std::max<std::size_t>(grain, 1);
+
+  if (n <= grain || pool.num_threads() == 1)
+  {
+    fn(begin, end);
+    return;
+  }
+
+  // Over-decompose a little so that stealing can even out imbalance.
+  std::size_t chunks =
+      std::min((n + grain - 1) / grain, 4 * pool.num_threads());
+  std::size_t chunk = (n + chunks - 1) / chunks;
+
+  TaskGroup group(pool);
+
+  for (std::size_t lo = begin + chunk; lo < end; lo += chunk)
+  {
+    std::size_t hi = std::min(lo + chunk, end);
+    group.run([&fn, lo, hi]() { fn(lo, hi); });
+  }
+
+  fn(begin, std::min(begin + chunk, end));
+
+  group.wait();
+}
+
+//
+// Reduces map(chunk_begin, chunk_end) over [begin, end) with combine. The
+// partial results are combined in chunk order, so the result does not depend
+// on scheduling.
+//
+template <typename R, typename Map, typename Combine>
+R parallel_reduce(std::size_t begin, std::size_t end, std::size_t grain,
+                  R identity, Map &&map, Combine &&combine)
+{
+  if (end <= begin)
+  {
+    return identity;
+  }
+
+  std::size_t n = end - begin;
+  auto &pool = ThreadPool::instance();
+  grain = std::max<std::size_t>(grain, 1);
+
+  if (n <= grain || pool.num_threads() == 1)
+  {
+    return combine(identity, map(begin, end));
+  }
+
+  std::size_t chunks = std::min((n + grain - 1) / grain, pool.num_threads());
+  std::size_t chunk = (n + chunks - 1) / chunks;
+  std::vector<R> partials(chunks, identity);
+
+  parallel_for(0, chunks, 1,
+               [&](std::size_t lo, std::size_t hi)
+               {
+                 for (std::size_t c = lo; c < hi; ++c)
+                 {
+                   std::size_t b = begin + c * chunk;
+                   std::size_t e = std::min(b + chunk, end);
+                   if (b < e)
+                   {
+                     partials[c] = map(b, e);
+                   }
+                 }
+               });
+
+  R result = identity;
+  for (auto const &partial : partials)
+  {
+    result = combine(result, partial);
+  }
+  return result;
+}
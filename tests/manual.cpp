@@ -1,21 +1,18 @@
-#include "tensor/tensor.h"
-#include "tensor/ops.h"
-#include "tensor/loss.h"
-#include "tensor/sgd.h"
+#include "tensor/tensor.hpp"
+#include "tensor/data_loader.hpp"
+#include "tensor/ops.hpp"
+#include "tensor/loss.hpp"
+#include "tensor/parameter_arena.hpp"
+#include "tensor/sgd.hpp"
 
 int main() {
-    Tensor<float> x({4, 2});
-
-    x[0u,0u] = 0.0f; x[0u,1u] = 1.0f;
-    x[1u,0u] = 0.0f; x[1u,1u] = 1.0f;
-    x[2u,0u] = 1.0f; x[2u,1u] = 0.0f;
-    x[3u,0u] = 1.0f; x[3u,1u] = 1.0f;
-
-    Tensor<float> y({4, 1});
-    y[0u,0u] = 0.0f; 
-    y[1u,0u] = 1.0f; 
-    y[2u,0u] = 1.0f;
-    y[3u,0u] = 0.0f; 
+    // Two inputs, then the target, per record.
+    DataLoader<float> loader(memory_records<float>({0.0f, 1.0f, 0.0f,
+                                                    0.0f, 1.0f, 1.0f,
+                                                    1.0f, 0.0f, 1.0f,
+                                                    1.0f, 1.0f, 0.0f}, 3),
+                             2, {.batch_size = 4, .shuffle = false});
+    Batch<float> batch;
 
     Tensor<float> w1({2, 4}); 
     (*w1.impl()->data_) = {0.1f, -0.2f, 0.3f, 0.5f, -0.5f, 0.2f, 0.1f, -0.1f};
@@ -34,31 +31,36 @@ int main() {
     b2.fill(0.0f);
     b2.impl()->requires_grad_ = true;
 
-    SGD<float> optim({w1, b1, w2, b2}, 0.1f); // Learning Rate = 0.1
+    ParameterArena<float> arena({w1, b1, w2, b2});
+    SGD<float> optim({arena.flat()}, 0.1f); // Learning Rate = 0.1
     MSELoss<float> criterion;
 
     for (int epoch = 0; epoch < 1000; ++epoch) {
-        optim.reset_grad();
+        while (loader.next(batch)) {
+            arena.zero_grad();
+
+            Tensor<float> h1 = linear_relu(batch.inputs_, w1, b1); // 4x4
 
-        auto h1_linear = add(matmul(x, w1), b1); //4x4
-        
-        Tensor<float> h1 = relu(h1_linear); // 4x4
-        
-        auto pred = add(matmul(h1, w2), b2); 
+            auto pred = linear(h1, w2, b2);
 
-        auto loss = criterion(pred, y);
+            auto loss = criterion(pred, batch.targets_);
 
-        loss.backward();
+            loss.backward();
 
-        optim.step();
+            optim.step();
 
-        if (epoch % 100 == 0) {
-            std::cout << "Epoch " << epoch << " | Loss: " << (*loss.impl()->data_)[0] << "\n";
+            if (epoch % 100 == 0) {
+                std::cout << "Epoch " << epoch << " | Loss: " << (*loss.impl()->data_)[0] << "\n";
+            }
         }
     }
 
     std::cout << "\n--- Final Predictions ---\n";
-    auto final_pred = add(matmul(add(matmul(x, w1), b1), w2), b2); 
+    NoGradGuard no_grad;
+    loader.next(batch);
+    Tensor<float> x = batch.inputs_;
+    Tensor<float> y = batch.targets_;
+    auto final_pred = linear(linear_relu(x, w1, b1), w2, b2); 
     for(size_t i=0; i<4; ++i) {
         std::cout << "Input " << i << ": " << (*final_pred.impl()->data_)[i] << " (Target: " << (*y.impl()->data_)[i] << ")\n";
     }
@@ -1,3 +1,2394 @@
 #include <gtest/gtest.h>
 
-#include "tensor/tensor.h"
+#include "tensor/adam.hpp"
+#include "tensor/checkpoint.hpp"
+#include "tensor/data_loader.hpp"
+#include "tensor/graph.hpp"
+#include "tensor/lazy.hpp"
+#include "tensor/loss.hpp"
+#include "tensor/ops.hpp"
+#include "tensor/parameter_arena.hpp"
+#include "tensor/quantize.hpp"
+#include "tensor/serialize.hpp"
+#include "tensor/sgd.hpp"
+#include "tensor/tensor.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+namespace
+{
+
+template <typename T> void fill_random(TensorImpl<T> &t, unsigned seed)
+{
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<T> dist(-1, 1);
+  for (auto &x : *t.data_)
+  {
+    x = dist(gen);
+  }
+}
+
+template <typename T>
+T naive_matmul_at(TensorImpl<T> const &a, TensorImpl<T> const &b,
+                  std::size_t i, std::size_t j)
+{
+  T acc{};
+  for (std::size_t k{}; k < a.shape_[1]; ++k)
+  {
+    acc += a.data_ptr()[i * a.stride_[0] + k * a.stride_[1]] *
+           b.data_ptr()[k * b.stride_[0] + j * b.stride_[1]];
+  }
+  return acc;
+}
+
+// Sets the library's thread count for one test and restores it after, so
+// later tests keep the count TENSOR_NUM_THREADS asked for.
+class ScopedThreads
+{
+public:
+  explicit ScopedThreads(std::size_t threads) : previous_{get_num_threads()}
+  {
+    if (threads != previous_)
+    {
+      set_num_threads(threads);
+    }
+  }
+
+  ~ScopedThreads()
+  {
+    if (get_num_threads() != previous_)
+    {
+      set_num_threads(previous_);
+    }
+  }
+
+  ScopedThreads(ScopedThreads const &) = delete;
+  ScopedThreads &operator=(ScopedThreads const &) = delete;
+
+private:
+  std::size_t previous_;
+};
+
+// Likewise for the SIMD level, so later tests keep the one TENSOR_SIMD
+// asked for.
+class ScopedLevel
+{
+public:
+  explicit ScopedLevel(simd::Level wanted = simd::level())
+      : previous_{simd::level()}
+  {
+    simd::set_level(wanted);
+  }
+
+  ~ScopedLevel() { simd::set_level(previous_); }
+
+  ScopedLevel(ScopedLevel const &) = delete;
+  ScopedLevel &operator=(ScopedLevel const &) = delete;
+
+private:
+  simd::Level previous_;
+};
+
+} // namespace
+
+TEST(Gemm, MatchesNaiveAcrossBlockBoundaries)
+{
+  TensorImpl<float> a(131u, 300u);
+  TensorImpl<float> b(300u, 37u);
+  fill_random(a, 1);
+  fill_random(b, 2);
+
+  auto c = a.matmul(b);
+
+  for (std::size_t i{}; i < 131; ++i)
+  {
+    for (std::size_t j{}; j < 37; ++j)
+    {
+      EXPECT_NEAR((*c.data_)[i * 37 + j], naive_matmul_at(a, b, i, j), 1e-4);
+    }
+  }
+}
+
+TEST(Gemm, ConsumesTransposedStrides)
+{
+  TensorImpl<double> a(64u, 50u);
+  TensorImpl<double> b(70u, 64u);
+  fill_random(a, 3);
+  fill_random(b, 4);
+
+  auto at = a.transpose(0, 1);
+  auto bt = b.transpose(0, 1);
+  auto c = at.matmul(bt);
+
+  ASSERT_EQ(c.shape_, (std::vector<std::uint32_t>{50, 70}));
+  for (std::size_t i{}; i < 50; ++i)
+  {
+    for (std::size_t j{}; j < 70; ++j)
+    {
+      EXPECT_NEAR((*c.data_)[i * 70 + j], naive_matmul_at(at, bt, i, j), 1e-9);
+    }
+  }
+}
+
+TEST(Gemm, MatmulBackwardAccumulates)
+{
+  Tensor<double> a(3u, 4u);
+  Tensor<double> b(4u, 2u);
+  fill_random(*a.impl(), 5);
+  fill_random(*b.impl(), 6);
+  a.impl()->requires_grad_ = true;
+  b.impl()->requires_grad_ = true;
+
+  auto c = matmul(a, b);
+  c.backward();
+
+  // With dC = 1, dA[i][k] = sum_j B[k][j] and dB[k][j] = sum_i A[i][k].
+  for (std::size_t i{}; i < 3; ++i)
+  {
+    for (std::size_t k{}; k < 4; ++k)
+    {
+      double expected = (*b.impl()->data_)[k * 2] + (*b.impl()->data_)[k * 2 + 1];
+      EXPECT_NEAR((*a.impl()->grad_->data_)[i * 4 + k], expected, 1e-12);
+    }
+  }
+  for (std::size_t k{}; k < 4; ++k)
+  {
+    for (std::size_t j{}; j < 2; ++j)
+    {
+      double expected = 0;
+      for (std::size_t i{}; i < 3; ++i)
+      {
+        expected += (*a.impl()->data_)[i * 4 + k];
+      }
+      EXPECT_NEAR((*b.impl()->grad_->data_)[k * 2 + j], expected, 1e-12);
+    }
+  }
+}
+
+TEST(ThreadPool, ParallelForCoversRangeOnce)
+{
+  ThreadPool pool(4);
+  std::vector<std::atomic<int>> hits(100000);
+
+  TaskGroup group(pool);
+  for (std::size_t c{}; c < 10; ++c)
+  {
+    group.run(
+        [&, c]()
+        {
+          for (std::size_t i = c * 10000; i < (c + 1) * 10000; ++i)
+          {
+            ++hits[i];
+          }
+        });
+  }
+  group.wait();
+
+  ScopedThreads threads(4);
+  parallel_for(0, hits.size(), 1000,
+               [&](std::size_t begin, std::size_t end)
+               {
+                 for (std::size_t i = begin; i < end; ++i)
+                 {
+                   ++hits[i];
+                 }
+               });
+
+  for (auto const &h : hits)
+  {
+    ASSERT_EQ(h.load(), 2);
+  }
+}
+
+TEST(ThreadPool, ParallelElementwiseMatchesSerial)
+{
+  ScopedThreads threads(4);
+
+  TensorImpl<float> a(300u, 257u);
+  TensorImpl<float> b(1u, 257u);
+  fill_random(a, 7);
+  fill_random(b, 8);
+
+  auto sum = a + b;
+  auto big = a.matmul(a.transpose(0, 1));
+
+  set_num_threads(1);
+  auto sum_serial = a + b;
+  auto big_serial = a.matmul(a.transpose(0, 1));
+
+  EXPECT_EQ(*sum.data_, *sum_serial.data_);
+  for (std::size_t i{}; i < big.data_->size(); ++i)
+  {
+    EXPECT_NEAR((*big.data_)[i], (*big_serial.data_)[i], 1e-3);
+  }
+}
+
+TEST(TensorIterator, CoalescesContiguousDimensions)
+{
+  TensorIterator<2> dense({2, 3, 4}, {{{12, 4, 1}, {12, 4, 1}}});
+  EXPECT_TRUE(dense.is_contiguous());
+
+  TensorIterator<2> row({2, 3, 4}, {{{12, 4, 1}, {0, 4, 1}}});
+  EXPECT_EQ(row.ndim(), 2u);
+}
+
+TEST(TensorIterator, BroadcastBinaryOps)
+{
+  TensorImpl<double> a(3u, 4u);
+  TensorImpl<double> row(1u, 4u);
+  TensorImpl<double> col(3u, 1u);
+  TensorImpl<double> scalar(1u);
+  fill_random(a, 9);
+  fill_random(row, 10);
+  fill_random(col, 11);
+  scalar.fill(2.5);
+
+  auto r = a + row;
+  auto c = a - col;
+  auto s = scalar + a;
+  auto t = a.transpose(0, 1) + col.transpose(0, 1);
+
+  for (std::size_t i{}; i < 3; ++i)
+  {
+    for (std::size_t j{}; j < 4; ++j)
+    {
+      double x = (*a.data_)[i * 4 + j];
+      EXPECT_DOUBLE_EQ((*r.data_)[i * 4 + j], x + (*row.data_)[j]);
+      EXPECT_DOUBLE_EQ((*c.data_)[i * 4 + j], x - (*col.data_)[i]);
+      EXPECT_DOUBLE_EQ((*s.data_)[i * 4 + j], x + 2.5);
+      EXPECT_DOUBLE_EQ((*t.data_)[j * 3 + i], x + (*col.data_)[i]);
+    }
+  }
+
+  auto acc = a;
+  acc.data_ = std::make_shared<Storage<double>>(*a.data_);
+  acc += row;
+  acc -= scalar;
+  for (std::size_t i{}; i < 12; ++i)
+  {
+    EXPECT_DOUBLE_EQ((*acc.data_)[i], (*a.data_)[i] + (*row.data_)[i % 4] - 2.5);
+  }
+}
+
+TEST(Simd, EveryLevelMatchesScalar)
+{
+  TensorImpl<float> a(37u, 41u);
+  TensorImpl<float> b(37u, 41u);
+  TensorImpl<float> w(41u, 29u);
+  fill_random(a, 12);
+  fill_random(b, 13);
+  fill_random(w, 14);
+
+  ScopedLevel simd_level(simd::Level::Scalar);
+  auto sum = a + b;
+  auto relu = (a - b).relu();
+  auto scaled = -(a * 3.0f);
+  auto prod = a.matmul(w);
+  auto dist = simd::squared_distance(a.data_->data(), b.data_->data(),
+                                     a.data_->size());
+
+  for (auto level : {simd::Level::SSE2, simd::Level::AVX2,
+                     simd::Level::AVX512})
+  {
+    simd::set_level(level);
+
+    EXPECT_EQ(*(a + b).data_, *sum.data_);
+    EXPECT_EQ(*(a - b).relu().data_, *relu.data_);
+    EXPECT_EQ(*(-(a * 3.0f)).data_, *scaled.data_);
+
+    auto p = a.matmul(w);
+    for (std::size_t i{}; i < p.data_->size(); ++i)
+    {
+      EXPECT_NEAR((*p.data_)[i], (*prod.data_)[i], 1e-4);
+    }
+    EXPECT_NEAR(simd::squared_distance(a.data_->data(), b.data_->data(),
+                                       a.data_->size()),
+                dist, 1e-2);
+  }
+}
+
+TEST(Views, ShareStorageWithoutCopying)
+{
+  TensorImpl<float> a(3u, 4u);
+  for (std::size_t i{}; i < 12; ++i)
+  {
+    (*a.data_)[i] = static_cast<float>(i);
+  }
+
+  auto t = a.transpose(0, 1);
+  EXPECT_EQ(t.data_, a.data_);
+  EXPECT_FALSE(t.is_contiguous());
+  EXPECT_EQ((t[2u, 1u]), 6.0f);
+
+  auto s = a.slice(1, 1, 4, 2);
+  EXPECT_EQ(s.data_, a.data_);
+  EXPECT_EQ(s.shape_, (std::vector<std::uint32_t>{3, 2}));
+  EXPECT_EQ((s[2u, 1u]), 11.0f);
+
+  s[0u, 0u] = 100.0f;
+  EXPECT_EQ((a[0u, 1u]), 100.0f);
+
+  auto p = a.view({2, 2, 3}).permute({2, 0, 1});
+  EXPECT_EQ(p.data_, a.data_);
+  EXPECT_EQ((p[1u, 1u, 0u]), 7.0f);
+
+  auto e = a.slice(0, 2, 3).expand({5, 3, 4});
+  EXPECT_EQ((e[4u, 1u, 3u]), 11.0f);
+
+  auto u = a.unsqueeze(1);
+  EXPECT_EQ(u.shape_, (std::vector<std::uint32_t>{3, 1, 4}));
+  EXPECT_EQ(u.squeeze().shape_, a.shape_);
+
+  EXPECT_EQ(a.contiguous().data_, a.data_);
+  auto c = t.contiguous();
+  EXPECT_NE(c.data_, a.data_);
+  EXPECT_TRUE(c.is_contiguous());
+  EXPECT_EQ((c[3u, 1u]), 7.0f);
+
+  EXPECT_THROW(t.view({12}), std::invalid_argument);
+  EXPECT_EQ(t.reshape({12})[1u], 4.0f);
+}
+
+TEST(Views, ElementwiseAndMatmulOnStridedViews)
+{
+  TensorImpl<double> a(40u, 30u);
+  TensorImpl<double> b(30u, 40u);
+  fill_random(a, 7);
+  fill_random(b, 8);
+
+  auto sum = a.transpose(0, 1) + b;
+  for (std::uint32_t i{}; i < 30; ++i)
+  {
+    for (std::uint32_t j{}; j < 40; ++j)
+    {
+      EXPECT_DOUBLE_EQ((sum[i, j]), (a[j, i] + b[i, j]));
+    }
+  }
+
+  auto a_rows = a.slice(0, 5, 25);
+  auto b_cols = b.narrow(1, 10, 20);
+  auto c = a_rows.matmul(b_cols);
+  for (std::uint32_t i{}; i < 20; ++i)
+  {
+    for (std::uint32_t j{}; j < 20; ++j)
+    {
+      double expect{};
+      for (std::uint32_t k{}; k < 30; ++k)
+      {
+        expect += a[i + 5, k] * b[k, j + 10];
+      }
+      EXPECT_NEAR((c[i, j]), expect, 1e-12);
+    }
+  }
+}
+
+TEST(Views, BackwardRoutesGradientsToInputLayout)
+{
+  Tensor<float> x(4u, 6u);
+  x.impl()->requires_grad_ = true;
+  fill_random(*x.impl(), 9);
+
+  // y = relu(x[:, 1:5:2]^T) broadcast over a new leading dimension of 3
+  auto s = slice(x, 1, 1, 5, 2);
+  auto y = expand(unsqueeze(relu(transpose(s, 0, 1)), 0), {3, 2, 4});
+
+  y.backward();
+
+  auto &g = *x.impl()->grad_;
+  EXPECT_EQ(g.shape_, x.impl()->shape_);
+  for (std::uint32_t i{}; i < 4; ++i)
+  {
+    for (std::uint32_t j{}; j < 6; ++j)
+    {
+      bool picked = (j == 1 || j == 3) && (*x.impl())[i, j] > 0;
+      EXPECT_EQ((g[i, j]), picked ? 3.0f : 0.0f);
+    }
+  }
+}
+
+TEST(Autograd, DeepChainBackward)
+{
+  Tensor<float> x(2u, 3u);
+  x.impl()->requires_grad_ = true;
+  x.fill(1.0f);
+
+  // Far deeper than a recursive traversal could follow comfortably.
+  Tensor<float> y = x;
+  for (int i{}; i < 50000; ++i)
+  {
+    y = relu(transpose(y, 0, 1));
+  }
+
+  y.backward();
+
+  EXPECT_EQ(x.impl()->grad_->shape_, x.impl()->shape_);
+  EXPECT_EQ(*x.impl()->grad_->data_, Storage<float>(6, 1.0f));
+}
+
+TEST(Autograd, BackwardPlanReplaysMatchingGraphs)
+{
+  Tensor<float> w(3u, 3u);
+  w.impl()->requires_grad_ = true;
+  fill_random(*w.impl(), 10);
+
+  auto step = [&](int depth)
+  {
+    Tensor<float> h = w;
+    for (int i{}; i < depth; ++i)
+    {
+      h = relu(matmul(h, w));
+    }
+    return h;
+  };
+
+  BackwardPlan<float> plan;
+
+  step(3).backward(plan);
+  EXPECT_FALSE(plan.last_replayed());
+  auto planned = *w.impl()->grad_->data_;
+
+  w.impl()->grad_ = nullptr;
+  step(3).backward(plan);
+  EXPECT_TRUE(plan.last_replayed());
+  EXPECT_EQ(*w.impl()->grad_->data_, planned);
+
+  w.impl()->grad_ = nullptr;
+  step(3).backward();
+  EXPECT_EQ(*w.impl()->grad_->data_, planned);
+
+  w.impl()->grad_ = nullptr;
+  step(4).backward(plan);
+  EXPECT_FALSE(plan.last_replayed());
+  EXPECT_EQ(plan.size(), 9u);
+}
+
+TEST(Autograd, BackwardReleasesGraphUnlessRetained)
+{
+  Tensor<float> x(4u, 3u);
+  Tensor<float> w(3u, 3u);
+  fill_random(*x.impl(), 12);
+  fill_random(*w.impl(), 13);
+  w.impl()->requires_grad_ = true;
+
+  auto y = sum(relu(matmul(x, w)));
+  std::weak_ptr<TensorImpl<float>> inner = y.impl()->parents_[0];
+
+  y.backward(true);
+  auto once = *w.impl()->grad_->data_;
+  EXPECT_FALSE(inner.expired());
+
+  // Each pass through the retained graph adds the same gradient again.
+  y.backward(true);
+  y.backward();
+  for (std::size_t i{}; i < once.size(); ++i)
+  {
+    EXPECT_FLOAT_EQ((*w.impl()->grad_->data_)[i], 3.0f * once[i]) << i;
+  }
+
+  EXPECT_TRUE(inner.expired());
+  EXPECT_TRUE(y.impl()->parents_.empty());
+  EXPECT_FALSE(y.impl()->backward_);
+
+  auto released = *w.impl()->grad_->data_;
+  y.backward();
+  EXPECT_EQ(*w.impl()->grad_->data_, released);
+}
+
+TEST(Autograd, NodeStorageKeepsValueSemantics)
+{
+  auto counter = std::make_shared<int>(0);
+
+  // One closure fits inline and one does not.
+  std::array<char, 2 * NodeFunction::kInline> pad{};
+  NodeFunction small = [counter]() { ++*counter; };
+  NodeFunction large = [counter, pad]() { *counter += 10 + pad[0]; };
+
+  auto copy = small;
+  auto moved = std::move(large);
+  small();
+  copy();
+  moved();
+  EXPECT_EQ(*counter, 12);
+  EXPECT_FALSE(large);
+  EXPECT_EQ(counter.use_count(), 4);
+
+  small = nullptr;
+  copy = moved;
+  copy();
+  EXPECT_EQ(*counter, 22);
+  EXPECT_EQ(counter.use_count(), 3);
+
+  // Past its inline capacity the vector moves to the heap.
+  SmallVector<std::shared_ptr<int>, 3> edges{counter, counter};
+  for (int i{}; i < 3; ++i)
+  {
+    edges.push_back(counter);
+  }
+  ASSERT_EQ(edges.size(), 5u);
+  EXPECT_EQ(edges[4], counter);
+
+  auto taken = std::move(edges);
+  EXPECT_TRUE(edges.empty());
+  EXPECT_EQ(counter.use_count(), 8);
+
+  taken.clear();
+  EXPECT_EQ(counter.use_count(), 3);
+}
+
+TEST(Autograd, ParallelBackwardMatchesSerial)
+{
+  Tensor<float> x(16u, 32u);
+  fill_random(*x.impl(), 140);
+  x.impl()->requires_grad_ = true;
+
+  std::vector<Tensor<float>> leaves{x};
+  for (unsigned k{}; k < 6; ++k)
+  {
+    Tensor<float> w(32u, 32u);
+    fill_random(*w.impl(), 141 + k);
+    w.impl()->requires_grad_ = true;
+    leaves.push_back(w);
+  }
+
+  // Every head reads x and the last three share a weight, so branches
+  // running side by side accumulate into the same gradients.
+  auto forward = [&]()
+  {
+    Tensor<float> total = relu(matmul(x, leaves[1]));
+    for (unsigned k = 1; k < 8; ++k)
+    {
+      total = add(total, relu(matmul(x, leaves[std::min(k, 5u) + 1])));
+    }
+    return sum(mean(total, {1}));
+  };
+
+  auto grads = [&]()
+  {
+    std::vector<std::vector<float>> out;
+    for (auto &t : leaves)
+    {
+      auto const &g = *t.impl()->grad_;
+      out.emplace_back(g.data_ptr(), g.data_ptr() + g.numel());
+      t.impl()->grad_ = nullptr;
+    }
+    return out;
+  };
+
+  {
+    ScopedThreads threads(1);
+    forward().backward();
+  }
+  auto serial = grads();
+
+  ScopedThreads threads(4);
+  for (int run{}; run < 3; ++run)
+  {
+    auto loss = forward();
+    std::weak_ptr<TensorImpl<float>> inner = loss.impl()->parents_[0];
+    loss.backward();
+    EXPECT_TRUE(inner.expired());
+
+    auto parallel = grads();
+    for (std::size_t i{}; i < serial.size(); ++i)
+    {
+      for (std::size_t j{}; j < serial[i].size(); ++j)
+      {
+        EXPECT_NEAR(parallel[i][j], serial[i][j], 1e-5f) << i << ' ' << j;
+      }
+    }
+  }
+}
+
+TEST(Autograd, TensorImplAssignsLikeItCopies)
+{
+  Tensor<float> x(2u, 3u);
+  fill_random(*x.impl(), 145);
+  x.impl()->requires_grad_ = true;
+  auto y = relu(x);
+
+  TensorImpl<float> a(4u);
+  a = *y.impl();
+  EXPECT_EQ(a.shape_, y.impl()->shape_);
+  EXPECT_EQ(a.data_, y.impl()->data_);
+  ASSERT_EQ(a.parents_.size(), 1u);
+  EXPECT_EQ(a.parents_[0], x.impl());
+  EXPECT_TRUE(a.backward_);
+
+  TensorImpl<float> b(1u);
+  b = std::move(a);
+  EXPECT_EQ(b.shape_, (std::vector<std::uint32_t>{2, 3}));
+  EXPECT_EQ(b.parents_[0], x.impl());
+  EXPECT_TRUE(a.parents_.empty());
+}
+
+TEST(Autograd, NoGradGuardSkipsGraph)
+{
+  Tensor<float> x(4u, 3u);
+  Tensor<float> w(3u, 3u);
+  Tensor<float> b(3u);
+  fill_random(*x.impl(), 150);
+  fill_random(*w.impl(), 151);
+  fill_random(*b.impl(), 152);
+  w.impl()->requires_grad_ = true;
+  b.impl()->requires_grad_ = true;
+
+  {
+    NoGradGuard no_grad;
+    auto y = MSELoss<float>{}(relu(linear(x, w, b)), x);
+    EXPECT_FALSE(y.impl()->requires_grad_);
+    EXPECT_TRUE(y.impl()->parents_.empty());
+    EXPECT_FALSE(y.impl()->backward_);
+
+    {
+      GradModeGuard enable(true);
+      EXPECT_TRUE(matmul(x, w).impl()->requires_grad_);
+    }
+    EXPECT_FALSE(grad_enabled());
+  }
+  EXPECT_TRUE(grad_enabled());
+
+  // Backward itself may run without recording, checkpoints included.
+  auto block = [&](Tensor<float> const &h) { return relu(matmul(h, w)); };
+
+  sum(block(x)).backward();
+  auto expected = *w.impl()->grad_->data_;
+  w.impl()->grad_ = nullptr;
+
+  auto loss = sum(checkpoint(block, x));
+  {
+    NoGradGuard no_grad;
+    loss.backward();
+  }
+  ASSERT_TRUE(w.impl()->grad_);
+  EXPECT_EQ(*w.impl()->grad_->data_, expected);
+}
+
+TEST(Allocator, AlignsAndReusesBlocks)
+{
+  auto &allocator = CachingAllocator::instance();
+  if (!allocator.caching())
+  {
+    GTEST_SKIP() << "caching disabled by TENSOR_CACHING_ALLOCATOR";
+  }
+
+  void const *first = nullptr;
+  {
+    Storage<float> s(1000);
+    first = s.data();
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(s.data()) % kAllocAlignment,
+              0u);
+  }
+
+  auto before = allocator.stats();
+  {
+    // Same size class as above, so the freed block comes back.
+    Storage<float> s(900, 1.0f);
+    EXPECT_EQ(s.data(), first);
+    EXPECT_EQ(s[899], 1.0f);
+  }
+  auto after = allocator.stats();
+
+  EXPECT_EQ(after.system_calls, before.system_calls);
+  EXPECT_EQ(after.cache_hits, before.cache_hits + 1);
+  EXPECT_EQ(after.in_use, before.in_use);
+
+  allocator.empty_cache();
+  EXPECT_EQ(allocator.stats().cached, 0u);
+}
+
+TEST(Allocator, SteadyStateTrainingStaysInCache)
+{
+  if (!CachingAllocator::instance().caching())
+  {
+    GTEST_SKIP() << "caching disabled by TENSOR_CACHING_ALLOCATOR";
+  }
+
+  Tensor<float> x(64u, 32u);
+  Tensor<float> y(64u, 1u);
+  Tensor<float> w1(32u, 48u);
+  Tensor<float> b1(64u, 48u);
+  Tensor<float> w2(48u, 1u);
+  fill_random(*x.impl(), 11);
+  fill_random(*y.impl(), 12);
+  fill_random(*w1.impl(), 13);
+  fill_random(*w2.impl(), 14);
+  b1.fill(0.0f);
+
+  for (auto &p : {w1, b1, w2})
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  SGD<float> optim({w1, b1, w2}, 0.01f);
+  MSELoss<float> criterion;
+
+  auto step = [&]()
+  {
+    optim.reset_grad();
+    auto pred = matmul(relu(add(matmul(x, w1), b1)), w2);
+    criterion(pred, y).backward();
+    optim.step();
+  };
+
+  step();
+  step();
+
+  auto warm = CachingAllocator::instance().stats();
+  for (int i{}; i < 5; ++i)
+  {
+    step();
+  }
+  auto steady = CachingAllocator::instance().stats();
+
+  EXPECT_GT(steady.requests, warm.requests);
+  EXPECT_EQ(steady.system_calls, warm.system_calls);
+  EXPECT_EQ(steady.in_use, warm.in_use);
+}
+
+TEST(Allocator, UninitializedOutputsAreFullyWritten)
+{
+  TensorImpl<float> a(33u, 65u);
+  TensorImpl<float> b(33u, 65u);
+  fill_random(a, 15);
+  fill_random(b, 16);
+
+  for (int round{}; round < 2; ++round)
+  {
+    // Leave NaN-filled blocks of every size class involved in the cache.
+    {
+      Storage<float> d0(33 * 65, std::nanf(""));
+      Storage<float> d1(33 * 65, std::nanf(""));
+      Storage<float> d2(33 * 33, std::nanf(""));
+    }
+
+    auto sum = a + b;
+    auto diff = (a - b).relu();
+    auto scaled = -(a * 2.0f);
+    auto t = a.transpose(0, 1).contiguous();
+    auto prod = a.matmul(b.transpose(0, 1));
+
+    for (std::uint32_t i{}; i < 33; ++i)
+    {
+      for (std::uint32_t j{}; j < 65; ++j)
+      {
+        EXPECT_EQ((sum[i, j]), (a[i, j] + b[i, j]));
+        EXPECT_EQ((diff[i, j]), (std::max(a[i, j] - b[i, j], 0.0f)));
+        EXPECT_EQ((scaled[i, j]), (-2.0f * a[i, j]));
+        EXPECT_EQ((t[j, i]), (a[i, j]));
+      }
+      for (std::uint32_t j{}; j < 33; ++j)
+      {
+        EXPECT_FALSE((std::isnan(prod[i, j])));
+      }
+    }
+  }
+}
+
+TEST(Linear, MatchesUnfusedLayer)
+{
+  for (bool with_relu : {false, true})
+  {
+    // 70 x 90 output crosses both GEMM blocking and the small-GEMM cutoff.
+    for (std::uint32_t batch : {3u, 70u})
+    {
+      Tensor<double> x(batch, 40u);
+      Tensor<double> w(40u, 90u);
+      Tensor<double> b(90u);
+      fill_random(*x.impl(), 17);
+      fill_random(*w.impl(), 18);
+      fill_random(*b.impl(), 19);
+
+      Tensor<double> x2(batch, 40u);
+      Tensor<double> w2(40u, 90u);
+      Tensor<double> b2(1u, 90u);
+      *x2.impl()->data_ = *x.impl()->data_;
+      *w2.impl()->data_ = *w.impl()->data_;
+      *b2.impl()->data_ = *b.impl()->data_;
+
+      for (auto &t : {x, w, b, x2, w2, b2})
+      {
+        t.impl()->requires_grad_ = true;
+      }
+
+      auto fused = with_relu ? linear_relu(x, w, b) : linear(x, w, b);
+      auto pre = add(matmul(x2, w2), expand(b2, {batch, 90}));
+      auto plain = with_relu ? relu(pre) : pre;
+
+      ASSERT_EQ(fused.impl()->shape_, plain.impl()->shape_);
+      for (std::size_t i{}; i < fused.impl()->numel(); ++i)
+      {
+        EXPECT_NEAR((*fused.impl()->data_)[i], (*plain.impl()->data_)[i],
+                    1e-12);
+      }
+
+      fused.backward();
+      plain.backward();
+
+      auto expect_grads_near = [](Tensor<double> const &a,
+                                  Tensor<double> const &b)
+      {
+        ASSERT_EQ(a.impl()->grad_->numel(), b.impl()->grad_->numel());
+        for (std::size_t i{}; i < a.impl()->grad_->numel(); ++i)
+        {
+          EXPECT_NEAR((*a.impl()->grad_->data_)[i],
+                      (*b.impl()->grad_->data_)[i], 1e-10);
+        }
+      };
+      expect_grads_near(x, x2);
+      expect_grads_near(w, w2);
+      expect_grads_near(b, b2);
+    }
+  }
+}
+
+TEST(Reduce, MatchesNaiveOverAxes)
+{
+  // 300 inner elements span several vector widths and a partial tile.
+  TensorImpl<double> x(5u, 7u, 300u);
+  fill_random(x, 21);
+
+  auto at = [&](std::size_t i, std::size_t j, std::size_t k)
+  { return (*x.data_)[(i * 7 + j) * 300 + k]; };
+
+  struct Case
+  {
+    std::vector<std::uint32_t> axes;
+    std::vector<std::uint32_t> shape;
+  };
+
+  for (auto const &c : {Case{{}, {}}, Case{{0}, {7, 300}},
+                        Case{{1}, {5, 300}}, Case{{2}, {5, 7}},
+                        Case{{0, 2}, {7}}, Case{{1, 0}, {300}}})
+  {
+    auto sum = x.sum(c.axes);
+    auto max = x.max(c.axes);
+    auto min = x.min(c.axes);
+    auto norm = x.norm(c.axes);
+    ASSERT_EQ(sum.shape_, c.shape);
+    ASSERT_EQ(x.mean(c.axes, true).shape_.size(), 3u);
+
+    std::vector<bool> reduced(3, c.axes.empty());
+    for (auto a : c.axes)
+    {
+      reduced[a] = true;
+    }
+
+    std::size_t I = reduced[0] ? 1 : 5;
+    std::size_t J = reduced[1] ? 1 : 7;
+    std::size_t K = reduced[2] ? 1 : 300;
+
+    for (std::size_t i{}; i < I; ++i)
+    {
+      for (std::size_t j{}; j < J; ++j)
+      {
+        for (std::size_t k{}; k < K; ++k)
+        {
+          double s{};
+          double sq{};
+          double hi = -1e300;
+          double lo = 1e300;
+
+          for (std::size_t a{}; a < (reduced[0] ? 5u : 1u); ++a)
+          {
+            for (std::size_t b{}; b < (reduced[1] ? 7u : 1u); ++b)
+            {
+              for (std::size_t e{}; e < (reduced[2] ? 300u : 1u); ++e)
+              {
+                double v = at(i + a, j + b, k + e);
+                s += v;
+                sq += v * v;
+                hi = std::max(hi, v);
+                lo = std::min(lo, v);
+              }
+            }
+          }
+
+          std::size_t out = (i * J + j) * K + k;
+          EXPECT_NEAR(sum.data_ptr()[out], s, 1e-10);
+          EXPECT_NEAR(norm.data_ptr()[out], std::sqrt(sq), 1e-10);
+          EXPECT_EQ(max.data_ptr()[out], hi);
+          EXPECT_EQ(min.data_ptr()[out], lo);
+        }
+      }
+    }
+  }
+
+  // A strided input reduces like its dense copy.
+  auto t = x.transpose(0, 2);
+  auto arg = t.argmax(1);
+  ASSERT_EQ(arg.shape_, (std::vector<std::uint32_t>{300, 5}));
+  for (std::size_t k{}; k < 300; ++k)
+  {
+    for (std::size_t i{}; i < 5; ++i)
+    {
+      std::size_t best{};
+      for (std::size_t j{}; j < 7; ++j)
+      {
+        best = (at(i, j, k) > at(i, best, k)) ? j : best;
+      }
+      EXPECT_EQ(arg.data_ptr()[k * 5 + i], static_cast<std::int64_t>(best));
+    }
+  }
+
+  EXPECT_THROW(x.sum({3}), std::invalid_argument);
+  EXPECT_THROW(x.sum({1, 1}), std::invalid_argument);
+}
+
+TEST(Reduce, FloatSumsStayAccurate)
+{
+  // Sequential float accumulation of 2^22 copies of 0.1 is off by percent.
+  std::uint32_t n = 1u << 22;
+  TensorImpl<float> x(n);
+  x.fill(0.1f);
+
+  double exact = 0.1f * static_cast<double>(n);
+  EXPECT_NEAR(x.sum().data_ptr()[0], exact, exact * 1e-6);
+
+  // The same along a non-innermost axis.
+  auto column = x.view({n / 4, 4}).sum({0});
+  EXPECT_NEAR(column.data_ptr()[0], exact / 4, exact * 1e-6);
+}
+
+TEST(Reduce, BroadcastBackwardReducesToInputShape)
+{
+  Tensor<double> x(4u, 3u);
+  Tensor<double> row(3u);
+  Tensor<double> column(4u, 1u);
+  for (auto &t : {x, row, column})
+  {
+    t.impl()->requires_grad_ = true;
+  }
+
+  auto y = sum(sub(add(x, row), column));
+  y.backward();
+
+  ASSERT_EQ(row.impl()->grad_->shape_, row.impl()->shape_);
+  ASSERT_EQ(column.impl()->grad_->shape_, column.impl()->shape_);
+  for (std::size_t i{}; i < 3; ++i)
+  {
+    EXPECT_EQ(row.impl()->grad_->data_ptr()[i], 4.0);
+  }
+  for (std::size_t i{}; i < 4; ++i)
+  {
+    EXPECT_EQ(column.impl()->grad_->data_ptr()[i], -3.0);
+  }
+
+  // Both operands of a same-shape add get separate buffers.
+  EXPECT_NE(x.impl()->grad_->data_, row.impl()->grad_->data_);
+}
+
+TEST(Reduce, GradientsMatchFiniteDifferences)
+{
+  using Op = std::function<Tensor<double>(Tensor<double> const &)>;
+  std::vector<std::uint32_t> axes{0, 2};
+
+  std::vector<Op> ops{
+      [&](Tensor<double> const &t) { return sum(t, axes); },
+      [&](Tensor<double> const &t) { return mean(t, axes, true); },
+      [&](Tensor<double> const &t) { return max(t, axes); },
+      [&](Tensor<double> const &t) { return min(transpose(t, 0, 1), {1}); },
+      [&](Tensor<double> const &t) { return prod(t, axes); },
+      [&](Tensor<double> const &t) { return norm(t, {1}, true); },
+  };
+
+  for (auto const &op : ops)
+  {
+    Tensor<double> x(3u, 4u, 5u);
+    fill_random(*x.impl(), 22);
+    // A zero factor: prod's gradient must not divide by it.
+    x.impl()->data_ptr()[7] = 0;
+    x.impl()->requires_grad_ = true;
+
+    sum(op(x)).backward();
+
+    for (std::size_t i{}; i < x.impl()->numel(); ++i)
+    {
+      double &v = x.impl()->data_ptr()[i];
+      double saved = v;
+      double h = 1e-6;
+
+      v = saved + h;
+      double up = sum(op(x)).impl()->data_ptr()[0];
+      v = saved - h;
+      double down = sum(op(x)).impl()->data_ptr()[0];
+      v = saved;
+
+      EXPECT_NEAR(x.impl()->grad_->data_ptr()[i], (up - down) / (2 * h),
+                  1e-6);
+    }
+  }
+}
+
+TEST(Matmul, BatchedBroadcastsLeadingDimensions)
+{
+  // Batch dims {2, 1} against {3}, with a transposed view on the right.
+  TensorImpl<double> a(2u, 1u, 5u, 7u);
+  TensorImpl<double> b_dense(3u, 4u, 7u);
+  fill_random(a, 23);
+  fill_random(b_dense, 24);
+  auto b = b_dense.transpose(1, 2);
+
+  auto c = a.matmul(b);
+  ASSERT_EQ(c.shape_, (std::vector<std::uint32_t>{2, 3, 5, 4}));
+
+  for (std::uint32_t i{}; i < 2; ++i)
+  {
+    for (std::uint32_t j{}; j < 3; ++j)
+    {
+      auto ai = a.slice(0, i, i + 1).squeeze(0).squeeze(0);
+      auto bj = b.slice(0, j, j + 1).squeeze(0);
+      for (std::uint32_t r{}; r < 5; ++r)
+      {
+        for (std::uint32_t k{}; k < 4; ++k)
+        {
+          EXPECT_NEAR((c[i, j, r, k]), naive_matmul_at(ai, bj, r, k), 1e-12);
+        }
+      }
+    }
+  }
+
+  // Enough batches and work per GEMM to run batches and GEMMs in parallel.
+  TensorImpl<float> x(16u, 70u, 50u);
+  TensorImpl<float> w(50u, 60u);
+  fill_random(x, 25);
+  fill_random(w, 26);
+  auto y = [&]()
+  {
+    ScopedThreads threads(4);
+    return x.matmul(w);
+  }();
+
+  for (std::uint32_t i{}; i < 16; ++i)
+  {
+    auto xi = x.slice(0, i, i + 1).squeeze(0);
+    auto yi = xi.matmul(w);
+    for (std::uint32_t r{}; r < 70; r += 13)
+    {
+      for (std::uint32_t k{}; k < 60; k += 7)
+      {
+        EXPECT_NEAR((y[i, r, k]), (yi[r, k]), 1e-4);
+      }
+    }
+  }
+
+  EXPECT_THROW(a.matmul(TensorImpl<double>(3u, 1u, 7u, 4u)),
+               std::invalid_argument);
+}
+
+TEST(Matmul, BatchedGradientsReduceOverBroadcastDimensions)
+{
+  Tensor<double> a(2u, 1u, 3u, 4u);
+  Tensor<double> b(3u, 4u, 2u);
+  Tensor<double> w(4u, 2u);
+  fill_random(*a.impl(), 27);
+  fill_random(*b.impl(), 28);
+  fill_random(*w.impl(), 29);
+
+  for (auto &t : {a, b, w})
+  {
+    t.impl()->requires_grad_ = true;
+  }
+
+  // norm makes the incoming gradient depend on the output.
+  auto loss = [&]() { return norm(add(matmul(a, b), matmul(a, w))); };
+  loss().backward();
+
+  for (auto &t : {a, b, w})
+  {
+    ASSERT_EQ(t.impl()->grad_->shape_, t.impl()->shape_);
+
+    for (std::size_t i{}; i < t.impl()->numel(); ++i)
+    {
+      double &v = t.impl()->data_ptr()[i];
+      double saved = v;
+      double h = 1e-6;
+
+      v = saved + h;
+      double up = loss().impl()->data_ptr()[0];
+      v = saved - h;
+      double down = loss().impl()->data_ptr()[0];
+      v = saved;
+
+      EXPECT_NEAR(t.impl()->grad_->data_ptr()[i], (up - down) / (2 * h),
+                  1e-6);
+    }
+  }
+}
+
+TEST(Half, ConversionsRoundToNearestEven)
+{
+  // 1 + 2^-8 sits halfway between two bf16 values; ties go to even.
+  EXPECT_EQ(bf16(1.0f + 0x1p-8f).bits_, bf16(1.0f).bits_);
+  EXPECT_EQ(bf16(1.0f + 0x1p-8f + 0x1p-20f).bits_, bf16(1.0f + 0x1p-7f).bits_);
+  EXPECT_EQ(f16(1.0f + 0x1p-11f).bits_, f16(1.0f).bits_);
+  EXPECT_EQ(f16(1.0f + 3 * 0x1p-11f).bits_, f16(1.0f + 0x1p-9f).bits_);
+
+  // Range limits, subnormals and specials.
+  EXPECT_EQ(static_cast<float>(f16(65504.0f)), 65504.0f);
+  EXPECT_TRUE(std::isinf(static_cast<float>(f16(1e6f))));
+  EXPECT_EQ(static_cast<float>(f16(0x1p-24f)), 0x1p-24f);
+  EXPECT_EQ(static_cast<float>(f16(-0x1p-20f)), -0x1p-20f);
+  EXPECT_TRUE(std::isnan(static_cast<float>(bf16(NAN))));
+  EXPECT_TRUE(std::isnan(static_cast<float>(f16(NAN))));
+
+  // Every f16 and finite bf16 bit pattern survives a trip through float.
+  for (std::uint32_t bits{}; bits < 0x10000u; ++bits)
+  {
+    auto h = f16::from_bits(static_cast<std::uint16_t>(bits));
+    if (!std::isnan(static_cast<float>(h)))
+    {
+      EXPECT_EQ(f16(static_cast<float>(h)).bits_, h.bits_);
+    }
+    auto b = bf16::from_bits(static_cast<std::uint16_t>(bits));
+    if (!std::isnan(static_cast<float>(b)))
+    {
+      EXPECT_EQ(bf16(static_cast<float>(b)).bits_, b.bits_);
+    }
+  }
+}
+
+TEST(Half, EveryLevelConvertsAndMatchesScalar)
+{
+  // Odd sizes leave a tail after every vector width.
+  TensorImpl<float> a(37u, 41u);
+  TensorImpl<float> b(37u, 41u);
+  fill_random(a, 30);
+  fill_random(b, 31);
+
+  ScopedLevel simd_level(simd::Level::Scalar);
+  auto ha = a.to<bf16>();
+  auto hb = b.to<f16>();
+  auto sum = ha + hb.to<bf16>();
+  auto relu = (ha - hb.to<bf16>()).relu();
+
+  for (auto level : {simd::Level::SSE2, simd::Level::AVX2,
+                     simd::Level::AVX512})
+  {
+    simd::set_level(level);
+
+    auto la = a.to<bf16>();
+    auto lb = b.to<f16>();
+    for (std::size_t i{}; i < a.numel(); ++i)
+    {
+      EXPECT_EQ(la.data_ptr()[i].bits_, ha.data_ptr()[i].bits_);
+      EXPECT_EQ(lb.data_ptr()[i].bits_, hb.data_ptr()[i].bits_);
+    }
+
+    auto s = la + lb.to<bf16>();
+    auto r = (la - lb.to<bf16>()).relu();
+    for (std::size_t i{}; i < a.numel(); ++i)
+    {
+      EXPECT_EQ(s.data_ptr()[i].bits_, sum.data_ptr()[i].bits_);
+      EXPECT_EQ(r.data_ptr()[i].bits_, relu.data_ptr()[i].bits_);
+    }
+  }
+}
+
+TEST(Half, GemmAndSumsAccumulateInFloat)
+{
+  TensorImpl<float> a(67u, 2000u);
+  TensorImpl<float> b(2000u, 45u);
+  fill_random(a, 32);
+  fill_random(b, 33);
+
+  // Compare against float on the already-rounded inputs, so the only error
+  // left is the final rounding of each output.
+  auto ha = a.to<bf16>();
+  auto hb = b.to<bf16>();
+  auto ref = ha.to<float>().matmul(hb.to<float>());
+  auto c = ha.matmul(hb).to<float>();
+
+  for (std::size_t i{}; i < c.numel(); ++i)
+  {
+    float r = ref.data_ptr()[i];
+    EXPECT_NEAR(c.data_ptr()[i], r, std::abs(r) * 0x1p-8f + 1e-3f);
+  }
+
+  // 2^16 copies of 1 overflow bf16's mantissa many times over.
+  TensorImpl<bf16> ones(1u << 16);
+  ones.fill(bf16(1.0f));
+  EXPECT_EQ(static_cast<float>(ones.sum().data_ptr()[0]), 65536.0f);
+  EXPECT_EQ(static_cast<float>(ones.view({256u, 256u}).sum({0}).data_ptr()[7]),
+            256.0f);
+
+  // The sums, 262144 and 102400, are past f16's largest finite value.
+  TensorImpl<f16> sixteens(1024u);
+  sixteens.fill(f16(16.0f));
+  EXPECT_EQ(static_cast<float>(sixteens.norm().data_ptr()[0]), 512.0f);
+  TensorImpl<f16> hundreds(2u, 1024u);
+  hundreds.fill(f16(100.0f));
+  EXPECT_EQ(static_cast<float>(hundreds.mean({1}).data_ptr()[1]), 100.0f);
+}
+
+TEST(Quantize, QgemmMatchesExactIntegerProduct)
+{
+  std::mt19937 gen(40);
+  std::uniform_int_distribution<int> byte(-128, 127);
+
+  // Odd sizes leave edge tiles and a partial group of four k.
+  std::size_t M = 53, N = 45, K = 1031;
+  std::vector<std::int8_t> a(M * K), b(K * N);
+  std::vector<std::int32_t> zb(N);
+  for (auto &x : a)
+  {
+    x = static_cast<std::int8_t>(byte(gen));
+  }
+  for (auto &x : b)
+  {
+    x = static_cast<std::int8_t>(byte(gen));
+  }
+  for (auto &z : zb)
+  {
+    z = byte(gen);
+  }
+  std::int32_t za = -17;
+
+  std::vector<std::int32_t> expected(M * N);
+  for (std::size_t i{}; i < M; ++i)
+  {
+    for (std::size_t j{}; j < N; ++j)
+    {
+      for (std::size_t k{}; k < K; ++k)
+      {
+        expected[i * N + j] += (a[i * K + k] - za) * (b[k * N + j] - zb[j]);
+      }
+    }
+  }
+
+  {
+    ScopedLevel simd_level;
+    for (auto level : {simd::Level::Scalar, simd::Level::AVX2,
+                       simd::Level::AVX512})
+    {
+      simd::set_level(level);
+
+      std::vector<std::int32_t> c(M * N);
+      qgemm(M, N, K, a.data(), K, 1, za, b.data(), N, 1, zb.data(),
+            c.data(), N);
+      EXPECT_EQ(c, expected);
+    }
+  }
+
+#if TENSOR_SIMD_X86
+  // The pmaddwd AVX-512 kernel, which VNNI machines never dispatch to.
+  if (simd::int8_level() >= simd::Int8Level::AVX512BW)
+  {
+    using Blk = QGemmBlocking<6, 32>;
+    std::vector<std::int32_t> c(M * N);
+    qgemm_blocked<Blk, simd::avx512bw::int8_micro_kernel<
+                           simd::avx512bw::Dot4, Blk::MR, Blk::NR>>(
+        M, N, K, a.data(), K, 1, b.data(), N, 1, c.data(), N);
+
+    std::vector<std::int32_t> ref(M * N);
+    qgemm_blocked<QGemmBlocking<4, 8>,
+                  simd::scalar::int8_micro_kernel<simd::scalar::Dot4, 4, 8>>(
+        M, N, K, a.data(), K, 1, b.data(), N, 1, ref.data(), N);
+    EXPECT_EQ(c, ref);
+  }
+#endif
+}
+
+TEST(Quantize, RoundTripsWithinHalfAStep)
+{
+  TensorImpl<float> x(16u, 24u);
+  fill_random(x, 41);
+  x.data_ptr()[5] = 3.0f;
+
+  // Per tensor, asymmetric: the range is [-1, 3] in 255 steps.
+  auto q = quantize(x);
+  float scale = q.params_.scale_[0];
+  EXPECT_NEAR(scale, 4.0f / 255, 1e-3);
+  auto back = q.dequantize();
+  for (std::size_t i{}; i < x.numel(); ++i)
+  {
+    EXPECT_NEAR(back.data_ptr()[i], x.data_ptr()[i], scale * 0.5f + 1e-6f);
+  }
+
+  // Per column, symmetric: each column gets its own scale.
+  auto w = quantize(x, 1u, true);
+  ASSERT_EQ(w.params_.scale_.size(), 24u);
+  EXPECT_NEAR(w.params_.scale_[5], 3.0f / 127, 1e-6);
+  EXPECT_LT(w.params_.scale_[4], w.params_.scale_[5]);
+  auto back_w = w.dequantize();
+  for (std::size_t i{}; i < x.numel(); ++i)
+  {
+    EXPECT_NEAR(back_w.data_ptr()[i], x.data_ptr()[i],
+                w.params_.scale_[i % 24] * 0.5f + 1e-6f);
+    EXPECT_EQ(w.params_.zero_point_[i % 24], 0);
+  }
+
+  // Per channel along a 1-D tensor's only axis, calibrated by an
+  // observer: every element is a channel of its own.
+  TensorImpl<float> bias(5u);
+  fill_random(bias, 46);
+  MinMaxObserver observer(0);
+  observer.observe(bias);
+  auto qb = quantize(bias, observer.params());
+  ASSERT_EQ(qb.params_.scale_.size(), 5u);
+  auto back_b = qb.dequantize();
+  for (std::size_t i{}; i < bias.numel(); ++i)
+  {
+    EXPECT_NEAR(back_b.data_ptr()[i], bias.data_ptr()[i],
+                qb.params_.scale_[i] * 0.5f + 1e-6f);
+  }
+
+  EXPECT_THROW(quantize(x, QuantParams{{1.0f}, {0}, 1u}),
+               std::invalid_argument);
+}
+
+TEST(Quantize, CalibratedMatmulTracksFloat)
+{
+  Tensor<float> x({32, 256});
+  Tensor<float> w({256, 40});
+  Tensor<float> b({1, 40});
+  fill_random(*x.impl(), 42);
+  fill_random(*w.impl(), 43);
+  fill_random(*b.impl(), 44);
+
+  // Calibrate the hidden activation on the float forward.
+  MinMaxObserver observer;
+  auto h = observer(linear_relu(x, w, b));
+  auto params = observer.params();
+  EXPECT_EQ(params.zero_point_[0], -128); // relu output: lo is 0
+
+  Tensor<float> w2({40, 8});
+  fill_random(*w2.impl(), 45);
+  auto ref = matmul(h, w2);
+
+  auto w2q = quantize(*w2.impl(), 1u, true);
+  auto out = matmul(quantize(*h.impl(), params), w2q);
+  ASSERT_EQ(out.impl()->shape_, ref.impl()->shape_);
+
+  // Each output sums 40 products, each off by at most half a step of
+  // either operand times the other's magnitude (|w2| <= 1, so its steps
+  // are at most 1 / 127).
+  float h_max = params.scale_[0] * 255;
+  float bound = 40 * 0.5f * (params.scale_[0] + h_max / 127);
+  for (std::size_t i{}; i < ref.impl()->numel(); ++i)
+  {
+    EXPECT_NEAR(out.impl()->data_ptr()[i], ref.impl()->data_ptr()[i], bound);
+  }
+
+  // Dynamic quantization of a float lhs.
+  auto dynamic = matmul(h, w2q);
+  for (std::size_t i{}; i < ref.impl()->numel(); ++i)
+  {
+    EXPECT_NEAR(dynamic.impl()->data_ptr()[i], ref.impl()->data_ptr()[i],
+                bound);
+  }
+}
+
+TEST(Graph, ReplayMatchesEagerSteps)
+{
+  Tensor<float> x(16u, 8u);
+  Tensor<float> y(16u, 1u);
+  Tensor<float> w1(8u, 12u);
+  Tensor<float> b1(12u);
+  Tensor<float> w2(12u, 1u);
+  fill_random(*x.impl(), 51);
+  fill_random(*y.impl(), 52);
+  fill_random(*w1.impl(), 53);
+  fill_random(*b1.impl(), 54);
+  fill_random(*w2.impl(), 55);
+
+  std::vector<Tensor<float>> params{w1, b1, w2};
+  for (auto &p : params)
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  // Covers views, a copying reshape, reductions and work on x alone.
+  auto step = [&]()
+  {
+    auto h = linear_relu(x, w1, b1);
+    auto t = reshape(transpose(h, 0, 1), {12u, 16u});
+    auto centred = sub(transpose(t, 0, 1), mean(h, {1}, true));
+    auto pred = add(matmul(relu(centred), w2), sum(x, {1}, true));
+    return MSELoss<float>{}(pred, y);
+  };
+
+  auto grads = [&]()
+  {
+    std::vector<std::vector<float>> out;
+    for (auto &p : params)
+    {
+      auto const &g = *p.impl()->grad_;
+      out.emplace_back(g.data_ptr(), g.data_ptr() + g.numel());
+    }
+    return out;
+  };
+
+  StaticGraph<float> graph;
+  auto loss = graph.capture(step);
+  SGD<float> optim(params, 0.05f);
+
+  for (unsigned i{}; i < 3; ++i)
+  {
+    optim.step();
+    fill_random(*x.impl(), 60 + i);
+
+    graph.replay();
+    float replayed = loss.impl()->data_ptr()[0];
+    auto replayed_grads = grads();
+
+    optim.reset_grad();
+    auto eager = step();
+    eager.backward();
+
+    EXPECT_FLOAT_EQ(replayed, eager.impl()->data_ptr()[0]);
+    EXPECT_EQ(replayed_grads, grads());
+  }
+}
+
+TEST(Graph, ReplayReusesCapturedBuffers)
+{
+  if (!CachingAllocator::instance().caching())
+  {
+    GTEST_SKIP() << "caching disabled by TENSOR_CACHING_ALLOCATOR";
+  }
+
+  Tensor<float> x(64u, 32u);
+  Tensor<float> y(64u, 1u);
+  Tensor<float> w1(32u, 48u);
+  Tensor<float> b1(48u);
+  Tensor<float> w2(48u, 1u);
+  Tensor<float> b2(1u);
+  fill_random(*x.impl(), 61);
+  fill_random(*y.impl(), 62);
+  fill_random(*w1.impl(), 63);
+  fill_random(*w2.impl(), 64);
+  b1.fill(0.0f);
+  b2.fill(0.0f);
+
+  for (auto &p : {w1, b1, w2, b2})
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  SGD<float> optim({w1, b1, w2, b2}, 0.01f);
+  MSELoss<float> criterion;
+  auto forward = [&]()
+  { return criterion(linear(linear_relu(x, w1, b1), w2, b2), y); };
+
+  auto &allocator = CachingAllocator::instance();
+
+  auto before = allocator.stats();
+  optim.reset_grad();
+  forward().backward();
+  optim.step();
+  std::size_t eager = allocator.stats().requests - before.requests;
+
+  StaticGraph<float> graph;
+  graph.capture(forward);
+  optim.step();
+  graph.replay();
+  optim.step();
+
+  before = allocator.stats();
+  for (int i{}; i < 5; ++i)
+  {
+    graph.replay();
+    optim.step();
+  }
+  auto after = allocator.stats();
+
+  // Outputs, gradients and masks are reused; GEMM packing buffers and the
+  // bias reductions' temporaries still come from the cache.
+  EXPECT_LT(after.requests - before.requests, 5 * eager);
+  EXPECT_EQ(after.system_calls, before.system_calls);
+  EXPECT_EQ(after.in_use, before.in_use);
+}
+
+TEST(Graph, CaptureRejectsNodesWithoutForward)
+{
+  Tensor<float> a(4u, 4u);
+  a.fill(1.0f);
+  a.impl()->requires_grad_ = true;
+
+  StaticGraph<float> graph;
+  EXPECT_THROW(graph.replay(), std::invalid_argument);
+
+  // A hand-built node can be backpropagated but not recomputed.
+  auto custom = [&]()
+  {
+    Tensor<float> out(TensorImpl<float>(a.impl()->relu()));
+    out.impl()->requires_grad_ = true;
+    out.impl()->parents_ = {a.impl()};
+    out.impl()->backward_ = []() {};
+    return sum(out);
+  };
+  EXPECT_THROW(graph.capture(custom), std::invalid_argument);
+  EXPECT_TRUE(graph.empty());
+  EXPECT_FALSE(capturing_graph());
+}
+
+TEST(Graph, AssignOffsetsSeparatesOnlyOverlappingLifetimes)
+{
+  std::vector<BufferLifetime> buffers{
+      {16, 0, 2}, {16, 3, 5}, {32, 1, 4}, {8, 2, 3}, {8, 5, 6}};
+
+  std::size_t arena = assign_offsets(buffers);
+
+  for (std::size_t i{}; i < buffers.size(); ++i)
+  {
+    EXPECT_LE(buffers[i].offset_ + buffers[i].size_, arena);
+    for (std::size_t j = i + 1; j < buffers.size(); ++j)
+    {
+      if (buffers[i].overlaps(buffers[j]))
+      {
+        bool apart =
+            buffers[i].offset_ + buffers[i].size_ <= buffers[j].offset_ ||
+            buffers[j].offset_ + buffers[j].size_ <= buffers[i].offset_;
+        EXPECT_TRUE(apart) << i << " and " << j;
+      }
+    }
+  }
+
+  // The two 16s take turns after the 32, whose space the last 8 reuses
+  // once it is dead.
+  EXPECT_EQ(arena, 56u);
+  EXPECT_EQ(buffers[0].offset_, buffers[1].offset_);
+  EXPECT_EQ(buffers[4].offset_, 0u);
+}
+
+TEST(Graph, PlannedReplayMatchesEagerInLessMemory)
+{
+  Tensor<float> x(32u, 16u);
+  Tensor<float> y(32u, 1u);
+  Tensor<float> w1(16u, 32u);
+  Tensor<float> b1(32u);
+  Tensor<float> w2(32u, 32u);
+  Tensor<float> w3(32u, 1u);
+  fill_random(*x.impl(), 71);
+  fill_random(*y.impl(), 72);
+  fill_random(*w1.impl(), 73);
+  fill_random(*b1.impl(), 74);
+  fill_random(*w2.impl(), 75);
+  fill_random(*w3.impl(), 76);
+
+  std::vector<Tensor<float>> params{w1, b1, w2, w3};
+  for (auto &p : params)
+  {
+    p.impl()->requires_grad_ = true;
+  }
+
+  // Unfused layers, so add and relu can overwrite their dead inputs.
+  auto step = [&]()
+  {
+    auto h1 = relu(add(matmul(x, w1), b1));
+    auto h2 = relu(matmul(h1, w2));
+    auto pred = matmul(sub(h2, max(h2, {1}, true)), w3);
+    return MSELoss<float>{}(pred, y);
+  };
+
+  StaticGraph<float> graph;
+  auto loss = graph.capture(step);
+  auto plan = graph.plan();
+
+  EXPECT_LT(plan.planned_bytes, plan.naive_bytes);
+  EXPECT_GT(plan.buffers, 0u);
+  EXPECT_EQ(plan.in_place, 3u); // add over matmul, both relus
+
+  SGD<float> optim(params, 0.01f);
+  for (unsigned i{}; i < 3; ++i)
+  {
+    optim.step();
+    fill_random(*x.impl(), 80 + i);
+
+    graph.replay();
+    float replayed = loss.impl()->data_ptr()[0];
+    std::vector<std::vector<float>> replayed_grads;
+    for (auto &p : params)
+    {
+      auto const &g = *p.impl()->grad_;
+      replayed_grads.emplace_back(g.data_ptr(), g.data_ptr() + g.numel());
+    }
+
+    optim.reset_grad();
+    auto eager = step();
+    eager.backward();
+
+    EXPECT_FLOAT_EQ(replayed, eager.impl()->data_ptr()[0]);
+    for (std::size_t p{}; p < params.size(); ++p)
+    {
+      auto const &g = *params[p].impl()->grad_;
+      EXPECT_EQ(replayed_grads[p],
+                std::vector<float>(g.data_ptr(), g.data_ptr() + g.numel()));
+    }
+  }
+}
+
+TEST(Lazy, FusedChainMatchesEagerOps)
+{
+  TensorImpl<float> h(48u, 300u);
+  TensorImpl<float> bias(300u);
+  TensorImpl<float> mean(48u, 1u);
+  TensorImpl<float> shift(1u);
+  TensorImpl<float> other(300u, 48u);
+  fill_random(h, 91);
+  fill_random(bias, 92);
+  fill_random(mean, 93);
+  fill_random(shift, 94);
+  fill_random(other, 95);
+
+  // Row and column broadcasts, a scalar and a transposed leaf.
+  auto t = other.transpose(0, 1);
+  auto expected = ((h + bias).relu() - mean) * 2.0f - t + shift;
+  auto fused = materialize((relu(lazy(h) + lazy(bias)) - lazy(mean)) * 2.0f -
+                           lazy(t) + lazy(shift));
+
+  ASSERT_EQ(fused.shape_, expected.shape_);
+  for (std::size_t i{}; i < expected.numel(); ++i)
+  {
+    EXPECT_EQ(fused.data_ptr()[i], expected.data_ptr()[i]) << i;
+  }
+
+  // Broadcast leaves alone still give the full shape.
+  auto outer = materialize(lazy(mean) - lazy(bias));
+  ASSERT_EQ(outer.shape_, (std::vector<std::uint32_t>{48, 300}));
+  EXPECT_EQ((outer[5u, 7u]), (mean[5u, 0u]) - (bias[7u]));
+
+  auto scalar = materialize(-lazy(shift) + lazy(shift) * 3.0f);
+  ASSERT_EQ(scalar.numel(), 1u);
+  EXPECT_FLOAT_EQ(scalar.data_ptr()[0], 2.0f * shift.data_ptr()[0]);
+}
+
+TEST(Lazy, WorksOnTensorsAndChecksBroadcast)
+{
+  Tensor<float> a(3u, 5u);
+  Tensor<float> b(4u, 5u);
+  Tensor<float> row(1u, 5u);
+  a.fill(2.0f);
+  b.fill(1.0f);
+  row.fill(1.0f);
+
+  EXPECT_THROW(materialize(lazy(a) + lazy(b)), std::invalid_argument);
+
+  auto c = materialize(relu(lazy(row) - lazy(a)) + lazy(a));
+  ASSERT_EQ(c.shape_, a.impl()->shape_);
+  for (std::size_t i{}; i < c.numel(); ++i)
+  {
+    EXPECT_EQ(c.data_ptr()[i], 2.0f);
+  }
+}
+
+TEST(Checkpoint, GradientsMatchUncheckpointed)
+{
+  Tensor<float> x(6u, 4u);
+  Tensor<float> y(6u, 4u);
+  Tensor<float> w(4u, 4u);
+  Tensor<float> b(4u);
+  fill_random(*x.impl(), 71);
+  fill_random(*y.impl(), 72);
+  fill_random(*w.impl(), 73);
+  fill_random(*b.impl(), 74);
+
+  std::vector<Tensor<float>> leaves{x, w, b};
+  for (auto &t : leaves)
+  {
+    t.impl()->requires_grad_ = true;
+  }
+
+  // Two inputs, one captured parameter, and x used past the checkpoint too.
+  auto block = [&](Tensor<float> const &h, Tensor<float> const &skip)
+  { return add(relu(add(matmul(h, w), b)), skip); };
+
+  auto grads = [&]()
+  {
+    std::vector<std::vector<float>> out;
+    for (auto &t : leaves)
+    {
+      auto const &g = *t.impl()->grad_;
+      out.emplace_back(g.data_ptr(), g.data_ptr() + g.numel());
+      t.impl()->grad_ = nullptr;
+    }
+    return out;
+  };
+
+  auto h = linear_relu(x, w, b);
+  MSELoss<float>{}(add(block(h, x), x), y).backward();
+  auto expected = grads();
+
+  auto h2 = linear_relu(x, w, b);
+  auto out = checkpoint(block, h2, x);
+  EXPECT_EQ(out.impl()->parents_.size(), 2u);
+  MSELoss<float>{}(add(out, x), y).backward();
+  auto actual = grads();
+
+  for (std::size_t i{}; i < expected.size(); ++i)
+  {
+    for (std::size_t j{}; j < expected[i].size(); ++j)
+    {
+      EXPECT_NEAR(actual[i][j], expected[i][j], 1e-5f) << i << ' ' << j;
+    }
+  }
+}
+
+TEST(Checkpoint, ParallelBackwardSharesCapturedParameter)
+{
+  Tensor<float> x(32u, 32u);
+  Tensor<float> w(32u, 32u);
+  fill_random(*x.impl(), 75);
+  fill_random(*w.impl(), 76);
+  x.impl()->requires_grad_ = true;
+  w.impl()->requires_grad_ = true;
+
+  // The recompute's backward walks w while the other branch's matmuls
+  // accumulate into its gradient.
+  auto f = [&](Tensor<float> const &h) { return relu(matmul(h, w)); };
+  auto forward = [&](bool checkpointed)
+  {
+    auto branch = checkpointed ? checkpoint(f, x) : f(x);
+    return sum(add(branch, matmul(matmul(x, w), w)));
+  };
+
+  auto grads = [&]()
+  {
+    std::vector<std::vector<float>> out;
+    for (auto *t : {&x, &w})
+    {
+      auto const &g = *t->impl()->grad_;
+      out.emplace_back(g.data_ptr(), g.data_ptr() + g.numel());
+      t->impl()->grad_ = nullptr;
+    }
+    return out;
+  };
+
+  {
+    ScopedThreads threads(1);
+    forward(false).backward();
+  }
+  auto expected = grads();
+
+  ScopedThreads threads(4);
+  for (int run{}; run < 5; ++run)
+  {
+    forward(true).backward();
+    auto actual = grads();
+    for (std::size_t i{}; i < expected.size(); ++i)
+    {
+      for (std::size_t j{}; j < expected[i].size(); ++j)
+      {
+        ASSERT_NEAR(actual[i][j], expected[i][j],
+                    1e-4f * std::max(1.0f, std::abs(expected[i][j])))
+            << i << ' ' << j;
+      }
+    }
+    EXPECT_TRUE(w.impl()->parents_.empty());
+  }
+}
+
+TEST(Checkpoint, SequentialBoundsLiveActivations)
+{
+  constexpr unsigned kLayers = 16;
+  Tensor<float> x(32u, 64u);
+  Tensor<float> y(32u, 64u);
+  fill_random(*x.impl(), 80);
+  fill_random(*y.impl(), 81);
+
+  std::vector<Tensor<float>> weights;
+  std::vector<std::function<Tensor<float>(Tensor<float> const &)>> layers;
+  for (unsigned l{}; l < kLayers; ++l)
+  {
+    Tensor<float> w(64u, 64u);
+    Tensor<float> b(64u);
+    fill_random(*w.impl(), 90 + l);
+    fill_random(*b.impl(), 120 + l);
+    w.impl()->requires_grad_ = true;
+    b.impl()->requires_grad_ = true;
+    weights.push_back(w);
+    layers.push_back([w, b](Tensor<float> const &h)
+                     { return linear_relu(h, w, b); });
+  }
+
+  auto &alloc = CachingAllocator::instance();
+
+  auto forward = [&](std::size_t segments)
+  {
+    if (segments != 0)
+    {
+      return checkpoint_sequential(layers, x, segments);
+    }
+    Tensor<float> h = x;
+    for (auto const &layer : layers)
+    {
+      h = layer(h);
+    }
+    return h;
+  };
+
+  // Bytes the forward pass leaves allocated, and the first layer's grad.
+  auto run = [&](std::size_t segments)
+  {
+    weights[0].impl()->grad_ = nullptr;
+    auto before = alloc.stats().in_use;
+    auto loss = MSELoss<float>{}(forward(segments), y);
+    auto held = alloc.stats().in_use - before;
+    loss.backward();
+
+    auto const &g = *weights[0].impl()->grad_;
+    return std::pair{held, std::vector<float>(g.data_ptr(),
+                                              g.data_ptr() + g.numel())};
+  };
+
+  auto [plain, expected] = run(0);
+  auto [bounded, actual] = run(4);
+
+  // Four segment outputs live instead of sixteen layer outputs.
+  EXPECT_LT(bounded * 2, plain);
+  for (std::size_t i{}; i < expected.size(); ++i)
+  {
+    EXPECT_NEAR(actual[i], expected[i], 1e-5f) << i;
+  }
+}
+
+TEST(Optimizer, FusedStepsMatchReference)
+{
+  // One parameter spanning several runs, a small one and a strided view.
+  auto make_params = []()
+  {
+    Tensor<float> big(200u, 300u);
+    Tensor<float> small(7u);
+    auto base = std::make_shared<Storage<float>>(48);
+    Tensor<float> view(TensorImpl<float>(base, {6u, 8u}, {1u, 6u}, 0));
+    fill_random(*big.impl(), 140);
+    fill_random(*small.impl(), 141);
+    fill_random(*view.impl(), 142);
+    return std::vector<Tensor<float>>{big, small, view};
+  };
+
+  auto values = [](TensorImpl<float> const &t)
+  {
+    auto dense = t.contiguous();
+    return std::vector<double>(dense.data_ptr(),
+                               dense.data_ptr() + dense.numel());
+  };
+
+  constexpr double lr = 0.01, mu = 0.9, b1 = 0.9, b2 = 0.999, eps = 1e-8;
+
+  ScopedThreads threads(4);
+  ScopedLevel simd_level;
+  for (int kind{}; kind < 3; ++kind)
+  {
+    for (auto level : {simd::Level::Scalar, simd::Level::SSE2,
+                       simd::Level::AVX2, simd::Level::AVX512})
+    {
+      simd::set_level(level);
+
+      auto params = make_params();
+      SGD<float> sgd(params, lr, mu, 0.01f, true);
+      Adam<float> adam(params, lr, b1, b2, eps, 0.01f);
+      AdamW<float> adamw(params, lr, b1, b2, eps, 0.1f);
+
+      std::vector<std::vector<double>> x, s0, s1;
+      for (auto const &p : params)
+      {
+        x.push_back(values(*p.impl()));
+        s0.emplace_back(x.back().size());
+        s1.emplace_back(x.back().size());
+      }
+
+      for (unsigned t = 1; t <= 3; ++t)
+      {
+        std::vector<std::vector<double>> g;
+        for (std::size_t i{}; i < params.size(); ++i)
+        {
+          auto &grad = params[i].impl()->grad_;
+          grad = std::make_shared<TensorImpl<float>>(
+              params[i].impl()->shape_);
+          fill_random(*grad, 150 + 10 * t + static_cast<unsigned>(i));
+          g.push_back(values(*grad));
+        }
+
+        if (kind == 0)
+        {
+          sgd.step();
+        }
+        else if (kind == 1)
+        {
+          adam.step();
+        }
+        else
+        {
+          adamw.step();
+        }
+
+        for (std::size_t i{}; i < params.size(); ++i)
+        {
+          for (std::size_t j{}; j < x[i].size(); ++j)
+          {
+            double &p = x[i][j];
+            if (kind == 0)
+            {
+              double d = g[i][j] + 0.01 * p;
+              s0[i][j] = mu * s0[i][j] + d;
+              p -= lr * (d + mu * s0[i][j]);
+              continue;
+            }
+
+            double d = g[i][j] + (kind == 1 ? 0.01 * p : 0);
+            s0[i][j] = b1 * s0[i][j] + (1 - b1) * d;
+            s1[i][j] = b2 * s1[i][j] + (1 - b2) * d * d;
+            double m = s0[i][j] / (1 - std::pow(b1, t));
+            double v = s1[i][j] / (1 - std::pow(b2, t));
+            p = p * (kind == 2 ? 1 - lr * 0.1 : 1) -
+                lr * m / (std::sqrt(v) + eps);
+          }
+
+          auto actual = values(*params[i].impl());
+          for (std::size_t j{}; j < x[i].size(); ++j)
+          {
+            ASSERT_NEAR(actual[j], x[i][j], 1e-5)
+                << kind << ' ' << t << ' ' << i << ' ' << j;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(Optimizer, HalfPrecisionKeepsConstantsAndStateInFloat)
+{
+  // bf16 rounds beta2 = 0.999 to 1 and f16 rounds eps = 1e-8 to 0, so both
+  // only work with the constants and moments kept in float. A fifth of the
+  // gradients are zero, which divide 0 by eps.
+  auto check = [](auto zero)
+  {
+    using T = decltype(zero);
+    double ulp = std::same_as<T, bf16> ? 0x1p-7 : 0x1p-10;
+    constexpr double lr = 0.05, mu = 0.9, b1 = 0.9, b2 = 0.999, eps = 1e-8;
+    constexpr std::uint32_t n = 37;
+
+    ScopedLevel simd_level;
+    for (auto level : {simd::Level::Scalar, simd::Level::AVX2,
+                       simd::Level::AVX512})
+    {
+      simd::set_level(level);
+      for (int kind{}; kind < 3; ++kind)
+      {
+        Tensor<T> param(n);
+        std::vector<double> x(n), s0(n), s1(n);
+        for (std::uint32_t j{}; j < n; ++j)
+        {
+          param.impl()->data_ptr()[j] = T(1.0f + static_cast<float>(j) / 64);
+          x[j] = static_cast<float>(param.impl()->data_ptr()[j]);
+        }
+        SGD<T> sgd({param}, lr, mu, 0, true);
+        Adam<T> adam({param}, lr, b1, b2, eps);
+        AdamW<T> adamw({param}, lr, b1, b2, eps, 0.1f);
+
+        for (unsigned t = 1; t <= 3; ++t)
+        {
+          auto &grad = param.impl()->grad_;
+          grad = std::make_shared<TensorImpl<T>>(param.impl()->shape_);
+          std::vector<double> g(n);
+          for (std::uint32_t j{}; j < n; ++j)
+          {
+            g[j] = ((j + t) % 5 - 2.0) * 0.25;
+            grad->data_ptr()[j] = T(static_cast<float>(g[j]));
+          }
+
+          if (kind == 0)
+          {
+            sgd.step();
+          }
+          else if (kind == 1)
+          {
+            adam.step();
+          }
+          else
+          {
+            adamw.step();
+          }
+
+          for (std::uint32_t j{}; j < n; ++j)
+          {
+            double &p = x[j];
+            if (kind == 0)
+            {
+              s0[j] = mu * s0[j] + g[j];
+              p -= lr * (g[j] + mu * s0[j]);
+            }
+            else
+            {
+              s0[j] = b1 * s0[j] + (1 - b1) * g[j];
+              s1[j] = b2 * s1[j] + (1 - b2) * g[j] * g[j];
+              double m = s0[j] / (1 - std::pow(b1, t));
+              double v = s1[j] / (1 - std::pow(b2, t));
+              p = p * (kind == 2 ? 1 - lr * 0.1 : 1) -
+                  lr * m / (std::sqrt(v) + eps);
+            }
+            p = static_cast<float>(T(static_cast<float>(p)));
+
+            double actual = static_cast<float>(param.impl()->data_ptr()[j]);
+            ASSERT_NEAR(actual, p, 2 * ulp * std::abs(p))
+                << kind << ' ' << t << ' ' << j;
+          }
+        }
+      }
+    }
+  };
+
+  check(bf16{});
+  check(f16{});
+}
+
+TEST(Optimizer, ZeroGradReusesGradientBuffers)
+{
+  Tensor<float> x(16u, 8u);
+  Tensor<float> y(16u, 4u);
+  Tensor<float> w(8u, 4u);
+  Tensor<float> b(4u);
+  fill_random(*x.impl(), 160);
+  fill_random(*y.impl(), 161);
+  fill_random(*w.impl(), 162);
+  fill_random(*b.impl(), 163);
+  w.impl()->requires_grad_ = true;
+  b.impl()->requires_grad_ = true;
+
+  AdamW<float> optim({w, b}, 0.01f);
+  auto backward = [&]()
+  { MSELoss<float>{}(linear(x, w, b), y).backward(); };
+
+  backward();
+  auto *grad = w.impl()->grad_.get();
+  std::vector<float> first(grad->data_ptr(),
+                           grad->data_ptr() + grad->numel());
+
+  optim.zero_grad();
+  ASSERT_EQ(w.impl()->grad_.get(), grad);
+  for (std::size_t i{}; i < grad->numel(); ++i)
+  {
+    EXPECT_EQ(grad->data_ptr()[i], 0.0f);
+  }
+
+  // The next backward accumulates into the zeroed buffer.
+  backward();
+  ASSERT_EQ(w.impl()->grad_.get(), grad);
+  for (std::size_t i{}; i < grad->numel(); ++i)
+  {
+    EXPECT_FLOAT_EQ(grad->data_ptr()[i], first[i]);
+  }
+
+  optim.step();
+  optim.reset_grad();
+  EXPECT_EQ(w.impl()->grad_, nullptr);
+}
+
+TEST(ParameterArena, StepsMatchSeparateParameters)
+{
+  Tensor<float> x(16u, 8u);
+  Tensor<float> y(16u, 1u);
+  fill_random(*x.impl(), 170);
+  fill_random(*y.impl(), 171);
+
+  auto make_params = []()
+  {
+    std::vector<Tensor<float>> params{Tensor<float>(8u, 12u),
+                                      Tensor<float>(12u),
+                                      Tensor<float>(12u, 1u),
+                                      Tensor<float>(1u)};
+    for (std::size_t i{}; i < params.size(); ++i)
+    {
+      fill_random(*params[i].impl(), 172 + static_cast<unsigned>(i));
+      params[i].impl()->requires_grad_ = true;
+    }
+    return params;
+  };
+
+  auto loss = [&](std::vector<Tensor<float>> const &p)
+  {
+    return MSELoss<float>{}(
+        linear(linear_relu(x, p[0], p[1]), p[2], p[3]), y);
+  };
+
+  auto separate = make_params();
+  auto packed = make_params();
+  ParameterArena<float> arena(packed);
+
+  auto *base = arena.data();
+  for (auto const &p : packed)
+  {
+    auto *data = p.impl()->data_ptr();
+    EXPECT_GE(data, base);
+    EXPECT_LE(data + p.impl()->numel(), base + arena.size());
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(data) % kAllocAlignment, 0u);
+    EXPECT_EQ(p.impl()->grad_->data_ptr() - arena.grad(), data - base);
+  }
+
+  SGD<float> plain(separate, 0.05f, 0.9f);
+  SGD<float> fused({arena.flat()}, 0.05f, 0.9f);
+
+  for (int step{}; step < 3; ++step)
+  {
+    plain.zero_grad();
+    arena.zero_grad();
+    loss(separate).backward();
+    loss(packed).backward();
+
+    double squares = 0;
+    for (auto const &p : separate)
+    {
+      auto const &g = *p.impl()->grad_;
+      for (std::size_t i{}; i < g.numel(); ++i)
+      {
+        squares += g.data_ptr()[i] * g.data_ptr()[i];
+      }
+    }
+    EXPECT_NEAR(arena.grad_norm(), std::sqrt(squares), 1e-5);
+
+    plain.step();
+    fused.step();
+  }
+
+  for (std::size_t k{}; k < separate.size(); ++k)
+  {
+    auto const &a = *separate[k].impl();
+    auto const &b = *packed[k].impl();
+    for (std::size_t i{}; i < a.numel(); ++i)
+    {
+      EXPECT_NEAR(b.data_ptr()[i], a.data_ptr()[i], 1e-6) << k << ' ' << i;
+    }
+  }
+
+  auto norm = arena.grad_norm();
+  EXPECT_FLOAT_EQ(arena.clip_grad_norm(norm / 2), norm);
+  EXPECT_NEAR(arena.grad_norm(), norm / 2, 1e-5);
+}
+
+TEST(ParameterArena, RejectsViews)
+{
+  Tensor<float> w(4u, 6u);
+  Tensor<float> view(TensorImpl<float>(w.impl()->data_, {6u, 4u}, {1u, 6u}, 0));
+  EXPECT_THROW(ParameterArena<float>({view}), std::invalid_argument);
+}
+
+TEST(Serialize, RoundTripsThroughMappedFile)
+{
+  auto path = testing::TempDir() + "round_trip.safetensors";
+
+  Tensor<float> w(5u, 7u);
+  Tensor<float> b(7u);
+  fill_random(*w.impl(), 180);
+  fill_random(*b.impl(), 181);
+  Tensor<float> wt(TensorImpl<float>(w.impl()->data_, {7u, 5u}, {1u, 7u}, 0));
+
+  save_safetensors<float>(path, {{"w", w}, {"bias", b}, {"w.T", wt}});
+
+  // The elements start 64-byte aligned, right after the header.
+  {
+    std::ifstream in(path, std::ios::binary);
+    unsigned char length[8];
+    in.read(reinterpret_cast<char *>(length), 8);
+    EXPECT_EQ((8 + length[0] + 256 * length[1]) % 64, 0);
+  }
+
+  auto loaded = load_safetensors<float>(path);
+  ASSERT_EQ(loaded.size(), 3u);
+
+  auto expect_equal = [](Tensor<float> const &a, Tensor<float> const &b)
+  {
+    ASSERT_EQ(a.impl()->shape_, b.impl()->shape_);
+    auto da = a.impl()->contiguous();
+    auto db = b.impl()->contiguous();
+    for (std::size_t i{}; i < da.numel(); ++i)
+    {
+      EXPECT_EQ(da.data_ptr()[i], db.data_ptr()[i]) << i;
+    }
+  };
+  expect_equal(loaded.at("w"), w);
+  expect_equal(loaded.at("bias"), b);
+  expect_equal(loaded.at("w.T"), wt);
+  EXPECT_TRUE(loaded.at("w.T").impl()->is_contiguous());
+
+  // Nothing was copied: the payloads lie in the mapping back to back.
+  EXPECT_EQ(loaded.at("bias").impl()->data_ptr(),
+            loaded.at("w").impl()->data_ptr() + 35);
+
+  // Writes stay private, and the mapping outlives the map it came in.
+  Tensor<float> kept = loaded.at("bias");
+  loaded.clear();
+  kept.impl()->data_ptr()[0] = 42.0f;
+  EXPECT_EQ(kept.impl()->data_ptr()[0], 42.0f);
+  expect_equal(load_safetensors<float>(path).at("bias"), b);
+
+  std::remove(path.c_str());
+}
+
+TEST(Serialize, ReadsForeignHeadersAndRejectsBadFiles)
+{
+  auto path = testing::TempDir() + "foreign.safetensors";
+
+  auto write = [&](std::string header, std::vector<float> const &data)
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    std::uint64_t length = header.size();
+    out.write(reinterpret_cast<char const *>(&length), 8);
+    out << header;
+    out.write(reinterpret_cast<char const *>(data.data()),
+              static_cast<std::streamsize>(data.size() * sizeof(float)));
+  };
+
+  // As another writer might lay it out: metadata, escapes, whitespace, a
+  // scalar, and a header padded to 8 bytes only.
+  write("{\"__metadata__\": {\"format\": \"pt\"},\n"
+        " \"layer\\u00e9.\\\"w\\\"\": {\"dtype\": \"F32\", \"shape\": [2, 2],"
+        " \"data_offsets\": [0, 16]},\n"
+        " \"scale\": {\"dtype\":\"F32\",\"shape\":[],\"data_offsets\":[16,20],"
+        " \"extra\": [1, -2.5e3, null, true, {\"k\": \"v\"}]}}    ",
+        {1, 2, 3, 4, 0.5f});
+
+  auto loaded = load_safetensors<float>(path);
+  ASSERT_EQ(loaded.size(), 2u);
+  auto const &w = *loaded.at("layer\xc3\xa9.\"w\"").impl();
+  EXPECT_EQ(w.shape_, (std::vector<std::uint32_t>{2, 2}));
+  EXPECT_EQ(w.data_ptr()[3], 4.0f);
+  EXPECT_EQ(loaded.at("scale").impl()->numel(), 1u);
+  EXPECT_EQ(loaded.at("scale").impl()->data_ptr()[0], 0.5f);
+
+  EXPECT_THROW(load_safetensors<double>(path), std::invalid_argument);
+
+  // Offsets past the end, a shape disagreeing with them, broken JSON, a
+  // repeated name.
+  for (std::string header :
+       {"{\"a\":{\"dtype\":\"F32\",\"shape\":[2],\"data_offsets\":[0,80]}}",
+        "{\"a\":{\"dtype\":\"F32\",\"shape\":[3],\"data_offsets\":[0,8]}}",
+        "{\"a\":{\"dtype\":\"F32\",\"shape\":[2],\"data_offsets\":[0,8]}",
+        "{\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[0,4]},"
+        "\"a\":{\"dtype\":\"F32\",\"shape\":[1],\"data_offsets\":[4,8]}}"})
+  {
+    write(header, {1, 2});
+    EXPECT_THROW(load_safetensors<float>(path), std::invalid_argument)
+        << header;
+  }
+
+  std::remove(path.c_str());
+  EXPECT_THROW(load_safetensors<float>(path), std::invalid_argument);
+}
+
+TEST(DataLoader, VisitsEveryRecordOncePerEpochInShuffledOrder)
+{
+  // Record r is (r, 2r, -r): two inputs, then the target.
+  std::vector<float> values;
+  for (int r{}; r < 103; ++r)
+  {
+    values.insert(values.end(), {float(r), float(2 * r), float(-r)});
+  }
+
+  std::vector<std::vector<int>> first;
+  for (std::size_t workers : {1u, 3u})
+  {
+    DataLoader<float> loader(memory_records(values, 3), 2,
+                             {.batch_size = 10, .seed = 7,
+                              .workers = workers, .prefetch = 3});
+    ASSERT_EQ(loader.batches(), 11u);
+
+    std::vector<std::vector<int>> epochs;
+    Batch<float> batch;
+    for (int epoch{}; epoch < 3; ++epoch)
+    {
+      std::vector<int> seen;
+      while (loader.next(batch))
+      {
+        auto const &x = *batch.inputs_.impl();
+        auto const &y = *batch.targets_.impl();
+        ASSERT_EQ(x.shape_[0], y.shape_[0]);
+        ASSERT_EQ(x.shape_[1], 2u);
+        ASSERT_EQ(y.shape_[1], 1u);
+        for (std::uint32_t i{}; i < x.shape_[0]; ++i)
+        {
+          float r = x.data_ptr()[2 * i];
+          EXPECT_EQ(x.data_ptr()[2 * i + 1], 2 * r);
+          EXPECT_EQ(y.data_ptr()[i], -r);
+          seen.push_back(static_cast<int>(r));
+        }
+      }
+      EXPECT_EQ(batch.inputs_.impl()->shape_[0], 3u); // 103 = 10 * 10 + 3
+      epochs.push_back(seen);
+    }
+
+    EXPECT_NE(epochs[0], epochs[1]);
+    EXPECT_NE(epochs[1], epochs[2]);
+    for (auto order : epochs)
+    {
+      std::sort(order.begin(), order.end());
+      for (int r{}; r < 103; ++r)
+      {
+        ASSERT_EQ(order[r], r);
+      }
+    }
+
+    // The same seed gives the same orders, whatever the number of workers.
+    if (first.empty())
+    {
+      first = epochs;
+    }
+    EXPECT_EQ(epochs, first);
+  }
+}
+
+TEST(DataLoader, ReadsBinaryAndCsvRecords)
+{
+  auto bin = testing::TempDir() + "records.bin";
+  auto csv = testing::TempDir() + "records.csv";
+
+  std::vector<double> values;
+  {
+    std::ofstream text(csv);
+    text << "a,b,c,label\n";
+    for (int r{}; r < 9; ++r)
+    {
+      for (int c{}; c < 4; ++c)
+      {
+        values.push_back(r * 0.25 - c);
+        text << (c ? ", " : "") << values.back();
+      }
+      text << (r == 4 ? "\r\n\n" : "\n");
+    }
+    std::ofstream binary(bin, std::ios::binary);
+    binary.write(reinterpret_cast<char const *>(values.data()),
+                 static_cast<std::streamsize>(values.size() * sizeof(double)));
+  }
+
+  DataLoaderOptions options{.batch_size = 4, .shuffle = false,
+                            .drop_last = true};
+  DataLoader<double> from_binary(binary_records<double>(bin, 4), 3, options);
+  DataLoader<double> from_csv(csv_records<double>(csv, true), 3, options);
+  EXPECT_EQ(from_csv.batches(), 2u);
+
+  Batch<double> a, b;
+  std::size_t batches = 0;
+  while (from_binary.next(a))
+  {
+    ASSERT_TRUE(from_csv.next(b));
+    auto const &x = *a.inputs_.impl();
+    ASSERT_EQ(x.shape_, (std::vector<std::uint32_t>{4, 3}));
+    for (std::size_t i{}; i < 12; ++i)
+    {
+      EXPECT_EQ(x.data_ptr()[i], b.inputs_.impl()->data_ptr()[i]);
+      EXPECT_EQ(x.data_ptr()[i], values[batches * 16 + i / 3 * 4 + i % 3]);
+    }
+    for (std::size_t i{}; i < 4; ++i)
+    {
+      EXPECT_EQ(a.targets_.impl()->data_ptr()[i],
+                values[batches * 16 + i * 4 + 3]);
+    }
+    ++batches;
+  }
+  EXPECT_EQ(batches, 2u);
+  EXPECT_FALSE(from_csv.next(b));
+
+  std::ofstream(csv, std::ios::app) << "1,2,3\n";
+  EXPECT_THROW(csv_records<double>(csv, true), std::invalid_argument);
+  EXPECT_THROW(binary_records<double>(bin, 5), std::invalid_argument);
+  EXPECT_THROW(DataLoader<double>(binary_records<double>(bin, 4), 4),
+               std::invalid_argument);
+
+  std::remove(bin.c_str());
+  std::remove(csv.c_str());
+}